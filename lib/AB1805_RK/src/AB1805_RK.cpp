@@ -257,16 +257,25 @@ bool AB1805::setRtcFromTime(time_t time, bool lock) {
 }
 
 bool AB1805::setRtcFromTm(const struct tm *timeptr, bool lock) {
+    return setRtcRegisters(timeptr, 0, lock);
+}
+
+bool AB1805::setRtcFromTimeMs(time_t time, uint16_t ms, bool lock) {
+    struct tm *tm = gmtime(&time);
+    return setRtcRegisters(tm, (ms < 1000) ? ms / 10 : 99, lock);
+}
+
+bool AB1805::setRtcRegisters(const struct tm *timeptr, uint8_t hundredths, bool lock) {
     static const char *errorMsg = "failure in setRtcFromTm %d";
     uint8_t array[8];
 
-    _log.info("setRtcAsTm %s", tmToString(timeptr).c_str());
+    _log.info("setRtcAsTm %s.%02d", tmToString(timeptr).c_str(), hundredths);
 
     if (lock) {
         wire.lock();
     }
 
-    array[0] = 0x00; // hundredths
+    array[0] = valueToBcd(hundredths);
     tmToRegisters(timeptr, &array[1], true);
 
     // Can only write RTC registers when WRTC is 1
@@ -330,6 +339,55 @@ bool AB1805::getRtcAsTm(struct tm *timeptr) {
 }
 
 
+bool AB1805::getRtcAsTimeMs(time_t &time, uint16_t &ms) {
+    uint8_t array[8];
+    struct tm tmstruct;
+    bool bResult = false;
+
+    memset(&tmstruct, 0, sizeof(tmstruct)); // tm_isdst 0 - mktime would otherwise take an hour off for a stray DST flag
+
+    // One read, so the hundredths and the seconds are from the same moment
+    if (isBitClear(REG_CTRL_1, REG_CTRL_1_WRTC)) {
+        bResult = readRegisters(REG_HUNDREDTH, array, sizeof(array));
+        if (bResult) {
+            registersToTm(&array[1], &tmstruct, true);
+            time = mktime(&tmstruct);
+            ms = bcdToValue(array[0]) * 10;
+        }
+    }
+    if (!bResult) {
+        time = 0;
+        ms = 0;
+    }
+
+    return bResult;
+}
+
+int AB1805::getXtCalibration() {
+    uint8_t value = readRegister(REG_CAL_XT);
+
+    int steps = value & REG_CAL_XT_OFFSETX;
+    if (steps & 0x40) {
+        steps -= 0x80; // Sign extend the 7 bit offset
+    }
+    return (value & REG_CAL_XT_CMDX) ? steps * 2 : steps;
+}
+
+bool AB1805::setXtCalibration(int steps) {
+    uint8_t value;
+
+    if (steps < -64 || steps > 127) {
+        return false;
+    }
+    if (steps <= 63) {
+        value = (uint8_t)steps & REG_CAL_XT_OFFSETX;
+    }
+    else {
+        value = REG_CAL_XT_CMDX | ((uint8_t)(steps / 2) & REG_CAL_XT_OFFSETX);
+    }
+    return writeRegister(REG_CAL_XT, value);
+}
+
 #if 0
 bool AB1805::testEN() {
     _log.info("testEN()");
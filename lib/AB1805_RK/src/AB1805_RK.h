@@ -185,6 +185,37 @@ public:
      */
     bool getRtcAsTm(struct tm *timeptr);
 
+    /**
+     * @brief Get the time from the RTC as a time_t and the milliseconds past it
+     * 
+     * @param time Filled in with the number of second since January 1, 1970 UTC.
+     * 
+     * @param ms Filled in with the milliseconds past time, from the hundredths register (0 - 990)
+     * 
+     * @return true on success or false if an error occurs.
+     */
+    bool getRtcAsTimeMs(time_t &time, uint16_t &ms);
+
+    /**
+     * @brief Gets the crystal oscillator calibration
+     * 
+     * @return The adjustment in steps of XT_CAL_PPB_PER_STEP, positive to speed the clock up
+     */
+    int getXtCalibration();
+
+    /**
+     * @brief Sets the crystal oscillator calibration
+     * 
+     * @param steps Adjustment in steps of XT_CAL_PPB_PER_STEP, positive to speed the clock up. -64 to 127 - from 64
+     * up the adjustment is made in pairs of steps.
+     * 
+     * @return true on success or false if an error occurs or steps is out of range. The extended range
+     * (XTCAL in REG_OSC_STATUS) is not used.
+     * 
+     * The adjustment is made every 128 seconds, so it takes a few minutes to show.
+     */
+    bool setXtCalibration(int steps);
+
     /**
      * @brief Resets the configuration of the AB1805 to default settings
      * 
@@ -449,6 +480,18 @@ public:
      */
     bool setRtcFromTm(const struct tm *timeptr, bool lock = true);
 
+    /**
+     * @brief Sets the RTC from a time_t and the milliseconds past it
+     * 
+     * @param time The time (in seconds since January 1, 1970, UNIX epoch), UTC.
+     * 
+     * @param ms Milliseconds past time (0 - 999), set to the hundredth. setRtcFromTime()
+     * starts the second when it is called, so can be up to a second out.
+     * 
+     * @param lock Lock the I2C bus. Default = true.
+     */
+    bool setRtcFromTimeMs(time_t time, uint16_t ms, bool lock = true);
+
     
     /**
      * @brief Reads a AB1805 register (single byte)
@@ -822,6 +865,9 @@ public:
     static const uint8_t   REG_SQW_SQWE             = 0x80;      //!< Square wave output control, enable
     static const uint8_t   REG_SQW_DEFAULT          = 0x26;      //!< Square wave output control, default 0b00100110
     static const uint8_t REG_CAL_XT                 = 0x14;      //!< Calibration for the XT oscillator
+    static const uint8_t   REG_CAL_XT_CMDX          = 0x80;      //!< Calibration for the XT oscillator, adjust in pairs of steps
+    static const uint8_t   REG_CAL_XT_OFFSETX       = 0x7f;      //!< Calibration for the XT oscillator, adjustment (two's complement)
+    static const uint32_t  XT_CAL_PPB_PER_STEP      = 1907;      //!< Calibration for the XT oscillator, parts per billion per step
     static const uint8_t REG_CAL_RC_HIGH            = 0x15;      //!< Calibration for the RC oscillator, upper 8 bits
     static const uint8_t REG_CAL_RC_LOW             = 0x16;      //!< Calibration for the RC oscillator, lower 8 bits
     static const uint8_t REG_SLEEP_CTRL             = 0x17;      //!< Power control system sleep function
@@ -943,6 +989,11 @@ public:
 
 
 protected:
+    /**
+     * @brief Sets the RTC registers from a struct tm and the hundredths of a second past it
+     */
+    bool setRtcRegisters(const struct tm *timeptr, uint8_t hundredths, bool lock);
+
     /**
      * @brief Internal function used to handle system events
      * 
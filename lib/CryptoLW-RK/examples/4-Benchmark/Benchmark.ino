@@ -0,0 +1,238 @@
+/*
+This example compares the ciphers in this library at the frame sizes the
+LoRa nodes send (19 to 64 bytes) so a build can pick one for the radio layer.
+
+For each cipher it reports the RAM the object takes, the time to set the
+key, and the time to encrypt and decrypt one message of each size the way
+the radio drivers do it:
+
+    Ascon128, Acorn128      As RHAuthenticatedDriver - setIV, 4 bytes of
+                            header as auth data, encrypt or decrypt, then
+                            computeTag or checkTag of a 4 byte tag
+
+    Speck, SpeckSmall       As RHEncryptedDriver in ECB mode - a length
+                            byte and the message padded to whole blocks,
+                            enciphered in place with encryptBlocks()
+
+    SpeckTiny (and all      As RHEncryptedDriver in CTR mode - cryptCTR()
+    three Speck, "ctr")     over the message, the same call both ways
+
+On a device the results go to the serial port. The same file runs on Linux:
+
+    g++ -O2 -x c++ -I../../src -I../../src/utility Benchmark.ino ../../src/[A-Z]*.cpp -o benchmark
+    ./benchmark
+
+Code size cannot be measured from inside the program. Build for the target
+and list the cipher's functions with their sizes, for example
+
+    arm-none-eabi-nm -S -C --size-sort path/to/firmware.elf | grep -i -E "ascon|acorn|speck"
+
+or the same with nm on the Linux build, which gives the relative sizes.
+*/
+
+#include <Crypto.h>
+#include <CryptoLW.h>
+#include <Ascon128.h>
+#include <Acorn128.h>
+#include <Speck.h>
+#include <SpeckSmall.h>
+#include <SpeckTiny.h>
+#include <string.h>
+
+#if defined(PARTICLE) || defined(ARDUINO)
+#define ITERATIONS 200
+#define report(...) Serial.printf(__VA_ARGS__)
+#else
+#include <stdio.h>
+#include <time.h>
+#define ITERATIONS 20000
+#define report(...) printf(__VA_ARGS__)
+static unsigned long micros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+#endif
+
+#define HEADER_LEN 4            // RadioHead TO, FROM, ID, FLAGS - authenticated, not encrypted
+#define TAG_LEN 4               // Truncated tag, as RHAuthenticatedDriver sends
+#define AEAD_OVERHEAD 7         // RHAuthenticatedDriver frame counter and tag
+#define CTR_OVERHEAD 4          // RHEncryptedDriver CTR mode nonce
+#define MAX_FRAME_LEN 80
+
+static const uint8_t frameSizes[] = {19, 32, 48, 64};
+static const uint8_t key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static uint8_t iv[16];
+static uint8_t header[HEADER_LEN] = {0x00, 0x05, 0x21, 0x00};
+static uint8_t message[MAX_FRAME_LEN];
+static uint8_t frame[MAX_FRAME_LEN];
+static uint8_t counter[16];
+static volatile uint8_t sink;   // Keeps the compiler from dropping the work
+
+Ascon128 ascon;
+Acorn128 acorn;
+Speck speck;
+SpeckSmall speckSmall;
+SpeckTiny speckTiny;
+
+// Nanoseconds per operation from a run of ITERATIONS
+static unsigned long nsPerOp(unsigned long startMicros)
+{
+    return (unsigned long)((micros() - startMicros) * 1000.0 / ITERATIONS);
+}
+
+static unsigned long setKeyNs(Cipher &cipher)
+{
+    uint8_t k[sizeof(key)];
+    memcpy(k, key, sizeof(k));
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        k[0] = i;               // A different key each time, so the work cannot be hoisted out of the loop
+        cipher.setKey(k, sizeof(k));
+    }
+    return nsPerOp(start);
+}
+
+static unsigned long setKeyNs(BlockCipher &cipher)
+{
+    uint8_t k[sizeof(key)];
+    memcpy(k, key, sizeof(k));
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        k[0] = i;               // A different key each time, so the work cannot be hoisted out of the loop
+        cipher.setKey(k, sizeof(k));
+    }
+    return nsPerOp(start);
+}
+
+static unsigned long sealNs(AuthenticatedCipher &cipher, uint8_t len)
+{
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        iv[0] = i;
+        cipher.setIV(iv, sizeof(iv));
+        cipher.addAuthData(header, sizeof(header));
+        cipher.encrypt(frame, message, len);
+        cipher.computeTag(frame + len, TAG_LEN);
+    }
+    sink = frame[0];
+    return nsPerOp(start);
+}
+
+static unsigned long openNs(AuthenticatedCipher &cipher, uint8_t len)
+{
+    // A real frame to open, so checkTag() does its whole comparison
+    cipher.setIV(iv, sizeof(iv));
+    cipher.addAuthData(header, sizeof(header));
+    cipher.encrypt(frame, message, len);
+    cipher.computeTag(frame + len, TAG_LEN);
+
+    bool ok = true;
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        cipher.setIV(iv, sizeof(iv));
+        cipher.addAuthData(header, sizeof(header));
+        cipher.decrypt(message, frame, len);
+        ok &= cipher.checkTag(frame + len, TAG_LEN);
+    }
+    unsigned long ns = nsPerOp(start);
+    if (!ok)
+        report("  tag check failed - results are not valid\n");
+    return ns;
+}
+
+static unsigned long ecbNs(BlockCipher &cipher, uint8_t len, bool decrypt)
+{
+    size_t blocks = len / cipher.blockSize() + 1;   // Length byte and padding, as STRICT_CONTENT_LEN
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (decrypt) {
+            cipher.decryptBlocks(frame, frame, blocks);
+        }
+        else {
+            frame[0] = len;
+            memcpy(frame + 1, message, len);
+            memset(frame + 1 + len, 0, blocks * cipher.blockSize() - len - 1);
+            cipher.encryptBlocks(frame, frame, blocks);
+        }
+    }
+    sink = frame[0];
+    return nsPerOp(start);
+}
+
+static unsigned long ctrNs(BlockCipher &cipher, uint8_t len)
+{
+    unsigned long start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        memset(counter, 0, sizeof(counter));
+        counter[3] = i;
+        cipher.cryptCTR(frame, message, len, counter);
+    }
+    sink = frame[0];
+    return nsPerOp(start);
+}
+
+static void benchAead(const char *name, AuthenticatedCipher &cipher, size_t ramBytes)
+{
+    report("%-12s RAM %4u bytes, setKey %6lu ns\n", name, (unsigned)ramBytes, setKeyNs(cipher));
+    cipher.setKey(key, sizeof(key));
+    for (size_t i = 0; i < sizeof(frameSizes); i++) {
+        uint8_t len = frameSizes[i];
+        unsigned long seal = sealNs(cipher, len);
+        unsigned long open = openNs(cipher, len);
+        report("  %2u bytes: encrypt %6lu ns, decrypt %6lu ns, %4lu ns/byte, +%u bytes on air\n",
+            len, seal, open, seal / len, AEAD_OVERHEAD);
+    }
+}
+
+static void benchBlock(const char *name, BlockCipher &cipher, size_t ramBytes, bool canDecrypt)
+{
+    report("%-12s RAM %4u bytes, setKey %6lu ns\n", name, (unsigned)ramBytes, setKeyNs(cipher));
+    cipher.setKey(key, sizeof(key));
+    for (size_t i = 0; i < sizeof(frameSizes); i++) {
+        uint8_t len = frameSizes[i];
+        unsigned long ctr = ctrNs(cipher, len);
+        if (canDecrypt) {
+            unsigned long seal = ecbNs(cipher, len, false);
+            unsigned long open = ecbNs(cipher, len, true);
+            size_t padded = (len / cipher.blockSize() + 1) * cipher.blockSize();
+            report("  %2u bytes: ecb encrypt %6lu ns, decrypt %6lu ns, +%u bytes on air; ctr %6lu ns, +%u bytes\n",
+                len, seal, open, (unsigned)(padded - len), ctr, CTR_OVERHEAD);
+        }
+        else {
+            report("  %2u bytes: ctr encrypt / decrypt %6lu ns, +%u bytes on air - no decryptBlock(), so no ecb\n",
+                len, ctr, CTR_OVERHEAD);
+        }
+    }
+}
+
+void setup()
+{
+#if defined(PARTICLE) || defined(ARDUINO)
+    Serial.begin(9600);
+    delay(5000);
+#endif
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i * 7;
+
+    report("%d iterations of each operation\n", ITERATIONS);
+    benchAead("Ascon128", ascon, sizeof(ascon));
+    benchAead("Acorn128", acorn, sizeof(acorn));
+    benchBlock("Speck", speck, sizeof(speck), true);
+    benchBlock("SpeckSmall", speckSmall, sizeof(speckSmall), true);
+    benchBlock("SpeckTiny", speckTiny, sizeof(speckTiny), false);
+}
+
+void loop()
+{
+}
+
+#if !defined(PARTICLE) && !defined(ARDUINO)
+int main()
+{
+    setup();
+    return 0;
+}
+#endif
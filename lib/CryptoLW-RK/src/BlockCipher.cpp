@@ -21,6 +21,8 @@
  */
 
 #include "BlockCipher.h"
+#include "Crypto.h"
+#include <string.h>
 
 /**
  * \class BlockCipher BlockCipher.h <BlockCipher.h>
@@ -122,3 +124,161 @@ BlockCipher::~BlockCipher()
  *
  * \sa setKey(), encryptBlock(), decryptBlock()
  */
+
+/**
+ * \brief Encrypts a run of contiguous blocks in electronic codebook mode.
+ *
+ * \param output The output buffer to put the ciphertext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the plaintext from, which may be
+ * the same buffer as \a output to encrypt in place.
+ * \param count The number of blocks.
+ *
+ * The default implementation calls encryptBlock() for each block.  Subclasses
+ * may override it to run the loop without a virtual call per block.
+ *
+ * \sa decryptBlocks(), encryptBlock()
+ */
+void BlockCipher::encryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    size_t size = blockSize();
+    while (count-- > 0) {
+        encryptBlock(output, input);
+        output += size;
+        input += size;
+    }
+}
+
+/**
+ * \brief Decrypts a run of contiguous blocks in electronic codebook mode.
+ *
+ * \param output The output buffer to put the plaintext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the ciphertext from, which may be
+ * the same buffer as \a output to decrypt in place.
+ * \param count The number of blocks.
+ *
+ * \sa encryptBlocks(), decryptBlock()
+ */
+void BlockCipher::decryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    size_t size = blockSize();
+    while (count-- > 0) {
+        decryptBlock(output, input);
+        output += size;
+        input += size;
+    }
+}
+
+/**
+ * \brief Encrypts a run of contiguous blocks in cipher block chaining mode.
+ *
+ * \param output The output buffer to put the ciphertext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the plaintext from, which may be
+ * the same buffer as \a output to encrypt in place.
+ * \param count The number of blocks.
+ * \param iv The initialization vector, blockSize() bytes.  On return it
+ * holds the last ciphertext block so that a further call continues the chain.
+ *
+ * Does nothing if blockSize() is greater than MAX_BLOCK_SIZE.
+ *
+ * \sa decryptCBC(), cryptCTR()
+ */
+void BlockCipher::encryptCBC(uint8_t *output, const uint8_t *input, size_t count, uint8_t *iv)
+{
+    size_t size = blockSize();
+    if (size > MAX_BLOCK_SIZE)
+        return;
+    while (count-- > 0) {
+        for (size_t i = 0; i < size; ++i)
+            iv[i] ^= input[i];
+        encryptBlock(iv, iv);
+        memcpy(output, iv, size);
+        output += size;
+        input += size;
+    }
+}
+
+/**
+ * \brief Decrypts a run of contiguous blocks in cipher block chaining mode.
+ *
+ * \param output The output buffer to put the plaintext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the ciphertext from, which may be
+ * the same buffer as \a output to decrypt in place.
+ * \param count The number of blocks.
+ * \param iv The initialization vector, blockSize() bytes.  On return it
+ * holds the last ciphertext block so that a further call continues the chain.
+ *
+ * Needs decryptBlock(), so cannot be used with SpeckTiny.  Does nothing if
+ * blockSize() is greater than MAX_BLOCK_SIZE.
+ *
+ * \sa encryptCBC()
+ */
+void BlockCipher::decryptCBC(uint8_t *output, const uint8_t *input, size_t count, uint8_t *iv)
+{
+    uint8_t block[MAX_BLOCK_SIZE];
+    size_t size = blockSize();
+    if (size > MAX_BLOCK_SIZE)
+        return;
+    while (count-- > 0) {
+        memcpy(block, input, size);     // The next block's IV, before an in place decrypt overwrites it
+        decryptBlock(output, input);
+        for (size_t i = 0; i < size; ++i)
+            output[i] ^= iv[i];
+        memcpy(iv, block, size);
+        output += size;
+        input += size;
+    }
+    clean(block);
+}
+
+/**
+ * \brief Encrypts or decrypts data of any length in counter mode.
+ *
+ * \param output The output buffer, at least \a len bytes in length.
+ * \param input The input buffer, which may be the same buffer as \a output.
+ * \param len The number of bytes - need not be a multiple of blockSize(),
+ * so no padding is needed.
+ * \param counter The initial counter block, blockSize() bytes.  It is treated
+ * as a big-endian number and incremented once for each block of keystream, so
+ * on return it holds the counter for the next block.
+ *
+ * The same call encrypts and decrypts.  Only encryptBlock() is needed, so this
+ * works with SpeckTiny.  A counter value must never be used twice with the same
+ * key.  Keystream is made several blocks at a time with encryptBlocks().  Does
+ * nothing if blockSize() is greater than MAX_BLOCK_SIZE.
+ *
+ * \sa encryptCBC()
+ */
+void BlockCipher::cryptCTR(uint8_t *output, const uint8_t *input, size_t len, uint8_t *counter)
+{
+    const size_t batch = 4;
+    uint8_t keystream[batch * MAX_BLOCK_SIZE];
+    size_t size = blockSize();
+    if (size > MAX_BLOCK_SIZE)
+        return;
+    while (len > 0) {
+        size_t blocks = (len + size - 1) / size;
+        if (blocks > batch)
+            blocks = batch;
+        for (size_t b = 0; b < blocks; ++b) {
+            memcpy(keystream + b * size, counter, size);
+            for (size_t i = size; i > 0; --i) {
+                if (++counter[i - 1] != 0)
+                    break;
+            }
+        }
+        encryptBlocks(keystream, keystream, blocks);
+        size_t bytes = blocks * size;
+        if (bytes > len)
+            bytes = len;
+        for (size_t i = 0; i < bytes; ++i)
+            output[i] = input[i] ^ keystream[i];
+        output += bytes;
+        input += bytes;
+        len -= bytes;
+    }
+    clean(keystream);
+}
@@ -40,6 +40,15 @@ public:
     virtual void encryptBlock(uint8_t *output, const uint8_t *input) = 0;
     virtual void decryptBlock(uint8_t *output, const uint8_t *input) = 0;
 
+    virtual void encryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+    virtual void decryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+
+    void encryptCBC(uint8_t *output, const uint8_t *input, size_t count, uint8_t *iv);
+    void decryptCBC(uint8_t *output, const uint8_t *input, size_t count, uint8_t *iv);
+    void cryptCTR(uint8_t *output, const uint8_t *input, size_t len, uint8_t *counter);
+
+    static const size_t MAX_BLOCK_SIZE = 16;
+
     virtual void clear() = 0;
 };
 
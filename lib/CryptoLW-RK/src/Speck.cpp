@@ -547,6 +547,24 @@ void Speck::decryptBlock(uint8_t *output, const uint8_t *input)
 #endif
 }
 
+/**
+ * \brief Encrypts a run of contiguous blocks with direct calls to encryptBlock().
+ */
+void Speck::encryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    for (; count > 0; --count, output += 16, input += 16)
+        Speck::encryptBlock(output, input);
+}
+
+/**
+ * \brief Decrypts a run of contiguous blocks with direct calls to decryptBlock().
+ */
+void Speck::decryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    for (; count > 0; --count, output += 16, input += 16)
+        Speck::decryptBlock(output, input);
+}
+
 void Speck::clear()
 {
     clean(k);
@@ -39,6 +39,9 @@ public:
     void encryptBlock(uint8_t *output, const uint8_t *input);
     void decryptBlock(uint8_t *output, const uint8_t *input);
 
+    void encryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+    void decryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+
     void clear();
 
 private:
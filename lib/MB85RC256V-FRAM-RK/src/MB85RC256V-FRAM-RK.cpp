@@ -4,7 +4,7 @@
 
 
 MB85RC::MB85RC(TwoWire &wire, size_t memorySize, int addr) :
-	wire(wire), memorySize(memorySize), addr(addr) {
+	wire(wire), memorySize(memorySize), addr(addr), transactions(0) {
 }
 
 MB85RC::~MB85RC() {
@@ -20,7 +20,7 @@ bool MB85RC::erase() {
 		size_t framAddr = 0;
 		size_t totalLen = memorySize;
 
-		uint8_t zero[30];
+		uint8_t zero[MOVE_BUFFER_SIZE];
 		memset(zero, 0, sizeof(zero));
 
 		while(totalLen > 0) {
@@ -47,36 +47,39 @@ bool MB85RC::erase() {
 bool MB85RC::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 	bool result = true;
 
-	WITH_LOCK(wire) {
+	if (dataLen == 0) {
+		return true;
+	}
 
-		while(dataLen > 0) {
-			wire.beginTransmission(addr | DEVICE_ADDR);
-			wire.write(framAddr >> 8);
-			wire.write(framAddr);
-			int stat = wire.endTransmission(false);
-			if (stat != 0) {
-				//Serial.printlnf("read set address failed %d", stat);
-				result = false;
-				break;
-			}
+	WITH_LOCK(wire) {
+		// Send the address once - the FRAM counts on from it, so each read below carries on where the last stopped
+		wire.beginTransmission(addr | DEVICE_ADDR);
+		wire.write(framAddr >> 8);
+		wire.write(framAddr);
+		int stat = wire.endTransmission(false);
+		if (stat != 0) {
+			//Serial.printlnf("read set address failed %d", stat);
+			result = false;
+		}
 
+		while(result && dataLen > 0) {
 			size_t bytesToRead = dataLen;
-			if (bytesToRead > 32) {
-				bytesToRead = 32;
+			if (bytesToRead > transferSize) {
+				bytesToRead = transferSize;
 			}
 
 			wire.requestFrom((uint8_t)(addr | DEVICE_ADDR), bytesToRead, (uint8_t) true);
+			transactions++;
 
-			if (Wire.available() < (int) bytesToRead) {
+			if (wire.available() < (int) bytesToRead) {
 				result = false;
 				break;
 			}
 
 			for(size_t ii = 0; ii < bytesToRead; ii++) {
-				*data++ = Wire.read();    // receive a byte as character
-				framAddr++;
-				dataLen--;
+				*data++ = wire.read();    // receive a byte as character
 			}
+			dataLen -= bytesToRead;
 		}
 	}
 	return result;
@@ -92,7 +95,7 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 			wire.write(framAddr >> 8);
 			wire.write(framAddr);
 
-			for(size_t ii = 0; ii < 30 && dataLen > 0; ii++) {
+			for(size_t ii = 0; ii < transferSize - 2 && dataLen > 0; ii++) {
 				wire.write(*data);
 				framAddr++;
 				data++;
@@ -100,6 +103,7 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 			}
 
 			int stat = wire.endTransmission(true);
+			transactions++;
 			if (stat != 0) {
 				//Serial.printlnf("write failed %d", stat);
 				result = false;
@@ -111,11 +115,23 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 }
 
 
+bool MB85RC::writeSpans(const Span *spans, size_t count) {
+	bool result = true;
+
+	WITH_LOCK(wire) {
+		for(size_t ii = 0; ii < count && result; ii++) {
+			result = writeData(spans[ii].framAddr, spans[ii].data, spans[ii].dataLen);
+		}
+	}
+	return result;
+}
+
+
 bool MB85RC::moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes) {
 	bool result = true;
 
-	// Maximum number of bytes we can write is 30
-	uint8_t buf[30];
+	// Each chunk is one sequential read and as few writes as the transfer size allows
+	uint8_t buf[MOVE_BUFFER_SIZE];
 
 	WITH_LOCK(wire) {
 		if (framAddrFrom < framAddrTo) {
@@ -176,40 +192,46 @@ bool MB85RC::moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes) {
 
 bool MB85RC1M::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 	bool result = true;
+	bool addressSent = false;
 
 	WITH_LOCK(wire) {
 
 		while(dataLen > 0) {
 			size_t count = dataLen;
-			if (count > 32) {
-				// Don't read more than 32 bytes (limit of Wire implementation)
-				count = 32;
+			if (count > transferSize) {
+				// Don't read more than the Wire buffer holds
+				count = transferSize;
 			}
 			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
-				// Crosses boundary at 65536, only write up to the boundary
+				// Crosses boundary at 65536, only read up to the boundary
 				count = 65536 - framAddr;
 			}
 
-			wire.beginTransmission(getI2CAddr(framAddr));
-			wire.write(framAddr >> 8);
-			wire.write(framAddr);
-			int stat = wire.endTransmission(false);
-			if (stat != 0) {
-				Log.info("read set address failed %d", stat);
-				result = false;
-				break;
+			if (!addressSent || framAddr == 65536) {
+				// The address is sent once for each half - the upper half has its own I2C address
+				wire.beginTransmission(getI2CAddr(framAddr));
+				wire.write(framAddr >> 8);
+				wire.write(framAddr);
+				int stat = wire.endTransmission(false);
+				if (stat != 0) {
+					Log.info("read set address failed %d", stat);
+					result = false;
+					break;
+				}
+				addressSent = true;
 			}
 
 			wire.requestFrom(getI2CAddr(framAddr), count, (uint8_t) true);
+			transactions++;
 
-			if (Wire.available() < (int) count) {
+			if (wire.available() < (int) count) {
 				Log.info("didn't receive enough bytes count=%u", count);
 				result = false;
 				break;
 			}
 
 			for(size_t ii = 0; ii < count; ii++) {
-				*data++ = Wire.read();    // receive a byte as character
+				*data++ = wire.read();    // receive a byte as character
 				framAddr++;
 				dataLen--;
 			}
@@ -224,9 +246,9 @@ bool MB85RC1M::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 	WITH_LOCK(wire) {
 		while(dataLen > 0) {
 			size_t count = dataLen;
-			if (count > 30) {
-				// Don't write more than 30 bytes (limit of Wire implementation)
-				count = 30;
+			if (count > transferSize - 2) {
+				// Don't write more than the Wire buffer holds after the address
+				count = transferSize - 2;
 			}
 			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
 				// Crosses boundary at 65536, only write up to the boundary
@@ -242,10 +264,10 @@ bool MB85RC1M::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 				framAddr++;
 				data++;
 				dataLen--;
-				count--;
 			}
 
 			int stat = wire.endTransmission(true);
+			transactions++;
 			if (stat != 0) {
 				Log.info("write failed %d", stat);
 				result = false;
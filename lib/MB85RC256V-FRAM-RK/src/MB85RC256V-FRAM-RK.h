@@ -5,6 +5,18 @@
 
 class MB85RC {
 public:
+	/**
+	 * @brief One region of a scatter/gather write - see writeSpans()
+	 */
+	struct Span {
+		size_t framAddr;		//!< Address in the FRAM to write to
+		const uint8_t *data;	//!< Bytes to write
+		size_t dataLen;			//!< Number of bytes
+	};
+
+	static const size_t DEFAULT_TRANSFER_SIZE = 32;		//!< The default Wire buffer on Particle devices
+	static const size_t MOVE_BUFFER_SIZE = 128;			//!< Stack buffer used by moveData() and erase()
+
 	/**
 	 * You will normally use one the subclasses of this object like MB85RC64, MB85RC256V, MB85RC512, or MB85RC1M
 	 *
@@ -66,7 +78,8 @@ public:
 	 *
 	 * @param dataLen The number of bytes to read
 	 *
-	 * The dataLen can be larger than the maximum I2C read. Multiple reads will be done if necessary.
+	 * The dataLen can be larger than the maximum I2C read. The address is sent once and the reads of up to
+	 * the transfer size each continue from where the last left off.
      */
 	virtual bool readData(size_t framAddr, uint8_t *data, size_t dataLen);
 
@@ -79,10 +92,24 @@ public:
 	 *
 	 * @param dataLen The number of bytes to write
 	 *
-	 * The dataLen can be larger than the maximum I2C write. Multiple writes will be done if necessary.
+	 * The dataLen can be larger than the maximum I2C write. Multiple writes will be done if necessary, each
+	 * the 2 address bytes and up to the transfer size less 2 of data.
      */
 	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen);
 
+    /**
+     * @brief Writes several regions under one lock of the I2C bus
+     *
+	 * @param spans The regions to write
+	 *
+	 * @param count The number of regions
+	 *
+	 * Each region is written with writeData(). Holding the lock across all of them saves relocking the bus
+	 * for each and keeps another thread from getting in between, so the regions are written together.
+	 * Stops at the first region that fails.
+     */
+	bool writeSpans(const Span *spans, size_t count);
+
 	/**
 	 * @brief Move data within the FRAM. This is just a read then write operation.
 	 *
@@ -94,12 +121,33 @@ public:
 	 */
 	virtual bool moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes);
 
+	/**
+	 * @brief Number of I2C transactions since the object was constructed
+	 *
+	 * Each read or write of up to the transfer size is one transaction. Useful for estimating the energy spent on the bus.
+	 */
+	inline uint32_t transactionCount() const { return transactions; }
+
+	/**
+	 * @brief Sets the most bytes sent or received in one I2C transaction, address bytes included
+	 *
+	 * @param transferSize Must not be larger than the Wire buffer - DEFAULT_TRANSFER_SIZE unless the application
+	 * gives Wire a larger one with acquireWireBuffer(). Values below 3 are ignored.
+	 *
+	 * Larger transfers mean fewer address phases and fewer transactions for the same data.
+	 */
+	MB85RC &withTransferSize(size_t transferSize) { if (transferSize > 2) this->transferSize = transferSize; return *this; }
+
+	inline size_t getTransferSize() const { return transferSize; }
+
 	static const uint8_t DEVICE_ADDR = 0b1010000;
 
 protected:
 	TwoWire &wire;
 	size_t memorySize;
 	int addr; // This is just 0-7, the (0b1010000 of the 7-bit address is ORed in later)
+	uint32_t transactions; // I2C transactions - see transactionCount()
+	size_t transferSize = DEFAULT_TRANSFER_SIZE; // Bytes in one I2C transaction, including address bytes on a write
 
 };
 
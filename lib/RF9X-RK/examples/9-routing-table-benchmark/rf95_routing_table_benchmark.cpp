@@ -0,0 +1,99 @@
+// rf95_routing_table_benchmark.cpp
+// -*- mode: C++ -*-
+// Example sketch that measures the cost of the RHRouter routing table operations
+// used on every routed packet and during route discovery: addRouteTo() (update and insert),
+// getRouteTo() and deleteRouteTo(), for networks of 10, 50 and 250 nodes.
+// No radio traffic is sent, so the radio need not be connected.
+// With the default RH_ROUTING_TABLE_SIZE of 50 the 250 node run also measures the cost
+// of retiring the least recently used route on each insert.
+
+#include <RHRouter.h>
+#include <RH_RF95.h>
+#include <SPI.h>
+
+SYSTEM_MODE(MANUAL);
+
+//Define pins for the RFM9x:
+#define RFM95_CS D4
+#define RFM95_INT D2
+
+#define NODE_ADDRESS 0
+#define PASSES 100
+
+// Singleton instance of the radio driver - not initialised, the benchmark only uses the routing table
+RH_RF95 driver(RFM95_CS, RFM95_INT);
+
+// Class whose routing table is being measured
+RHRouter router(driver, NODE_ADDRESS);
+
+// Average time of one operation in nanoseconds
+static unsigned long nsPerOp(unsigned long startMicros, unsigned long ops)
+{
+	return (unsigned long)(((uint64_t)(micros() - startMicros) * 1000) / ops);
+}
+
+static void benchmark(uint8_t nodes)
+{
+	unsigned long start, found = 0;
+	uint8_t dest;
+	int pass;
+
+	router.clearRoutingTable();
+
+	// Insert: a route to every node, each via the node below it
+	start = micros();
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		router.clearRoutingTable();
+		for (dest = 1; dest <= nodes; dest++)
+			router.addRouteTo(dest, dest - 1);
+	}
+	unsigned long insertNs = nsPerOp(start, (unsigned long)PASSES * nodes);
+
+	// Update: change the next hop of every existing route
+	start = micros();
+	for (pass = 0; pass < PASSES; pass++)
+		for (dest = 1; dest <= nodes; dest++)
+			router.addRouteTo(dest, pass & 0x7f);
+	unsigned long updateNs = nsPerOp(start, (unsigned long)PASSES * nodes);
+
+	// Lookup: every node, hit or miss depending on whether the route was retired
+	start = micros();
+	for (pass = 0; pass < PASSES; pass++)
+		for (dest = 1; dest <= nodes; dest++)
+			if (router.getRouteTo(dest))
+				found++;
+	unsigned long lookupNs = nsPerOp(start, (unsigned long)PASSES * nodes);
+
+	// Delete: every node
+	start = micros();
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		for (dest = 1; dest <= nodes; dest++)
+			router.addRouteTo(dest, dest - 1);
+		for (dest = 1; dest <= nodes; dest++)
+			router.deleteRouteTo(dest);
+	}
+	unsigned long addDeleteNs = nsPerOp(start, (unsigned long)PASSES * nodes);
+
+	Serial.printlnf("%3u nodes: insert %lu ns, update %lu ns, lookup %lu ns (%lu%% hits), insert+delete %lu ns, %u routes kept",
+		nodes, insertNs, updateNs, lookupNs, (found * 100) / ((unsigned long)PASSES * nodes), addDeleteNs,
+		router.routeCount());
+}
+
+void setup() 
+{
+	Serial.begin(9600);
+
+	// Wait for a USB serial connection for up to 15 seconds
+	waitFor(Serial.isConnected, 15000);
+
+	Serial.printlnf("Routing table benchmark, RH_ROUTING_TABLE_SIZE %d, %d passes", RH_ROUTING_TABLE_SIZE, PASSES);
+	benchmark(10);
+	benchmark(50);
+	benchmark(250);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,185 @@
+// RHAuthenticatedDriver.cpp
+
+#include <RadioHead.h>
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+#include <RHAuthenticatedDriver.h>
+
+RHAuthenticatedDriver::RHAuthenticatedDriver(RHGenericDriver& driver, AuthenticatedCipher& cipher)
+    : _driver(driver),
+      _cipher(cipher),
+      _frameCounter(1),
+      _reservedTo(1),
+      _reserveHandler(NULL),
+      _senderId(0),
+      _lastSenderId(0),
+      _rxGood(0),
+      _rxReplayed(0)
+{
+    clearReplayTable();
+}
+
+void RHAuthenticatedDriver::startMessage(uint8_t to, uint8_t from, uint8_t id, uint8_t flags, uint32_t counter, uint32_t sender)
+{
+    // Nonce is the sender's address, the frame counter and the sender id, padded to the cipher's 16 bytes
+    uint8_t nonce[16];
+    memset(nonce, 0, sizeof(nonce));
+    nonce[0] = from;
+    nonce[1] = counter >> 16;
+    nonce[2] = counter >> 8;
+    nonce[3] = counter;
+    nonce[4] = sender >> 24;
+    nonce[5] = sender >> 16;
+    nonce[6] = sender >> 8;
+    nonce[7] = sender;
+    _cipher.setIV(nonce, sizeof(nonce));
+
+    uint8_t header[4] = { to, from, id, flags };
+    _cipher.addAuthData(header, sizeof(header));
+}
+
+bool RHAuthenticatedDriver::recv(uint8_t* buf, uint8_t* len)
+{
+    uint8_t frameLen = sizeof(_buffer);
+
+    if (!_driver.recv(_buffer, &frameLen))
+	return false;
+    if (!buf || !len)
+	return true; // Discarding the message, as the real driver does
+
+    if (frameLen < RH_AUTHENTICATED_OVERHEAD || frameLen - RH_AUTHENTICATED_OVERHEAD > *len)
+    {
+	_rxBad++;
+	return false;
+    }
+    uint32_t counter = ((uint32_t)_buffer[0] << 16) | ((uint32_t)_buffer[1] << 8) | _buffer[2];
+    uint32_t sender = ((uint32_t)_buffer[3] << 24) | ((uint32_t)_buffer[4] << 16) | ((uint32_t)_buffer[5] << 8) | _buffer[6];
+    ReplayEntry* entry = findSender(sender);
+    if (entry && counter <= entry->counter)
+    {
+	// Checked before the tag so a replay costs no cipher time
+	_rxReplayed++;
+	_rxBad++;
+	return false;
+    }
+
+    uint8_t messageLen = frameLen - RH_AUTHENTICATED_OVERHEAD;
+    const uint8_t* ciphertext = &_buffer[RH_AUTHENTICATED_COUNTER_LEN + RH_AUTHENTICATED_SENDER_LEN];
+    startMessage(_driver.headerTo(), _driver.headerFrom(), _driver.headerId(), _driver.headerFlags(), counter, sender);
+    _cipher.decrypt(buf, ciphertext, messageLen);
+    if (!_cipher.checkTag(ciphertext + messageLen, RH_AUTHENTICATED_TAG_LEN))
+    {
+	memset(buf, 0, messageLen); // Do not leave unauthenticated plaintext behind
+	_rxBad++;
+	return false;
+    }
+
+    // Only an authenticated message moves the counter on or takes an entry, so a forgery cannot lock a node out
+    if (!entry)
+    {
+	for (uint16_t i = 0; !entry && i < RH_AUTHENTICATED_REPLAY_SENDERS; i++)
+	    if (_replayTable[i].counter == 0)
+		entry = &_replayTable[i];
+	if (!entry)
+	{
+	    entry = &_replayTable[_nextReplayEntry]; // Full - reuse the entry taken longest ago
+	    _nextReplayEntry = (_nextReplayEntry + 1) % RH_AUTHENTICATED_REPLAY_SENDERS;
+	}
+	entry->sender = sender;
+    }
+    entry->counter = counter;
+    _lastSenderId = sender;
+    *len = messageLen;
+    _rxGood++;
+    return true;
+}
+
+bool RHAuthenticatedDriver::send(const uint8_t* data, uint8_t len)
+{
+    if (len > maxMessageLength() || _frameCounter > RH_AUTHENTICATED_MAX_COUNTER)
+	return false;
+
+    if (_frameCounter >= _reservedTo)
+    {
+	_reservedTo = _frameCounter + RH_AUTHENTICATED_COUNTER_BLOCK;
+	if (_reserveHandler)
+	    _reserveHandler(_reservedTo); // Stored before any counter in the block goes on the air
+    }
+    uint32_t counter = _frameCounter++;
+
+    _buffer[0] = counter >> 16;
+    _buffer[1] = counter >> 8;
+    _buffer[2] = counter;
+    _buffer[3] = _senderId >> 24;
+    _buffer[4] = _senderId >> 16;
+    _buffer[5] = _senderId >> 8;
+    _buffer[6] = _senderId;
+    uint8_t* ciphertext = &_buffer[RH_AUTHENTICATED_COUNTER_LEN + RH_AUTHENTICATED_SENDER_LEN];
+    startMessage(_txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, counter, _senderId);
+    _cipher.encrypt(ciphertext, data, len);
+    _cipher.computeTag(ciphertext + len, RH_AUTHENTICATED_TAG_LEN);
+
+    return _driver.send(_buffer, len + RH_AUTHENTICATED_OVERHEAD);
+}
+
+uint8_t RHAuthenticatedDriver::maxMessageLength()
+{
+    int driver_len = _driver.maxMessageLength();
+
+    if (driver_len > RH_AUTHENTICATED_MAX_FRAME_LEN)
+	driver_len = RH_AUTHENTICATED_MAX_FRAME_LEN;
+    return driver_len - RH_AUTHENTICATED_OVERHEAD;
+}
+
+void RHAuthenticatedDriver::setThisAddress(uint8_t thisAddress)
+{
+    RHGenericDriver::setThisAddress(thisAddress);
+    _driver.setThisAddress(thisAddress);
+}
+
+void RHAuthenticatedDriver::setHeaderTo(uint8_t to)
+{
+    RHGenericDriver::setHeaderTo(to);
+    _driver.setHeaderTo(to);
+}
+
+void RHAuthenticatedDriver::setHeaderFrom(uint8_t from)
+{
+    RHGenericDriver::setHeaderFrom(from);
+    _driver.setHeaderFrom(from);
+}
+
+void RHAuthenticatedDriver::setHeaderId(uint8_t id)
+{
+    RHGenericDriver::setHeaderId(id);
+    _driver.setHeaderId(id);
+}
+
+void RHAuthenticatedDriver::setHeaderFlags(uint8_t set, uint8_t clear)
+{
+    RHGenericDriver::setHeaderFlags(set, clear);
+    _driver.setHeaderFlags(set, clear);
+}
+
+void RHAuthenticatedDriver::setFrameCounter(uint32_t counter)
+{
+    if (counter == 0)
+	counter = 1; // 0 marks an address not yet heard from at the receiver
+    _frameCounter = counter;
+    _reservedTo = counter; // So the first send reserves a block
+}
+
+void RHAuthenticatedDriver::clearReplayTable()
+{
+    memset(_replayTable, 0, sizeof(_replayTable));
+    _nextReplayEntry = 0;
+}
+
+RHAuthenticatedDriver::ReplayEntry* RHAuthenticatedDriver::findSender(uint32_t sender)
+{
+    for (uint16_t i = 0; i < RH_AUTHENTICATED_REPLAY_SENDERS; i++)
+	if (_replayTable[i].counter != 0 && _replayTable[i].sender == sender)
+	    return &_replayTable[i];
+    return NULL;
+}
+
+#endif
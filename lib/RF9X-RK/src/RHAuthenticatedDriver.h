@@ -0,0 +1,267 @@
+// RHAuthenticatedDriver.h
+
+// Generic authenticated encryption layer that could use any driver.
+// Requires the CryptoLW-RK library for the AuthenticatedCipher (Ascon128, Acorn128)
+
+#ifndef RHAuthenticatedDriver_h
+#define RHAuthenticatedDriver_h
+
+#include <RHGenericDriver.h>
+#if defined(RH_ENABLE_ENCRYPTION_MODULE) || defined(DOXYGEN)
+#include <AuthenticatedCipher.h>
+
+// Bytes of frame counter sent in front of each message
+#define RH_AUTHENTICATED_COUNTER_LEN 3
+
+// Bytes of sender id sent after the frame counter
+#define RH_AUTHENTICATED_SENDER_LEN 4
+
+// Bytes of the cipher's tag sent after each message. 4 bytes gives a forger one chance in 2^32 per frame
+#define RH_AUTHENTICATED_TAG_LEN 4
+
+// Bytes added to each message
+#define RH_AUTHENTICATED_OVERHEAD (RH_AUTHENTICATED_COUNTER_LEN + RH_AUTHENTICATED_SENDER_LEN + RH_AUTHENTICATED_TAG_LEN)
+
+// Largest frame counter - the key must be changed before a node sends this many frames
+#define RH_AUTHENTICATED_MAX_COUNTER 0xffffffUL
+
+// Frame counters are reserved in blocks of this many, so the reserve handler is called once per block
+#define RH_AUTHENTICATED_COUNTER_BLOCK 64
+
+// Largest frame this layer will pass to or take from the driver
+#define RH_AUTHENTICATED_MAX_FRAME_LEN 255
+
+// Senders the receiver keeps the last frame counter of - once it is full the oldest entry is reused
+#define RH_AUTHENTICATED_REPLAY_SENDERS 256
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHAuthenticatedDriver RHAuthenticatedDriver <RHAuthenticatedDriver.h>
+/// \brief Virtual Driver to encrypt, authenticate and replay-check data. Can be used with any other RadioHead driver.
+///
+/// This driver acts as a wrapper for any other RadioHead driver, like RHEncryptedDriver, but uses an
+/// authenticated cipher so that a message which has been altered, forged or replayed is dropped rather than
+/// delivered. Each message is sent as
+///
+/// \code
+/// frame counter (3 bytes, big endian) | sender id (4 bytes, big endian) | ciphertext (same length as the message) | tag (4 bytes)
+/// \endcode
+///
+/// so it costs 11 bytes, against the 1 to 16 bytes of padding RHEncryptedDriver adds to fill a block.
+///
+/// The sender id belongs to the device rather than to its address - set it with setSenderId() from something
+/// unique to the device, such as a hash of its serial number. The nonce is the FROM header, the frame counter
+/// and the sender id, so it is not repeated when an address passes to another device or when several devices
+/// send from one address at once, as long as their sender ids differ and each device's counter only goes up.
+/// The four RadioHead header bytes (TO, FROM, ID, FLAGS) are authenticated but not encrypted, as the driver
+/// needs them in the clear.
+///
+/// The receiver keeps the last counter it accepted from each sender id, whatever address it came from, and
+/// drops any message that does not carry a higher one. That table is only in RAM, so after the receiver
+/// restarts - or once RH_AUTHENTICATED_REPLAY_SENDERS others have pushed a sender out of it - the first
+/// message from each sender is accepted whatever its counter.
+///
+/// The sender's counter must survive its restarts. Rather than save it after every message, counters are
+/// reserved in blocks of RH_AUTHENTICATED_COUNTER_BLOCK and the reserve handler is called with the end of
+/// each new block - store that value and give it to setFrameCounter() at the next boot. The counters left
+/// in a block when the node restarts are skipped.
+///
+/// For successful communications, both sender and receiver must use the same cipher and the same key.
+
+class RHAuthenticatedDriver : public RHGenericDriver
+{
+public:
+    /// Called with the first frame counter not yet reserved - store it so the next boot starts from it
+    typedef void (*ReserveHandler)(uint32_t reservedTo);
+
+    /// Constructor.
+    /// Adds an authenticated ciphering layer to messages sent and received by the actual transport driver.
+    /// \param[in] driver The RadioHead driver to use to transport messages.
+    /// \param[in] cipher The authenticated cipher (from CryptoLW) that encrypts and authenticates the data. Ensure
+    /// that the cipher has had its key set before sending or receiving messages. It must take a 16 byte IV.
+    RHAuthenticatedDriver(RHGenericDriver& driver, AuthenticatedCipher& cipher);
+
+    /// Calls the real driver's init()
+    /// \return The value returned from the driver init() method;
+    virtual bool init() { return _driver.init();};
+
+    /// Tests whether a new message is available from the Driver.
+    /// A message reported here may still be dropped by recv() if it fails authentication.
+    /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
+    virtual bool available() { return _driver.available();};
+
+    /// If a message is available, checks its tag and frame counter, decrypts it into buf and returns true.
+    /// A message that fails either check is discarded, counted in rxBad() and false is returned.
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to available space in buf. Set to the actual number of octets copied.
+    /// \return true if a valid message was copied to buf
+    virtual bool recv(uint8_t* buf, uint8_t* len);
+
+    /// Encrypts the message under the next frame counter and sends it with the real driver.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send
+    /// \return false if the message is too long, the frame counters are used up, or the driver's send() failed
+    virtual bool send(const uint8_t* data, uint8_t len);
+
+    /// Returns the maximum message length, which is the underlying driver's less RH_AUTHENTICATED_OVERHEAD
+    /// \return The maximum legal message length
+    virtual uint8_t maxMessageLength();
+
+    /// Blocks until the transmitter is no longer transmitting.
+    virtual bool            waitPacketSent() { return _driver.waitPacketSent();} ;
+
+    /// Blocks until the transmitter is no longer transmitting, or until the timeout occurs
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if the radio completed transmission within the timeout period. False if it timed out.
+    virtual bool            waitPacketSent(uint16_t timeout) {return _driver.waitPacketSent(timeout);} ;
+
+    /// Starts the receiver and blocks until a received message is available or a timeout
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if a message is available
+    virtual bool            waitAvailableTimeout(uint16_t timeout) {return _driver.waitAvailableTimeout(timeout);};
+
+    /// Calls the waitCAD method in the driver
+    virtual bool            waitCAD() { return _driver.waitCAD();};
+
+    /// Sets the Channel Activity Detection timeout in milliseconds to be used by waitCAD().
+    void setCADTimeout(unsigned long cad_timeout) {_driver.setCADTimeout(cad_timeout);};
+
+    /// Determine if the currently selected radio channel is active.
+    virtual bool            isChannelActive() { return _driver.isChannelActive();};
+
+    /// Sets the address of this node in this layer and the real driver
+    virtual void setThisAddress(uint8_t thisAddress);
+
+    /// Sets the TO header to be sent in all subsequent messages
+    virtual void           setHeaderTo(uint8_t to);
+
+    /// Sets the FROM header to be sent in all subsequent messages. This is the address used in the nonce.
+    virtual void           setHeaderFrom(uint8_t from);
+
+    /// Sets the ID header to be sent in all subsequent messages
+    virtual void           setHeaderId(uint8_t id);
+
+    /// Sets and clears bits in the FLAGS header to be sent in all subsequent messages
+    virtual void           setHeaderFlags(uint8_t set, uint8_t clear = RH_FLAGS_APPLICATION_SPECIFIC);
+
+    /// Tells the receiver to accept messages with any TO address
+    virtual void           setPromiscuous(bool promiscuous){ _driver.setPromiscuous(promiscuous);};
+
+    /// Returns the TO header of the last received message
+    virtual uint8_t        headerTo() { return _driver.headerTo();};
+
+    /// Returns the FROM header of the last received message
+    virtual uint8_t        headerFrom() { return _driver.headerFrom();};
+
+    /// Returns the ID header of the last received message
+    virtual uint8_t        headerId() { return _driver.headerId();};
+
+    /// Returns the FLAGS header of the last received message
+    virtual uint8_t        headerFlags() { return _driver.headerFlags();};
+
+    /// Returns the most recent RSSI (Receiver Signal Strength Indicator).
+    int16_t        lastRssi() { return _driver.lastRssi();};
+
+    /// Returns the operating mode of the library.
+    RHMode          mode() { return _driver.mode();};
+
+    /// Sets the operating mode of the transport.
+    void            setMode(RHMode mode) { _driver.setMode(mode);};
+
+    /// Sets the transport hardware into low-power sleep mode (if supported).
+    virtual bool    sleep() { return _driver.sleep();};
+
+    /// Returns the number of received packets the driver rejected plus those this layer rejected
+    /// for a bad length, a bad tag or a replayed frame counter
+    virtual uint16_t       rxBad() { return _driver.rxBad() + _rxBad;};
+
+    /// Returns the number of received packets that passed the checks in this layer
+    virtual uint16_t       rxGood() { return _rxGood;};
+
+    /// Returns the count of the number of packets successfully transmitted
+    virtual uint16_t       txGood() { return _driver.txGood();};
+
+    /// Returns the number of received packets dropped because their frame counter had been seen
+    uint16_t               rxReplayed() { return _rxReplayed;};
+
+    /// Sets the frame counter the next message is sent with - call with the value last given to the
+    /// reserve handler before sending anything. Counters start at 1.
+    /// \param[in] counter The next frame counter
+    void setFrameCounter(uint32_t counter);
+
+    /// Returns the frame counter the next message will be sent with
+    uint32_t frameCounter() { return _frameCounter;};
+
+    /// Sets the sender id sent with, and in the nonce of, every message - unique to this device and the
+    /// same at every boot
+    /// \param[in] senderId The sender id
+    void setSenderId(uint32_t senderId) { _senderId = senderId;};
+
+    /// Returns the sender id of this device
+    uint32_t senderId() { return _senderId;};
+
+    /// Returns the sender id of the last message received
+    uint32_t lastSenderId() { return _lastSenderId;};
+
+    /// Sets the function called each time a new block of frame counters is reserved
+    /// \param[in] handler Function to store the reserved value, or NULL
+    void setReserveHandler(ReserveHandler handler) { _reserveHandler = handler;};
+
+    /// Forgets the frame counters seen from every sender, so the next message from each is accepted
+    void clearReplayTable();
+
+private:
+    /// Last frame counter accepted from a sender
+    typedef struct
+    {
+	uint32_t sender;
+	uint32_t counter; // 0 for an unused entry
+    } ReplayEntry;
+
+    /// Starts the cipher on the nonce for a message and adds the headers as associated data
+    void startMessage(uint8_t to, uint8_t from, uint8_t id, uint8_t flags, uint32_t counter, uint32_t sender);
+
+    /// Returns the replay table entry for a sender, or NULL if it has none
+    ReplayEntry* findSender(uint32_t sender);
+
+    /// The underlying transport river we are to use
+    RHGenericDriver&        _driver;
+
+    /// The authenticated cipher we are to use for encrypting/decrypting
+    AuthenticatedCipher&    _cipher;
+
+    /// Buffer to store encrypted messages
+    uint8_t                 _buffer[RH_AUTHENTICATED_MAX_FRAME_LEN];
+
+    /// Frame counter for the next message sent
+    uint32_t                _frameCounter;
+
+    /// First frame counter not yet reserved
+    uint32_t                _reservedTo;
+
+    /// Told about each new block of frame counters
+    ReserveHandler          _reserveHandler;
+
+    /// This device's sender id
+    uint32_t                _senderId;
+
+    /// Sender id of the last message received
+    uint32_t                _lastSenderId;
+
+    /// Last frame counter accepted from each sender heard from
+    ReplayEntry             _replayTable[RH_AUTHENTICATED_REPLAY_SENDERS];
+
+    /// Entry the next new sender replaces once the table is full
+    uint16_t                _nextReplayEntry;
+
+    /// Received messages accepted by this layer
+    uint16_t                _rxGood;
+
+    /// Received messages dropped for a replayed frame counter
+    uint16_t                _rxReplayed;
+};
+
+#else // RH_ENABLE_ENCRYPTION_MODULE
+#error "You have included RHAuthenticatedDriver.h, but not enabled RH_ENABLE_ENCRYPTION_MODULE in RadioHead.h"
+#endif
+
+#endif
@@ -10,40 +10,55 @@
 
 RHEncryptedDriver::RHEncryptedDriver(RHGenericDriver& driver, BlockCipher& blockcipher)
     : _driver(driver),
-      _blockcipher(blockcipher)
+      _blockcipher(blockcipher),
+      _cipherMode(CipherModeECB),
+      _nonce(0),
+      _reservedTo(0),
+      _reserveHandler(NULL)
 {
-    _buffer = (uint8_t *)calloc(_driver.maxMessageLength(), sizeof(uint8_t));
 }
 
 bool RHEncryptedDriver::recv(uint8_t* buf, uint8_t* len)
 {
-    int h = 0; // Index of output _buffer
+    uint8_t frameLen = sizeof(_buffer);
 
-    bool status = _driver.recv(_buffer, len);
+    bool status = _driver.recv(_buffer, &frameLen);
     if (status && buf && len)
     {
+	if (_cipherMode == CipherModeCTR)
+	{
+	    if (frameLen < RH_ENCRYPTED_NONCE_LEN)
+		return false; // Too short to have come from a CTR sender
+	    uint32_t nonce = ((uint32_t)_buffer[0] << 24) | ((uint32_t)_buffer[1] << 16) | ((uint32_t)_buffer[2] << 8) | _buffer[3];
+	    uint8_t messageLen = frameLen - RH_ENCRYPTED_NONCE_LEN;
+	    if (messageLen > *len)
+		messageLen = *len;
+	    setCounter(nonce, _driver.headerFrom());
+	    _blockcipher.cryptCTR(buf, &_buffer[RH_ENCRYPTED_NONCE_LEN], messageLen, _counter);
+	    *len = messageLen;
+	    return true;
+	}
+
 	int blockSize = _blockcipher.blockSize(); // Size of blocks used by encryption
-	int nbBlocks = *len / blockSize; 	  // Number of blocks in that message
-	if (nbBlocks * blockSize == *len)
+	if (frameLen % blockSize != 0)
+	    return false; // Or we have a missmatch ... this is probably not symetrically encrypted
+	_blockcipher.decryptBlocks(_buffer, _buffer, frameLen / blockSize); // Decrypt in place
+
+	uint8_t* content = _buffer;
+	uint8_t contentLen = frameLen;
+#ifdef STRICT_CONTENT_LEN
+	if (frameLen > 0)
 	{
-	    // Or we have a missmatch ... this is probably not symetrically encrypted 
-	    for (int k = 0; k < nbBlocks; k++)
-	    {
-		// Decrypt each block
-		_blockcipher.decryptBlock(&buf[h], &_buffer[k*blockSize]); // Decrypt that block into buf	
-		h += blockSize;
-#ifdef STRICT_CONTENT_LEN	
-		if (k == 0)
-		{
-//		    if (buf[0] > *len - 1)
-//			return false; // Bogus payload length
-		    *len = buf[0]; // First byte contains length
-		    h--;	   // First block is of length--
-		    memmove(buf, buf+1, blockSize - 1);
-		}
-#endif			
-	    }
+	    if (_buffer[0] > frameLen - 1)
+		return false; // Bogus payload length
+	    contentLen = _buffer[0]; // First byte contains length
+	    content++;
 	}
+#endif
+	if (contentLen > *len)
+	    contentLen = *len;
+	memcpy(buf, content, contentLen);
+	*len = contentLen;
     }
 
     return status;
@@ -53,96 +68,67 @@ bool RHEncryptedDriver::send(const uint8_t* data, uint8_t len)
 {
     if (len > maxMessageLength())
 	return false;
-    
-    bool status = true;
-    int blockSize = _blockcipher.blockSize(); // Size of blocks used by encryption
-	
-    if (len == 0) // PassThru
-	return _driver.send(data, len);
 
-    if (_cipheringBlocks.blockSize != blockSize)
+    if (_cipherMode == CipherModeCTR)
     {
-	// Cipher has changed it's block size
-	_cipheringBlocks.inputBlock = (uint8_t *)realloc(_cipheringBlocks.inputBlock, blockSize);
-	_cipheringBlocks.blockSize = blockSize;	
+	if (_nonce == 0)
+	    setNonce(random(1, 0x7fffffff)); // Chosen on first use so the platform's random number generator is ready
+	if (_nonce - _reservedTo < RH_ENCRYPTED_NONCE_BLOCK) // At or past the end of the block, allowing for wrap
+	{
+	    _reservedTo = _nonce + RH_ENCRYPTED_NONCE_BLOCK;
+	    if (_reserveHandler)
+		_reserveHandler(_reservedTo); // Stored before any nonce in the block goes on the air
+	}
+	uint32_t nonce = _nonce++;
+	_buffer[0] = nonce >> 24;
+	_buffer[1] = nonce >> 16;
+	_buffer[2] = nonce >> 8;
+	_buffer[3] = nonce;
+	setCounter(nonce, _txHeaderFrom);
+	_blockcipher.cryptCTR(&_buffer[RH_ENCRYPTED_NONCE_LEN], data, len, _counter);
+	return _driver.send(_buffer, len + RH_ENCRYPTED_NONCE_LEN);
     }
-	
-    int max_message_length = maxMessageLength();
-#ifdef STRICT_CONTENT_LEN	
-    uint8_t nbBlocks = len / blockSize + 1; // How many blocks do we need for that message
-    uint8_t nbBpM = (max_message_length + 1) / blockSize; // Max number of blocks per message
-#else
-    uint8_t nbBlocks = (len - 1) / blockSize + 1; // How many blocks do we need for that message
-    uint8_t nbBpM = max_message_length / blockSize; // Max number of blocks per message
-#endif	
-    int k = 0, j = 0; // k is block index, j is original message index
-#ifndef ALLOW_MULTIPLE_MSG	
+
+    if (len == 0) // PassThru
+	return _driver.send(data, len);
+
+    int blockSize = _blockcipher.blockSize(); // Size of blocks used by encryption
 #ifdef STRICT_CONTENT_LEN
-    for (k = 0; k < nbBpM && k * blockSize < len + 1; k++)
+    int streamLen = len + 1; // Length byte, then the message
 #else
-    for (k = 0; k < nbBpM && k * blockSize < len; k++)
+    int streamLen = len;
 #endif
+    int nbBlocks = (streamLen - 1) / blockSize + 1; // How many blocks do we need for that message
+#ifndef ALLOW_MULTIPLE_MSG
+    fillBlocks(data, len, 0, nbBlocks * blockSize);
+    _blockcipher.encryptBlocks(_buffer, _buffer, nbBlocks); // Encrypt in place
+    return _driver.send(_buffer, nbBlocks * blockSize);
+#else
+    bool status = true;
+    int nbBpM = maxMessageLength() / blockSize; // Max number of blocks per message
+    if (nbBpM == 0)
+	return false;
+    for (int k = 0; k < nbBlocks; k += nbBpM)
     {
-	// k blocks in that message
-	int h = 0; // h is block content index
-#ifdef STRICT_CONTENT_LEN
-	if (k == 0)
-	    _cipheringBlocks.inputBlock[h++] = len; // put in first byte of first block the message length
-#endif		
-	while (h < blockSize)
-	{	
-	    // Copy each msg byte into inputBlock, and trail with 0 if necessary
-	    if (j < len)
-		_cipheringBlocks.inputBlock[h++] = data[j++];
-	    else
-		_cipheringBlocks.inputBlock[h++] = 0; // Completing with trailing 0
-	}
-	_blockcipher.encryptBlock(&_buffer[k * blockSize], _cipheringBlocks.inputBlock); // Cipher that message into _buffer
-    }
-//    Serial.println(max_message_length);
-//    Serial.println(nbBlocks);
-//    Serial.println(nbBpM);
-//    Serial.println(k);
-//    Serial.println(blockSize);
-//    printBuffer("single send", _buffer, k * blockSize);
-    if (!_driver.send(_buffer, k*blockSize))  // We now send that message with it's new length
-	status = false;
-#else	
-    uint8_t nbMsg = (nbBlocks * blockSize) / max_message_length + 1; // How many message do we need
-
-    for (int i = 0; i < nbMsg; i++)
-    {
-	// i is message index
-	for (k = 0; k < nbBpM && k * blockSize < len ; k++)
-	{
-	    // k blocks in that message
-	    int h = 0;
-#ifdef STRICT_CONTENT_LEN
-	    if (k == 0 && i == 0)
-		_cipheringBlocks.inputBlock[h++] = len; // put in first byte of first block of first message the message length
-#endif			
-	    while (h < blockSize)
-	    {		
-		// Copy each msg byte into inputBlock, and trail with 0 if necessary
-		if (j < len)
-		    _cipheringBlocks.inputBlock[h++] = data[j++];
-		else
-		    _cipheringBlocks.inputBlock[h++] = 0;
-	    }
-	    _blockcipher.encryptBlock(&_buffer[k * blockSize], _cipheringBlocks.inputBlock); // Cipher that message into buffer
-	}
-//	printBuffer("multiple send", _buffer, k * blockSize);
-	if (!_driver.send(_buffer, k * blockSize))  // We now send that message with it's new length
+	int blocks = (nbBlocks - k < nbBpM) ? nbBlocks - k : nbBpM; // Blocks in this message
+	fillBlocks(data, len, k * blockSize, blocks * blockSize);
+	_blockcipher.encryptBlocks(_buffer, _buffer, blocks);
+	if (!_driver.send(_buffer, blocks * blockSize))
 	    status = false;
     }
-#endif
     return status;
+#endif
 }
 
 uint8_t RHEncryptedDriver::maxMessageLength()
 {
     int driver_len = _driver.maxMessageLength();
-    
+
+    if (driver_len > RH_ENCRYPTED_MAX_FRAME_LEN)
+	driver_len = RH_ENCRYPTED_MAX_FRAME_LEN;
+    if (_cipherMode == CipherModeCTR)
+	return driver_len - RH_ENCRYPTED_NONCE_LEN;
+
 #ifndef ALLOW_MULTIPLE_MSG
     driver_len = ((int)(driver_len/_blockcipher.blockSize()) ) * _blockcipher.blockSize();
 #endif
@@ -153,4 +139,47 @@ uint8_t RHEncryptedDriver::maxMessageLength()
     return driver_len;
 }
 
+void RHEncryptedDriver::setNonce(uint32_t nonce)
+{
+    _nonce = nonce;
+    _reservedTo = nonce; // So the first send reserves a block
+}
+
+void RHEncryptedDriver::setCounter(uint32_t nonce, uint8_t from)
+{
+    memset(_counter, 0, sizeof(_counter));
+    _counter[0] = nonce >> 24;
+    _counter[1] = nonce >> 16;
+    _counter[2] = nonce >> 8;
+    _counter[3] = nonce;
+    _counter[4] = from; // The low bytes count the blocks within the message
+}
+
+void RHEncryptedDriver::fillBlocks(const uint8_t* data, uint8_t len, int offset, int count)
+{
+    // The stream is the length byte (with STRICT_CONTENT_LEN), the message, then 0 to the end of the last block
+#ifdef STRICT_CONTENT_LEN
+    int skip = 1;
+    if (offset == 0 && count > 0)
+	_buffer[0] = len;
+#else
+    int skip = 0;
+#endif
+    for (int h = (offset == 0) ? skip : 0; h < count; )
+    {
+	int j = offset + h - skip; // Index in the message
+	if (j < len)
+	{
+	    int n = (len - j < count - h) ? len - j : count - h;
+	    memcpy(&_buffer[h], &data[j], n);
+	    h += n;
+	}
+	else
+	{
+	    memset(&_buffer[h], 0, count - h); // Completing with trailing 0
+	    break;
+	}
+    }
+}
+
 #endif
@@ -26,6 +26,15 @@
 // With STRICT_CONTENT_LEN, receiver will try to extract length from every message !!!!
 //#define ALLOW_MULTIPLE_MSG  
 
+// Largest frame this driver will build or take from the driver. The buffer is part of the object, so nothing is allocated
+#define RH_ENCRYPTED_MAX_FRAME_LEN 255
+
+// Bytes of message nonce sent in front of each message in CTR mode
+#define RH_ENCRYPTED_NONCE_LEN 4
+
+// CTR nonces are reserved in blocks of this many, so the reserve handler is called once per block
+#define RH_ENCRYPTED_NONCE_BLOCK 64
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHEncryptedDriver RHEncryptedDriver <RHEncryptedDriver.h>
 /// \brief Virtual Driver to encrypt/decrypt data. Can be used with any other RadioHead driver.
@@ -35,7 +44,22 @@
 /// and not the to/from address or flags. Any of the encryption ciphers supported by
 /// ArduinoLibs Cryptographic Library http://rweather.github.io/arduinolibs/crypto.html may be used.
 ///
-/// For successful communications, both sender and receiver must use the same cipher and the same key.
+/// For successful communications, both sender and receiver must use the same cipher, the same key and
+/// the same cipher mode.
+///
+/// In the default ECB mode each message is padded to whole cipher blocks, which adds 1 to 16 bytes. In
+/// CTR mode (setCipherMode()) the message is XORed with a keystream so the ciphertext is the same length as
+/// the message, and a RH_ENCRYPTED_NONCE_LEN byte nonce is sent in front of it: a 19 byte message goes as 23
+/// bytes rather than 32. CTR mode only needs encryptBlock(), so it also works with SpeckTiny. Neither mode
+/// detects altered or replayed messages - use RHAuthenticatedDriver for that.
+///
+/// The CTR keystream comes from the nonce and the from address, so a (key, from address, nonce) must never
+/// be used twice - two messages under the same keystream give away the XOR of their plaintexts. The nonce goes
+/// up with each message, and on its own starts at random, which does not survive a reset safely. Persist it
+/// the way RHAuthenticatedDriver does its frame counter: nonces are reserved in blocks of
+/// RH_ENCRYPTED_NONCE_BLOCK and the reserve handler is called with the end of each new block - store that
+/// value and give it to setNonce() at the next boot. If nonces cannot be stored, or several senders can share
+/// a from address (unconfigured nodes, reassigned addresses), give each sender its own key.
 ///
 /// In order to enable this module you must uncomment #define RH_ENABLE_ENCRYPTION_MODULE at the bottom of RadioHead.h
 /// But ensure you have installed the Crypto directory from arduinolibs first:
@@ -44,6 +68,16 @@
 class RHEncryptedDriver : public RHGenericDriver
 {
 public:
+    /// How messages are enciphered
+    typedef enum
+    {
+	CipherModeECB = 0, ///< Each block enciphered alone, padded to whole blocks (the default)
+	CipherModeCTR      ///< Counter mode, no padding, nonce sent with each message
+    } CipherMode;
+
+    /// Called with the first CTR nonce not yet reserved - store it so the next boot starts from it
+    typedef void (*ReserveHandler)(uint32_t reservedTo);
+
     /// Constructor.
     /// Adds a ciphering layer to messages sent and received by the actual transport driver.
     /// \param[in] driver The RadioHead driver to use to transport messages.
@@ -141,7 +175,8 @@ public:
 
     /// Sets the FROM header to be sent in all subsequent messages
     /// \param[in] from The new FROM header value
-    virtual void           setHeaderFrom(uint8_t from){ _driver.setHeaderFrom(from);};
+    /// Kept here too, as CTR mode uses it in the counter block
+    virtual void           setHeaderFrom(uint8_t from){ RHGenericDriver::setHeaderFrom(from); _driver.setHeaderFrom(from);};
 
     /// Sets the ID header to be sent in all subsequent messages
     /// \param[in] id The new ID header value
@@ -215,25 +250,55 @@ public:
     /// \return The number of packets successfully transmitted
     virtual uint16_t       txGood() { return _driver.txGood();};
 
+    /// Sets how messages are enciphered. Both ends must use the same mode.
+    /// \param[in] mode CipherModeECB (the default) or CipherModeCTR
+    void            setCipherMode(CipherMode mode) { _cipherMode = mode;};
+
+    /// Returns how messages are enciphered
+    CipherMode      cipherMode() { return _cipherMode;};
+
+    /// Sets the nonce the next CTR message is sent with - call with the value last given to the reserve
+    /// handler before sending anything. With 0, the default, the first message picks a nonce at random.
+    /// \param[in] nonce The next nonce
+    void            setNonce(uint32_t nonce);
+
+    /// Returns the nonce the next CTR message will be sent with - 0 if it has not been chosen yet
+    uint32_t        nonce() { return _nonce;};
+
+    /// Sets the function called each time a new block of CTR nonces is reserved
+    /// \param[in] handler Function to store the reserved value, or NULL
+    void            setReserveHandler(ReserveHandler handler) { _reserveHandler = handler;};
+
 private:
+    /// Puts the counter block for a CTR message in _counter
+    void            setCounter(uint32_t nonce, uint8_t from);
+
+    /// Fills _buffer with count bytes of the padded ECB stream, starting offset bytes into it
+    void            fillBlocks(const uint8_t* data, uint8_t len, int offset, int count);
+
     /// The underlying transport river we are to use
     RHGenericDriver&        _driver;
     
     /// The CipherBlock we are to use for encrypting/decrypting
     BlockCipher&	    _blockcipher;
     
-    /// Struct for with buffers for ciphering
-    typedef struct
-    {
-	size_t  blockSize    = 0;
-	uint8_t *inputBlock  = NULL;
-	//uint8_t *outputBlock = NULL;		
-    } CipherBlocks;
-    
-    CipherBlocks            _cipheringBlocks;
-    
+    /// How messages are enciphered
+    CipherMode              _cipherMode;
+
+    /// Nonce for the next message sent in CTR mode
+    uint32_t                _nonce;
+
+    /// First CTR nonce not yet reserved
+    uint32_t                _reservedTo;
+
+    /// Told each time a block of nonces is reserved
+    ReserveHandler          _reserveHandler;
+
+    /// Counter block for CTR mode
+    uint8_t                 _counter[BlockCipher::MAX_BLOCK_SIZE];
+
     /// Buffer to store encrypted/decrypted message
-    uint8_t*                _buffer;
+    uint8_t                 _buffer[RH_ENCRYPTED_MAX_FRAME_LEN];
 };
 
 /// @example nrf24_encrypted_client.pde
@@ -16,6 +16,9 @@ RHGenericDriver::RHGenericDriver()
     _rxBad(0),
     _rxGood(0),
     _txGood(0),
+    _modeStartMs(0),
+    _txTimeMs(0),
+    _rxTimeMs(0),
     _cad_timeout(0)
 {
 }
@@ -169,6 +172,7 @@ RHGenericDriver::RHMode  RHGenericDriver::mode()
 
 void  RHGenericDriver::setMode(RHMode mode)
 {
+    accountModeTime();
     _mode = mode;
 }
 
@@ -212,6 +216,35 @@ uint16_t RHGenericDriver::txGood()
     return _txGood;
 }
 
+// Called with the mode about to change - may be from the interrupt handler
+void RHGenericDriver::accountModeTime()
+{
+    uint32_t now = millis();
+    if (_mode == RHModeTx)
+	_txTimeMs += now - _modeStartMs;
+    else if (_mode == RHModeRx || _mode == RHModeCad)
+	_rxTimeMs += now - _modeStartMs;
+    _modeStartMs = now;
+}
+
+uint32_t RHGenericDriver::txTimeMs()
+{
+    uint32_t total;
+    ATOMIC_BLOCK_START;
+    total = _txTimeMs + ((_mode == RHModeTx) ? millis() - _modeStartMs : 0);
+    ATOMIC_BLOCK_END;
+    return total;
+}
+
+uint32_t RHGenericDriver::rxTimeMs()
+{
+    uint32_t total;
+    ATOMIC_BLOCK_START;
+    total = _rxTimeMs + ((_mode == RHModeRx || _mode == RHModeCad) ? millis() - _modeStartMs : 0);
+    ATOMIC_BLOCK_END;
+    return total;
+}
+
 void RHGenericDriver::setCADTimeout(unsigned long cad_timeout)
 {
     _cad_timeout = cad_timeout;
@@ -258,8 +258,21 @@ public:
     /// \return The number of packets successfully transmitted
     virtual uint16_t       txGood();
 
+    /// Returns the total time the transport has spent transmitting, including any transmission in progress.
+    /// For estimating energy use - the transmitter draws far more than any other mode
+    /// \return Milliseconds in RHModeTx since the driver was constructed
+    uint32_t               txTimeMs();
+
+    /// Returns the total time the transport has spent with the receiver on, including channel activity detection
+    /// \return Milliseconds in RHModeRx or RHModeCad since the driver was constructed
+    uint32_t               rxTimeMs();
+
 protected:
 
+    /// Adds the time since the last mode change to the total for the mode we are leaving.
+    /// Drivers call this just before they change _mode
+    void                   accountModeTime();
+
     /// The current transport operating mode
     volatile RHMode     _mode;
 
@@ -308,6 +321,15 @@ protected:
     /// Channel activity detected
     volatile bool       _cad;
 
+    /// millis() at the last mode change
+    volatile uint32_t   _modeStartMs;
+
+    /// Time spent transmitting
+    volatile uint32_t   _txTimeMs;
+
+    /// Time spent with the receiver on
+    volatile uint32_t   _rxTimeMs;
+
     /// Channel activity timeout in ms
     unsigned int        _cad_timeout;
 
@@ -20,6 +20,9 @@ uint8_t RHMesh::_tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
 RHMesh::RHMesh(RHGenericDriver& driver, uint8_t thisAddress) 
     : RHRouter(driver, thisAddress)
 {
+    _asyncDest = RH_BROADCAST_ADDRESS;
+    _asyncCallback = NULL;
+    _asyncContext = NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -47,6 +50,42 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
     return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
 }
 
+////////////////////////////////////////////////////////////////////
+// As sendtoWait(), but returns once the first transmission to the next hop has started
+uint8_t RHMesh::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, SendCompleteCallback callback, void* context)
+{
+    if (len > RH_MESH_MAX_MESSAGE_LEN)
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+    if (sendInProgress())
+	return RH_ROUTER_ERROR_BUSY;
+
+    if (address != RH_BROADCAST_ADDRESS)
+    {
+	RoutingTableEntry* route = getRouteTo(address);
+	if (!route && !doArp(address))
+	    return RH_ROUTER_ERROR_NO_ROUTE;
+    }
+
+    // Now have a route. Contruct an application layer message and start sending it via that route
+    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    memcpy(a->data, buf, len);
+    _asyncDest = address;
+    _asyncCallback = callback;
+    _asyncContext = context;
+    return RHRouter::sendtoAsync(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags, asyncSendComplete, this);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::asyncSendComplete(uint8_t handle, bool acked, void* context)
+{
+    RHMesh* mesh = (RHMesh*)context;
+    if (!acked && mesh->_asyncDest != RH_BROADCAST_ADDRESS)
+	mesh->deleteRouteTo(mesh->_asyncDest); // Cant deliver to the next hop. Delete the route
+    if (mesh->_asyncCallback)
+	mesh->_asyncCallback(handle, acked, mesh->_asyncContext);
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::doArp(uint8_t address)
 {
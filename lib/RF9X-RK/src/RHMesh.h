@@ -174,6 +174,26 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+    /// Starts sending a message to the destination node without waiting for the next hop to acknowledge it.
+    /// Like sendtoWait(), but once a route is known the send is advanced by RHReliableDatagram::pollSend(),
+    /// which must be called frequently (eg from your main loop) until it returns false.
+    /// If no route is known, route discovery is still done first and blocks as it does in sendtoWait().
+    /// If the next hop does not acknowledge, the route is deleted before the callback is called.
+    /// \param [in] buf The application message data. It is copied, so need not remain valid.
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address. If the address is RH_BROADCAST_ADDRESS (255)
+    /// the message will be broadcast to all the nearby nodes, but not routed or relayed.
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
+    /// \param [in] callback If not NULL, called from pollSend() when the send completes
+    /// \param [in] context Passed unchanged to callback
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE The send has started, the callback will report the outcome
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH The message is too long
+    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest and none could be discovered
+    ///         - RH_ROUTER_ERROR_BUSY Another asynchronous send is still in progress
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, SendCompleteCallback callback = NULL, void* context = NULL);
+
     /// Starts the receiver if it is not running already, processes and possibly routes any received messages
     /// addressed to other nodes
     /// and delivers any messages addressed to this node.
@@ -250,9 +270,22 @@ protected:
     virtual bool isPhysicalAddress(uint8_t* address, uint8_t addresslen);
 
 private:
+    /// Completion callback for sends started by sendtoAsync(). Deletes the route if the
+    /// next hop did not acknowledge, then calls the application's callback
+    static void asyncSendComplete(uint8_t handle, bool acked, void* context);
+
     /// Temporary message buffer
     static uint8_t _tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
 
+    /// Destination of the message being sent by sendtoAsync()
+    uint8_t _asyncDest;
+
+    /// The application's callback for the message being sent by sendtoAsync()
+    SendCompleteCallback _asyncCallback;
+
+    /// Passed to _asyncCallback
+    void* _asyncContext;
+
 };
 
 /// @example rf22_mesh_client.pde
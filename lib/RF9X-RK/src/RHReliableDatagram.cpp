@@ -23,6 +23,16 @@ RHReliableDatagram::RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddr
     _timeout = RH_DEFAULT_TIMEOUT;
     _retries = RH_DEFAULT_RETRIES;
     memset(_seenIds, 0, sizeof(_seenIds));
+    _asyncState = AsyncIdle;
+    _asyncLen = 0;
+    _asyncAddress = RH_BROADCAST_ADDRESS;
+    _asyncSequenceNumber = 0;
+    _asyncTries = 0;
+    _asyncSendTime = 0;
+    _asyncAckTimeout = 0;
+    _asyncAcked = false;
+    _asyncCallback = NULL;
+    _asyncContext = NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -47,83 +57,169 @@ uint8_t RHReliableDatagram::retries()
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 {
-    // Assemble the message
-    uint8_t thisSequenceNumber = ++_lastSequenceNumber;
-    uint8_t retries = 0;
-    while (retries++ <= _retries)
+    // Let any asynchronous send already in progress finish first
+    while (pollSend())
+	YIELD;
+
+    if (!sendtoAsync(buf, len, address))
+	return false;
+    while (pollSend())
+	YIELD;
+    return _asyncAcked;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address, SendCompleteCallback callback, void* context)
+{
+    if (_asyncState != AsyncIdle)
+	return 0;
+#if RH_ASYNC_MAX_MESSAGE_LEN < 255
+    if (len > RH_ASYNC_MAX_MESSAGE_LEN)
+	return 0;
+#endif
+
+    // Assemble the message. Sequence number 0 is skipped so it can never be mistaken for a failed start
+    if (++_lastSequenceNumber == 0)
+	++_lastSequenceNumber;
+    memcpy(_asyncBuf, buf, len);
+    _asyncLen = len;
+    _asyncAddress = address;
+    _asyncSequenceNumber = _lastSequenceNumber;
+    _asyncTries = 0;
+    _asyncCallback = callback;
+    _asyncContext = context;
+    asyncTransmit();
+    return _asyncSequenceNumber;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::pollSend()
+{
+    switch (_asyncState)
     {
-	setHeaderId(thisSequenceNumber);
-
-        // Set and clear header flags depending on if this is an
-        // initial send or a retry.
-        uint8_t headerFlagsToSet = RH_FLAGS_NONE;
-        // Always clear the ACK flag
-        uint8_t headerFlagsToClear = RH_FLAGS_ACK;
-        if (retries == 1) {
-            // On an initial send, clear the RETRY flag in case
-            // it was previously set
-            headerFlagsToClear |= RH_FLAGS_RETRY;
-        } else {
-            // Not an initial send, set the RETRY flag
-            headerFlagsToSet = RH_FLAGS_RETRY;
-        }
-        setHeaderFlags(headerFlagsToSet, headerFlagsToClear);
-
-	sendto(buf, len, address);
-	waitPacketSent();
+    case AsyncIdle:
+	return false;
+
+    case AsyncTx:
+	if (_driver.mode() == RHGenericDriver::RHModeTx)
+	    return true; // Still on the air
 
 	// Never wait for ACKS to broadcasts:
-	if (address == RH_BROADCAST_ADDRESS)
-	    return true;
+	if (_asyncAddress == RH_BROADCAST_ADDRESS)
+	{
+	    asyncComplete(true);
+	    return false;
+	}
 
-	if (retries > 1)
-	    _retransmissions++;
-	unsigned long thisSendTime = millis(); // Timeout does not include original transmit time
+	// Timeout does not include original transmit time
+	_asyncSendTime = millis();
 
 	// Compute a new timeout, random between _timeout and _timeout*2
 	// This is to prevent collisions on every retransmit
 	// if 2 nodes try to transmit at the same time
 #if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
-	uint16_t timeout = _timeout + (_timeout * (random() & 0xFF) / 256);
+	_asyncAckTimeout = _timeout + (_timeout * (random() & 0xFF) / 256);
 #else
-	uint16_t timeout = _timeout + (_timeout * random(0, 256) / 256);
+	_asyncAckTimeout = _timeout + (_timeout * random(0, 256) / 256);
 #endif
-	int32_t timeLeft;
-        while ((timeLeft = timeout - (millis() - thisSendTime)) > 0)
+	_asyncState = AsyncWaitAck;
+	// Fall through and look for the ACK straight away
+
+    case AsyncWaitAck:
+	while (available())
 	{
-	    if (waitAvailableTimeout(timeLeft))
+	    uint8_t from, to, id, flags;
+	    if (recvfrom(0, 0, &from, &to, &id, &flags)) // Discards the message
 	    {
-		uint8_t from, to, id, flags;
-		if (recvfrom(0, 0, &from, &to, &id, &flags)) // Discards the message
+		// Now have a message: is it our ACK?
+		if (   from == _asyncAddress
+		       && to == _thisAddress
+		       && (flags & RH_FLAGS_ACK)
+		       && (id == _asyncSequenceNumber))
 		{
-		    // Now have a message: is it our ACK?
-		    if (   from == address 
-			   && to == _thisAddress 
-			   && (flags & RH_FLAGS_ACK) 
-			   && (id == thisSequenceNumber))
-		    {
-			// Its the ACK we are waiting for
-			return true;
-		    }
-		    else if (   !(flags & RH_FLAGS_ACK)
-				&& (id == _seenIds[from]))
-		    {
-			// This is a request we have already received. ACK it again
-			acknowledge(id, from);
-		    }
-		    // Else discard it
+		    // Its the ACK we are waiting for
+		    asyncComplete(true);
+		    return false;
 		}
+		else if (   !(flags & RH_FLAGS_ACK)
+			    && (id == _seenIds[from]))
+		{
+		    // This is a request we have already received. ACK it again
+		    acknowledge(id, from);
+		}
+		// Else discard it
 	    }
-	    // Not the one we are waiting for, maybe keep waiting until timeout exhausted
-	    YIELD;
 	}
+	if (millis() - _asyncSendTime < _asyncAckTimeout)
+	    return true; // Keep waiting
+
 	// Timeout exhausted, maybe retry
-	YIELD;
+	if (_asyncTries > _retries)
+	{
+	    // Retries exhausted
+	    asyncComplete(false);
+	    return false;
+	}
+	_retransmissions++;
+	asyncTransmit();
+	return true;
     }
-    // Retries exhausted
     return false;
 }
 
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::sendInProgress()
+{
+    return _asyncState != AsyncIdle;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::lastSendAcked()
+{
+    return _asyncAcked;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::cancelSend()
+{
+    _asyncState = AsyncIdle;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::asyncTransmit()
+{
+    setHeaderId(_asyncSequenceNumber);
+
+    // Set and clear header flags depending on if this is an
+    // initial send or a retry.
+    uint8_t headerFlagsToSet = RH_FLAGS_NONE;
+    // Always clear the ACK flag
+    uint8_t headerFlagsToClear = RH_FLAGS_ACK;
+    if (_asyncTries == 0) {
+	// On an initial send, clear the RETRY flag in case
+	// it was previously set
+	headerFlagsToClear |= RH_FLAGS_RETRY;
+    } else {
+	// Not an initial send, set the RETRY flag
+	headerFlagsToSet = RH_FLAGS_RETRY;
+    }
+    setHeaderFlags(headerFlagsToSet, headerFlagsToClear);
+
+    _asyncTries++;
+    _asyncState = AsyncTx;
+    sendto(_asyncBuf, _asyncLen, _asyncAddress); // Returns once the transmission has started
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::asyncComplete(bool acked)
+{
+    // Go idle before the callback so it can start another send
+    _asyncState = AsyncIdle;
+    _asyncAcked = acked;
+    if (_asyncCallback)
+	_asyncCallback(_asyncSequenceNumber, acked, _asyncContext);
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {  
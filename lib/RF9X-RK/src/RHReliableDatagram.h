@@ -35,6 +35,12 @@
 /// The default number of retries
 #define RH_DEFAULT_RETRIES 3
 
+/// The largest message that can be queued by sendtoAsync(). The message is copied so
+/// the caller's buffer may be reused as soon as sendtoAsync() returns
+#ifndef RH_ASYNC_MAX_MESSAGE_LEN
+#define RH_ASYNC_MAX_MESSAGE_LEN 255
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHReliableDatagram RHReliableDatagram.h <RHReliableDatagram.h>
 /// \brief RHDatagram subclass for sending addressed, acknowledged, retransmitted datagrams.
@@ -134,6 +140,45 @@ public:
     /// \return true if the message was transmitted and an acknowledgement was received.
     bool sendtoWait(uint8_t* buf, uint8_t len, uint8_t address);
 
+    /// Function called by pollSend() when an asynchronous send started by sendtoAsync() completes.
+    /// \param[in] handle The handle returned by sendtoAsync() for this message
+    /// \param[in] acked true if the message was acknowledged (or was a broadcast and has been transmitted),
+    /// false if all retries were exhausted without an acknowledgement
+    /// \param[in] context The context pointer that was passed to sendtoAsync()
+    typedef void (*SendCompleteCallback)(uint8_t handle, bool acked, void* context);
+
+    /// Starts sending the message (with retries) without waiting for the acknowledgement.
+    /// The message is transmitted immediately (waiting only for any earlier transmission to finish), and
+    /// each subsequent call to pollSend() advances it through wait-for-ACK, retransmit and completion.
+    /// Only one asynchronous send can be in progress at a time.
+    /// Any message other than the desired ACK received while it is in progress is discarded, as with sendtoWait().
+    /// \param[in] buf Pointer to the binary message to send. It is copied, so need not remain valid.
+    /// \param[in] len Number of octets to send, at most RH_ASYNC_MAX_MESSAGE_LEN
+    /// \param[in] address The address to send the message to.
+    /// \param[in] callback If not NULL, called from pollSend() when the send completes
+    /// \param[in] context Passed unchanged to callback
+    /// \return A non-zero handle identifying this send (its sequence number), or 0 if the send could not be
+    /// started because another is in progress or the message is too long.
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address, SendCompleteCallback callback = NULL, void* context = NULL);
+
+    /// Advances any asynchronous send started by sendtoAsync(). Never blocks waiting for the radio,
+    /// except to re-acknowledge a duplicate request received while waiting for the ACK.
+    /// Call this frequently (eg from your main loop) while sendInProgress() is true.
+    /// \return true if the send is still in progress, false if it has completed (or none was started)
+    bool pollSend();
+
+    /// Tests whether an asynchronous send is in progress
+    /// \return true if a send started by sendtoAsync() has not yet completed
+    bool sendInProgress();
+
+    /// Returns the outcome of the most recently completed asynchronous send
+    /// \return true if it was acknowledged
+    bool lastSendAcked();
+
+    /// Abandons any asynchronous send in progress without calling its completion callback,
+    /// eg before putting the radio to sleep.
+    void cancelSend();
+
     /// If there is a valid message available for this node, send an acknowledgement to the SRC
     /// address (blocking until this is complete), then copy the message to buf and return true
     /// else return false. 
@@ -192,6 +237,20 @@ protected:
     bool haveNewMessage();
 
 private:
+    /// States of the asynchronous send engine
+    typedef enum
+    {
+	AsyncIdle = 0,  ///< No send in progress
+	AsyncTx,        ///< The message is being transmitted
+	AsyncWaitAck    ///< The message has been transmitted and we are waiting for its ACK
+    } AsyncState;
+
+    /// (Re)transmits the message held by the asynchronous send engine
+    void asyncTransmit();
+
+    /// Finishes the asynchronous send and calls the completion callback
+    void asyncComplete(bool acked);
+
     /// Count of retransmissions we have had to send
     uint32_t _retransmissions;
 
@@ -212,6 +271,39 @@ private:
     /// (this is generally due to lost ACKs, causing the sender to retransmit, even though we have already
     /// received that message)
     uint8_t _seenIds[256];
+
+    /// Current state of the asynchronous send engine
+    AsyncState _asyncState;
+
+    /// Copy of the message being sent asynchronously
+    uint8_t _asyncBuf[RH_ASYNC_MAX_MESSAGE_LEN];
+
+    /// Length of _asyncBuf
+    uint8_t _asyncLen;
+
+    /// Destination of the message being sent asynchronously
+    uint8_t _asyncAddress;
+
+    /// Sequence number (and handle) of the message being sent asynchronously
+    uint8_t _asyncSequenceNumber;
+
+    /// Number of transmissions made so far of the message being sent asynchronously
+    uint8_t _asyncTries;
+
+    /// millis() when the last transmission finished
+    unsigned long _asyncSendTime;
+
+    /// Time to wait for the ACK after the last transmission, milliseconds
+    uint16_t _asyncAckTimeout;
+
+    /// Outcome of the most recently completed asynchronous send
+    bool _asyncAcked;
+
+    /// Called when the asynchronous send completes
+    SendCompleteCallback _asyncCallback;
+
+    /// Passed to _asyncCallback
+    void* _asyncContext;
 };
 
 /// @example rf22_reliable_datagram_client.pde
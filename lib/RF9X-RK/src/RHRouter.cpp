@@ -22,6 +22,7 @@ RHRouter::RHRouter(RHGenericDriver& driver, uint8_t thisAddress)
 {
     _max_hops = RH_DEFAULT_MAX_HOPS;
     _isa_router = true;
+    _forwarded = 0;
     clearRoutingTable();
 }
 
@@ -49,79 +50,78 @@ void RHRouter::setIsaRouter(bool isa_router)
 ////////////////////////////////////////////////////////////////////
 void RHRouter::addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state)
 {
-    uint8_t i;
+    RoutingTableEntry* route = &_routes[dest];
 
-    // First look for an existing entry we can update
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    // A new route may need room making for it
+    if (route->state == Invalid && state != Invalid)
     {
-	if (_routes[i].dest == dest)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
-	}
-    }
-
-    // Look for an invalid entry we can use
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].state == Invalid)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
-	}
+	if (_routeCount >= RH_ROUTING_TABLE_SIZE)
+	    retireOldestRoute();
+	_routeCount++;
     }
+    else if (route->state != Invalid && state == Invalid)
+	_routeCount--;
+
+    route->dest = dest;
+    route->next_hop = next_hop;
+    route->state = state;
+    route->rssi = _driver.lastRssi();
+    route->learned = millis();
+    route->lastUsed = ++_routeClock;
+}
 
-    // Need to make room for a new one
-    retireOldestRoute();
-    // Should be an invalid slot now
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].state == Invalid)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	}
-    }
+////////////////////////////////////////////////////////////////////
+void RHRouter::restoreRouteTo(uint8_t dest, uint8_t next_hop, int16_t rssi, uint32_t ageMillis)
+{
+    addRouteTo(dest, next_hop, Valid);
+    _routes[dest].rssi = rssi;
+    _routes[dest].learned = millis() - ageMillis;
 }
 
 ////////////////////////////////////////////////////////////////////
 RHRouter::RoutingTableEntry* RHRouter::getRouteTo(uint8_t dest)
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-	if (_routes[i].dest == dest && _routes[i].state != Invalid)
-	    return &_routes[i];
-    return NULL;
+    RoutingTableEntry* route = &_routes[dest];
+    if (route->state == Invalid)
+	return NULL;
+    route->lastUsed = ++_routeClock;
+    return route;
+}
+
+////////////////////////////////////////////////////////////////////
+const RHRouter::RoutingTableEntry* RHRouter::peekRouteTo(uint8_t dest)
+{
+    if (_routes[dest].state == Invalid)
+	return NULL;
+    return &_routes[dest];
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::deleteRoute(uint8_t index)
 {
-    // Delete a route by copying following routes on top of it
-    memcpy(&_routes[index], &_routes[index+1], 
-	   sizeof(RoutingTableEntry) * (RH_ROUTING_TABLE_SIZE - index - 1));
-    _routes[RH_ROUTING_TABLE_SIZE - 1].state = Invalid;
+    if (_routes[index].state != Invalid)
+	_routeCount--;
+    _routes[index].state = Invalid;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::printRoutingTable()
 {
 #ifdef RH_HAVE_SERIAL
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    uint16_t i;
+    for (i = 0; i < 256; i++)
     {
+	if (_routes[i].state == Invalid)
+	    continue;
 	Serial.print(i, DEC);
 	Serial.print(" Dest: ");
 	Serial.print(_routes[i].dest, DEC);
 	Serial.print(" Next Hop: ");
 	Serial.print(_routes[i].next_hop, DEC);
 	Serial.print(" State: ");
-	Serial.println(_routes[i].state, DEC);
+	Serial.print(_routes[i].state, DEC);
+	Serial.print(" RSSI: ");
+	Serial.println(_routes[i].rssi, DEC);
     }
 #endif
 }
@@ -129,31 +129,48 @@ void RHRouter::printRoutingTable()
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::deleteRouteTo(uint8_t dest)
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    if (_routes[dest].state == Invalid)
+	return false;
+    deleteRoute(dest);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::retireOldestRoute()
+{
+    // Only called when the table is full, so the linear search here is not on the per-packet path
+    uint16_t i;
+    int16_t oldest = -1;
+    for (i = 0; i < 256; i++)
     {
-	if (_routes[i].dest == dest)
-	{
-	    deleteRoute(i);
-	    return true;
-	}
+	if (_routes[i].state != Invalid
+	    && (oldest < 0 || (int32_t)(_routes[i].lastUsed - _routes[oldest].lastUsed) < 0))
+	    oldest = i;
     }
-    return false;
+    if (oldest >= 0)
+	deleteRoute(oldest);
 }
 
 ////////////////////////////////////////////////////////////////////
-void RHRouter::retireOldestRoute()
+uint16_t RHRouter::routeCount()
 {
-    // We just obliterate the first in the table and clear the last
-    deleteRoute(0);
+    return _routeCount;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::clearRoutingTable()
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    uint16_t i;
+    for (i = 0; i < 256; i++)
+    {
+	_routes[i].dest = i;
 	_routes[i].state = Invalid;
+	_routes[i].rssi = 0;
+	_routes[i].learned = 0;
+	_routes[i].lastUsed = 0;
+    }
+    _routeCount = 0;
+    _routeClock = 0;
 }
 
 
@@ -180,6 +197,38 @@ uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest,
     return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
 }
 
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags, SendCompleteCallback callback, void* context)
+{
+    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+    if (sendInProgress())
+	return RH_ROUTER_ERROR_BUSY;
+
+    // See if we have a route:
+    uint8_t next_hop = RH_BROADCAST_ADDRESS;
+    if (dest != RH_BROADCAST_ADDRESS)
+    {
+	RoutingTableEntry* route = getRouteTo(dest);
+	if (!route)
+	    return RH_ROUTER_ERROR_NO_ROUTE;
+	next_hop = route->next_hop;
+    }
+
+    // Construct a RH RouterMessage message
+    _tmpMessage.header.source = _thisAddress;
+    _tmpMessage.header.dest = dest;
+    _tmpMessage.header.hops = 0;
+    _tmpMessage.header.id = _lastE2ESequenceNumber++;
+    _tmpMessage.header.flags = flags;
+    memcpy(_tmpMessage.data, buf, len);
+
+    if (!RHReliableDatagram::sendtoAsync((uint8_t*)&_tmpMessage, sizeof(RoutedMessageHeader)+len, next_hop, callback, context))
+	return RH_ROUTER_ERROR_BUSY;
+
+    return RH_ROUTER_ERROR_NONE;
+}
+
 ////////////////////////////////////////////////////////////////////
 uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
 {
@@ -268,6 +317,21 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	    ||  _thisAddress == 2
 	    || (_thisAddress == 3 && (_from == 1 || _from == 2))
 
+#elif RH_TEST_NETWORK==6
+	       // This network looks like a park deployment: a gateway 0 with nodes 1-4
+	       // in direct range and nodes 5-8 only reachable through the node in front of them.
+	       // An unconfigured node (254) sits next to the gateway so join requests work.
+	       //                        0----254
+	       //                     ---------
+	       //                     |  | |  |
+	       //                     1  2 3  4
+	       //                     |  | |  |
+	       //                     5  6 7  8
+	       (_thisAddress == 0 && ((_from >= 1 && _from <= 4) || _from == 254))
+	    || (_thisAddress >= 1 && _thisAddress <= 4 && (_from == 0 || _from == _thisAddress + 4))
+	    || (_thisAddress >= 5 && _thisAddress <= 8 && _from == _thisAddress - 4)
+	    || (_thisAddress == 254 && _from == 0)
+
 #endif
 	    )
 	{
@@ -304,7 +368,10 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	    
 	    // If we are forwarding packets, do so. Otherwise, drop.
 	    if (_isa_router)
+	    {
 	        route(&_tmpMessage, tmpMessageLen);
+		_forwarded++;
+	    }
 	}
 	// Discard it and maybe wait for another
     }
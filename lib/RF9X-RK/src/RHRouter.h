@@ -12,8 +12,12 @@
 // Default max number of hops we will route
 #define RH_DEFAULT_MAX_HOPS 30
 
-// The default size of the routing table we keep
+// The default maximum number of valid routes we keep. The table itself is indexed directly by
+// destination address, so this only limits how many routes are remembered before the least
+// recently used one is retired
+#ifndef RH_ROUTING_TABLE_SIZE
 #define RH_ROUTING_TABLE_SIZE 50
+#endif
 
 // Error codes
 #define RH_ROUTER_ERROR_NONE              0
@@ -22,6 +26,7 @@
 #define RH_ROUTER_ERROR_TIMEOUT           3
 #define RH_ROUTER_ERROR_NO_REPLY          4
 #define RH_ROUTER_ERROR_UNABLE_TO_DELIVER 5
+#define RH_ROUTER_ERROR_BUSY              6
 
 // This size of RH_ROUTER_MAX_MESSAGE_LEN is OK for Arduino Mega, but too big for
 // Duemilanove. Size of 50 works with the sample router programs on Duemilanove.
@@ -34,6 +39,8 @@
 //#define RH_TEST_NETWORK 2
 //#define RH_TEST_NETWORK 3
 //#define RH_TEST_NETWORK 4
+//#define RH_TEST_NETWORK 5
+//#define RH_TEST_NETWORK 6
 
 /////////////////////////////////////////////////////////////////////
 /// \class RHRouter RHRouter.h <RHRouter.h>
@@ -166,6 +173,9 @@ public:
 	uint8_t      dest;      ///< Destination node address
 	uint8_t      next_hop;  ///< Send via this next hop address
 	uint8_t      state;     ///< State of this route, one of RouteState
+	int16_t      rssi;      ///< RSSI in dBm of the most recent frame received when this route was added or updated
+	uint32_t     learned;   ///< millis() when this route was added or last updated
+	uint32_t     lastUsed;  ///< Value of the route clock when this route was last added, updated or looked up
     } RoutingTableEntry;
 
     /// Constructor. 
@@ -186,6 +196,10 @@ public:
     /// \param[in] isa_router true or false
     void setIsaRouter(bool isa_router);
 
+    /// Returns the number of messages this node has passed on towards another node since it started
+    /// \return The count, wrapping at 65535
+    uint16_t forwarded() { return _forwarded; };
+
     /// Sets the max_hops to the given value
     /// This controls the maximum number of hops allowed between source and destination nodes
     /// Messages that are not delivered by the time their HOPS field exceeds max_hops on a 
@@ -194,26 +208,46 @@ public:
     void setMaxHops(uint8_t max_hops);
 
     /// Adds a route to the local routing table, or updates it if already present.
-    /// If there is not enough room the oldest (first) route will be deleted by calling retireOldestRoute().
+    /// If RH_ROUTING_TABLE_SIZE routes are already known, the least recently used route
+    /// will be deleted by calling retireOldestRoute(). Constant time unless a route has to be retired.
     /// \param [in] dest The destination node address. RH_BROADCAST_ADDRESS is permitted.
     /// \param [in] next_hop The address of the next hop to send messages destined for dest
     /// \param [in] state The satte of the route. Defaults to Valid
     void addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state = Valid);
 
-    /// Finds and returns a RoutingTableEntry for the given destination node
+    /// Finds and returns a RoutingTableEntry for the given destination node, and marks it as recently used.
+    /// Constant time.
     /// \param [in] dest The desired destination node address.
-    /// \return pointer to a RoutingTableEntry for dest
+    /// \return pointer to a RoutingTableEntry for dest, or NULL if there is no valid route
     RoutingTableEntry* getRouteTo(uint8_t dest);
 
+    /// Finds and returns a RoutingTableEntry for the given destination node without marking it as
+    /// recently used, eg for saving or printing the routing table. Constant time.
+    /// \param [in] dest The desired destination node address.
+    /// \return pointer to a RoutingTableEntry for dest, or NULL if there is no valid route
+    const RoutingTableEntry* peekRouteTo(uint8_t dest);
+
+    /// Adds a previously saved Valid route to the local routing table, eg after a reset, keeping the
+    /// link quality and age it had when it was saved rather than those of the last frame received.
+    /// \param [in] dest The destination node address
+    /// \param [in] next_hop The address of the next hop to send messages destined for dest
+    /// \param [in] rssi The RSSI recorded for the route when it was saved
+    /// \param [in] ageMillis How long ago the route was learned, in milliseconds
+    void restoreRouteTo(uint8_t dest, uint8_t next_hop, int16_t rssi, uint32_t ageMillis);
+
     /// Deletes from the local routing table any route for the destination node.
     /// \param [in] dest The destination node address
     /// \return true if the route was present
     bool deleteRouteTo(uint8_t dest);
 
-    /// Deletes the oldest (first) route from the 
+    /// Deletes the least recently used route from the 
     /// local routing table
     void retireOldestRoute();
 
+    /// Returns the number of valid routes in the local routing table
+    /// \return The number of routes, at most RH_ROUTING_TABLE_SIZE
+    uint16_t routeCount();
+
     /// Clears all entries from the 
     /// local routing table
     void clearRoutingTable();
@@ -256,6 +290,24 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
 
+    /// Starts sending a message to the destination node without waiting for the next hop to acknowledge it.
+    /// Like sendtoWait(), but the send is advanced by RHReliableDatagram::pollSend(), which must be called
+    /// frequently (eg from your main loop) until it returns false. 
+    /// \param [in] buf The application message data. It is copied, so need not remain valid.
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
+    /// \param [in] callback If not NULL, called from pollSend() when the next hop has acknowledged
+    ///             the message (acked is true) or all retries are exhausted (acked is false)
+    /// \param [in] context Passed unchanged to callback
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE The send has started, the callback will report the outcome
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH The message is too long
+    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest in the local routing table
+    ///         - RH_ROUTER_ERROR_BUSY Another asynchronous send is still in progress
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, SendCompleteCallback callback = NULL, void* context = NULL);
+
     /// Starts the receiver if it is not running already.
     /// If there is a valid message available for this node (or RH_BROADCAST_ADDRESS), 
     /// send an acknowledgement to the last hop
@@ -311,7 +363,7 @@ protected:
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
     /// Deletes a specific rout entry from therouting table
-    /// \param [in] index The 0 based index of the routing table entry to delete
+    /// \param [in] index The index of the routing table entry to delete, which is its destination address
     void deleteRoute(uint8_t index);
 
     /// The last end-to-end sequence number to be used
@@ -325,13 +377,22 @@ protected:
     /// Flag to set if packets are forwarded or not
     bool _isa_router;
 
+    /// Messages passed on towards another node
+    uint16_t _forwarded;
+
 private:
 
     /// Temporary mesage buffer
     static RoutedMessage _tmpMessage;
 
-    /// Local routing table
-    RoutingTableEntry    _routes[RH_ROUTING_TABLE_SIZE];
+    /// Local routing table, indexed by destination address
+    RoutingTableEntry    _routes[256];
+
+    /// Number of valid routes in _routes
+    uint16_t             _routeCount;
+
+    /// Incremented each time a route is used, to give the age order of the routes
+    uint32_t             _routeClock;
 };
 
 /// @example rf22_router_client.pde
@@ -29,10 +29,20 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
     
 };
 
+#if (RH_RF95_RX_QUEUE_LEN & (RH_RF95_RX_QUEUE_LEN - 1)) || RH_RF95_RX_QUEUE_LEN > 128
+ #error RH_RF95_RX_QUEUE_LEN must be a power of 2 no larger than 128
+#endif
+
+// Stops the compiler moving slot accesses across the head/tail updates of the receive queue.
+// The queue has one writer per index so no atomic read-modify-write is needed
+#define RH_RF95_RX_QUEUE_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+    _rxHead(0),
+    _rxTail(0),
+    _rxDropped(0)
 {
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
@@ -185,7 +195,7 @@ void RH_RF95::handleInterrupt()
     {
 //	Serial.println("E");
 	_rxBad++;
-        clearRxBuf();
+	// Frames already in the receive queue are good, so leave them there
     }
     // It is possible to get RX_DONE and CRC_ERROR and VALID_HEADER all at once
     // so this must be an else
@@ -194,35 +204,61 @@ void RH_RF95::handleInterrupt()
 	// Packet received, no CRC error
 //	Serial.println("R");
 	// Have received a packet
+	uint32_t rxDoneMs = millis(); // Before the FIFO is read, so the time is as close to the end of the frame as we can get
 	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
 
 	// Reset the fifo read ptr to the beginning of the packet
 	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-	spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-	_bufLen = len;
-
-	// Remember the last signal to noise ratio, LORA mode
-	// Per page 111, SX1276/77/78/79 datasheet
-	_lastSNR = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
-
-	// Remember the RSSI of this packet, LORA mode
-	// this is according to the doc, but is it really correct?
-	// weakest receiveable signals are reported RSSI at about -66
-	_lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
-	// Adjust the RSSI, datasheet page 87
-	if (_lastSNR < 0)
-	    _lastRssi = _lastRssi + _lastSNR;
-	else
-	    _lastRssi = (int)_lastRssi * 16 / 15;
-	if (_usingHFport)
-	    _lastRssi -= 157;
+
+	// The frame goes straight into the next free slot of the receive queue. If recv() has
+	// not kept up there is nowhere to put it, so it is left in the radio FIFO - and counted
+	// as dropped only if its header says it was for us
+	uint8_t head = _rxHead;
+	if ((uint8_t)(head - _rxTail) >= RH_RF95_RX_QUEUE_LEN)
+	{
+	    uint8_t header[RH_RF95_HEADER_LEN];
+	    if (len >= RH_RF95_HEADER_LEN)
+	    {
+		spiBurstRead(RH_RF95_REG_00_FIFO, header, sizeof(header));
+		if (isForThisNode(header, len))
+		    _rxDropped++;
+	    }
+	}
 	else
-	    _lastRssi -= 164;
-	    
-	// We have received a message.
-	validateRxBuf(); 
-	if (_rxBufValid)
-	    setModeIdle(); // Got one 
+	{
+	    RxSlot* slot = &_rxQueue[head & (RH_RF95_RX_QUEUE_LEN - 1)];
+
+	    spiBurstRead(RH_RF95_REG_00_FIFO, slot->buf, len);
+	    slot->len = len;
+
+	    // Remember the signal to noise ratio of this packet, LORA mode
+	    // Per page 111, SX1276/77/78/79 datasheet
+	    slot->snr = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
+	    slot->rxDoneMs = rxDoneMs;
+
+	    // Remember the RSSI of this packet, LORA mode
+	    // this is according to the doc, but is it really correct?
+	    // weakest receiveable signals are reported RSSI at about -66
+	    int16_t rssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
+	    // Adjust the RSSI, datasheet page 87
+	    if (slot->snr < 0)
+		rssi = rssi + slot->snr;
+	    else
+		rssi = (int)rssi * 16 / 15;
+	    if (_usingHFport)
+		rssi -= 157;
+	    else
+		rssi -= 164;
+	    slot->rssi = rssi;
+
+	    // We have received a message. Publish it only if it is for us; the radio stays
+	    // in continuous receive so a frame arriving before recv() is called is not lost
+	    if (validateRxBuf(slot->buf, len))
+	    {
+		RH_RF95_RX_QUEUE_BARRIER();
+		_rxHead = head + 1;
+	    }
+	}
     }
     else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
     {
@@ -240,6 +276,14 @@ void RH_RF95::handleInterrupt()
     {
 //	Serial.println("?");
     }
+
+    // A single receive window ends with its frame or its timeout, and the radio has gone to standby
+    if (_rxSingle && (irq_flags & (RH_RF95_RX_DONE | RH_RF95_RX_TIMEOUT)))
+    {
+	accountModeTime();
+	_mode = RHModeIdle;
+	_rxSingle = false;
+    }
 	
     // Sigh: on some processors, for some unknown reason, doing this only once does not actually
     // clear the radio's interrupt flag. So we do it twice. Why?
@@ -267,23 +311,24 @@ void RH_INTERRUPT_ATTR RH_RF95::isr2()
 	_deviceForInterrupt[2]->handleInterrupt();
 }
 
-// Check whether the latest received message is complete and uncorrupted
-void RH_RF95::validateRxBuf()
+// Check whether a received message is complete and addressed to us
+bool RH_RF95::isForThisNode(const uint8_t* buf, uint8_t len)
 {
-    if (_bufLen < 4)
-	return; // Too short to be a real message
-    // Extract the 4 headers
-    _rxHeaderTo    = _buf[0];
-    _rxHeaderFrom  = _buf[1];
-    _rxHeaderId    = _buf[2];
-    _rxHeaderFlags = _buf[3];
-    if (_promiscuous ||
-	_rxHeaderTo == _thisAddress ||
-	_rxHeaderTo == RH_BROADCAST_ADDRESS)
+    if (len < RH_RF95_HEADER_LEN)
+	return false; // Too short to be a real message
+    return _promiscuous ||
+	buf[0] == _thisAddress ||
+	buf[0] == RH_BROADCAST_ADDRESS;
+}
+
+bool RH_RF95::validateRxBuf(const uint8_t* buf, uint8_t len)
+{
+    if (isForThisNode(buf, len))
     {
 	_rxGood++;
-	_rxBufValid = true;
+	return true;
     }
+    return false;
 }
 
 bool RH_RF95::available()
@@ -294,16 +339,31 @@ bool RH_RF95::available()
     	RH_MUTEX_UNLOCK(lock);
 	return false;
     }
-    setModeRx();
+    if (!_receiveOnDemand)
+	setModeRx();
     RH_MUTEX_UNLOCK(lock);
-    return _rxBufValid; // Will be set by the interrupt handler when a good message is received
+    return _rxHead != _rxTail; // Advanced by the interrupt handler when a good message is received
 }
 
 void RH_RF95::clearRxBuf()
+{
+    _rxTail = _rxHead;
+}
+
+uint8_t RH_RF95::rxQueued()
+{
+    return (uint8_t)(_rxHead - _rxTail);
+}
+
+uint16_t RH_RF95::rxDropped()
+{
+    return _rxDropped;
+}
+
+void RH_RF95::resetRxDropped()
 {
     ATOMIC_BLOCK_START;
-    _rxBufValid = false;
-    _bufLen = 0;
+    _rxDropped = 0;
     ATOMIC_BLOCK_END;
 }
 
@@ -312,16 +372,29 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     if (!available())
 	return false;
     RH_MUTEX_LOCK(lock); // Multithread support
+    // The interrupt handler never writes the oldest slot while it is queued, so no
+    // interrupt lockout is needed to read it
+    uint8_t tail = _rxTail;
+    RH_RF95_RX_QUEUE_BARRIER();
+    const RxSlot* slot = &_rxQueue[tail & (RH_RF95_RX_QUEUE_LEN - 1)];
+    // Extract the 4 headers and link quality of this message for headerFrom(), lastRssi() etc
+    _rxHeaderTo    = slot->buf[0];
+    _rxHeaderFrom  = slot->buf[1];
+    _rxHeaderId    = slot->buf[2];
+    _rxHeaderFlags = slot->buf[3];
+    _lastRssi      = slot->rssi;
+    _lastSNR       = slot->snr;
+    _lastRxDoneMs  = slot->rxDoneMs;
+    _lastRxLen     = slot->len;
     if (buf && len)
     {
-	ATOMIC_BLOCK_START;
-	// Skip the 4 headers that are at the beginning of the rxBuf
-	if (*len > _bufLen-RH_RF95_HEADER_LEN)
-	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
-	ATOMIC_BLOCK_END;
+	// Skip the 4 headers that are at the beginning of the slot
+	if (*len > slot->len-RH_RF95_HEADER_LEN)
+	    *len = slot->len-RH_RF95_HEADER_LEN;
+	memcpy(buf, slot->buf+RH_RF95_HEADER_LEN, *len);
     }
-    clearRxBuf(); // This message accepted and cleared
+    RH_RF95_RX_QUEUE_BARRIER();
+    _rxTail = tail + 1; // This message accepted and its slot released
     RH_MUTEX_UNLOCK(lock);
     return true;
 }
@@ -394,8 +467,10 @@ void RH_RF95::setModeIdle()
     if (_mode != RHModeIdle)
     {
 	modeWillChange(RHModeIdle);
+	accountModeTime();
 	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
 	_mode = RHModeIdle;
+	_rxSingle = false;
     }
 }
 
@@ -404,32 +479,86 @@ bool RH_RF95::sleep()
     if (_mode != RHModeSleep)
     {
 	modeWillChange(RHModeSleep);
+	accountModeTime();
 	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP);
 	_mode = RHModeSleep;
+	_rxSingle = false;
     }
     return true;
 }
 
 void RH_RF95::setModeRx()
 {
-    if (_mode != RHModeRx)
+    if (_mode != RHModeRx || _rxSingle)
     {
 	modeWillChange(RHModeRx);
+	accountModeTime();
 	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS);
 	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
 	_mode = RHModeRx;
+	_rxSingle = false;
     }
 }
 
 void RH_RF95::setModeTx()
 {
+    _receiveOnDemand = false;
     if (_mode != RHModeTx)
     {
 	modeWillChange(RHModeTx);
+	accountModeTime();
 	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_TX);
 	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x40); // Interrupt on TxDone
 	_mode = RHModeTx;
+	_rxSingle = false;
+    }
+}
+
+void RH_RF95::setModeRxSingle(uint16_t symbols)
+{
+    if (symbols < 4)
+	symbols = 4;
+    if (symbols > RH_RF95_MAX_SYMB_TIMEOUT)
+	symbols = RH_RF95_MAX_SYMB_TIMEOUT;
+
+    setModeIdle(); // The window is set up in standby
+    uint8_t reg_1e = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2);
+    spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, (reg_1e & ~RH_RF95_SYM_TIMEOUT_MSB) | (symbols >> 8));
+    spiWrite(RH_RF95_REG_1F_SYMB_TIMEOUT_LSB, symbols & 0xff);
+    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // So an old timeout does not close the window at once
+
+    modeWillChange(RHModeRx);
+    accountModeTime();
+    spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXSINGLE);
+    spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
+    _mode = RHModeRx;
+    _rxSingle = true;
+}
+
+bool RH_RF95::receiveWindowOpen()
+{
+    if (!_rxSingle)
+	return false;
+
+    uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
+    if (irq_flags & RH_RF95_RX_DONE)
+    {
+	handleInterrupt(); // The processor slept through the interrupt
+    }
+    else if (irq_flags & RH_RF95_RX_TIMEOUT)
+    {
+	// The timeout is on DIO1, which is not connected, so it is only seen here
+	ATOMIC_BLOCK_START;
+	spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff);
+	if (_rxSingle)
+	{
+	    accountModeTime();
+	    _mode = RHModeIdle;
+	    _rxSingle = false;
+	}
+	ATOMIC_BLOCK_END;
     }
+    return _rxSingle;
 }
 
 void RH_RF95::setTxPower(int8_t power, bool useRFO)
@@ -510,6 +639,7 @@ bool RH_RF95::isChannelActive()
     if (_mode != RHModeCad)
     {
 	modeWillChange(RHModeCad);
+	accountModeTime();
         spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_CAD);
         spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x80); // Interrupt on CadDone
         _mode = RHModeCad;
@@ -708,3 +838,50 @@ uint8_t RH_RF95::getDeviceVersion()
 	return _deviceVersion;
 }
 
+uint32_t RH_RF95::symbolTimeUs()
+{
+    uint8_t BW = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
+    int SF = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;
+    if (BW > 9)
+	return 0;
+
+    uint32_t bw_tab[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+    return (uint32_t)((1000000ULL << SF) / bw_tab[BW]);
+}
+
+uint32_t RH_RF95::lastRxTimeOnAir()
+{
+    return timeOnAir(_lastRxLen > RH_RF95_HEADER_LEN ? _lastRxLen - RH_RF95_HEADER_LEN : 0);
+}
+
+uint32_t RH_RF95::timeOnAir(uint8_t len)
+{
+    uint8_t reg_1d = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1);
+    uint8_t reg_1e = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2);
+    uint8_t reg_26 = spiRead(RH_RF95_REG_26_MODEM_CONFIG3);
+    uint16_t preamble = (spiRead(RH_RF95_REG_20_PREAMBLE_MSB) << 8) | spiRead(RH_RF95_REG_21_PREAMBLE_LSB);
+
+    uint8_t BW = reg_1d >> 4;					// bw is in bits 7..4
+    if (BW > 9)
+	return 0;
+    int SF = reg_1e >> 4;					// sf is in bits 7..4
+    int CR = (reg_1d & RH_RF95_CODING_RATE) >> 1;		// 1 to 4 for 4/5 to 4/8
+    int IH = (reg_1d & RH_RF95_IMPLICIT_HEADER_MODE_ON) ? 1 : 0;
+    int CRC = (reg_1e & RH_RF95_PAYLOAD_CRC_ON) ? 1 : 0;
+    int DE = (reg_26 & RH_RF95_LOW_DATA_RATE_OPTIMIZE) ? 1 : 0;
+    int PL = len + RH_RF95_HEADER_LEN;
+
+    float bw_tab[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+    float symbolTime = 1000.0 * (1 << SF) / bw_tab[BW];	// ms
+
+    // Number of payload symbols, including the header
+    int numerator = 8 * PL - 4 * SF + 28 + 16 * CRC - 20 * IH;
+    int denominator = 4 * (SF - 2 * DE);
+    int payloadSymbols = 8;
+    if (numerator > 0 && denominator > 0)
+	payloadSymbols += ((numerator + denominator - 1) / denominator) * (CR + 4);
+
+    float ms = (preamble + 4.25) * symbolTime + payloadSymbols * symbolTime;
+    return (uint32_t)ms + 1;
+}
+
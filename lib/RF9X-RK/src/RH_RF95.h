@@ -36,6 +36,16 @@
  #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
 #endif
 
+// Number of received frames that can be held between the interrupt handler and recv().
+// Frames arriving while the queue is full are dropped and counted in rxDropped().
+// Must be a power of 2 (each slot costs about RH_RF95_MAX_PAYLOAD_LEN bytes of SRAM).
+#ifndef RH_RF95_RX_QUEUE_LEN
+ #define RH_RF95_RX_QUEUE_LEN 4
+#endif
+
+// Longest receive window setModeRxSingle() can open, in symbols - the symbol timeout register is 10 bits
+#define RH_RF95_MAX_SYMB_TIMEOUT 1023
+
 // The crystal oscillator frequency of the module
 #define RH_RF95_FXOSC 32000000.0
 
@@ -660,6 +670,7 @@ public:
     /// Tests whether a new message is available from the Driver. 
     /// On most drivers, this will also put the Driver into RHModeRx mode until
     /// a message is actually received by the transport, when it will be returned to RHModeIdle.
+    /// While receiving on demand (see setReceiveOnDemand()) the mode is left alone.
     /// This can be called multiple times in a timeout loop
     /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
     virtual bool    available();
@@ -717,8 +728,33 @@ public:
 
     /// If current mode is Rx or Idle, changes it to Rx. F
     /// Starts the transmitter in the RF95/96/97/98.
+    /// Ends receiving on demand, as whatever is sent is likely to be answered.
     void           setModeTx();
 
+    /// Opens a single receive window that the radio closes itself if no preamble is heard within the
+    /// given number of symbols. A preamble heard in time is received to the end of its frame, which goes
+    /// into the receive queue as usual. Either way the radio then goes to standby, so the processor can
+    /// sleep through the window and wake on the RxDone interrupt or when the window is due to end.
+    /// Only RxDone is on DIO0, so call receiveWindowOpen() after waking to find out whether it timed out.
+    /// Use with setReceiveOnDemand(true), or the next available() turns the receiver on for good.
+    /// \param[in] symbols Window length in symbols, 4 to RH_RF95_MAX_SYMB_TIMEOUT. See symbolTimeUs()
+    void           setModeRxSingle(uint16_t symbols);
+
+    /// Tests whether the window opened by setModeRxSingle() is still open, closing it if the radio
+    /// has timed out and handling an RxDone the processor slept through.
+    /// \return true while the radio is listening for, or receiving, a frame in the window
+    bool           receiveWindowOpen();
+
+    /// When on, available() and recv() no longer turn the receiver on - the application opens receive
+    /// windows with setModeRxSingle() or setModeRx() itself and can leave the radio asleep in between.
+    /// Sending turns it off again, so acknowledgements are heard. Off by default.
+    /// \param[in] on true to receive on demand
+    void           setReceiveOnDemand(bool on) { _receiveOnDemand = on; };
+
+    /// Returns the length of a symbol with the current spreading factor and bandwidth
+    /// \return Symbol time in microseconds. 0 if the bandwidth setting is invalid
+    uint32_t       symbolTimeUs();
+
     /// Sets the transmitter power output level, and configures the transmitter pin.
     /// Be a good neighbour and set the lowest power level you need.
     /// Some SX1276/77/78/79 and compatible modules (such as RFM95/96/97/98) 
@@ -786,6 +822,16 @@ public:
     /// \return SNR of the last received message in dB
     int lastSNR();
 
+    /// Returns when the last received message finished arriving - the moment the sender's transmission
+    /// ended, less the interrupt latency. Use it with lastRxTimeOnAir() to timestamp the message.
+    /// \return millis() when the RxDone interrupt for the last message returned by recv() was handled
+    uint32_t lastRxDoneMs() { return _lastRxDoneMs; };
+
+    /// Calculates how long the last received message was on the air, with the current modem settings,
+    /// so call it before changing them
+    /// \return The time on air in milliseconds, rounded up
+    uint32_t lastRxTimeOnAir();
+
     /// brian.n.norman@gmail.com 9th Nov 2018
     /// Sets the radio spreading factor.
     /// valid values are 6 through 12.
@@ -848,6 +894,25 @@ public:
     /// \param none
     /// \return uint8_t deviceID
     uint8_t getDeviceVersion();
+
+    /// Calculates how long a message will take to transmit with the current modem settings
+    /// (spreading factor, bandwidth, coding rate, preamble length, header mode, CRC and
+    /// low data rate optimisation), per the Semtech SX1276/77/78/79 datasheet section 4.1.1.7.
+    /// \param[in] len Length of the message in octets, not including the 4 RadioHead headers
+    /// \return The time on air in milliseconds, rounded up. 0 if the bandwidth setting is invalid
+    uint32_t timeOnAir(uint8_t len);
+
+    /// Returns the number of received frames waiting in the receive queue to be collected by recv()
+    /// \return Number of queued frames, 0 to RH_RF95_RX_QUEUE_LEN
+    uint8_t rxQueued();
+
+    /// Returns the count of good frames for this node that were dropped because the receive queue was full
+    /// when they arrived (the application did not call recv() often enough).
+    /// \return The number of dropped frames since initialisation or the last resetRxDropped()
+    uint16_t rxDropped();
+
+    /// Resets the count of dropped frames to 0
+    void resetRxDropped();
     
 protected:
     /// This is a low level function to handle the interrupts for one instance of RH_RF95.
@@ -855,10 +920,20 @@ protected:
     /// Should not need to be called by user code.
     void           handleInterrupt();
 
-    /// Examine the revceive buffer to determine whether the message is for this node
-    void validateRxBuf();
+    /// Examine the headers of a received frame to determine whether it is addressed to this node.
+    /// Unlike validateRxBuf() it does not count the frame as received
+    /// \param[in] buf The frame, or at least its 4 RadioHead headers
+    /// \param[in] len Length of the whole frame in octets
+    /// \return true if the frame is addressed to this node (or we are promiscuous)
+    bool isForThisNode(const uint8_t* buf, uint8_t len);
+
+    /// Examine a received frame to determine whether the message is for this node
+    /// \param[in] buf The frame, including the 4 RadioHead headers
+    /// \param[in] len Length of the frame in octets
+    /// \return true if the frame is addressed to this node (or we are promiscuous)
+    bool validateRxBuf(const uint8_t* buf, uint8_t len);
 
-    /// Clear our local receive buffer
+    /// Discard all frames in the receive queue
     void clearRxBuf();
 
     /// Called by RH_RF95 when the radio mode is about to change to a new setting.
@@ -894,14 +969,27 @@ private:
     /// else 0xff
     uint8_t             _myInterruptIndex;
 
-    /// Number of octets in the buffer
-    volatile uint8_t    _bufLen;
-    
-    /// The receiver/transmitter buffer
-    uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN];
+    /// One received frame, with the link quality it arrived with
+    typedef struct
+    {
+	uint8_t         len;                          ///< Number of octets in buf, including headers
+	int16_t         rssi;                         ///< RSSI of this frame in dBm
+	int8_t          snr;                          ///< SNR of this frame in dB
+	uint32_t        rxDoneMs;                     ///< millis() when RxDone was handled
+	uint8_t         buf[RH_RF95_MAX_PAYLOAD_LEN]; ///< The frame, starting with the 4 headers
+    } RxSlot;
+
+    /// Single producer (handleInterrupt) / single consumer (recv) queue of received frames
+    RxSlot              _rxQueue[RH_RF95_RX_QUEUE_LEN];
+
+    /// Free running count of frames added to _rxQueue. Only written by the interrupt handler
+    volatile uint8_t    _rxHead;
 
-    /// True when there is a valid message in the buffer
-    volatile bool       _rxBufValid;
+    /// Free running count of frames removed from _rxQueue. Only written by recv() and clearRxBuf()
+    volatile uint8_t    _rxTail;
+
+    /// Good frames dropped because _rxQueue was full
+    volatile uint16_t   _rxDropped;
 
     /// True if we are using the HF port (779.0 MHz and above)
     bool                _usingHFport;
@@ -909,11 +997,23 @@ private:
     /// Last measured SNR, dB
     int8_t              _lastSNR;
 
+    /// millis() when the last message returned by recv() finished arriving
+    uint32_t            _lastRxDoneMs = 0;
+
+    /// Length of the last message returned by recv(), including the headers
+    uint8_t             _lastRxLen = 0;
+
     /// If true, sends CRCs in every packet and requires a valid CRC in every received packet
     bool                _enableCRC;
 
     /// device ID
     uint8_t		_deviceVersion = 0x00;
+
+    /// True while a window opened by setModeRxSingle() is open
+    volatile bool       _rxSingle = false;
+
+    /// If true, available() does not turn the receiver on
+    bool                _receiveOnDemand = false;
     
 };
 
@@ -0,0 +1,122 @@
+// Measures the FRAM bytes written and CPU time for a counter update like the one made for each count:
+// three set calls, then a save. Requires the MB85RC256V-FRAM-RK library and an MB85RC64 on I2C.
+#include "MB85RC256V-FRAM-RK.h"
+#include "StorageHelperRK.h"
+
+
+SerialLogHandler logHandler(LOG_LEVEL_INFO);
+
+
+SYSTEM_THREAD(ENABLED);
+SYSTEM_MODE(SEMI_AUTOMATIC);
+
+
+// Counts what is written so we can see the I2C traffic for each save
+class CountingFRAM : public MB85RC64 {
+public:
+	CountingFRAM(TwoWire &wire, int addr = 0) : MB85RC64(wire, addr) {};
+
+	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
+		bytesWritten += dataLen;
+		writes++;
+		return MB85RC64::writeData(framAddr, data, dataLen);
+	}
+
+	size_t bytesWritten = 0;
+	size_t writes = 0;
+};
+
+CountingFRAM fram(Wire, 0);
+
+
+class MyPersistentData : public StorageHelperRK::PersistentDataFRAM {
+public:
+	class MyData {
+	public:
+		// This structure must always begin with the header (16 bytes)
+		StorageHelperRK::PersistentDataBase::SavedDataHeader header;
+		// Your fields go here. Once you've added a field you cannot add fields
+		// (except at the end), insert fields, remove fields, change size of a field.
+		// Doing so will cause the data to be corrupted!
+		time_t lastCountTime;
+		uint16_t hourlyCount;
+		uint16_t dailyCount;
+		uint8_t other[64];			// Stands in for the rest of a typical structure
+	};
+
+	static const uint32_t DATA_MAGIC = 0x20a99e75;
+	static const uint16_t DATA_VERSION = 1;
+
+	MyPersistentData() : PersistentDataFRAM(::fram, 0, &myData.header, sizeof(MyData), DATA_MAGIC, DATA_VERSION) {};
+
+	void set_lastCountTime(time_t value) {
+		setValue<time_t>(offsetof(MyData, lastCountTime), value);
+	}
+
+	uint16_t get_hourlyCount() const {
+		return getValue<uint16_t>(offsetof(MyData, hourlyCount));
+	}
+
+	void set_hourlyCount(uint16_t value) {
+		setValue<uint16_t>(offsetof(MyData, hourlyCount), value);
+	}
+
+	uint16_t get_dailyCount() const {
+		return getValue<uint16_t>(offsetof(MyData, dailyCount));
+	}
+
+	void set_dailyCount(uint16_t value) {
+		setValue<uint16_t>(offsetof(MyData, dailyCount), value);
+	}
+
+	MyData myData;
+};
+
+
+MyPersistentData persistentData;
+
+const int ITERATIONS = 100;
+
+
+void measure(const char *name, bool batched) {
+	size_t bytesBefore = fram.bytesWritten;
+	size_t writesBefore = fram.writes;
+	uint32_t updateTicks = 0;
+	uint32_t saveTicks = 0;
+
+	for(int ii = 0; ii < ITERATIONS; ii++) {
+		uint32_t start = System.ticks();
+		if (batched) persistentData.beginUpdate();
+		persistentData.set_lastCountTime(Time.now() + ii);
+		persistentData.set_hourlyCount(persistentData.get_hourlyCount() + 1);
+		persistentData.set_dailyCount(persistentData.get_dailyCount() + 1);
+		if (batched) persistentData.commit();
+		else persistentData.updateHash();	// Whole structure changed - how every save worked before dirty spans
+		uint32_t updated = System.ticks();
+		persistentData.flush(true);
+		saveTicks += System.ticks() - updated;
+		updateTicks += updated - start;
+	}
+
+	Log.info("%s: %u cycles to update, %u cycles to save, %u bytes in %u writes per count", name,
+		(unsigned)(updateTicks / ITERATIONS), (unsigned)(saveTicks / ITERATIONS),
+		(unsigned)((fram.bytesWritten - bytesBefore) / ITERATIONS), (unsigned)((fram.writes - writesBefore) / ITERATIONS));
+}
+
+void setup() {
+	waitFor(Serial.isConnected, 10000);
+
+	fram.begin();
+	persistentData
+		.withSaveDelayMs(1000)
+		.load();
+
+	Log.info("structure is %u bytes, %lu cycles per microsecond", (unsigned)sizeof(MyPersistentData::MyData), System.ticksPerMicrosecond());
+
+	persistentData.flush(true);
+	measure("before - a hash per set, whole structure saved", false);
+	measure("after - beginUpdate() / commit(), changed bytes saved", true);
+}
+
+void loop() {
+}
@@ -67,7 +67,8 @@ bool StorageHelperRK::PersistentDataBase::setValueString(size_t offset, size_t s
             if (strcmp(value, p) != 0) {
                 memset(p, 0, size);
                 strcpy(p, value);
-                updateHash();
+                markDirty(offset, size);
+                hashChanged();
             }
             result = true;
         }
@@ -97,15 +98,101 @@ uint32_t StorageHelperRK::PersistentDataBase::getHash() const {
 }
 
 void StorageHelperRK::PersistentDataBase::updateHash() {
+    WITH_LOCK(*this) {
+        markDirty(0, savedDataSize);
+        hashChanged();
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::hashChanged() {
+    if (updateDepth > 0) {
+        hashPending = true;
+        return;
+    }
     savedDataHeader->hash = getHash();
+    markDirty(offsetof(SavedDataHeader, hash), sizeof(SavedDataHeader::hash));
     saveOrDefer();
 }
 
+void StorageHelperRK::PersistentDataBase::beginUpdate() {
+    lock();
+    updateDepth++;
+}
+
+void StorageHelperRK::PersistentDataBase::commit() {
+    if (updateDepth == 0) {
+        return;                             // No beginUpdate() to match
+    }
+    if (--updateDepth == 0 && hashPending) {
+        hashPending = false;
+        hashChanged();
+    }
+    unlock();
+}
+
+void StorageHelperRK::PersistentDataBase::getFieldBytes(size_t offset, void *value, size_t size) const {
+    WITH_LOCK(*this) {
+        memcpy(value, (const uint8_t *)savedDataHeader + offset, size);
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::setFieldBytes(size_t offset, const void *value, size_t size) {
+    WITH_LOCK(*this) {
+        uint8_t *p = (uint8_t *)savedDataHeader + offset;
+        if (memcmp(p, value, size) != 0) {
+            memcpy(p, value, size);
+            markDirty(offset, size);
+            hashChanged();
+        }
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::markDirty(size_t offset, size_t size) {
+    size_t start = offset;
+    size_t end = offset + size;
+
+    WITH_LOCK(*this) {
+        // Absorb any spans that overlap or are close to this one
+        for(size_t ii = 0; ii < dirtySpanCount; ) {
+            if (start <= dirtySpans[ii].end + DIRTY_MERGE_GAP && dirtySpans[ii].start <= end + DIRTY_MERGE_GAP) {
+                start = min(start, (size_t)dirtySpans[ii].start);
+                end = max(end, (size_t)dirtySpans[ii].end);
+                dirtySpans[ii] = dirtySpans[--dirtySpanCount];
+            }
+            else {
+                ii++;
+            }
+        }
+
+        if (dirtySpanCount == MAX_DIRTY_SPANS) {
+            // Out of spans - merge into the one with the smallest gap
+            size_t closest = 0;
+            size_t closestGap = (size_t)-1;
+            for(size_t ii = 0; ii < dirtySpanCount; ii++) {
+                size_t gap = (dirtySpans[ii].start > end) ? dirtySpans[ii].start - end : start - dirtySpans[ii].end;
+                if (gap < closestGap) {
+                    closestGap = gap;
+                    closest = ii;
+                }
+            }
+            start = min(start, (size_t)dirtySpans[closest].start);
+            end = max(end, (size_t)dirtySpans[closest].end);
+            dirtySpans[closest] = dirtySpans[--dirtySpanCount];
+        }
+
+        dirtySpans[dirtySpanCount].start = (uint16_t)start;
+        dirtySpans[dirtySpanCount].end = (uint16_t)end;
+        dirtySpanCount++;
+    }
+}
+
 
 bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
     bool isValid = false;
 
-    uint32_t hash = getHash();
+    // A blank or half-written header can hold any size - never hash past the end of the structure
+    bool sizeValid = savedDataHeader->size <= savedDataSize;
+    uint32_t hash = sizeValid ? getHash() : 0;
 
     if (logData) {
         Log.info("validating data size=%d", (int)dataSize);
@@ -115,8 +202,9 @@ bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
 
     if (dataSize >= 12 && 
         savedDataHeader->magic == savedDataMagic && 
-        savedDataHeader->version == savedDataVersion &&
+        savedDataHeader->version <= savedDataVersion &&
         savedDataHeader->size <= (uint16_t) dataSize &&
+        sizeValid &&
         savedDataHeader->hash == hash) {                
         if ((size_t)dataSize < savedDataSize) {
             // Current structure is larger than what's in the file; pad with zero bytes
@@ -126,8 +214,15 @@ bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
             }
         }
         savedDataHeader->size = (uint16_t) savedDataSize;
-        savedDataHeader->hash = getHash();
+
+        // Older data is upgraded a version at a time
         isValid = true;
+        for(uint16_t version = savedDataHeader->version; version < savedDataVersion && isValid; version++) {
+            isValid = migrate(version);
+            Log.info("migrating data from version %d %s", (int)version, isValid ? "done" : "not possible");
+        }
+        savedDataHeader->version = savedDataVersion;
+        savedDataHeader->hash = getHash();
     }   
     if (!isValid && dataSize != 0 && savedDataHeader->magic != 0) {
         // Only log if the data is not empty and was not zeroed out, to avoid logging when doing a load operation on
@@ -568,7 +568,7 @@ public:
             uint16_t version;               //!< savedDataVersion, should rarely, if ever, change
             uint16_t size;                  //!< size of the whole structure, including the user data after it
             uint32_t hash;                  //!< hash value for verifying data integrity
-            uint32_t reserved1;             //!< reserved for future use
+            uint32_t reserved1;             //!< reserved for future use - the generation of each copy when PersistentDataFRAM keeps two
             // You cannot change the size of this structure without changing the version number!
         };
         
@@ -682,6 +682,42 @@ public:
             return result;
         }
 
+        /**
+         * @brief Get a field whose offset is known at compile time, normally offsetof(field, T)
+         *
+         * @tparam T
+         * @tparam offset
+         * @return T
+         *
+         * A naturally aligned field of up to 4 bytes is read with one load, which a write holding the lock cannot
+         * be half way through, so it is read without taking the lock. Larger fields are copied out under the lock
+         * by getFieldBytes(), which is not inlined, so the accessors stay small at every call.
+         * The offset is not range checked - it must come from the structure savedDataHeader points to.
+         */
+        template<class T, size_t offset>
+        T getField() const {
+            if (sizeof(T) <= sizeof(uint32_t) && offset % sizeof(T) == 0) {
+                return *(const T *)((const uint8_t *)savedDataHeader + offset);
+            }
+            T result;
+            getFieldBytes(offset, &result, sizeof(T));
+            return result;
+        }
+
+        /**
+         * @brief Set a field whose offset is known at compile time, normally offsetof(field, T)
+         * 
+         * @tparam T 
+         * @tparam offset 
+         * @param value The value to set
+         * 
+         * Same as setValue() but the work is done by setFieldBytes(), which is not inlined.
+         */
+        template<class T, size_t offset>
+        void setField(T value) {
+            setFieldBytes(offset, &value, sizeof(T));
+        }
+
         /**
          * @brief Templated class for setting integral values (uint32_t, float, double, etc.)
          * 
@@ -699,7 +735,8 @@ public:
                     T oldValue = *(T *)p;
                     if (oldValue != value) {
                         *(T *)p = value;
-                        updateHash();
+                        markDirty(offset, sizeof(T));
+                        hashChanged();
                     }
                 }
             }
@@ -740,9 +777,31 @@ public:
         /**
          * @brief Update the hash
          * 
+         * Use this after changing fields in the structure directly. As it cannot tell which fields changed,
+         * the whole structure is written on the next save.
          */
         void updateHash();
 
+        /**
+         * @brief Start a batch of changes - the hash is only calculated once, when commit() is called
+         * 
+         * Holds the lock until commit() so other threads don't see (or save) a half finished update. Calls
+         * can be nested; the hash is updated when the outermost commit() is called.
+         * 
+         * ```
+         * data.beginUpdate();
+         * data.set_hourlyCount(data.get_hourlyCount() + 1);
+         * data.set_dailyCount(data.get_dailyCount() + 1);
+         * data.commit();
+         * ```
+         */
+        void beginUpdate();
+
+        /**
+         * @brief Finish a batch of changes started by beginUpdate()
+         */
+        void commit();
+
         static const uint32_t HASH_SEED = 0x851c2a3f; //!< Murmur32 hash seed value (randomly generated)
 
     protected:
@@ -771,6 +830,19 @@ public:
          */
         virtual bool validate(size_t dataSize);
 
+        /**
+         * @brief Upgrades the data from one version to the next. Called by validate() for data with an older version.
+         * 
+         * @param fromVersion The version the data is in now - upgrade it to fromVersion + 1
+         * @return true if the data was upgraded, false if it cannot be and should be reinitialized
+         * 
+         * validate() has already checked the hash and padded the structure with zeros to savedDataSize, so fields
+         * added at the end are 0. It calls this once for each version up to savedDataVersion, then sets the version
+         * and rehashes. Modify the structure directly - the lock is held. The default upgrades nothing, so any
+         * version change reinitializes the data as it always has.
+         */
+        virtual bool migrate(uint16_t fromVersion) { return false; };
+
         /**
          * @brief Used to allow subclasses to initialize the saved data structure. Called internally by load(). 
          * 
@@ -779,6 +851,53 @@ public:
          */
         virtual void initialize();
 
+        /**
+         * @brief Copies a field out of the structure under the lock - used by getField()
+         */
+        void getFieldBytes(size_t offset, void *value, size_t size) const;
+
+        /**
+         * @brief Copies a field into the structure under the lock, and marks it dirty and rehashes if it changed - used by setField()
+         */
+        void setFieldBytes(size_t offset, const void *value, size_t size);
+
+        /**
+         * @brief Records that part of the structure has changed and needs to be saved
+         * 
+         * @param offset Offset into the structure
+         * @param size Number of bytes changed
+         * 
+         * Nearby spans are merged. If there are more than MAX_DIRTY_SPANS the closest two are merged.
+         */
+        void markDirty(size_t offset, size_t size);
+
+        /**
+         * @brief Forget the changed spans - call once they have been saved
+         */
+        void clearDirty() { dirtySpanCount = 0; };
+
+        /**
+         * @brief Recalculates the hash, or notes it is needed at commit() if an update is in progress
+         */
+        void hashChanged();
+
+        /**
+         * @brief A range of bytes in the structure that has changed since the last save
+         */
+        struct DirtySpan {
+            uint16_t start;             //!< Offset of the first changed byte
+            uint16_t end;               //!< Offset after the last changed byte
+        };
+
+        static const size_t MAX_DIRTY_SPANS = 4;    //!< Spans tracked before they are merged
+        static const size_t DIRTY_MERGE_GAP = 4;    //!< Spans closer than this are written as one - about the cost of starting another write
+
+        DirtySpan dirtySpans[MAX_DIRTY_SPANS]; //!< Changed spans, in no particular order
+        size_t dirtySpanCount = 0;      //!< Number of valid entries in dirtySpans. 0 = save the whole structure
+
+        int updateDepth = 0;            //!< Nesting level of beginUpdate()
+        bool hashPending = false;       //!< Hash needs to be updated at commit()
+
 
         SavedDataHeader *savedDataHeader = 0; //!< Pointer to the saved data header, which is followed by the data
         uint32_t savedDataSize = 0;     //!< Size of the saved data (header + actual data)
@@ -878,6 +997,24 @@ public:
             PersistentDataBase(savedDataHeader, savedDataSize, savedDataMagic, savedDataVersion), fram(fram), framOffset(framOffset) {
         };
         
+        /**
+         * @brief Keep two copies in FRAM so that power failing part way through a save cannot lose the data
+         * 
+         * @param secondFramOffset Offset into FRAM of the second copy - savedDataSize bytes that nothing else uses
+         * @return PersistentDataFRAM& 
+         * 
+         * Call before load(). Each save goes to the copy not holding the newest data, with the generation in the
+         * header's reserved1 field one higher, so there is always a whole copy with a good hash. load() takes the
+         * valid copy with the highest generation. A save writes what changed in this save and the one before, as
+         * the copy being written is two saves behind.
+         * 
+         * Data saved with a single copy is picked up from the first copy, so this can be turned on for existing devices.
+         */
+        PersistentDataFRAM &withDoubleBuffer(int secondFramOffset) {
+            this->secondFramOffset = secondFramOffset;
+            return *this;
+        }
+
         /**
          * @brief Load the persistent data file. You normally do not need to call this; it will be loaded automatically.
          * 
@@ -886,10 +1023,39 @@ public:
          */
         virtual bool load() {
             WITH_LOCK(*this) {
-                fram.readData(framOffset, (uint8_t*)savedDataHeader, savedDataSize);
-                if (!validate(savedDataHeader->size)) {
+                bool loaded = false;
+                if (secondFramOffset < 0) {
+                    loaded = loadCopy(0);
+                }
+                else {
+                    // Try the newer copy first and fall back to the other if it does not validate
+                    SavedDataHeader headers[2];
+                    fram.readData(copyOffset(0), (uint8_t *)&headers[0], sizeof(SavedDataHeader));
+                    fram.readData(copyOffset(1), (uint8_t *)&headers[1], sizeof(SavedDataHeader));
+                    bool usable[2];
+                    for(int ii = 0; ii < 2; ii++) {
+                        usable[ii] = headers[ii].magic == savedDataMagic && headers[ii].size <= savedDataSize;
+                    }
+                    int first = (usable[1] && (!usable[0] || (int32_t)(headers[1].reserved1 - headers[0].reserved1) > 0)) ? 1 : 0;
+
+                    for(int ii = 0; ii < 2 && !loaded; ii++) {
+                        int copy = first ^ ii;
+                        if (usable[copy] && loadCopy(copy)) {
+                            newestCopy = copy;
+                            loaded = true;
+                            if (ii > 0) {
+                                Log.info("recovered saved data from copy %d generation %lu", copy, (unsigned long)savedDataHeader->reserved1);
+                            }
+                        }
+                    }
+                }
+                if (!loaded) {
                     initialize();
                 }
+                lastSaveSpanCount = 0;      // The other copy could be any age - the first save writes all of it
+                if (fullSaves > 0) {
+                    saveOrDefer();          // Store an upgrade or new defaults now, so they are only made once
+                }
             }
 
             return true;
@@ -900,14 +1066,114 @@ public:
          */
         virtual void save() {
             WITH_LOCK(*this) {
-                fram.writeData(framOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+                if (fullSaves > 0) {
+                    // The copy in FRAM may differ anywhere, not just where the spans say
+                    fullSaves--;
+                    clearDirty();
+                }
+
+                bool written;
+                if (secondFramOffset < 0) {
+                    written = writeDirty(framOffset);
+                }
+                else {
+                    // This save's spans are what the copy we are writing now will be missing at the next save
+                    DirtySpan thisSave[MAX_DIRTY_SPANS];
+                    size_t thisSaveCount = dirtySpanCount;
+                    memcpy(thisSave, dirtySpans, sizeof(thisSave));
+
+                    if (dirtySpanCount > 0 && lastSaveSpanCount > 0) {
+                        for(size_t ii = 0; ii < lastSaveSpanCount; ii++) {
+                            markDirty(lastSaveSpans[ii].start, lastSaveSpans[ii].end - lastSaveSpans[ii].start);
+                        }
+                        markDirty(offsetof(SavedDataHeader, reserved1), sizeof(SavedDataHeader::reserved1));
+                        markDirty(offsetof(SavedDataHeader, hash), sizeof(SavedDataHeader::hash));
+                    }
+                    else {
+                        clearDirty();       // The whole structure
+                    }
+                    savedDataHeader->reserved1++;
+                    savedDataHeader->hash = getHash();
+
+                    newestCopy ^= 1;
+                    written = writeDirty(copyOffset(newestCopy));
+                    memcpy(lastSaveSpans, thisSave, sizeof(lastSaveSpans));
+                    lastSaveSpanCount = thisSaveCount;
+                }
+                if (!written) {
+                    fullSaves = copyCount();
+                }
+                clearDirty();
             }
             PersistentDataBase::save();
         } 
 
+    protected:
+        /**
+         * @brief Reinitializes the data, keeping the generation so the next save is still the newest copy
+         */
+        virtual void initialize() {
+            uint32_t generation = savedDataHeader->reserved1;
+            PersistentDataBase::initialize();
+            if (secondFramOffset >= 0) {
+                savedDataHeader->reserved1 = generation;
+                savedDataHeader->hash = getHash();
+            }
+            fullSaves = copyCount();
+        }
+
+        /**
+         * @brief Reads copy 0 or 1 into the structure and validates it
+         */
+        bool loadCopy(int copy) {
+            fram.readData(copyOffset(copy), (uint8_t*)savedDataHeader, savedDataSize);
+            uint16_t storedSize = savedDataHeader->size;
+            uint16_t storedVersion = savedDataHeader->version;
+            if (!validate(storedSize)) {
+                return false;
+            }
+            if (savedDataHeader->size != storedSize || savedDataHeader->version != storedVersion) {
+                // The structure has grown or been migrated - the header and hash cover bytes no span will mark
+                fullSaves = copyCount();
+            }
+            return true;
+        }
+
+        /**
+         * @brief Writes the dirty spans, or the whole structure if none are recorded, to the copy at offset
+         */
+        bool writeDirty(int offset) {
+            if (dirtySpanCount == 0) {
+                return fram.writeData(offset, (const uint8_t*)savedDataHeader, savedDataSize);
+            }
+            // Only the bytes that changed - the hash is one of them - under one lock of the bus
+            MB85RC::Span spans[MAX_DIRTY_SPANS];
+            for(size_t ii = 0; ii < dirtySpanCount; ii++) {
+                spans[ii].framAddr = offset + dirtySpans[ii].start;
+                spans[ii].data = (const uint8_t*)savedDataHeader + dirtySpans[ii].start;
+                spans[ii].dataLen = dirtySpans[ii].end - dirtySpans[ii].start;
+            }
+            return fram.writeSpans(spans, dirtySpanCount);
+        }
+
+        /**
+         * @brief FRAM offset of copy 0 or 1
+         */
+        int copyOffset(int copy) const { return (copy == 0) ? framOffset : secondFramOffset; }
+
+        /**
+         * @brief Number of copies kept in FRAM
+         */
+        uint8_t copyCount() const { return (secondFramOffset < 0) ? 1 : 2; }
+
     protected:
         MB85RC &fram; //!< Reference to FRAM object
         int framOffset; //!< Offset into FRAM to save the data
+        int secondFramOffset = -1; //!< Offset into FRAM of the second copy, -1 for a single copy
+        int newestCopy = 0; //!< Copy holding the newest data - the next save goes to the other
+        DirtySpan lastSaveSpans[MAX_DIRTY_SPANS]; //!< Spans written by the last save - the other copy does not have them
+        size_t lastSaveSpanCount = 0; //!< Number of valid entries in lastSaveSpans. 0 = the next save writes everything
+        uint8_t fullSaves = 0; //!< Saves still to write the whole structure, whatever the spans - after initialize() or a failed write
     };
     #endif // defined(__MB85RC256V_FRAM_RK) || defined(DOXYGEN_BUILD)
 
@@ -0,0 +1,56 @@
+#include "ClockSync.h"
+
+ClockSync::ClockSync(Clock clock) :
+    clock(clock), haveSync(false), haveDrift(false), referenceAtSync(0), localAtSync(0), referenceAtDriftStart(0), offsetSinceDriftStart(0), driftPpb(0) {
+}
+
+int32_t ClockSync::sync(uint64_t referenceMs, bool measureDrift) {
+    int64_t offset = 0;
+
+    if (haveSync) {
+        offset = (int64_t)now() - (int64_t)referenceMs;
+        if (offset > MAX_OFFSET_MS || offset < -MAX_OFFSET_MS || !measureDrift || referenceMs <= referenceAtDriftStart) {
+            referenceAtDriftStart = referenceMs;            // A step, or a time we should not measure from - start again
+            offsetSinceDriftStart = 0;
+        }
+        else {
+            offsetSinceDriftStart += offset;
+            uint64_t interval = referenceMs - referenceAtDriftStart;
+            if (interval >= MIN_DRIFT_INTERVAL_MS) {
+                // What is left over after the correction we already make - ahead means we run faster than we allowed for
+                int64_t residualPpb = (offsetSinceDriftStart * 1000000000LL) / (int64_t)interval;
+                int64_t drift = driftPpb + (haveDrift ? residualPpb / 2 : residualPpb);
+                if (drift > MAX_DRIFT_PPM * 1000LL) drift = MAX_DRIFT_PPM * 1000LL;
+                if (drift < -MAX_DRIFT_PPM * 1000LL) drift = -MAX_DRIFT_PPM * 1000LL;
+                driftPpb = (int32_t)drift;
+                haveDrift = true;
+                referenceAtDriftStart = referenceMs;
+                offsetSinceDriftStart = 0;
+            }
+        }
+    }
+    else {
+        referenceAtDriftStart = referenceMs;
+        offsetSinceDriftStart = 0;
+    }
+
+    referenceAtSync = referenceMs;
+    localAtSync = clock();
+    haveSync = true;
+    return (int32_t)offset;
+}
+
+uint64_t ClockSync::now() const {
+    if (!haveSync) return 0;
+
+    uint32_t elapsed = clock() - localAtSync;               // Wraps safely - syncs are far less than 49 days apart
+    int64_t correction = ((int64_t)elapsed * driftPpb) / 1000000000LL;
+    return referenceAtSync + elapsed - correction;
+}
+
+void ClockSync::setDriftPpm(int32_t ppm) {
+    if (ppm > MAX_DRIFT_PPM) ppm = MAX_DRIFT_PPM;
+    if (ppm < -MAX_DRIFT_PPM) ppm = -MAX_DRIFT_PPM;
+    driftPpb = ppm * 1000;
+    haveDrift = (ppm != 0);                                 // A saved measurement - the next one is averaged with it
+}
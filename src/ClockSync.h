@@ -0,0 +1,92 @@
+/**
+ * @file ClockSync.h
+ * @brief The Gateway's time to the millisecond, carried forward between syncs on our own clock and corrected for its drift
+ *
+ * @details Time.now() only has whole seconds and Time.setTime() starts the second wherever we happen to be, so a node
+ * set from it can be most of a second out before it has drifted at all. Instead each sync records the Gateway's time
+ * against our millisecond clock, and now() adds the time since. millis() keeps running through ULTRA_LOW_POWER sleep,
+ * so this holds from one report to the next.
+ *
+ * Each sync also shows how far our clock wandered since the one before. Over a long enough interval that is the drift
+ * of our clock, which is averaged and taken out of now(). A sync that is far out is taken as a step - the clock or the
+ * Gateway was reset - and not as drift.
+ *
+ * Only the C++ standard headers are used and the clock is passed in, so a sequence of syncs can be replayed on the host.
+ *
+ */
+
+#ifndef __CLOCK_SYNC_H
+#define __CLOCK_SYNC_H
+
+#include <stdint.h>
+
+class ClockSync {
+public:
+    typedef uint32_t (*Clock)();                            // Milliseconds - millis() on the device
+
+    static const uint32_t MIN_DRIFT_INTERVAL_MS = 1800000;  // Shorter intervals are swamped by the error of each sync
+    static const int32_t MAX_DRIFT_PPM = 2000;
+    static const int32_t MAX_OFFSET_MS = 2000;              // Further out than this is a step, not drift
+
+    /**
+     * @brief Construct a new Clock Sync - not synced until the first sync()
+     *
+     * @param clock Our millisecond clock
+     */
+    ClockSync(Clock clock);
+
+    /**
+     * @brief Records the reference time as of now
+     *
+     * @param referenceMs The Gateway's time now - milliseconds since the epoch
+     * @param measureDrift false if the time is less accurate than usual, so it only sets the clock
+     * @return int32_t - how far now() was out, in milliseconds, positive if we were ahead. 0 if this is the first sync
+     */
+    int32_t sync(uint64_t referenceMs, bool measureDrift = true);
+
+    /**
+     * @brief Tests whether there has been a sync to carry forward
+     */
+    bool synced() const { return haveSync; }
+
+    /**
+     * @brief The reference time now, corrected for our drift since the last sync
+     *
+     * @return uint64_t - milliseconds since the epoch, 0 if not synced
+     */
+    uint64_t now() const;
+
+    /**
+     * @brief Time since the last sync on our clock
+     */
+    uint32_t sinceSyncMs() const { return clock() - localAtSync; }
+
+    /**
+     * @brief Our clock's drift against the reference - positive if we run fast
+     *
+     * @return int32_t - parts per million
+     */
+    int32_t driftPpm() const { return (driftPpb >= 0) ? (driftPpb + 500) / 1000 : (driftPpb - 500) / 1000; }
+
+    /**
+     * @brief Starts the drift from a saved value - call before the first sync
+     */
+    void setDriftPpm(int32_t ppm);
+
+    /**
+     * @brief Forgets the sync, keeping the drift
+     */
+    void reset() { haveSync = false; }
+
+protected:
+    Clock clock;
+    bool haveSync;
+    bool haveDrift;                                         // A measurement to average the next one with
+    uint64_t referenceAtSync;
+    uint32_t localAtSync;
+    uint64_t referenceAtDriftStart;                         // Start of the interval the next drift is measured over
+    int64_t offsetSinceDriftStart;                          // Sum of the offsets found by the syncs since then
+    int32_t driftPpb;
+};
+
+#endif  /* __CLOCK_SYNC_H */
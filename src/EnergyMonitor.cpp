@@ -0,0 +1,87 @@
+#include "EnergyMonitor.h"
+#include "LoRA_Functions.h"
+
+EnergyMonitor *EnergyMonitor::_instance;
+
+// [static]
+EnergyMonitor &EnergyMonitor::instance() {
+    if (!_instance) {
+        _instance = new EnergyMonitor();
+    }
+    return *_instance;
+}
+
+EnergyMonitor::EnergyMonitor() {
+    profile.sleepUa = DEFAULT_SLEEP_UA;
+    profile.awakeUa = DEFAULT_AWAKE_UA;
+    profile.radioTxUa = DEFAULT_RADIO_TX_UA;
+    profile.radioRxUa = DEFAULT_RADIO_RX_UA;
+    memset(&pending, 0, sizeof(pending));
+}
+
+EnergyMonitor::~EnergyMonitor() {
+}
+
+void EnergyMonitor::setup() {
+    lastRadioTxMs = LoRA_Functions::instance().radioTxMs();
+    lastRadioRxMs = LoRA_Functions::instance().radioRxMs();
+    lastFramTransactions = fram.transactionCount();
+}
+
+void EnergyMonitor::update(StateMachine &machine) {
+    uint32_t radioTxMs = LoRA_Functions::instance().radioTxMs();
+    uint32_t radioRxMs = LoRA_Functions::instance().radioRxMs();
+    uint32_t framTransactions = fram.transactionCount();
+
+    for (uint8_t i = 0; i < energyStatusData::ENERGY_STATES; i++) pending.stateMs[i] = machine.dwellMs(i);
+    machine.resetStatistics();
+    pending.radioTxMs = radioTxMs - lastRadioTxMs;
+    pending.radioRxMs = radioRxMs - lastRadioRxMs;
+    pending.framTransactions = framTransactions - lastFramTransactions;
+    lastRadioTxMs = radioTxMs;
+    lastRadioRxMs = radioRxMs;
+    lastFramTransactions = framTransactions;
+
+    energyStatus.beginUpdate();                                     // One hash and one save, rolled over or not
+    if (nearWrap()) energyStatus.rollCounters(chargeUah());
+    energyStatus.addCounters(pending);
+    energyStatus.commit();
+    memset(&pending, 0, sizeof(pending));
+}
+
+bool EnergyMonitor::nearWrap() const {
+    energyStatusData::EnergyCounters counters;
+    energyStatus.get_counters(counters);
+
+    uint32_t largest = max(max(counters.sleepMs + pending.sleepMs, counters.radioTxMs + pending.radioTxMs), counters.radioRxMs + pending.radioRxMs);
+    for (uint8_t i = 0; i < energyStatusData::ENERGY_STATES; i++) largest = max(largest, counters.stateMs[i] + pending.stateMs[i]);
+    return largest >= ROLLOVER_MS;
+}
+
+uint32_t EnergyMonitor::chargeUah() const {
+    energyStatusData::EnergyCounters counters;
+    energyStatus.get_counters(counters);
+
+    uint64_t totalMs = 0;
+    for (uint8_t i = 0; i < energyStatusData::ENERGY_STATES; i++) totalMs += counters.stateMs[i];
+    uint64_t awakeMs = (totalMs > counters.sleepMs) ? totalMs - counters.sleepMs : 0;
+
+    uint64_t microAmpMs = (uint64_t)counters.sleepMs * profile.sleepUa + awakeMs * profile.awakeUa
+        + (uint64_t)counters.radioTxMs * profile.radioTxUa + (uint64_t)counters.radioRxMs * profile.radioRxUa;
+    return energyStatus.get_rolledChargeUah() + (uint32_t)(microAmpMs / 3600000ULL);
+}
+
+uint32_t EnergyMonitor::chargeSinceReportUah() const {
+    uint32_t charge = chargeUah();
+    uint32_t reported = energyStatus.get_reportedChargeUah();
+    return (charge >= reported) ? charge - reported : charge;          // energyStatus has been reinitialized since
+}
+
+void EnergyMonitor::logSummary() const {
+    energyStatusData::EnergyCounters counters;
+    energyStatus.get_counters(counters);
+
+    Log.info("Energy since %s - %lu uAh estimated, asleep %lu s, radio tx %lu ms / rx %lu s, %lu FRAM transactions, %lu sensor wakes",
+        Time.format(energyStatus.get_countersSince(), "%F").c_str(), chargeUah(), counters.sleepMs / 1000UL,
+        counters.radioTxMs, counters.radioRxMs / 1000UL, counters.framTransactions, counters.sensorWakes);
+}
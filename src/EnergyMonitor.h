@@ -0,0 +1,152 @@
+/**
+ * @file EnergyMonitor.h
+ * @brief Where the battery goes - time in each state, radio and sleep time, FRAM traffic and an estimate of the charge used
+ *
+ * @details Counting is left to the things being counted - the state machine keeps its dwell times, the radio driver its
+ * transmit and receive times and the FRAM driver its transactions. update() takes the differences once per wake cycle,
+ * on the way into sleep, and adds them to energyStatusData in FRAM in one save, so this costs next to nothing to leave on.
+ *
+ * The charge is estimated from the times and a CurrentProfile. The defaults are typical figures for a Boron with the
+ * cellular modem off and an RFM95 at full power - measure your own board and set them with withCurrentProfile().
+ *
+ * The times in each state come from millis(), which keeps running through ULTRA_LOW_POWER sleep, so the sleeping
+ * state's time includes the sleep and the awake time is the total less the time asleep.
+ *
+ * The counters are milliseconds in 32 bits, which would wrap after 49 days. Before one reaches ROLLOVER_MS, update()
+ * keeps the charge they stand for in energyStatusData and zeroes them, so the charge goes on adding up and the
+ * times start again from a new countersSince.
+ *
+ */
+
+#ifndef __ENERGY_MONITOR_H
+#define __ENERGY_MONITOR_H
+
+#include "Particle.h"
+#include "MyPersistentData.h"
+#include "StateMachine.h"
+
+class EnergyMonitor {
+public:
+    /**
+     * @brief Current drawn in each mode
+     */
+    struct CurrentProfile {
+        uint32_t sleepUa;                                   // Whole node in ULTRA_LOW_POWER sleep
+        uint32_t awakeUa;                                   // Awake with the radio in standby
+        uint32_t radioTxUa;                                 // Added while the radio transmits
+        uint32_t radioRxUa;                                 // Added while the radio receives
+    };
+
+    static const uint32_t DEFAULT_SLEEP_UA = 150;
+    static const uint32_t DEFAULT_AWAKE_UA = 6000;
+    static const uint32_t DEFAULT_RADIO_TX_UA = 120000;     // +20dBm on PA_BOOST
+    static const uint32_t DEFAULT_RADIO_RX_UA = 11500;
+    static const uint32_t ROLLOVER_MS = 0x80000000UL;      // About 24.8 days - half way to a wrap, so adding an update cannot wrap either
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     *
+     * Use EnergyMonitor::instance() to instantiate the singleton.
+     */
+    static EnergyMonitor &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup() after energyStatus.setup()
+     */
+    void setup();
+
+    /**
+     * @brief Replaces the current figures the charge is estimated from
+     */
+    EnergyMonitor &withCurrentProfile(const CurrentProfile &profile) { this->profile = profile; return *this; };
+
+    /**
+     * @brief Whether the charge estimate goes in the data report - on by default
+     */
+    EnergyMonitor &withReporting(bool report) { this->report = report; return *this; };
+
+    bool reporting() const { return report; }
+
+    /**
+     * @brief Notes a wake by the sensor interrupt
+     */
+    void sensorWake() { pending.sensorWakes++; }
+
+    /**
+     * @brief Notes time asleep
+     */
+    void slept(uint32_t ms) { pending.sleepMs += ms; }
+
+    /**
+     * @brief Adds everything since the last update to the counters in FRAM - call on the way into sleep
+     *
+     * @param machine The main loop's state machine - its dwell times are taken and reset
+     */
+    void update(StateMachine &machine);
+
+    /**
+     * @brief Estimated charge used since energyStatusData was initialized, as of the last update()
+     *
+     * @return uint32_t - micro amp hours
+     */
+    uint32_t chargeUah() const;
+
+    /**
+     * @brief Estimated charge used since the last acknowledged data report, as of the last update()
+     */
+    uint32_t chargeSinceReportUah() const;
+
+    /**
+     * @brief Records that the Gateway has the estimate up to chargeUah
+     */
+    void reportAcknowledged(uint32_t chargeUah) { energyStatus.set_reportedChargeUah(chargeUah); }
+
+    /**
+     * @brief Logs the counters and the estimate
+     */
+    void logSummary() const;
+
+protected:
+    /**
+     * @brief Tests whether adding pending would take a counter to ROLLOVER_MS
+     */
+    bool nearWrap() const;
+
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     *
+     * Use EnergyMonitor::instance() to instantiate the singleton.
+     */
+    EnergyMonitor();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~EnergyMonitor();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    EnergyMonitor(const EnergyMonitor&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    EnergyMonitor& operator=(const EnergyMonitor&) = delete;
+
+    /**
+     * @brief Singleton instance of this class
+     *
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static EnergyMonitor *_instance;
+
+    CurrentProfile profile;
+    bool report = true;
+    energyStatusData::EnergyCounters pending;               // Sleep and sensor wakes since the last update
+    uint32_t lastRadioTxMs = 0;                             // Driver totals at the last update
+    uint32_t lastRadioRxMs = 0;
+    uint32_t lastFramTransactions = 0;
+};
+
+#endif  /* __ENERGY_MONITOR_H */
@@ -34,10 +34,13 @@
 // v10.00 - Breaking Change - v9 Gateway required - Node reports RSSI / SNR to Gateway - Listening / repeating mode, Simplified error handling
 // v12.00 - Debounce for button press-to transmit
 // v13.00 - Adding code to ensure the device charges reliably - Removed PMIC - Fixed the internal temp to int8_t
+// v14.00 - Breaking Change - v14 Gateway required - Messages are bit packed from the schemas in LoRA_Messages.h, TDMA slots and stored reports
+// v14.01 - Table-driven state machine - timers, interrupts and the radio post events rather than writing the state
+// v14.02 - Energy accounting - time in each state, radio and sleep time kept in FRAM with an estimate of the charge used
+// v14.03 - Low power listening - the receiver only runs when there is something to hear and the Boron naps in between
+// v14.04 - Breaking Change - Gateway time stamps carry milliseconds - slots are timed to the millisecond and the guard time is shorter
 
 
-#define NODENUMBEROFFSET 10000UL					// By how much do we off set each node by node number
-
 // Particle Libraries
 #include "AB1805_RK.h"                              // Watchdog and Real Time Clock - https://github.com/rickkas7/AB1805_RK
 #include "Particle.h"                               // Because it is a CPP file not INO
@@ -47,6 +50,8 @@
 #include "device_pinout.h"							// Define pinouts and initialize them
 #include "take_measurements.h"						// Manages interactions with the sensors (default is temp for charging)
 #include "MyPersistentData.h"						// Persistent Storage
+#include "StateMachine.h"							// Event queue and transition table for the main loop
+#include "EnergyMonitor.h"							// Where the battery goes
 
 
 // Prototypes and System Mode calls
@@ -57,13 +62,15 @@ STARTUP(System.enableFeature(FEATURE_RESET_INFO));
 // For monitoring / debugging, you have some options on the next few lines - uncomment one
 SerialLogHandler logHandler(LOG_LEVEL_INFO);     // Easier to see the program flow
 
-PRODUCT_VERSION(13);									// For now, we are putting nodes and gateways in the same product group - need to deconflict #
+PRODUCT_VERSION(14);									// For now, we are putting nodes and gateways in the same product group - need to deconflict #
 
 // Prototype functions
 void publishStateTransition(void);                  // Keeps track of state machine changes - for debugging
 void userSwitchISR();                               // interrupt service routime for the user switch
 void sensorISR();
 bool disconnectFromParticle();						// Makes sure we are disconnected from Particle
+void syncRtc();										// Sets the RTC from the Gateway's time and calibrates it
+void storeUnacknowledgedReport();					// Keeps a data report the Gateway never acknowledged for the next one that gets through
 
 // System Health Variables
 int outOfMemory = -1;                               // From reference code provided in AN0023 (see above)
@@ -71,22 +78,51 @@ int outOfMemory = -1;                               // From reference code provi
 // State Machine Variables
 enum State { INITIALIZATION_STATE, ERROR_STATE, IDLE_STATE, SLEEPING_STATE, LoRA_TRANSMISSION_STATE, LoRA_LISTENING_STATE, LoRA_RETRY_WAIT_STATE, CONNECTING_STATE, DISCONNECTING_STATE, REPORTING_STATE};
 char stateNames[10][16] = {"Initialize", "Error", "Idle", "Sleeping", "LoRA Transmit", "LoRA Listening", "LoRA Retry Wait", "Connecting", "Disconnecting", "Reporting"};
-volatile State state = INITIALIZATION_STATE;
-State oldState = INITIALIZATION_STATE;
+enum Event { STARTUP_DONE, WAKE_FOR_REPORT, WAKE_BY_USER, REPORT_DUE, ALERT_RAISED, ALERT_RESOLVED, RESTART, TRANSMIT_SLOT, SEND_DELIVERED, SEND_FAILED, SEND_ABANDONED, RETRY_DUE, LISTENING_DONE, USER_BUTTON};
+
+// Every state change - an event the current state has no entry for is dropped
+const StateMachine::Transition transitions[] = {
+	{INITIALIZATION_STATE, STARTUP_DONE, SLEEPING_STATE},
+	{SLEEPING_STATE, WAKE_FOR_REPORT, IDLE_STATE},
+	{SLEEPING_STATE, WAKE_BY_USER, IDLE_STATE},
+	{IDLE_STATE, ALERT_RAISED, ERROR_STATE},
+	{IDLE_STATE, REPORT_DUE, LoRA_LISTENING_STATE},
+	{LoRA_LISTENING_STATE, TRANSMIT_SLOT, LoRA_TRANSMISSION_STATE},			// Posted after transmitDelayMs() - our slot has come round
+	{LoRA_LISTENING_STATE, ALERT_RAISED, ERROR_STATE},
+	{LoRA_TRANSMISSION_STATE, SEND_DELIVERED, LoRA_LISTENING_STATE},		// Radio - the next hop has our message, listen for the reply
+	{LoRA_TRANSMISSION_STATE, SEND_FAILED, LoRA_RETRY_WAIT_STATE},
+	{LoRA_TRANSMISSION_STATE, ALERT_RAISED, ERROR_STATE},
+	{LoRA_RETRY_WAIT_STATE, RETRY_DUE, LoRA_TRANSMISSION_STATE},
+	{LoRA_RETRY_WAIT_STATE, SEND_ABANDONED, LoRA_LISTENING_STATE},
+	{LoRA_RETRY_WAIT_STATE, ALERT_RAISED, ERROR_STATE},
+	{LoRA_LISTENING_STATE, LISTENING_DONE, SLEEPING_STATE},					// Posted after listeningWindowMs() - the radio is shut off on the way into sleep
+	{LoRA_TRANSMISSION_STATE, LISTENING_DONE, SLEEPING_STATE},
+	{LoRA_RETRY_WAIT_STATE, LISTENING_DONE, SLEEPING_STATE},
+	{ERROR_STATE, ALERT_RESOLVED, LoRA_LISTENING_STATE},
+	{ERROR_STATE, RESTART, IDLE_STATE},
+	{IDLE_STATE, USER_BUTTON, LoRA_TRANSMISSION_STATE},						// The user wants a report now
+	{SLEEPING_STATE, USER_BUTTON, LoRA_TRANSMISSION_STATE},
+	{LoRA_LISTENING_STATE, USER_BUTTON, LoRA_TRANSMISSION_STATE},
+	{LoRA_RETRY_WAIT_STATE, USER_BUTTON, LoRA_TRANSMISSION_STATE},
+};
+
+uint32_t stateMachineClock() { return millis(); }
+StateMachine stateMachine(transitions, sizeof(transitions) / sizeof(transitions[0]), INITIALIZATION_STATE, stateMachineClock);
 
 // Initialize Functions
 SystemSleepConfiguration config;                    // Initialize new Sleep 2.0 Api
 AB1805 ab1805(Wire);                                // Rickkas' RTC / Watchdog library
 void outOfMemoryHandler(system_event_t event, int param);
-void transmitDelayTimerISR();
-void listeningDurationTimerISR();
+void sendComplete(bool delivered);
 
 // Program Variables
 volatile bool userSwitchDectected = false;		
-volatile bool sensorDetect = false;
-
-Timer transmitDelayTimer(10000,transmitDelayTimerISR,true);
-Timer listeningDurationTimer(300000,listeningDurationTimerISR,true);
+volatile uint8_t sensorTypeISR = 0;					// sysStatus sensorType for the interrupt - the accessors take a lock
+unsigned long transmitStartMillis = 0;				// When we started our last transmission - retries wait for the same slot in the next frame
+int retryCount = 0;									// Retries of the message we are sending
+bool reportUnacknowledged = false;					// A data report has gone out this period and the Gateway's acknowledgement has not come back
+const uint32_t MIN_NAP_MS = 100;					// Shorter naps while listening cost more to get in and out of than they save
+const uint32_t RTC_CAL_INTERVAL_MS = 3600000;		// Shortest time between RTC settings we measure its drift over - it reads to the hundredth
 
 void setup() {
 
@@ -96,6 +132,10 @@ void setup() {
 
 	sysStatus.setup();								// Initialize persistent storage
 	current.setup();
+	savedRoutes.setup();
+	reportBacklog.setup();
+	energyStatus.setup();
+	eventLog.setup();
 
 	takeMeasurements();                             // Populates values so you can read them before the hour
 
@@ -124,42 +164,68 @@ void setup() {
 	System.on(out_of_memory, outOfMemoryHandler);   // Enabling an out of memory handler is a good safety tip. If we run out of memory a System.reset() is done.
 
 	// In this section we test for issues and set alert codes as needed
+	LoRA_Functions::instance().withSendCompleteHandler(sendComplete);		// The radio tells the state machine when a send is done
 	if (! LoRA_Functions::instance().setup(false)) 	{						// Start the LoRA radio - Node
 		sysStatus.set_alertCodeNode(3);										// Initialization failure
 		sysStatus.set_alertTimestampNode(Time.now());
 		Log.info("LoRA Initialization failure alert code %d - power cycle in 30", sysStatus.get_alertCodeNode());
 	}
-	else if (sysStatus.get_nodeNumber() > 10 || !Time.isValid()) {			// If the node number indicates this node is uninitialized or the clock needs to be set, initiate a join request
+	else if (sysStatus.get_nodeNumber() > MAX_NODE_NUMBER || !Time.isValid()) {			// If the node number indicates this node is uninitialized or the clock needs to be set, initiate a join request
 		sysStatus.set_alertCodeNode(1); 									// Will initiate a join request
 		Log.info("Node number indicated unconfigured node of %d setting alert code to %d", sysStatus.get_nodeNumber(), sysStatus.get_alertCodeNode());
 	}
 
+	time_t rtcTime;
+	uint16_t rtcMs;
+	if (Time.isValid() && ab1805.getRtcAsTimeMs(rtcTime, rtcMs)) {			// The RTC keeps the Gateway's time to the hundredth through a reset
+		LoRA_Functions::instance().restoreGatewayTime((uint64_t)rtcTime * 1000ULL + rtcMs);
+	}
+
   	takeMeasurements();                                                  	// Populates values so you can read them before the hour
+	EnergyMonitor::instance().setup();										// Radio and FRAM counts from here on
   
+	sensorTypeISR = sysStatus.get_sensorType();
     attachInterrupt(INT_PIN, sensorISR, RISING);                     		// PIR or Pressure Sensor interrupt from low to high
 	attachInterrupt(BUTTON_PIN,userSwitchISR,FALLING); 						// We may need to monitor the user switch to change behaviours / modes
 
 	if (sysStatus.get_openHours()) sensorControl(sysStatus.get_sensorType(),true); // Turn the sensor on during open hours
 
-	if (state == INITIALIZATION_STATE) state = SLEEPING_STATE;               	// Sleep unless otherwise from above code
+	stateMachine.post(STARTUP_DONE);               							// Sleep unless otherwise from above code
   	Log.info("Startup complete for the Node with alert code %d and last connect %s", sysStatus.get_alertCodeNode(), Time.format(sysStatus.get_lastConnection(), "%T").c_str());
   	digitalWrite(BLUE_LED,LOW);                                          	// Signal the end of startup
 }
 
 void loop() {
-	switch (state) {
+	stateMachine.dispatch();												// Make the transitions for anything that has happened since the last pass
+
+	switch (stateMachine.state()) {
 		case IDLE_STATE: {													// Unlike most sketches - nodes spend most time in sleep and only transit IDLE once or twice each period
-			if (state != oldState) publishStateTransition();              	// We will apply the back-offs before sending to ERROR state - so if we are here we will take action
+			if (stateMachine.entered()) publishStateTransition();          	// We will apply the back-offs before sending to ERROR state - so if we are here we will take action
 
-			if (sysStatus.get_alertCodeNode() != 0) state = ERROR_STATE;	// Error - let's handle this first
-			else state = LoRA_LISTENING_STATE;  							// No error - Enter the LoRA state
+			if (sysStatus.get_alertCodeNode() != 0) stateMachine.post(ALERT_RAISED);	// Error - let's handle this first
+			else stateMachine.post(REPORT_DUE);  							// No error - Enter the LoRA state
 		} break;
 
 		case SLEEPING_STATE: {
-			unsigned long wakeInSeconds, wakeBoundary;
+			unsigned long wakeInSeconds, wakeBoundary, sleepMs;
+			static unsigned long reportDueMs;								// When the first sleep of this visit was to end
 			time_t time;
 
-			publishStateTransition();              							// Publish state transition
+			if (stateMachine.entered()) {
+				publishStateTransition();              						// Publish state transition
+				storeUnacknowledgedReport();								// The window can close before the retries run out
+				retryCount = 0;
+				reportDueMs = 0;
+				EnergyMonitor::instance().update(stateMachine);				// Once per wake cycle - one FRAM save
+				EnergyMonitor::instance().logSummary();
+			}
+			if (countFeedbackActive()) break;								// Let the LED finish showing the last count before we sleep
+			if (stateMachine.pending()) break;								// Something has happened since this pass started - act on it first
+			if (reportDueMs != 0 && (long)(millis() - reportDueMs) >= 0) {	// A sensor wake ran past the boundary - sleeping again would skip the report
+				stateMachine.post(WAKE_FOR_REPORT);
+				break;
+			}
+			LoRA_Functions::instance().sleepLoRaRadio();					// Done with the radio - shut it off
 			// How long to sleep
 			if (Time.isValid()) {
 				wakeBoundary = (sysStatus.get_frequencyMinutes() * 60UL);
@@ -173,124 +239,147 @@ void loop() {
 			}
 			// Turn things off to save power
 			if (!sysStatus.get_openHours()) if (sysStatus.get_openHours()) sensorControl(sysStatus.get_sensorType(),false);
-			// Configure Sleep
+			// Configure Sleep - to the millisecond on the Gateway's clock if we have it
+			sleepMs = LoRA_Functions::instance().msToNextPeriod();
+			if (sleepMs == 0) sleepMs = wakeInSeconds * 1000UL;
+			if (reportDueMs == 0) reportDueMs = (millis() + sleepMs) | 1;	// Never 0 - that means not yet set
 			config.mode(SystemSleepMode::ULTRA_LOW_POWER)
 				.gpio(BUTTON_PIN,CHANGE)
 				.gpio(INT_PIN,RISING)
-				.duration((wakeInSeconds) * 1000L);							// Configuring sleep
+				.duration(sleepMs);											// Configuring sleep
 			ab1805.stopWDT();  												// No watchdogs interrupting our slumber
+			unsigned long sleepStart = millis();
 			SystemSleepResult result = System.sleep(config);              	// Put the device to sleep device continues operations from here
+			EnergyMonitor::instance().slept(millis() - sleepStart);
 			ab1805.resumeWDT();                                             // Wakey Wakey - WDT can resume
 			sensorControl(sysStatus.get_sensorType(),true);					// Enable the sensor
 			if (result.wakeupPin() == BUTTON_PIN) {                         // If the user woke the device we need to get up - device was sleeping so we need to reset opening hours
 				waitFor(Serial.isConnected, 10000);							// Wait for serial connection if we are using the button - we may want to monito serial 
 				Log.info("Woke with user button");
-				state = IDLE_STATE;
+				stateMachine.post(WAKE_BY_USER);
 			}
 			else if (result.wakeupPin() == INT_PIN) {
-				Log.info("Woke with sensor interrupt");						// Will count at the bottom of the main loop
-				state = SLEEPING_STATE;										// This is the normal behaviour
+				Log.info("Woke with sensor interrupt");						// Will count at the bottom of the main loop and sleep again on the next pass
+				EnergyMonitor::instance().sensorWake();
 			}
 			else {
 				Log.info("Time is up at %s with %li free memory", Time.format((Time.now()+wakeInSeconds), "%T").c_str(), System.freeMemory());
-				state = IDLE_STATE;
+				stateMachine.post(WAKE_FOR_REPORT);
 			}
 		} break;
 
-		case LoRA_LISTENING_STATE: {																// Timers will take us to transmit and back to sleep
+		case LoRA_LISTENING_STATE: {																// Delayed events will take us to transmit and back to sleep
 			static int lastReportingHour = Time.hour();
 
-			if (state != oldState) {
-				if (oldState != LoRA_TRANSMISSION_STATE) {
-					if (!listeningDurationTimer.isActive()) listeningDurationTimer.start();				// Don't reset timer if it is already running
-					if (sysStatus.get_nodeNumber() < 11) transmitDelayTimer.changePeriod(sysStatus.get_nodeNumber()*NODENUMBEROFFSET);		// Wait a beat before transmitting
-					else state = LoRA_TRANSMISSION_STATE;
+			if (stateMachine.entered()) {
+				if (stateMachine.previousState() == LoRA_TRANSMISSION_STATE || stateMachine.previousState() == LoRA_RETRY_WAIT_STATE) retryCount = 0;	// Delivered or given up - wait for the reply in this window
+				else {
+					if (!stateMachine.scheduled(LISTENING_DONE)) {										// Don't restart the window if it is already running
+						stateMachine.postAfter(LISTENING_DONE, LoRA_Functions::instance().listeningWindowMs());
+						LoRA_Functions::instance().startListening();
+					}
+					if (sysStatus.get_nodeNumber() <= MAX_NODE_NUMBER) stateMachine.postAfter(TRANSMIT_SLOT, LoRA_Functions::instance().transmitDelayMs());	// Wait for our slot before transmitting
+					else stateMachine.post(TRANSMIT_SLOT);
 				}
 				publishStateTransition();                   										// Publish state transition
 			}
 
 			if (LoRA_Functions::instance().listenForLoRAMessageNode()) {							// Listen for LoRA signals - could be an acknowledgement or a message to relay to another node
 				sysStatus.set_lastConnection(Time.now());											// Came back as true - message was for our node
+				reportUnacknowledged = false;
 				randomSeed(sysStatus.get_lastConnection() * sysStatus.get_nodeNumber());			// Done so we can genrate rando numbers later
-				ab1805.setRtcFromTime(Time.now());
+				syncRtc();
 				if (Time.hour() != lastReportingHour) {
 					current.set_hourlyCount(0);					    								// Zero the hourly count
 					lastReportingHour = Time.hour();
 				}
-				else if (sysStatus.get_alertCodeNode() != 0) state = ERROR_STATE;					// Need to resolve alert before listening for others
+				else if (sysStatus.get_alertCodeNode() != 0) stateMachine.post(ALERT_RAISED);		// Need to resolve alert before listening for others
 			}
-		} break;
 
-		case LoRA_TRANSMISSION_STATE: {
-			bool result = false;
-			static int retryCount = 0;
+			// Nap until the radio hears something, the receive window closes or the next delayed event is due
+			if (stateMachine.pending() || countFeedbackActive() || userSwitchDectected) break;
+			uint32_t napMs = min(LoRA_Functions::instance().listenLowPower(), stateMachine.msUntilScheduled());
+			if (napMs < MIN_NAP_MS) break;
+			SystemSleepConfiguration napConfig;
+			napConfig.mode(SystemSleepMode::ULTRA_LOW_POWER)
+				.gpio(RFM95_INT,RISING)
+				.gpio(BUTTON_PIN,CHANGE)
+				.gpio(INT_PIN,RISING)
+				.duration(napMs);
+			ab1805.stopWDT();
+			unsigned long napStart = millis();
+			SystemSleepResult result = System.sleep(napConfig);
+			EnergyMonitor::instance().slept(millis() - napStart);
+			ab1805.resumeWDT();
+			if (result.wakeupPin() == INT_PIN) EnergyMonitor::instance().sensorWake();	// Counted at the bottom of the main loop
+		} break;
 
-			publishStateTransition();                   					// Let everyone know we are changing state
-			takeMeasurements();												// Taking measurements now should allow for accurate battery measurements
-			LoRA_Functions::instance().clearBuffer();
-			// Based on Alert code, determine what message to send
-			if (sysStatus.get_alertCodeNode() == 0) result = LoRA_Functions::instance().composeDataReportNode();
-			else if (sysStatus.get_alertCodeNode() == 1 || sysStatus.get_alertCodeNode() == 2) result = LoRA_Functions::instance().composeJoinRequesttNode();
-			else {
-				Log.info("Alert code = %d",sysStatus.get_alertCodeNode());
-				state = ERROR_STATE;
-				break;														// Resolve the alert code in ERROR_STATE
-			}		
-
-			if (result) {
-				retryCount = 0;												// Successful transmission - go listen for response
-				state = LoRA_LISTENING_STATE;
-			}
-			else if (retryCount >= 3) {
-				Log.info("Too many retries - giving up for this period");
-				retryCount = 0;
-				if ((Time.now() - sysStatus.get_lastConnection() > 2 * sysStatus.get_frequencyMinutes() * 60UL)) { 	// Device has not connected for two reporting periods
-					Log.info("Nothing for two reporting periods - power cycle after current cycle");
-					sysStatus.set_alertCodeNode(3);							// This will trigger a power cycle reset
-					sysStatus.set_alertTimestampNode(Time.now());		
-					sysStatus.set_lastConnection(Time.now());				// Prevents cyclical resets
-					state = ERROR_STATE;									// Likely radio is locked up - reset the device and radio
+		case LoRA_TRANSMISSION_STATE: {										// Starts the send on the way in - sendComplete() posts the outcome
+			if (stateMachine.entered()) {
+				bool result = false;
+
+				publishStateTransition();                   				// Let everyone know we are changing state
+				transmitStartMillis = millis();
+				takeMeasurements();											// Taking measurements now should allow for accurate battery measurements
+				LoRA_Functions::instance().clearBuffer();
+				// Based on Alert code, determine what message to send
+				if (sysStatus.get_alertCodeNode() == 0) {
+					reportUnacknowledged = true;
+					result = LoRA_Functions::instance().composeDataReportNode();
+				}
+				else if (sysStatus.get_alertCodeNode() == 1 || sysStatus.get_alertCodeNode() == 2) result = LoRA_Functions::instance().composeJoinRequesttNode();
+				else {
+					Log.info("Alert code = %d",sysStatus.get_alertCodeNode());
+					stateMachine.post(ALERT_RAISED);						// Resolve the alert code in ERROR_STATE
 					break;
 				}
-				state = LoRA_LISTENING_STATE;
-			}
-			else {
-				Log.info("Transmission failed - retry number %d",retryCount++);
-				state = LoRA_RETRY_WAIT_STATE;
+				if (!result) stateMachine.post(SEND_FAILED);				// Could not start the send - LoRA_Functions::loop() carries one that did while we keep counting
 			}
 		} break;
 
-		case LoRA_RETRY_WAIT_STATE: {										// In this state we introduce a random delay and then retransmit
+		case LoRA_RETRY_WAIT_STATE: {										// In this state we wait for our slot in the next frame and then retransmit
 			static unsigned long variableDelay = 0;
-			static unsigned long startDelay = 0;
 
-			if (state != oldState) {
+			if (stateMachine.entered()) {
 				publishStateTransition();                   				// Publish state transition
-				variableDelay = random(20000);								// a random delay up to 20 seconds
-				startDelay = millis();
-				Log.info("Going to retry in %lu seconds", variableDelay/1000UL);
+				if (retryCount >= 3) {
+					Log.info("Too many retries - giving up for this period");
+					retryCount = 0;
+					storeUnacknowledgedReport();							// Before a power cycle can take it
+					if ((Time.now() - sysStatus.get_lastConnection() > 2 * sysStatus.get_frequencyMinutes() * 60UL)) { 	// Device has not connected for two reporting periods
+						Log.info("Nothing for two reporting periods - power cycle after current cycle");
+						sysStatus.set_alertCodeNode(3);						// This will trigger a power cycle reset
+						sysStatus.set_alertTimestampNode(Time.now());		
+						sysStatus.set_lastConnection(Time.now());			// Prevents cyclical resets
+						stateMachine.post(ALERT_RAISED);					// Likely radio is locked up - reset the device and radio
+					}
+					else stateMachine.post(SEND_ABANDONED);
+					break;
+				}
+				Log.info("Transmission failed - retry number %d",retryCount++);
+				variableDelay = LoRA_Functions::instance().frameMs();		// One frame after our last attempt
+				Log.info("Going to retry in %lu seconds", (variableDelay - min(variableDelay, millis() - transmitStartMillis))/1000UL);
 			}
 
-			if (millis() >= startDelay + variableDelay) state = LoRA_TRANSMISSION_STATE;
+			if (millis() - transmitStartMillis >= variableDelay) stateMachine.post(RETRY_DUE);
 
 		} break;
 
 		case ERROR_STATE: {													// Where we go if things are not quite right
-			if (state != oldState) publishStateTransition();                // We will apply the back-offs before sending to ERROR state - so if we are here we will take action
+			if (stateMachine.entered()) publishStateTransition();            // We will apply the back-offs before sending to ERROR state - so if we are here we will take action
 
 			switch (sysStatus.get_alertCodeNode()) {
 			case 1:															// Case 1 is an unconfigured node - needs to send join request
-				sysStatus.set_nodeNumber(11);
+				sysStatus.set_nodeNumber(UNCONFIGURED_NODE);
 				Log.info("LoRA Radio initialized as an unconfigured node %i and a deviceID of %s", sysStatus.get_nodeNumber(), System.deviceID().c_str());
-				state = LoRA_LISTENING_STATE;							// Sends the alert and clears alert code
+				stateMachine.post(ALERT_RESOLVED);							// Sends the alert and clears alert code
 			break;
 			case 2:															// Case 2 is for Time not synced
 				Log.info("Alert 2- Time is not valid going to join again");
-				state = LoRA_LISTENING_STATE;							// Sends the alert and clears alert code
+				stateMachine.post(ALERT_RESOLVED);							// Sends the alert and clears alert code
 			break;
 			case 3: {														// Case 3 is generic - power cycle device to recover from errors
-				static system_tick_t enteredState = millis();
-				if (millis() - enteredState > 30000L) {
+				if (stateMachine.timeInStateMs() > 30000L) {
 					Log.info("Alert 3 - Resetting device");
 					sysStatus.set_alertCodeNode(0);							// Need to clear so we don't get in a retry cycle
 					sysStatus.set_alertTimestampNode(Time.now());
@@ -304,13 +393,13 @@ void loop() {
 				if(LoRA_Functions::instance().initializeRadio()) {
 					Log.info("Initialization successful");	
 					sysStatus.set_alertCodeNode(0);							// Modem reinitialized successfully, going back to retransmit
-					state = LoRA_LISTENING_STATE;							// Sends the alert and clears alert code
+					stateMachine.post(ALERT_RESOLVED);						// Sends the alert and clears alert code
 				}
 				else {
 					Log.info(("Initialization not successful - power cycle"));
 					sysStatus.set_alertCodeNode(3);							// Next time through - will transition to power cycle
 					sysStatus.set_alertTimestampNode(Time.now());
-					state = IDLE_STATE;
+					stateMachine.post(RESTART);
 				}
 			break;
 			case 5:															// In this case, we will reset all data
@@ -319,32 +408,35 @@ void loop() {
 				sysStatus.set_alertCodeNode(1);								// Resetting system values requires we re-join the network
 				sysStatus.set_alertTimestampNode(Time.now());			
 				Log.info("Full Reset and Re-Join Network");
-				state = LoRA_LISTENING_STATE;							// Sends the alert and clears alert code
+				stateMachine.post(ALERT_RESOLVED);							// Sends the alert and clears alert code
 
 			break;
 			case 6: 														// In this state system data is retained but current data is reset
 				current.resetEverything();
 				sysStatus.set_alertCodeNode(0);
-				state = LoRA_LISTENING_STATE;								// Once we clear the counts we can go back to listening
+				stateMachine.post(ALERT_RESOLVED);							// Once we clear the counts we can go back to listening
 			break;
 			default:
 				Log.info("Undefined Error State");
 				sysStatus.set_alertCodeNode(0);
-				state = IDLE_STATE;
+				stateMachine.post(RESTART);
 			break;
 			}
-		}
+		} break;
 	}
 
 	// Housekeeping for each transit of the main loop
 	ab1805.loop();                                  						// Keeps the RTC synchronized with the Boron's clock
 
+	LoRA_Functions::instance().loop();										// Services any LoRA message we are sending
+
 	current.loop();
 	sysStatus.loop();
+	savedRoutes.loop();
+	energyStatus.loop();
 
-	if (sensorDetect) {														// Count the pulse and reset for next
-		if (recordCount()) sensorDetect = false;
-	}
+	sensorTypeISR = sysStatus.get_sensorType();
+	recordCounts();															// Record any counts the sensor interrupt has queued
 
 	if (outOfMemory >= 0) {                         // In this function we are going to reset the system if there is an out of memory error
 		Log.info("Resetting due to low memory");
@@ -355,9 +447,12 @@ void loop() {
 	if (userSwitchDectected) {
 		delay(100);									// Debounce the button press
 		userSwitchDectected = false;				// Clear the interrupt flag
-		if (!listeningDurationTimer.isActive()) listeningDurationTimer.start();				// Don't reset timer if it is already running
+		if (!stateMachine.scheduled(LISTENING_DONE)) {										// Don't restart the window if it is already running
+			stateMachine.postAfter(LISTENING_DONE, LoRA_Functions::instance().listeningWindowMs());
+			LoRA_Functions::instance().startListening();
+		}
 		Log.info("Detected button press");
-		state = LoRA_TRANSMISSION_STATE;
+		stateMachine.post(USER_BUTTON);
 	}
 
 }
@@ -371,12 +466,13 @@ void loop() {
 void publishStateTransition(void)
 {
 	char stateTransitionString[256];
-	if (state == IDLE_STATE) {
-		if (!Time.isValid()) snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s with invalid time", stateNames[oldState],stateNames[state]);
-		else snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", stateNames[oldState],stateNames[state]);
+	const char *oldStateName = stateNames[stateMachine.previousState()];
+	const char *stateName = stateNames[stateMachine.state()];
+	if (stateMachine.state() == IDLE_STATE) {
+		if (!Time.isValid()) snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s with invalid time", oldStateName, stateName);
+		else snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", oldStateName, stateName);
 	}
-	else snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", stateNames[oldState],stateNames[state]);
-	oldState = state;
+	else snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", oldStateName, stateName);
 	Log.info(stateTransitionString);
 }
 
@@ -385,13 +481,50 @@ void outOfMemoryHandler(system_event_t event, int param) {
     outOfMemory = param;
 }
 
-void transmitDelayTimerISR() {
-	state = LoRA_TRANSMISSION_STATE;										// Time for our node to transmit
+/**
+ * @brief Sets the RTC to the hundredth from the Gateway's time, and calibrates its crystal from how far it had wandered
+ *
+ * @details The RTC is set after each acknowledgement, so over an hour or more what it has gained or lost is its drift.
+ * Half of that is taken out with the crystal calibration each time so one bad reading does not throw it off.
+ */
+void syncRtc() {
+	static uint64_t rtcSetAtMs = 0;											// Gateway time we last set the RTC to
+	uint64_t gatewayMs = LoRA_Functions::instance().gatewayTimeMs();
+	time_t rtcTime;
+	uint16_t rtcMs;
+
+	if (gatewayMs == 0) {
+		ab1805.setRtcFromTime(Time.now());
+		return;
+	}
+	if (rtcSetAtMs > 0 && gatewayMs > rtcSetAtMs + RTC_CAL_INTERVAL_MS && ab1805.getRtcAsTimeMs(rtcTime, rtcMs)) {
+		int64_t rtcOffsetMs = (int64_t)rtcTime * 1000LL + rtcMs - (int64_t)gatewayMs;
+		if (rtcOffsetMs > -2000 && rtcOffsetMs < 2000) {					// Further out than this the RTC was reset, not drifting
+			int32_t rtcPpb = (int32_t)((rtcOffsetMs * 1000000000LL) / (int64_t)(gatewayMs - rtcSetAtMs));
+			int steps = ab1805.getXtCalibration() - rtcPpb / (2 * (int32_t)AB1805::XT_CAL_PPB_PER_STEP);	// Fast needs slowing down
+			steps = constrain(steps, -64, 127);
+			if (steps != ab1805.getXtCalibration() && ab1805.setXtCalibration(steps)) {
+				Log.info("RTC %li mSec out over %lu sec - calibration now %d steps", (int32_t)rtcOffsetMs, (uint32_t)((gatewayMs - rtcSetAtMs) / 1000ULL), steps);
+			}
+		}
+	}
+	if (ab1805.setRtcFromTimeMs((time_t)(gatewayMs / 1000ULL), gatewayMs % 1000ULL)) rtcSetAtMs = gatewayMs;
+}
+
+/**
+ * @brief Stores the data report sent this period if the Gateway has not acknowledged it - on giving up, or on the way to
+ * sleep when the listening window closed first. Once a period - it goes with the next report that gets through
+ */
+void storeUnacknowledgedReport() {
+	if (!reportUnacknowledged) return;
+	reportUnacknowledged = false;
+	if (!Time.isValid()) return;
+	reportBacklog.append(Time.now(), current.get_hourlyCount(), current.get_dailyCount());
+	Log.info("Data report not acknowledged - stored, %d pending", reportBacklog.pendingCount());
 }
 
-void listeningDurationTimerISR() {
-	LoRA_Functions::instance().sleepLoRaRadio();							// Done with the radio - shut it off
-	state = SLEEPING_STATE;													// Go back to sleep
+void sendComplete(bool delivered) {											// Called from LoRA_Functions::loop() when a send is done
+	stateMachine.post((delivered) ? SEND_DELIVERED : SEND_FAILED);
 }
 
 void userSwitchISR() {
@@ -401,8 +534,8 @@ void userSwitchISR() {
 void sensorISR()
 {
   static bool frontTireFlag = false;
-  if (frontTireFlag || sysStatus.get_sensorType() == 1) {               	// Counts the rear tire for pressure sensors and once for PIR
-    sensorDetect = true;                                              		// sets the sensor flag for the main loop
+  if (frontTireFlag || sensorTypeISR == 1) {               				// Counts the rear tire for pressure sensors and once for PIR
+    queueCount();                                              				// queues the count for the main loop
     frontTireFlag = false;
   }
   else frontTireFlag = true;
@@ -0,0 +1,107 @@
+#include "LoRA_ADR.h"
+
+// ************************************************************************
+// *****                      Link Statistics                         *****
+// ************************************************************************
+
+LinkStats::LinkStats() {
+    reset();
+}
+
+void LinkStats::record(bool acked, int16_t rssi, int16_t snr) {
+    window[next].acked = acked;
+    window[next].rssi = rssi;
+    window[next].snr = snr;
+    next = (next + 1) % WINDOW;
+    if (count < WINDOW) count++;
+
+    if (acked) failures = 0;
+    else if (failures < 255) failures++;
+}
+
+void LinkStats::reset() {
+    next = 0;
+    count = 0;
+    failures = 0;
+}
+
+uint8_t LinkStats::successPercent() const {
+    if (count == 0) return 0;
+
+    uint8_t acked = 0;
+    for (uint8_t i = 0; i < count; i++) if (window[i].acked) acked++;
+    return (acked * 100) / count;
+}
+
+int16_t LinkStats::maxSnr() const {
+    int16_t best = -32768;
+    for (uint8_t i = 0; i < count; i++) if (window[i].acked && window[i].snr > best) best = window[i].snr;
+    return best;
+}
+
+int16_t LinkStats::averageRssi() const {
+    int32_t total = 0;
+    uint8_t acked = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (window[i].acked) {
+            total += window[i].rssi;
+            acked++;
+        }
+    }
+    return (acked) ? (int16_t)(total / acked) : 0;
+}
+
+
+// ************************************************************************
+// *****                      Data Rate Selection                     *****
+// ************************************************************************
+
+// Data rate 0 to 4 is SF11 to SF7 at 125kHz and 4/5 - the demodulator needs 2.5dB less SNR for each step up in SF
+static const uint8_t SPREADING_FACTOR[LoRA_ADR::MAX_DATA_RATE + 1] = {11, 10, 9, 8, 7};
+static const int16_t REQUIRED_SNR_TENTHS[LoRA_ADR::MAX_DATA_RATE + 1] = {-175, -150, -125, -100, -75};
+
+const int8_t TX_POWER_STEP = 3;                             // dB per power step - it costs that much SNR
+const int16_t STEP_TENTHS = 25;                             // SNR a data rate step costs
+
+// [static]
+uint8_t LoRA_ADR::spreadingFactor(uint8_t dataRate) {
+    return SPREADING_FACTOR[(dataRate > MAX_DATA_RATE) ? DEFAULT_DATA_RATE : dataRate];
+}
+
+// [static]
+int16_t LoRA_ADR::requiredSnrTenths(uint8_t dataRate) {
+    return REQUIRED_SNR_TENTHS[(dataRate > MAX_DATA_RATE) ? DEFAULT_DATA_RATE : dataRate];
+}
+
+// [static]
+void LoRA_ADR::recommend(const LinkStats &link, uint8_t &dataRate, int8_t &txPower) {
+    if (dataRate > MAX_DATA_RATE) dataRate = DEFAULT_DATA_RATE;
+    txPower = constrain(txPower, MIN_TX_POWER, MAX_TX_POWER);
+
+    if (link.consecutiveFailures() >= FALLBACK_FAILURES || (link.samples() >= MIN_SAMPLES && link.successPercent() < MIN_SUCCESS_PERCENT)) {
+        dataRate = DEFAULT_DATA_RATE;                       // The link is struggling - go back to the most robust setting
+        txPower = MAX_TX_POWER;
+        return;
+    }
+    if (link.samples() < MIN_SAMPLES) return;              // Not enough history to move yet
+
+    int16_t spareTenths = link.maxSnr() * 10 - requiredSnrTenths(dataRate) - INSTALLATION_MARGIN_TENTHS;
+
+    while (spareTenths >= STEP_TENTHS && dataRate < MAX_DATA_RATE) {  // Spend margin on air time first - it saves the most energy
+        dataRate++;
+        spareTenths -= STEP_TENTHS;
+    }
+    while (spareTenths >= TX_POWER_STEP * 10 && txPower - TX_POWER_STEP >= MIN_TX_POWER) {  // Only whole steps so we never spend margin we don't have
+        txPower -= TX_POWER_STEP;
+        spareTenths -= TX_POWER_STEP * 10;
+    }
+    while (spareTenths < 0 && txPower < MAX_TX_POWER) {     // Short of margin - power goes back up first
+        int8_t raised = min((int)MAX_TX_POWER, txPower + TX_POWER_STEP);
+        spareTenths += (raised - txPower) * 10;
+        txPower = raised;
+    }
+    while (spareTenths < 0 && dataRate > DEFAULT_DATA_RATE) {  // Then the data rate comes down
+        dataRate--;
+        spareTenths += STEP_TENTHS;
+    }
+}
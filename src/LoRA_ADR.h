@@ -0,0 +1,115 @@
+/**
+ * @file LoRA_ADR.h
+ * @brief Adaptive data rate - picks the fastest spreading factor and lowest power a link can carry
+ *
+ * @details The Gateway keeps a LinkStats for each node and pushes LoRA_ADR::recommend()'s choice in the data
+ * acknowledgement. The node keeps one for its link to the Gateway and falls back to the robust default after
+ * consecutive failures.
+ *
+ * Everyone listens at data rate 0 - relays and the Gateway's single radio can only hear one spreading factor at a time.
+ * A node only uses a faster data rate for its own report and the acknowledgement in its slot, and only when it is one
+ * hop from the Gateway, so the Gateway can switch to that node's data rate for the slot. Slots are sized for data rate 0.
+ *
+ */
+
+#ifndef __LORA_ADR_H
+#define __LORA_ADR_H
+
+#include "Particle.h"
+
+/**
+ * @brief Rolling window of the last few exchanges on one link
+ */
+class LinkStats {
+public:
+    static const uint8_t WINDOW = 8;                        // Exchanges remembered
+
+    LinkStats();
+
+    /**
+     * @brief Records the outcome of an exchange
+     *
+     * @param acked true if the other end acknowledged - rssi and snr are only meaningful then
+     * @param rssi Signal strength of the acknowledgement
+     * @param snr Signal to noise ratio of the acknowledgement
+     */
+    void record(bool acked, int16_t rssi = 0, int16_t snr = 0);
+
+    /**
+     * @brief Forgets the window - call when the data rate changes as the samples no longer apply
+     */
+    void reset();
+
+    uint8_t samples() const { return count; }
+
+    /**
+     * @brief Share of the exchanges in the window that were acknowledged
+     *
+     * @return uint8_t - percent
+     */
+    uint8_t successPercent() const;
+
+    /**
+     * @brief Best SNR of the acknowledged exchanges in the window - what the link can do when it is working
+     */
+    int16_t maxSnr() const;
+
+    int16_t averageRssi() const;
+
+    uint8_t consecutiveFailures() const { return failures; }
+
+protected:
+    struct Sample {
+        int16_t rssi;
+        int16_t snr;
+        bool acked;
+    };
+    Sample window[WINDOW];
+    uint8_t next;                                           // Where the next sample goes
+    uint8_t count;                                          // Samples in the window
+    uint8_t failures;                                       // Failures since the last success
+};
+
+/**
+ * @brief The data rates and the recommendation logic - static as it is shared by every link
+ */
+class LoRA_ADR {
+public:
+    static const uint8_t DEFAULT_DATA_RATE = 0;             // SF11 - what everyone listens on
+    static const uint8_t MAX_DATA_RATE = 4;                 // SF7
+    static const int8_t MAX_TX_POWER = 20;                  // dBm - the most PA_BOOST gives
+    static const int8_t MIN_TX_POWER = 5;
+    static const uint8_t FALLBACK_FAILURES = 3;             // Consecutive failures before a node goes back to the default
+
+    /**
+     * @brief Recommends the data rate and power for a link
+     *
+     * @details LoRaWAN style - the SNR margin over what the current data rate needs, less an installation margin, is spent
+     * first on faster data rates, 2.5dB a step, and then on lower power, 3dB a step. A negative margin puts the power back
+     * up, then the data rate down, until the margin is made good.
+     * Links without enough history, or that are losing exchanges, go back to the default.
+     *
+     * @param link Statistics for the link, gathered at dataRate
+     * @param dataRate Data rate the link is using - updated with the recommendation
+     * @param txPower Power the link is using in dBm - updated with the recommendation
+     */
+    static void recommend(const LinkStats &link, uint8_t &dataRate, int8_t &txPower);
+
+    /**
+     * @brief Spreading factor for a data rate
+     */
+    static uint8_t spreadingFactor(uint8_t dataRate);
+
+    /**
+     * @brief Lowest SNR the demodulator can work with at a data rate
+     *
+     * @return int16_t - tenths of a dB
+     */
+    static int16_t requiredSnrTenths(uint8_t dataRate);
+
+    static const int16_t INSTALLATION_MARGIN_TENTHS = 100;  // Fading margin we keep in hand
+    static const uint8_t MIN_SAMPLES = LinkStats::WINDOW / 2;
+    static const uint8_t MIN_SUCCESS_PERCENT = 75;
+};
+
+#endif  /* __LORA_ADR_H */
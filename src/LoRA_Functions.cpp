@@ -1,8 +1,15 @@
 #include "LoRA_Functions.h"
 #include <RHMesh.h>
 #include <RH_RF95.h>						        // https://docs.particle.io/reference/device-os/libraries/r/RH_RF95/
+#include <RHAuthenticatedDriver.h>
+#include <Ascon128.h>
+#include <Acorn128.h>
 #include "device_pinout.h"
 #include "MyPersistentData.h"
+#include "LoRA_Messages.h"
+#include "LoRA_ADR.h"
+#include "ClockSync.h"
+#include "EnergyMonitor.h"
 
 
 // Singleton instantiation - from template
@@ -26,11 +33,81 @@ LoRA_Functions::~LoRA_Functions() {
 // ************************************************************************
 // *****                      LoRA Setup                              *****
 // ************************************************************************
-// In this implementation - we have one gateway numde number 0 and up to 10 nodes with node numbers 1-10
-// Node numbers greater than 10 initiate a join request
+// In this implementation - we have one gateway with node number 0 and nodes the gateway numbers 1 to MAX_NODE_NUMBER
+// A node without a number uses UNCONFIGURED_NODE and initiates a join request
 const uint8_t GATEWAY_ADDRESS = 0;
 // const double RF95_FREQ = 915.0;				 	// Frequency - ISM
 const double RF95_FREQ = 926.84;				// Center frequency for the omni-directional antenna I am using
+const int8_t DEFAULT_TX_POWER = 23;				// dBm - the driver limits this to what PA_BOOST can do
+
+// Frames are encrypted and authenticated with a key shared by the Gateway and every node in the deployment. It is kept out of
+// the source - define LORA_LINK_KEY as the deployment's 16 bytes, comma separated, in the build or in src/link_key.h (gitignored)
+#if !defined(LORA_LINK_KEY) && defined(__has_include)
+#if __has_include("link_key.h")
+#include "link_key.h"
+#endif
+#endif
+#ifndef LORA_LINK_KEY
+#error "No link key - add src/link_key.h with #define LORA_LINK_KEY 0x.., 0x.., ... (16 bytes, the same as the Gateway's)"
+#endif
+const uint8_t LINK_KEY[16] = {LORA_LINK_KEY};
+const uint32_t FIRST_FRAME_COUNTER_RANGE = 0x400000;	// A node with no saved frame counter starts at random below this
+
+// Routes are saved to FRAM when the radio sleeps and restored when it is initialized so we don't need a route discovery broadcast each period
+const bool PERSIST_ROUTES = true;
+const uint32_t ROUTE_TTL_SECONDS = 6 * 3600UL;	// Saved routes older than this are discarded - the mesh may have changed
+
+// TDMA schedule - the Gateway assigns each node a slot in a frame that starts as the nodes wake for the reporting period
+// A slot holds a data report, the data acknowledgement and the hop acks for both, with a guard time at each end
+const uint8_t DATA_RPT_MAX_LEN = RH_MESH_MAX_MESSAGE_LEN;	// Data report carrying as many stored reports as will fit
+const uint8_t HOP_ACK_LEN = 1 + RH_AUTHENTICATED_OVERHEAD;	// RHReliableDatagram acknowledgement
+const uint8_t MESH_HEADER_LEN = sizeof(RHRouter::RoutedMessageHeader) + sizeof(RHMesh::MeshMessageHeader) + RH_AUTHENTICATED_OVERHEAD;
+const uint32_t SLOT_TURNAROUND_MS = 250;		// Time for the receiver to process each frame and start its reply
+const uint32_t SYNC_ERROR_MS = 200;				// How far out the Gateway's time stamp can leave us, even with no drift - see Time sync in LoRA_Functions.h
+const uint32_t MAX_DRIFT_PPM = 100;				// Clock drift the guard time allows for over an hour between syncs
+const uint32_t SLOT_GUARD_MS = SYNC_ERROR_MS + (MAX_DRIFT_PPM * 3600UL) / 1000UL;
+const uint8_t RELAYED_STEP_SYNCS = 3;				// Relayed time stamps that must agree before we follow the Gateway's clock forward
+const uint32_t LEGACY_SLOT_MS = 10000;			// Spacing by node number until the Gateway assigns a slot
+const uint32_t LEGACY_SLOT_COUNT = 12;			// Slot 0 as we wake, one each for node numbers 1-10 and the last shared by higher and unconfigured nodes
+const uint32_t LISTENING_WINDOW_MS = 300000;	// Shortest time we listen each period
+const bool LOW_POWER_LISTENING = true;			// Sleep the receiver when there is nothing we need to hear - see listenLowPower()
+const uint8_t RELAY_CHECK_PERIODS = 8;			// A node that is not relaying listens through the frames one period in this many
+
+// Messages are bit packed - the schemas are in LoRA_Messages.h
+static LoRA_Messages::DataAck dataAck;			// Decoded from buf as each acknowledgement is received
+static LoRA_Messages::JoinAck joinAck;
+
+// Reports that could not be delivered are stored in FRAM (see reportBacklogData) and sent on the end of the next data report
+const uint8_t MAX_BACKLOG_PER_REPORT = 255;		// Sent as Bits<8> - in practice the message length is the limit
+static uint8_t backlogInFlight = 0;				// Stored reports carried by the data report we are sending
+
+// Counts in each COUNT_BUCKET_MINUTES since the last acknowledged report - dropped from currentStatusData once acknowledged
+static_assert(MAX_COUNT_BUCKETS == LoRA_Messages::MAX_HISTOGRAM_BUCKETS, "The histogram must hold every count bucket");
+static uint8_t bucketsInFlight = 0;				// Buckets carried by the data report we are sending
+static uint32_t chargeInFlight = 0;				// Charge estimate the data report we are sending brings the Gateway up to
+
+// Adaptive data rate - the Gateway recommends a data rate and power for our slot, we listen at the default
+static LinkStats gatewayLink;					// Recent exchanges with the Gateway
+static uint8_t linkDataRate = LoRA_ADR::DEFAULT_DATA_RATE;	// Last recommendation from the Gateway
+static int8_t linkTxPower = LoRA_ADR::MAX_TX_POWER;
+static uint8_t messageHops = 0;					// Hops the last message we received took
+static uint32_t slotAirTimeMs = 0;				// Air time of a slot at the default data rate - worked out when the radio is initialized
+static uint8_t radioDataRate = LoRA_ADR::DEFAULT_DATA_RATE;	// What the radio is set to now
+static int8_t radioTxPower = DEFAULT_TX_POWER;
+static bool listening = false;					// Between startListening() and sleepLoRaRadio()
+static uint32_t listenStartMs = 0;
+static bool relayingThisPeriod = false;			// Receiver stays on through the frames
+static uint8_t periodsSinceRelayCheck = RELAY_CHECK_PERIODS;	// So we listen through the first period after a reset
+static uint16_t forwardedAtListenStart = 0;
+static bool awaitingReply = false;				// Our report or join request is out and the Gateway's reply is still to come
+static uint32_t replySentMs = 0;				// When the send started - the reply comes back in our slot
+static uint32_t rxWindowEndMs = 0;				// When the open receive window times out
+static bool radioNapping = false;				// Put to sleep by listenLowPower() - the routes have not been saved
+
+static uint32_t gatewayClockMillis() { return millis(); }
+static ClockSync gatewayClock(gatewayClockMillis);	// The Gateway's time to the millisecond, from its acknowledgements
+static uint8_t relayedTimeDoubts = 0;				// Relayed time stamps in a row that put us too far ahead to use
+static int32_t doubtedOffsetMs = 0;				// How far ahead the last of them put us
 
 // Define the message flags
 typedef enum { NULL_STATE, JOIN_REQ, JOIN_ACK, DATA_RPT, DATA_ACK, ALERT_RPT, ALERT_ACK} LoRA_State;
@@ -40,8 +117,19 @@ static LoRA_State lora_state = NULL_STATE;
 // Singleton instance of the radio driver
 RH_RF95 driver(RFM95_CS, RFM95_INT);
 
+// Link cipher - any CryptoLW AuthenticatedCipher with a 16 byte key and nonce, so Ascon128 or Acorn128. Define LORA_LINK_CIPHER
+// in the build to change it - the Gateway and every node must use the same one. examples/4-Benchmark in CryptoLW-RK
+// measures them: Ascon128 is the faster at our frame sizes and the smaller in flash
+#ifndef LORA_LINK_CIPHER
+#define LORA_LINK_CIPHER Ascon128
+#endif
+
+// Encrypts, authenticates and replay checks every frame between the mesh and the radio
+LORA_LINK_CIPHER linkCipher;
+RHAuthenticatedDriver linkDriver(driver, linkCipher);
+
 // Class to manage message delivery and receipt, using the driver declared above
-RHMesh manager(driver, GATEWAY_ADDRESS);
+RHMesh manager(linkDriver, GATEWAY_ADDRESS);
 
 // Mesh has much greater memory requirements, and you may need to limit the
 // max message length to prevent wierd crashes
@@ -54,8 +142,27 @@ RHMesh manager(driver, GATEWAY_ADDRESS);
 // #define RH_MESH_MAX_MESSAGE_LEN 50
 uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];               // Related to max message size - RadioHead example note: dont put this on the stack:
 
+static float dataReportSuccessPercent = 0.0;		// Computed when the data report is composed, logged when it is delivered
+static void (*sendCompleteHandler)(bool delivered) = NULL;	// Told when each data report or join request send completes
+
+static void dataReportSent(uint8_t handle, bool acked, void* context);
+static void joinRequestSent(uint8_t handle, bool acked, void* context);
+static void useDataRate(uint8_t dataRate, int8_t txPower);
+static void frameCountersReserved(uint32_t reservedTo);
+
 
 bool LoRA_Functions::setup(bool gatewayID) {
+	// Set up the link encryption - a node must never reuse a frame counter so we carry on from the last one reserved
+	linkCipher.setKey(LINK_KEY, sizeof(LINK_KEY));
+	uint32_t frameCounter = sysStatus.get_frameCounterReserved();
+	if (frameCounter == 0) {						// New device - start at random so unjoined nodes sharing an address don't share nonces
+		frameCounter = 1 + HAL_RNG_GetRandomNumber() % FIRST_FRAME_COUNTER_RANGE;
+	}
+	linkDriver.setFrameCounter(frameCounter);
+	linkDriver.setReserveHandler(frameCountersReserved);
+	linkDriver.setSenderId(linkSenderId(System.deviceID()));	// Ours whatever node number we have - in the nonce and the replay check
+	gatewayClock.setDriftPpm(sysStatus.get_clockDriftPpm());
+
     // Set up the Radio Module
 	LoRA_Functions::initializeRadio();
 
@@ -65,13 +172,13 @@ bool LoRA_Functions::setup(bool gatewayID) {
 		sysStatus.set_nodeNumber(GATEWAY_ADDRESS);							// Gateway - Manager is initialized by default with GATEWAY_ADDRESS - make sure it is stored in FRAM
 		Log.info("LoRA Radio initialized as a gateway with a deviceID of %s", System.deviceID().c_str());
 	}
-	else if (sysStatus.get_nodeNumber() > 0 && sysStatus.get_nodeNumber() <= 10) {
+	else if (sysStatus.get_nodeNumber() > 0 && sysStatus.get_nodeNumber() <= MAX_NODE_NUMBER) {
 		manager.setThisAddress(sysStatus.get_nodeNumber());// Node - use the Node address in valid range from memory
 		Log.info("LoRA Radio initialized as node %i and a deviceID of %s", manager.thisAddress(), System.deviceID().c_str());
 	}
 	else {																						// Else, we will set as an unconfigured node
-		sysStatus.set_nodeNumber(11);
-		manager.setThisAddress(11);
+		sysStatus.set_nodeNumber(UNCONFIGURED_NODE);
+		manager.setThisAddress(UNCONFIGURED_NODE);
 		sysStatus.set_alertCodeNode(1);															// Join request required
 		Log.info("LoRA Radio initialized as an unconfigured node %i and a deviceID of %s and alert code %d", manager.thisAddress(), System.deviceID().c_str(), sysStatus.get_alertCodeNode());
 	}
@@ -80,7 +187,122 @@ bool LoRA_Functions::setup(bool gatewayID) {
 }
 
 void LoRA_Functions::loop() {
-    // Put your code to run during the application thread loop here
+	manager.pollSend();								// Moves any message we are sending along - transmit, wait for the ack and retry
+}
+
+bool LoRA_Functions::sendInProgress() {
+	return manager.sendInProgress();
+}
+
+bool LoRA_Functions::lastSendSucceeded() {
+	return manager.lastSendAcked();
+}
+
+uint32_t LoRA_Functions::radioTxMs() {
+	return driver.txTimeMs();
+}
+
+uint32_t LoRA_Functions::radioRxMs() {
+	return driver.rxTimeMs();
+}
+
+void LoRA_Functions::withSendCompleteHandler(void (*handler)(bool delivered)) {
+	sendCompleteHandler = handler;
+}
+
+uint32_t LoRA_Functions::slotMs() {
+	if (sysStatus.get_slotCount() == 0) return LEGACY_SLOT_MS;
+
+	return slotAirTimeMs + 4 * SLOT_TURNAROUND_MS + 2 * SLOT_GUARD_MS;
+}
+
+uint32_t LoRA_Functions::frameMs() {
+	if (sysStatus.get_slotCount() == 0) return LEGACY_SLOT_COUNT * LEGACY_SLOT_MS;
+	return sysStatus.get_slotCount() * slotMs();
+}
+
+uint32_t LoRA_Functions::transmitDelayMs() {
+	if (sysStatus.get_slotCount() == 0) return min((uint32_t)sysStatus.get_nodeNumber(), LEGACY_SLOT_COUNT - 1) * LEGACY_SLOT_MS;
+
+	int32_t slotStartMs = sysStatus.get_slotIndex() * slotMs() + SLOT_GUARD_MS;
+	uint32_t periodMs = sysStatus.get_frequencyMinutes() * 60000UL;
+	if (gatewayClock.synced() && periodMs > 0) {
+		// Timed from the reporting boundary on the Gateway's clock, however early or late we woke for it
+		int32_t intoPeriodMs = gatewayClock.now() % periodMs;
+		if (intoPeriodMs > (int32_t)(periodMs / 2)) intoPeriodMs -= periodMs;	// Woke a little before the boundary
+		return (slotStartMs > intoPeriodMs) ? slotStartMs - intoPeriodMs : 0;
+	}
+
+	// Not synced since a reset - if our clock runs fast we woke early, so wait that much longer to line up with the Gateway's frame
+	int32_t correctionMs = 0;
+	if (Time.isValid() && sysStatus.get_lastConnection() > 0 && Time.now() > sysStatus.get_lastConnection()) {
+		correctionMs = ((int32_t)sysStatus.get_clockDriftPpm() * (int32_t)(Time.now() - sysStatus.get_lastConnection())) / 1000;
+		correctionMs = constrain(correctionMs, -(int32_t)(SLOT_GUARD_MS - SYNC_ERROR_MS), (int32_t)(SLOT_GUARD_MS - SYNC_ERROR_MS));
+	}
+	return slotStartMs + correctionMs;
+}
+
+uint64_t LoRA_Functions::gatewayTimeMs() {
+	return gatewayClock.now();
+}
+
+void LoRA_Functions::restoreGatewayTime(uint64_t ms) {
+	if (!gatewayClock.synced()) gatewayClock.sync(ms, false);
+}
+
+uint32_t LoRA_Functions::msToNextPeriod() {
+	uint32_t periodMs = sysStatus.get_frequencyMinutes() * 60000UL;
+	if (!gatewayClock.synced() || periodMs == 0) return 0;
+
+	return periodMs - gatewayClock.now() % periodMs;
+}
+
+uint32_t LoRA_Functions::listeningWindowMs() {
+	uint32_t window = transmitDelayMs() + 2 * frameMs();	// Our slot and the same slot in the next frame for a retry
+	return (window > LISTENING_WINDOW_MS) ? window : LISTENING_WINDOW_MS;
+}
+
+void LoRA_Functions::startListening() {
+	uint16_t forwarded = manager.forwarded();
+
+	listening = true;
+	listenStartMs = millis();
+	awaitingReply = false;
+	// Keep listening through the frames while others route through us - and now and then so a new node can find us
+	relayingThisPeriod = (forwarded != forwardedAtListenStart) || ++periodsSinceRelayCheck >= RELAY_CHECK_PERIODS;
+	if (relayingThisPeriod) periodsSinceRelayCheck = 0;
+	forwardedAtListenStart = forwarded;
+}
+
+uint32_t LoRA_Functions::listenLowPower() {
+	uint32_t now = millis();
+
+	if (!LOW_POWER_LISTENING || !listening || sysStatus.get_slotCount() == 0 || !Time.isValid() || manager.sendInProgress()
+		|| (relayingThisPeriod && now - listenStartMs < 2 * frameMs() + SLOT_GUARD_MS)) {
+		driver.setReceiveOnDemand(false);			// available() keeps the receiver on
+		return 0;
+	}
+	driver.setReceiveOnDemand(true);
+	if (driver.rxQueued() > 0) return 0;			// Take what the last window caught first
+
+	if (awaitingReply && now - replySentMs < slotMs()) {
+		if (!driver.receiveWindowOpen()) {
+			uint32_t symbolUs = driver.symbolTimeUs();
+			if (symbolUs == 0) return 0;
+			uint32_t symbols = ((slotMs() - (now - replySentMs)) * 1000UL) / symbolUs + 1;
+			if (symbols > RH_RF95_MAX_SYMB_TIMEOUT) symbols = RH_RF95_MAX_SYMB_TIMEOUT;
+			driver.setModeRxSingle(symbols);
+			rxWindowEndMs = now + (symbols * symbolUs + 999UL) / 1000UL;
+		}
+		return ((int32_t)(rxWindowEndMs - now) > 0) ? rxWindowEndMs - now : 0;	// Past the timeout we are receiving a frame - stay up for it
+	}
+	awaitingReply = false;
+
+	if (driver.mode() != RHGenericDriver::RHModeSleep) {
+		driver.sleep();
+		radioNapping = true;
+	}
+	return 0xffffffff;								// Nothing to hear until the state machine's next event
 }
 
 
@@ -97,6 +319,14 @@ void LoRA_Functions::clearBuffer() {
 }
 
 void LoRA_Functions::sleepLoRaRadio() {
+	manager.cancelSend();							// Abandon any send in progress so it does not retry when we wake
+	useDataRate(LoRA_ADR::DEFAULT_DATA_RATE, DEFAULT_TX_POWER);	// Wake up listening where everyone else is
+	listening = false;
+	awaitingReply = false;
+	driver.setReceiveOnDemand(false);
+	if (driver.mode() == RHGenericDriver::RHModeSleep && !radioNapping) return;	// Already asleep - nothing new to save
+	radioNapping = false;
+	if (PERSIST_ROUTES) LoRA_Functions::saveRoutes();
 	driver.sleep();                             	// Here is where we will power down the LoRA radio module
 }
 
@@ -111,15 +341,59 @@ bool  LoRA_Functions::initializeRadio() {  			// Set up the Radio Module
 		return false;
 	}
 	driver.setFrequency(RF95_FREQ);					// Frequency is typically 868.0 or 915.0 in the Americas, or 433.0 in the EU - Are there more settings possible here?
-	driver.setTxPower(23, false);                   // If you are using RFM95/96/97/98 modules which uses the PA_BOOST transmitter pin, then you can set transmitter powers from 5 to 23 dBm (13dBm default).  PA_BOOST?
+	driver.setTxPower(DEFAULT_TX_POWER, false);                   // If you are using RFM95/96/97/98 modules which uses the PA_BOOST transmitter pin, then you can set transmitter powers from 5 to 23 dBm (13dBm default).  PA_BOOST?
 
 	driver.setModemConfig(RH_RF95::Bw125Cr45Sf2048);
 	// driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);	// This optimized the radio for long range - https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html
 	driver.setLowDatarate();						// https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html#a8e2df6a6d2cb192b13bd572a7005da67
+	radioDataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+	radioTxPower = DEFAULT_TX_POWER;
 	manager.setTimeout(1000);						// 200mSec is the default - may need to extend once we play with other settings on the modem - https://www.airspayce.com/mikem/arduino/RadioHead/classRHReliableDatagram.html
+	// Slots are sized for the default data rate - the frame is the same for every node whatever rate it uses
+	slotAirTimeMs = driver.timeOnAir(DATA_RPT_MAX_LEN + MESH_HEADER_LEN) + driver.timeOnAir(HOP_ACK_LEN)
+				  + driver.timeOnAir(LoRA_Messages::maxEncodedLen<LoRA_Messages::DataAck>() + MESH_HEADER_LEN) + driver.timeOnAir(HOP_ACK_LEN);
+	if (PERSIST_ROUTES) LoRA_Functions::restoreRoutes();
 return true;
 }
 
+uint8_t LoRA_Functions::saveRoutes() {
+	savedRoutesData::RouteRecord routes[savedRoutesData::MAX_SAVED_ROUTES];
+	uint8_t count = 0;
+
+	if (!Time.isValid()) return 0;					// Can't age the routes without a valid clock
+
+	for (int dest = 0; dest < 256 && count < savedRoutesData::MAX_SAVED_ROUTES; dest++) {
+		const RHRouter::RoutingTableEntry *route = manager.peekRouteTo(dest);
+		if (!route || route->state != RHRouter::Valid) continue;
+		routes[count].dest = route->dest;
+		routes[count].nextHop = route->next_hop;
+		routes[count].rssi = route->rssi;
+		routes[count].ageSeconds = (millis() - route->learned) / 1000UL;
+		count++;
+	}
+	savedRoutes.saveRoutes(routes, count, Time.now());
+	Log.info("Saved %d routes", count);
+	return count;
+}
+
+uint8_t LoRA_Functions::restoreRoutes() {
+	savedRoutesData::RouteRecord route;
+	uint8_t restored = 0;
+
+	if (!Time.isValid() || savedRoutes.get_savedAt() == 0 || Time.now() < savedRoutes.get_savedAt()) return 0;
+	uint32_t sinceSaved = Time.now() - savedRoutes.get_savedAt();
+
+	for (uint8_t i = 0; savedRoutes.get_route(i, route); i++) {
+		uint32_t ageSeconds = route.ageSeconds + sinceSaved;
+		if (ageSeconds > ROUTE_TTL_SECONDS) continue;		// Too old to trust
+		if (manager.peekRouteTo(route.dest)) continue;		// We already know a more recent route
+		manager.restoreRouteTo(route.dest, route.nextHop, route.rssi, ageSeconds * 1000UL);
+		restored++;
+	}
+	Log.info("Restored %d of %d saved routes", restored, savedRoutes.get_routeCount());
+	return restored;
+}
+
 
 // ************************************************************************
 // *****                         Node Functions                       *****
@@ -132,26 +406,61 @@ bool LoRA_Functions::listenForLoRAMessageNode() {
 	uint8_t messageFlag;
 	uint8_t hops;
 	if (manager.recvfromAck(buf, &len, &from, &dest, &id, &messageFlag, &hops))	{	// We have received a message
-		buf[len] = 0;
-		if ((buf[0] << 8 | buf[1]) != sysStatus.get_magicNumber()) {
+		LoRA_Messages::AckHeader header;
+		if (!LoRA_Messages::decode(header, buf, len) || header.magicNumber != sysStatus.get_magicNumber()) {
 			Log.info("Magic Number mismatch - ignoring message");
 			return false;
 		} 
 		lora_state = (LoRA_State)messageFlag;
+		messageHops = hops;
 		Log.info("Received from node %d with RSSI / SNR of %d / %d - a %s message with %d hops", from, driver.lastRssi(), driver.lastSNR(), loraStateNames[lora_state], hops);
 
-		Time.setTime(((buf[2] << 24) | (buf[3] << 16) | (buf[4] << 8) | buf[5]));  // Set time based on response from gateway
-		sysStatus.set_frequencyMinutes((buf[6] << 8 | buf[7]));			// Frequency of reporting set by Gateway
+		if (lora_state == DATA_ACK) {
+			if (!LoRA_Messages::decode(dataAck, buf, len)) {Log.info("Data acknowledgement too short - %d bytes", len); return false;}
+		}
+		else if (lora_state == JOIN_ACK) {
+			if (!LoRA_Messages::decode(joinAck, buf, len)) {Log.info("Join acknowledgement too short - %d bytes", len); return false;}
+			// Every unconfigured node has the same node number, so the acknowledgement may be another device's
+			if (joinAck.nodeID != stringCheckSum(System.deviceID()) || joinAck.senderId != linkSenderId(System.deviceID())) {
+				Log.info("Join acknowledgement for nodeID %d - not us", joinAck.nodeID);
+				return false;
+			}
+		}
+		else {Log.info("Invaled LoRA message flag"); return false;}
+		awaitingReply = false;										// Nothing more to listen for in our slot
+
+		// The Gateway stamped the frame as it started sending - add the time on air and the time since it arrived
+		uint32_t airMs = driver.lastRxTimeOnAir();		// Before the data rate goes back to the default
+		uint64_t gatewayMs = (uint64_t)header.time * 1000ULL + header.timeMs + airMs + (millis() - driver.lastRxDoneMs());
+		if (hops > 0) gatewayMs += hops * (driver.timeOnAir(HOP_ACK_LEN) + SLOT_TURNAROUND_MS + airMs);	// Each relay acks it and sends it on - an estimate
+		int64_t expectedOffsetMs = (gatewayClock.synced()) ? (int64_t)gatewayClock.now() - (int64_t)gatewayMs : 0;
+		// A relay that had to retry makes the time stamp late, so it only ever puts us ahead. Within the drift the guard
+		// allows for it cannot be a retry; further ahead is only taken as the Gateway's clock stepping once it repeats
+		int32_t plausibleMs = SLOT_GUARD_MS - SYNC_ERROR_MS;
+		bool consistent = relayedTimeDoubts > 0 && expectedOffsetMs - doubtedOffsetMs <= (int64_t)SYNC_ERROR_MS && expectedOffsetMs - doubtedOffsetMs >= -(int64_t)SYNC_ERROR_MS;
+		if (hops > 0 && gatewayClock.synced() && expectedOffsetMs > plausibleMs && !(consistent && relayedTimeDoubts >= RELAYED_STEP_SYNCS - 1)) {
+			relayedTimeDoubts = (consistent) ? relayedTimeDoubts + 1 : 1;
+			doubtedOffsetMs = (int32_t)constrain(expectedOffsetMs, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+			Log.info("Relayed time puts us %li mSec ahead - not used", (long)doubtedOffsetMs);
+		}
+		else {
+			relayedTimeDoubts = 0;
+			bool measureDrift = (hops == 0) || (expectedOffsetMs <= plausibleMs && expectedOffsetMs >= -plausibleMs);
+			int32_t offsetMs = gatewayClock.sync(gatewayMs, measureDrift);
+			if (gatewayClock.driftPpm() != sysStatus.get_clockDriftPpm()) sysStatus.set_clockDriftPpm(gatewayClock.driftPpm());
+			Log.info("Clock was %li mSec out - drift %d ppm", offsetMs, sysStatus.get_clockDriftPpm());
+		}
+		Time.setTime(gatewayClock.now() / 1000ULL);  // Set time based on response from gateway
+		sysStatus.set_frequencyMinutes(header.frequencyMinutes);		// Frequency of reporting set by Gateway
 
 		// The gateway may set an alert code for the node
-		sysStatus.set_alertCodeNode(buf[8]);
+		sysStatus.set_alertCodeNode(header.alertCode);
 		sysStatus.set_alertTimestampNode(Time.now());
 
 		Log.info("Set clock to %s and report frequency to %d minutes", Time.timeStr().c_str(),sysStatus.get_frequencyMinutes());
 
 		if (lora_state == DATA_ACK) { if(LoRA_Functions::instance().receiveAcknowledmentDataReportNode()) return true;}
 		else if (lora_state == JOIN_ACK) { if(LoRA_Functions::instance().receiveAcknowledmentJoinRequestNode()) return true;}
-		else {Log.info("Invaled LoRA message flag"); return false;}
 
 	}
 	else LoRA_Functions::clearBuffer();
@@ -160,7 +469,7 @@ bool LoRA_Functions::listenForLoRAMessageNode() {
 
 
 bool LoRA_Functions::composeDataReportNode() {
-	float successPercent;
+	float &successPercent = dataReportSuccessPercent;
 
 	if (current.get_messageCount()==0) {		// 8-bit number so need to protect against divide by zero on reset or wrap around
 		successPercent = 0.0;	
@@ -172,40 +481,68 @@ bool LoRA_Functions::composeDataReportNode() {
 
 	digitalWrite(BLUE_LED,HIGH);
 
-	int deviceIDCheckSum = stringCheckSum(System.deviceID());
-
-	buf[0] = highByte(sysStatus.get_magicNumber());
-	buf[1] = lowByte(sysStatus.get_magicNumber());			
-	buf[2] = highByte(deviceIDCheckSum);
-	buf[3] = lowByte(deviceIDCheckSum);
-	buf[4] = highByte(current.get_hourlyCount());
-	buf[5] = lowByte(current.get_hourlyCount()); 
-	buf[6] = highByte(current.get_dailyCount());
-	buf[7] = lowByte(current.get_dailyCount()); 
-	buf[8] = sysStatus.get_sensorType();
-	buf[9] = current.get_internalTempC();
-	buf[10] = current.get_stateOfCharge();
-	buf[11] = current.get_batteryState();	
-	buf[12] = sysStatus.get_resetCount();
-	buf[13] = current.get_messageCount();
-	buf[14] = current.get_successCount();
-	buf[15] = highByte(current.get_RSSI());
-	buf[16] = lowByte(current.get_RSSI());
-	buf[17] = highByte(current.get_SNR());
-	buf[18] = lowByte(current.get_SNR());
+	LoRA_Messages::DataReport report;
+	report.magicNumber = sysStatus.get_magicNumber();
+	report.nodeID = stringCheckSum(System.deviceID());
+	report.hourly = current.get_hourlyCount();
+	report.daily = current.get_dailyCount();
+	report.sensorType = sysStatus.get_sensorType();
+	report.temp = current.get_internalTempC();
+	report.battChg = (uint8_t)current.get_stateOfCharge();
+	report.battState = current.get_batteryState();
+	report.resets = sysStatus.get_resetCount();
+	report.messageCount = current.get_messageCount();
+	report.successCount = current.get_successCount();
+	report.rssi = current.get_RSSI();
+	report.snr = current.get_SNR();
+
+	// Only whole buckets are sent - the one we are in is still filling
+	time_t bucketStart = current.get_bucketStart();
+	bucketsInFlight = current.completeBuckets(Time.now());
+	report.histogramStart = (bucketStart % 86400) / (COUNT_BUCKET_MINUTES * 60);
+	report.histogram.count = bucketsInFlight;
+	for (uint8_t i = 0; i < bucketsInFlight; i++) report.histogram.buckets[i] = current.get_countBucket(i);
+
+	chargeInFlight = EnergyMonitor::instance().chargeUah();
+	report.chargeUah = (EnergyMonitor::instance().reporting()) ? EnergyMonitor::instance().chargeSinceReportUah() : 0;
+
+	LoRA_Messages::BitWriter writer(buf, DATA_RPT_MAX_LEN);
+	writer.put(report);
+
+	// Drain as many stored reports as will fit - they are marked sent when the Gateway acknowledges this report
+	reportBacklogData::ReportRecord record;
+	size_t countPos = writer.position();
+	backlogInFlight = 0;
+	writer.write(0, 8);													// Count of stored reports - filled in below
+	while (backlogInFlight < MAX_BACKLOG_PER_REPORT && reportBacklog.peek(backlogInFlight, record)) {
+		LoRA_Messages::StoredReport stored;
+		stored.timestamp = record.timestamp;
+		stored.hourly = record.hourlyCount;
+		stored.daily = record.dailyCount;
+
+		size_t mark = writer.position();
+		if (!writer.put(stored)) {										// No room for this one - it waits for the next report
+			writer.rewind(mark);
+			break;
+		}
+		backlogInFlight++;
+	}
+	if (backlogInFlight > 0) {
+		writer.writeAt(countPos, backlogInFlight, 8);
+		Log.info("Data report carries %d of %d stored reports", backlogInFlight, reportBacklog.pendingCount());
+	}
+	else writer.rewind(countPos);										// No stored reports - leave the count off
+	uint8_t len = writer.length();
 
 	// Send a message to manager_server
   	// A route to the destination will be automatically discovered.
-	unsigned char result = manager.sendtoWait(buf, 19, GATEWAY_ADDRESS, DATA_RPT);
+	// The send completes in the background - loop() services it and dataReportSent() reports the outcome
+	useDataRate(linkDataRate, linkTxPower);								// Our slot - use what the Gateway recommended
+	unsigned char result = manager.sendtoAsync(buf, len, GATEWAY_ADDRESS, DATA_RPT, dataReportSent);
 	
 	if ( result == RH_ROUTER_ERROR_NONE) {
-		// It has been reliably delivered to the next node.
-		// Now wait for a reply from the ultimate server 
-		current.set_successCount(current.get_successCount()+1);
-		current.set_RSSI(driver.lastRssi());				// Set these here - will send on next data report
-		current.set_SNR(driver.lastSNR());
-		Log.info("Node %d data report delivered - success rate %4.2f and  RSSI/SNR of %d / %d ",sysStatus.get_nodeNumber(),successPercent,current.get_RSSI(), current.get_SNR());
-		digitalWrite(BLUE_LED, LOW);
+		awaitingReply = true;											// The Data Ack should come back in our slot
+		replySentMs = millis();
 		return true;
 	}
 	else if (result == RH_ROUTER_ERROR_NO_ROUTE) {
@@ -217,19 +554,44 @@ bool LoRA_Functions::composeDataReportNode() {
 	else  {
 		Log.info("Node %d - Data report send to gateway %d failed  - Unknown - success rate %4.2f", sysStatus.get_nodeNumber(), GATEWAY_ADDRESS,successPercent);
 	}
+	useDataRate(LoRA_ADR::DEFAULT_DATA_RATE, DEFAULT_TX_POWER);
 	digitalWrite(BLUE_LED, LOW);
 	return false;
 }
 
+static void dataReportSent(uint8_t handle, bool acked, void* context) {
+	gatewayLink.record(acked, driver.lastRssi(), driver.lastSNR());
+
+	if (acked) {
+		// It has been reliably delivered to the next node.
+		// Now wait for a reply from the ultimate server 
+		current.set_successCount(current.get_successCount()+1);
+		current.set_RSSI(driver.lastRssi());				// Set these here - will send on next data report
+		current.set_SNR(driver.lastSNR());
+		Log.info("Node %d data report delivered - success rate %4.2f and  RSSI/SNR of %d / %d ",sysStatus.get_nodeNumber(),dataReportSuccessPercent,current.get_RSSI(), current.get_SNR());
+	}
+	else {
+		Log.info("Node %d - Data report send to gateway %d failed - Unable to Deliver - success rate %4.2f", sysStatus.get_nodeNumber(), GATEWAY_ADDRESS,dataReportSuccessPercent);
+		useDataRate(LoRA_ADR::DEFAULT_DATA_RATE, DEFAULT_TX_POWER);			// Back to listening with everyone else
+		if (gatewayLink.consecutiveFailures() >= LoRA_ADR::FALLBACK_FAILURES && linkDataRate != LoRA_ADR::DEFAULT_DATA_RATE) {
+			Log.info("ADR - %d failures in a row - back to the default data rate", gatewayLink.consecutiveFailures());
+			linkDataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+			linkTxPower = LoRA_ADR::MAX_TX_POWER;
+		}
+	}
+	digitalWrite(BLUE_LED, LOW);
+	if (sendCompleteHandler) sendCompleteHandler(acked);
+}
+
 bool LoRA_Functions::receiveAcknowledmentDataReportNode() {
 	LEDStatus blinkBlue(RGB_COLOR_BLUE, LED_PATTERN_BLINK, LED_SPEED_NORMAL, LED_PRIORITY_IMPORTANT);
 
-	// contents of response for 1-7 handled in common function above
-	sysStatus.set_alertCodeNode(buf[8]);
+	// contents of the header handled in common function above
+	sysStatus.set_alertCodeNode(dataAck.alertCode);
 
 	if (sysStatus.get_alertCodeNode() == 7) {		// This alert triggers an update to the sensor type on the node - handle it here
-		Log.info("The gatway is updating sensor type from %d to %d", sysStatus.get_sensorType(), buf[9]);
-		sysStatus.set_sensorType(buf[9]);
+		Log.info("The gatway is updating sensor type from %d to %d", sysStatus.get_sensorType(), dataAck.sensorType);
+		sysStatus.set_sensorType(dataAck.sensorType);
 		sysStatus.set_alertCodeNode(0);				// Sensor updated - clear alert
 	}
 	else if (sysStatus.get_alertCodeNode()) {
@@ -237,7 +599,29 @@ bool LoRA_Functions::receiveAcknowledmentDataReportNode() {
 		sysStatus.set_alertTimestampNode(Time.now());	
 	}
 
-	sysStatus.set_openHours(buf[10]);				// The Gateway tells us whether the park is open or closed
+	sysStatus.set_openHours(dataAck.openHours);		// The Gateway tells us whether the park is open or closed
+
+	if (backlogInFlight > 0) {						// The Gateway tells us how many of the stored reports we sent with this one it has
+		reportBacklog.consume(min(backlogInFlight, dataAck.storedReports));
+		Log.info("%d stored reports delivered - %d still pending", min(backlogInFlight, dataAck.storedReports), reportBacklog.pendingCount());
+		backlogInFlight = 0;
+	}
+
+	current.shiftBuckets(bucketsInFlight, Time.now());		// The Gateway has these buckets - start the next histogram after them
+	bucketsInFlight = 0;
+	EnergyMonitor::instance().reportAcknowledged(chargeInFlight);
+
+	LoRA_Functions::setSlot(dataAck.slotIndex, dataAck.slotCount);
+
+	useDataRate(LoRA_ADR::DEFAULT_DATA_RATE, DEFAULT_TX_POWER);		// Our slot is over - listen with everyone else
+	uint8_t dataRate = (messageHops == 0 && dataAck.dataRate <= LoRA_ADR::MAX_DATA_RATE) ? dataAck.dataRate : LoRA_ADR::DEFAULT_DATA_RATE;	// Relayed - the relays only hear the default
+	int8_t txPower = constrain((int8_t)dataAck.txPower, LoRA_ADR::MIN_TX_POWER, LoRA_ADR::MAX_TX_POWER);
+	if (dataRate != linkDataRate || txPower != linkTxPower) {
+		Log.info("ADR - Gateway recommends SF%d at %ddBm (was SF%d at %ddBm)", LoRA_ADR::spreadingFactor(dataRate), txPower, LoRA_ADR::spreadingFactor(linkDataRate), linkTxPower);
+		if (dataRate != linkDataRate) gatewayLink.reset();			// Samples taken at the old data rate no longer apply
+		linkDataRate = dataRate;
+		linkTxPower = txPower;
+	}
 
 	if (sysStatus.get_openHours() == 0) {			// Open Hours Processing
 		current.resetEverything();
@@ -245,7 +629,7 @@ bool LoRA_Functions::receiveAcknowledmentDataReportNode() {
 	}
 	else sysStatus.set_openHours(true);
 
-	Log.info("Data report acknowledged %s alert for message %d park is %s and alert code is %d", (sysStatus.get_alertCodeNode()) ? "with":"without", buf[11], (buf[10] ==1) ? "open":"closed", sysStatus.get_alertCodeNode());
+	Log.info("Data report acknowledged %s alert for message %d park is %s and alert code is %d", (sysStatus.get_alertCodeNode()) ? "with":"without", dataAck.messageNumber, (dataAck.openHours == 1) ? "open":"closed", sysStatus.get_alertCodeNode());
 	
 	blinkBlue.setActive(true);
 	unsigned long strength = (unsigned long)(map(current.get_RSSI(),-10,-140,3000,100));
@@ -257,42 +641,56 @@ bool LoRA_Functions::receiveAcknowledmentDataReportNode() {
 }
 
 bool LoRA_Functions::composeJoinRequesttNode() {
-	char deviceID[25];
-	System.deviceID().toCharArray(deviceID, 25);					// the deviceID is 24 charcters long
-	int deviceIDCheckSum = stringCheckSum(System.deviceID());
+	LoRA_Messages::JoinRequest request;
+	System.deviceID().toCharArray(request.deviceID, sizeof(request.deviceID));	// the deviceID is 24 charcters long
+	request.nodeID = stringCheckSum(System.deviceID());
+	request.magicNumber = sysStatus.get_magicNumber();
+	request.sensorType = sysStatus.get_sensorType();
 
 	manager.setThisAddress(sysStatus.get_nodeNumber());				// Join with the right node number
+	useDataRate(LoRA_ADR::DEFAULT_DATA_RATE, DEFAULT_TX_POWER);		// The Gateway has not given us a slot to use anything else in
 
-	buf[0] = highByte(sysStatus.get_magicNumber());					// Needs to equal 128
-	buf[1] = lowByte(sysStatus.get_magicNumber());					// Needs to equal 128
-	buf[2] = highByte(deviceIDCheckSum);
-	buf[3] = lowByte(deviceIDCheckSum);
-	for (uint8_t i=0; i < sizeof(deviceID); i++) {
-		buf[i+4] = deviceID[i];
-	}
-	buf[29] = sysStatus.get_sensorType();
+	uint8_t len = LoRA_Messages::encode(request, buf, sizeof(buf));
 
 	digitalWrite(BLUE_LED,HIGH);
-	unsigned char result = manager.sendtoWait(buf, 30, GATEWAY_ADDRESS, JOIN_REQ);
-	digitalWrite(BLUE_LED, LOW);
+	unsigned char result = manager.sendtoAsync(buf, len, GATEWAY_ADDRESS, JOIN_REQ, joinRequestSent);	// joinRequestSent() reports the outcome
 
-	if (result == RH_ROUTER_ERROR_NONE) {					// It has been reliably delivered to the next node.
-		current.set_RSSI(driver.lastRssi());				// Set these here - will send on next data report
-		current.set_SNR(driver.lastSNR());
-		Log.info("Join request sent to gateway successfully RSSI/SNR of %d / %d ",current.get_RSSI(), current.get_SNR());
+	if (result == RH_ROUTER_ERROR_NONE) {
+		awaitingReply = true;
+		replySentMs = millis();
 		return true;
 	}
 	else {
+		digitalWrite(BLUE_LED, LOW);
 		Log.info("Join request to Gateway failed");
 		return false;
 	}
 }
 
+static void joinRequestSent(uint8_t handle, bool acked, void* context) {
+	digitalWrite(BLUE_LED, LOW);
+
+	if (acked) {											// It has been reliably delivered to the next node.
+		current.set_RSSI(driver.lastRssi());				// Set these here - will send on next data report
+		current.set_SNR(driver.lastSNR());
+		Log.info("Join request sent to gateway successfully RSSI/SNR of %d / %d ",current.get_RSSI(), current.get_SNR());
+	}
+	else Log.info("Join request to Gateway failed");
+	if (sendCompleteHandler) sendCompleteHandler(acked);
+}
+
 bool LoRA_Functions::receiveAcknowledmentJoinRequestNode() {
 	LEDStatus blinkOrange(RGB_COLOR_ORANGE, LED_PATTERN_BLINK, LED_SPEED_NORMAL, LED_PRIORITY_IMPORTANT);
 
-	if (sysStatus.get_nodeNumber() > 10) sysStatus.set_nodeNumber(buf[9]);
-	sysStatus.set_sensorType(buf[10]);
+	if (sysStatus.get_nodeNumber() > MAX_NODE_NUMBER) {
+		if (joinAck.newNodeNumber < 1 || joinAck.newNodeNumber > MAX_NODE_NUMBER) {
+			Log.info("Join acknowledgement with node number %d - not one the Gateway can assign", joinAck.newNodeNumber);
+			return false;
+		}
+		sysStatus.set_nodeNumber(joinAck.newNodeNumber);
+	}
+	sysStatus.set_sensorType(joinAck.sensorType);
+	LoRA_Functions::setSlot(joinAck.slotIndex, joinAck.slotCount);
 	Log.info("Node %d Join request acknowledged and sensor set to %d", sysStatus.get_nodeNumber(), sysStatus.get_sensorType());
 	manager.setThisAddress(sysStatus.get_nodeNumber());
 
@@ -306,6 +704,35 @@ bool LoRA_Functions::receiveAcknowledmentJoinRequestNode() {
 }
 
 
+static void useDataRate(uint8_t dataRate, int8_t txPower) {
+	if (dataRate == radioDataRate && txPower == radioTxPower) return;
+
+	// 125kHz, 4/5, explicit header, CRC on, AGC on - the same as Bw125Cr45Sf2048 at the default data rate
+	RH_RF95::ModemConfig config = {0x72, (uint8_t)((LoRA_ADR::spreadingFactor(dataRate) << 4) | 0x04), 0x04};
+	driver.setModemRegisters(&config);
+	driver.setLowDatarate();						// Sets low data rate optimization for SF11 and above
+	driver.setTxPower(txPower, false);
+	radioDataRate = dataRate;
+	radioTxPower = txPower;
+}
+
+static void frameCountersReserved(uint32_t reservedTo) {
+	sysStatus.set_frameCounterReserved(reservedTo);
+	sysStatus.flush(true);							// Saved before any counter in the block is sent - a reset must not reuse one
+}
+
+void LoRA_Functions::setSlot(uint16_t slotIndex, uint16_t slotCount) {
+	if (slotCount == 0 || slotIndex >= slotCount) {
+		Log.info("Ignoring invalid slot %d of %d", slotIndex, slotCount);
+		return;
+	}
+	if (slotIndex != sysStatus.get_slotIndex() || slotCount != sysStatus.get_slotCount()) {
+		sysStatus.set_slotIndex(slotIndex);
+		sysStatus.set_slotCount(slotCount);
+		Log.info("Gateway assigned slot %d of %d - %lu mSec slots", slotIndex, slotCount, LoRA_Functions::slotMs());
+	}
+}
+
 int LoRA_Functions::stringCheckSum(String str){												// This function is made for the Particle DeviceID
     int result = 0;
     for(unsigned int i = 0; i < str.length(); i++){
@@ -324,3 +751,12 @@ int LoRA_Functions::stringCheckSum(String str){												// This function is m
     return result;
 }
 
+uint32_t LoRA_Functions::linkSenderId(String deviceID) {
+	uint32_t hash = 2166136261UL;										// 32 bit FNV-1a
+	for (unsigned int i = 0; i < deviceID.length(); i++) {
+		hash ^= (uint8_t)deviceID[i];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
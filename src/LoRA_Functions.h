@@ -8,50 +8,129 @@
  */
 
 // Data exchange formats
+// Messages are bit packed, most significant bit first - the schemas are in LoRA_Messages.h. Widths are in bits, varint is 8 or more
 // Format of a data report
 /*
-buf[0 - 1] magicNumber                      // Magic number for devices
-buf[2 - 3] nodeID                           // nodeID for verification
-buf[4 - 5] hourly                           // Hourly count
-buf[6 - 7] daily                            // Daily Count
-buf[8] sensorType                           // What sensor type is it
-buf[9] temp;                                // Enclosure temp
-buf[10] battChg;                            // State of charge
-buf[11] battState;                          // Battery State
-buf[12] resets                              // Reset count
-buf[13] messageCount;                       // Sequential message number
-buf[14] successCount;                       // How Many successful sends
-buf[15-16] RSSI                             // From the Node's perspective
-buf[17-18] SNR                              // From the Node's perspective
+16 magicNumber                              // Magic number for devices
+9 nodeID                                    // nodeID for verification
+varint hourly                               // Hourly count
+varint daily                                // Daily Count
+4 sensorType                                // What sensor type is it
+8 temp;                                     // Enclosure temp - signed
+7 battChg;                                  // State of charge
+3 battState;                                // Battery State
+8 resets                                    // Reset count
+8 messageCount;                             // Sequential message number
+8 successCount;                             // How Many successful sends
+9 RSSI                                      // From the Node's perspective - signed
+7 SNR                                       // From the Node's perspective - signed
+9 histogramStart                            // 5 minute interval of the day (UTC) the first bucket starts in
+histogram                                   // Counts in each 5 minute interval since the last acknowledged report - see below
+varint chargeUah                            // Estimated charge used since the last acknowledged report in uAh - 0 if not reported
+8 backlogCount                              // Stored reports that follow - optional, only sent when there are reports that could not be delivered
+backlog                                     // backlogCount stored reports, oldest first, up to RH_MESH_MAX_MESSAGE_LEN
+*/
+
+// Format of the histogram - the narrower of the counts or their changes
+/*
+4 bucketCount                               // Whole intervals - 0 to 12
+1 mode                                      // 0 - counts, 1 - first count then the change from the count before - only if bucketCount > 0
+5 width                                     // Bits in each count - 0 when every bucket is empty
+mode 0:
+width x bucketCount buckets
+mode 1:
+width first                                 // The first bucket
+5 deltaWidth                                // Bits in each change
+deltaWidth x (bucketCount - 1) changes      // Zigzag encoded - 0, -1, 1, -2 ... as 0, 1, 2, 3 ...
+*/
+
+// Format of a stored report - one that could not be delivered when it was due
+/*
+32 timestamp                                // When the report should have been sent
+varint hourly                               // Hourly count at that time
+varint daily                                // Daily count at that time
 */
 
 // Format of a data acknowledgement
 /*    
-    buf[0 - 1 ] magicNumber                 // Magic Number
-    buf[2 - 5 ] Time.now()                  // Set the time 
-    buf[6 - 7] frequencyMinutes             // For the Gateway minutes on the hour
-    buf[8] alertCode                        // This lets the Gateway trigger an alert on the node - typically a join request
-    buf[9] sensorType                       // Let's the Gateway reset the sensor if needed 
-    buf[10] openHours                       // From the Gateway to the node - is the park open?
-    buf[11] message number                  // Parrot this back to see if it matches
+16 magicNumber                              // Magic Number
+32 Time.now()                               // Set the time 
+10 timeMs                                   // Milliseconds past Time.now() when the Gateway starts sending - see Time sync below
+varint frequencyMinutes                     // For the Gateway minutes on the hour
+4 alertCode                                 // This lets the Gateway trigger an alert on the node - typically a join request
+4 sensorType                                // Let's the Gateway reset the sensor if needed 
+1 openHours                                 // From the Gateway to the node - is the park open?
+8 message number                            // Parrot this back to see if it matches
+varint slotIndex                            // Transmit slot for this node
+varint slotCount                            // Number of slots in the frame
+8 storedReports                             // How many of the stored reports sent with the data report the Gateway received
+3 dataRate                                  // Recommended data rate for our slot - see LoRA_ADR.h
+5 txPower                                   // Recommended transmit power in dBm
 */
 
 // Format of a join request
 /*
-buf[0-1] magicNumber;                       // Magic Number
-buf[2 - 3] nodeID                            // nodeID for verification
-buf[4- 28] Particle deviceID;               // deviceID is unique to the device
-buf[29] sensorType				            // Identifies sensor type to Gateway
+16 magicNumber;                             // Magic Number
+9 nodeID                                    // nodeID for verification
+96 Particle deviceID;                       // deviceID is unique to the device - 24 hex digits
+4 sensorType				                // Identifies sensor type to Gateway
 */
 
 // Format for a join acknowledgement
 /*
-    buf[0 - 1 ]  magicNumber                // Magic Number
-    buf[2 - 5 ] Time.now()                  // Set the time 
-    buf[6 - 7] frequencyMinutes             // For the Gateway minutes on the hour  
-    buf[8] alertCodeNode                    // Gateway can set an alert code here
-    buf[9]  newNodeNumber                   // New Node Number for device
-    buf[10]  sensorType				        // Gateway confirms sensor type
+16 magicNumber                              // Magic Number
+32 Time.now()                               // Set the time 
+10 timeMs                                   // Milliseconds past Time.now() when the Gateway starts sending
+varint frequencyMinutes                     // For the Gateway minutes on the hour  
+4 alertCodeNode                             // Gateway can set an alert code here
+9 nodeID                                    // The join request's nodeID - a node ignores an acknowledgement for another device
+32 senderId                                 // linkSenderId() of the join request's deviceID - nodeID is a sum of the hex digits, so devices share it
+8 newNodeNumber                             // New Node Number for device
+4 sensorType				                // Gateway confirms sensor type
+varint slotIndex                            // Transmit slot for this node
+varint slotCount                            // Number of slots in the frame
+*/
+
+// Link encryption - every frame on the air, hop by hop, under RHAuthenticatedDriver and the key shared with the Gateway
+/*
+24 frameCounter                             // Goes up with every frame this node sends - part of the nonce, checked for replays
+32 senderId                                 // linkSenderId(deviceID) - part of the nonce, the replay check is per sender id
+ciphertext                                  // The RadioHead mesh headers and the message above, Ascon-128 encrypted
+32 tag                                      // Truncated Ascon-128 tag over the ciphertext and the to / from / id / flags header
+
+    The nonce is from address | frameCounter | senderId, so it is not repeated when a node number passes to another
+    device or when unjoined nodes, all sending from UNCONFIGURED_NODE, happen to pick the same starting counter.
+    Frames with a bad tag, or a counter no higher than the last one from that sender id, are dropped by the radio layer.
+    Frame counters are reserved in FRAM a block at a time (sysStatus frameCounterReserved) so they are not reused after a reset.
+    The key is LORA_LINK_KEY from the build or the gitignored src/link_key.h - it is not in the source.
+
+    The Gateway must run the same layout: call linkDriver.setSenderId(linkSenderId(System.deviceID())) at setup, and it
+    no longer needs to forget a node number's counter when it hands the number to a new device.
+*/
+
+// Transmit slots
+/*
+    Each reporting period is a frame of slotCount slots that starts as the nodes wake on the reporting boundary.
+    A node transmits one guard time into its slot. The slot length is computed from the modem settings
+    (see LoRA_Functions::slotMs()) so it must be the same on the Gateway and on every node.
+    Slots are long enough for a data report of the full RH_MESH_MAX_MESSAGE_LEN so a node can drain its stored reports.
+    Until the Gateway assigns a slot, nodes transmit nodeNumber * 10 seconds into the period - node numbers above 10, and
+    unconfigured nodes, share the slot 110 seconds in so the legacy frame is two minutes whatever the node number.
+    With a slot assigned, a node only runs its receiver through the frames when relaying for others - otherwise just
+    from its own send to the end of its slot, when the Gateway's reply must have come (see LoRA_Functions::listenLowPower()).
+*/
+
+// Time sync
+/*
+    The Gateway stamps each acknowledgement with its time to the millisecond, taken as it starts sending - after any wait
+    for the channel. The node takes the end of the frame from the radio's RxDone interrupt and works back by the frame's
+    time on air, so it knows the Gateway's time at that moment to within the interrupt latency. Time.setTime() only takes
+    whole seconds, so the millisecond time is carried forward on millis() with the drift of our clock taken out (see
+    ClockSync) and slots are timed from it. A reply through relays has also waited at each hop, which is estimated. A relay
+    that had to retry makes the stamp late, so a relayed time that puts us further ahead than the guard allows for is
+    only used once RELAYED_STEP_SYNCS of them agree. The guard time at each end of a slot allows SYNC_ERROR_MS for all
+    this plus MAX_DRIFT_PPM over an hour. The AB1805 is set to the hundredth from the same time and its crystal
+    calibrated against it, so the millisecond time survives a reset.
 */
 
 #ifndef __LORA_FUNCTIONS_H
@@ -93,6 +172,117 @@ public:
      */
     void loop();
 
+    /**
+     * @brief Tests whether a data report or join request is still being sent
+     * 
+     * @details Sends complete in the background while loop() is called - transmit, wait for the next hop to acknowledge and retry
+     * 
+     * @return true while the send is in progress
+     */
+    bool sendInProgress();
+
+    /**
+     * @brief Reports whether the last data report or join request was acknowledged by the next hop
+     * 
+     * @return true if it was delivered
+     */
+    bool lastSendSucceeded();
+
+    /**
+     * @brief Total time the radio has spent transmitting since startup
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t radioTxMs();
+
+    /**
+     * @brief Total time the radio has spent with the receiver on since startup
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t radioRxMs();
+
+    /**
+     * @brief Sets a function to call when a data report or join request send completes
+     * 
+     * @details Called from loop() with true if the next hop acknowledged the message - lets the state machine wait
+     * for an event rather than poll sendInProgress()
+     */
+    void withSendCompleteHandler(void (*handler)(bool delivered));
+
+    /**
+     * @brief Length of one transmit slot
+     * 
+     * @details Time on air of a data report, the data acknowledgement and their hop acks with the current modem settings,
+     * plus turnaround and a guard time at each end
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t slotMs();
+
+    /**
+     * @brief Length of the frame of slots the Gateway has assigned
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t frameMs();
+
+    /**
+     * @brief How long after waking for the reporting period we should transmit
+     * 
+     * @details Start of our slot plus the guard time, corrected for the measured drift of our clock since the last sync
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t transmitDelayMs();
+
+    /**
+     * @brief How long to listen in each reporting period - long enough for our slot in this frame and the next one
+     * 
+     * @return uint32_t - milliseconds
+     */
+    uint32_t listeningWindowMs();
+
+    /**
+     * @brief The Gateway's time now, carried forward from its last acknowledgement and corrected for our clock's drift
+     * 
+     * @return uint64_t - milliseconds since the epoch, 0 until we have heard from the Gateway or restoreGatewayTime()
+     */
+    uint64_t gatewayTimeMs();
+
+    /**
+     * @brief Starts the Gateway's time from a backup - the RTC after a reset - until the Gateway is heard from
+     * 
+     * @param ms Milliseconds since the epoch
+     */
+    void restoreGatewayTime(uint64_t ms);
+
+    /**
+     * @brief Time to the next reporting boundary on the Gateway's clock - what a node wakes for
+     * 
+     * @return uint32_t - milliseconds, 0 if we have not synced
+     */
+    uint32_t msToNextPeriod();
+
+    /**
+     * @brief Notes that the listening window for this reporting period has started - call as we wake to report
+     * 
+     * @details Also decides whether we listen through the frames this period to relay for other nodes - see listenLowPower()
+     */
+    void startListening();
+
+    /**
+     * @brief Turns the receiver off while we are listening, except when there is something we need to hear
+     * 
+     * @details Call on each pass while listening. The receiver stays on through the frames in periods when we are relaying for
+     * other nodes, and one period in RELAY_CHECK_PERIODS so a new node can find a route through us. After our own send it opens
+     * single receive windows, which the radio closes itself, until the end of our slot - when the Gateway's reply must have
+     * come. The rest of the time the radio sleeps. In legacy slots, or without a valid clock, the receiver is always on.
+     * 
+     * @return uint32_t - milliseconds the processor can sleep, waking on the radio interrupt - 0 to stay awake and keep listening
+     */
+    uint32_t listenLowPower();
+
 
     // Common Functions
     /**
@@ -117,6 +307,24 @@ public:
      */
    bool initializeRadio();
 
+    /**
+     * @brief Saves the valid mesh routes, with their age and link quality, to FRAM
+     * 
+     * @details Called as the radio goes to sleep so the routes can be restored by restoreRoutes()
+     * 
+     * @return uint8_t - the number of routes saved
+     */
+    uint8_t saveRoutes();
+
+    /**
+     * @brief Restores the routes saved by saveRoutes() that are younger than the route TTL
+     * 
+     * @details Called when the radio is initialized so the first report of a period doesn't need a route discovery broadcast
+     * 
+     * @return uint8_t - the number of routes restored
+     */
+    uint8_t restoreRoutes();
+
  
     // Node Functions
     /**
@@ -127,9 +335,9 @@ public:
      */
     bool listenForLoRAMessageNode();                // Node - sent a message - awiting reply
     /**
-     * @brief Composes a Data Report and sends to the Gateway
+     * @brief Composes a Data Report and starts sending it to the Gateway
      * 
-     * @return true 
+     * @return true if the send has started - use sendInProgress() / lastSendSucceeded() for the outcome
      * @return false 
      */
     bool composeDataReportNode();                  // Node - Composes data report
@@ -141,9 +349,9 @@ public:
      */
     bool receiveAcknowledmentDataReportNode();     // Node - receives acknolwedgement
     /**
-     * @brief Composes a Join Request and sends to the Gateway
+     * @brief Composes a Join Request and starts sending it to the Gateway
      * 
-     * @return true 
+     * @return true if the send has started - use sendInProgress() / lastSendSucceeded() for the outcome
      * @return false 
      */
     bool composeJoinRequesttNode();                // Node - Composes Join request
@@ -161,6 +369,21 @@ public:
      * @return int - a value from 0 to 360 based on the character string
      */
     int stringCheckSum(String str);
+    /**
+     * @brief The sender id RHAuthenticatedDriver sends with every frame from a device - a 32 bit FNV-1a hash of its deviceID
+     * 
+     * @param deviceID - the Particle deviceID
+     * @return uint32_t - the same for a device at every boot, whatever its node number
+     */
+    uint32_t linkSenderId(String deviceID);
+
+    /**
+     * @brief Stores the transmit slot assigned by the Gateway
+     * 
+     * @param slotIndex - our slot, 0 to slotCount - 1
+     * @param slotCount - number of slots in the frame
+     */
+    void setSlot(uint16_t slotIndex, uint16_t slotCount);
 
 
 protected:
@@ -0,0 +1,493 @@
+/**
+ * @file LoRA_Messages.h
+ * @brief Schemas for the messages exchanged with the Gateway and the bit-packed codec that encodes and decodes them
+ *
+ * @details Each message lists its fields once, in fields(), with the encoding of each one. The same list drives
+ * the encoder, the decoder and maxEncodedLen() so the two ends cannot drift apart the way hand-packed offsets do.
+ * Fields are packed most significant bit first with no padding between them - only the last byte is padded with zeros.
+ *
+ * Encodings
+ *  Bits<N>        - unsigned, N bits. Values out of range saturate at the largest that fits
+ *  SignedBits<N>  - two's complement, N bits. Saturates at both ends
+ *  Varint         - unsigned, 7 bits per group with a continuation bit - 8 bits up to 127, 16 bits up to 16383
+ *  Hex<N>         - a string of N hex digits, 4 bits each
+ *  AdaptiveCounts - a short run of counts at the narrowest bit width that holds them - raw or as deltas
+ *
+ * Changing a schema changes the over-the-air format - the Gateway must be built from the same schemas.
+ *
+ */
+
+#ifndef __LORA_MESSAGES_H
+#define __LORA_MESSAGES_H
+
+#include "Particle.h"
+
+namespace LoRA_Messages {
+
+/**
+ * @brief Writes fields into a buffer one bit at a time, most significant bit first
+ *
+ * @details Writing past the end sets an overflow flag rather than touching memory - check ok() when done
+ */
+class BitWriter {
+public:
+    BitWriter(uint8_t *buf, size_t bufLen) : buf(buf), bufLen(bufLen), bitPos(0), overflow(false) {};
+
+    void write(uint32_t value, uint8_t bits) {
+        for (int bit = bits - 1; bit >= 0; bit--, bitPos++) {
+            if (bitPos >= bufLen * 8) {
+                overflow = true;
+                return;
+            }
+            uint8_t mask = 0x80 >> (bitPos % 8);
+            if ((value >> bit) & 1) buf[bitPos / 8] |= mask;
+            else buf[bitPos / 8] &= ~mask;
+        }
+    }
+
+    /**
+     * @brief Rewrites bits already written - used to fill in a count once it is known
+     */
+    void writeAt(size_t pos, uint32_t value, uint8_t bits) {
+        size_t savedPos = bitPos;
+        bitPos = pos;
+        write(value, bits);
+        bitPos = savedPos;
+    }
+
+    /**
+     * @brief Encodes every field of a message
+     */
+    template <class Message> bool put(Message &msg);
+
+    /**
+     * @brief Goes back to an earlier position, clearing any overflow - used to drop a message that did not fit
+     */
+    void rewind(size_t pos) {
+        bitPos = pos;
+        overflow = false;
+    }
+
+    size_t position() const { return bitPos; }
+
+    bool ok() const { return !overflow; }
+
+    /**
+     * @brief Number of bytes written, including the partly filled last byte
+     */
+    uint8_t length() const { return (uint8_t)((bitPos + 7) / 8); }
+
+protected:
+    uint8_t *buf;
+    size_t bufLen;
+    size_t bitPos;
+    bool overflow;
+};
+
+/**
+ * @brief Reads fields back from a buffer written by BitWriter
+ *
+ * @details Reading past the end returns zeros and sets an underflow flag - check ok() when done
+ */
+class BitReader {
+public:
+    BitReader(const uint8_t *buf, size_t len) : buf(buf), len(len), bitPos(0), underflow(false) {};
+
+    uint32_t read(uint8_t bits) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < bits; i++, bitPos++) {
+            if (bitPos >= len * 8) {
+                underflow = true;
+                return 0;
+            }
+            value = (value << 1) | ((buf[bitPos / 8] >> (7 - bitPos % 8)) & 1);
+        }
+        return value;
+    }
+
+    /**
+     * @brief Decodes every field of a message
+     */
+    template <class Message> bool get(Message &msg);
+
+    /**
+     * @brief Bits left to read - the padding in the last byte is always less than 8
+     */
+    size_t remaining() const { return (bitPos < len * 8) ? len * 8 - bitPos : 0; }
+
+    bool ok() const { return !underflow; }
+
+protected:
+    const uint8_t *buf;
+    size_t len;
+    size_t bitPos;
+    bool underflow;
+};
+
+
+// Field encodings - each has encode(), decode() and the most bits it can take
+
+template <uint8_t N> struct Bits {
+    static const uint16_t MAX_BITS = N;
+    template <typename T> static void encode(BitWriter &w, T value) {
+        const uint32_t maxValue = (N >= 32) ? 0xffffffffUL : ((1UL << N) - 1);
+        if (value < 0) value = 0;
+        w.write(((uint32_t)value > maxValue) ? maxValue : (uint32_t)value, N);
+    }
+    template <typename T> static void decode(BitReader &r, T &value) {
+        value = (T)r.read(N);
+    }
+};
+
+template <uint8_t N> struct SignedBits {
+    static const uint16_t MAX_BITS = N;
+    template <typename T> static void encode(BitWriter &w, T value) {
+        const int32_t maxValue = (1L << (N - 1)) - 1;
+        int32_t v = constrain((int32_t)value, -maxValue - 1, maxValue);
+        w.write((uint32_t)v, N);                                // The low N bits are the two's complement value
+    }
+    template <typename T> static void decode(BitReader &r, T &value) {
+        uint32_t v = r.read(N);
+        if (v & (1UL << (N - 1))) v |= ~((1UL << N) - 1);       // Sign extend
+        value = (T)(int32_t)v;
+    }
+};
+
+struct Varint {
+    static const uint16_t MAX_BITS = 40;                        // 32 bits in 7 bit groups
+    template <typename T> static void encode(BitWriter &w, T value) {
+        uint32_t v = (value < 0) ? 0 : (uint32_t)value;
+        while (v > 0x7f) {
+            w.write(0x80 | (v & 0x7f), 8);
+            v >>= 7;
+        }
+        w.write(v, 8);
+    }
+    template <typename T> static void decode(BitReader &r, T &value) {
+        uint32_t v = 0;
+        for (uint8_t shift = 0; shift < 35; shift += 7) {
+            uint32_t group = r.read(8);
+            v |= (group & 0x7f) << shift;
+            if (!(group & 0x80)) break;
+        }
+        value = (T)v;
+    }
+};
+
+template <uint8_t N> struct Hex {
+    static const uint16_t MAX_BITS = 4 * N;
+    template <typename T> static void encode(BitWriter &w, const T &str) {
+        for (uint8_t i = 0; i < N; i++) {
+            char c = str[i];
+            uint8_t nibble = 0;
+            if (c >= '0' && c <= '9') nibble = c - '0';
+            else if (c >= 'a' && c <= 'f') nibble = 10 + c - 'a';
+            else if (c >= 'A' && c <= 'F') nibble = 10 + c - 'A';
+            w.write(nibble, 4);
+        }
+    }
+    template <typename T> static void decode(BitReader &r, T &str) {
+        for (uint8_t i = 0; i < N; i++) {
+            uint8_t nibble = (uint8_t)r.read(4);
+            str[i] = (nibble < 10) ? '0' + nibble : 'a' + nibble - 10;
+        }
+        str[N] = '\0';                                          // The string must have room for the terminator
+    }
+};
+
+/**
+ * @brief Up to MAX_HISTOGRAM_BUCKETS counts - the counts in each interval of the reporting period
+ */
+const uint8_t MAX_HISTOGRAM_BUCKETS = 12;
+
+struct CountHistogram {
+    uint8_t count;                                  // Buckets in use
+    uint16_t buckets[MAX_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief Encoding for a CountHistogram
+ *
+ * @details Bits<4> count, then if there are any buckets a Bits<1> mode and a Bits<5> width W of the largest count.
+ * Mode 0 is count fields of W bits. Mode 1 is the first count in W bits, a Bits<5> width D and each later count's
+ * change from the one before in D bits, zigzag encoded so small rises and falls both stay small. The encoder picks
+ * whichever mode is shorter - steady traffic packs as changes, bursty traffic as raw counts - and an empty hour is just
+ * the 10 bit header with W of 0.
+ */
+struct AdaptiveCounts {
+    static const uint16_t MAX_BITS = 4 + 1 + 5 + MAX_HISTOGRAM_BUCKETS * 16;   // Changes are only sent when shorter than raw
+
+    static uint8_t bitWidth(uint32_t value) {
+        uint8_t width = 0;
+        while (value) {
+            width++;
+            value >>= 1;
+        }
+        return width;
+    }
+
+    static uint32_t zigzag(int32_t value) { return (value < 0) ? ((uint32_t)(-value) << 1) - 1 : (uint32_t)value << 1; }
+
+    static int32_t unzigzag(uint32_t value) { return (value & 1) ? -(int32_t)((value + 1) >> 1) : (int32_t)(value >> 1); }
+
+    static void encode(BitWriter &w, const CountHistogram &h) {
+        uint8_t count = (h.count > MAX_HISTOGRAM_BUCKETS) ? MAX_HISTOGRAM_BUCKETS : h.count;
+        w.write(count, 4);
+        if (count == 0) return;
+
+        uint8_t width = 0, deltaWidth = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            width = max(width, bitWidth(h.buckets[i]));
+            if (i) deltaWidth = max(deltaWidth, bitWidth(zigzag((int32_t)h.buckets[i] - h.buckets[i - 1])));
+        }
+        bool delta = 5 + (count - 1) * deltaWidth < (count - 1) * width;
+        w.write(delta, 1);
+        w.write(width, 5);
+        if (!delta) {
+            for (uint8_t i = 0; i < count; i++) w.write(h.buckets[i], width);
+            return;
+        }
+        w.write(h.buckets[0], width);
+        w.write(deltaWidth, 5);
+        for (uint8_t i = 1; i < count; i++) w.write(zigzag((int32_t)h.buckets[i] - h.buckets[i - 1]), deltaWidth);
+    }
+
+    static void decode(BitReader &r, CountHistogram &h) {
+        h.count = (uint8_t)r.read(4);
+        if (h.count > MAX_HISTOGRAM_BUCKETS) h.count = MAX_HISTOGRAM_BUCKETS;
+        if (h.count == 0) return;
+
+        bool delta = r.read(1);
+        uint8_t width = (uint8_t)r.read(5);
+        if (!delta) {
+            for (uint8_t i = 0; i < h.count; i++) h.buckets[i] = (uint16_t)r.read(width);
+            return;
+        }
+        int32_t previous = (int32_t)r.read(width);
+        h.buckets[0] = (uint16_t)previous;
+        uint8_t deltaWidth = (uint8_t)r.read(5);
+        for (uint8_t i = 1; i < h.count; i++) {
+            previous += unzigzag(r.read(deltaWidth));
+            h.buckets[i] = (uint16_t)previous;
+        }
+    }
+};
+
+
+// Visitors - fields() calls one of these for each field in order
+
+class Encoder {
+public:
+    Encoder(BitWriter &w) : w(w) {};
+    template <typename T, class Encoding> void operator()(T &value, Encoding) { Encoding::encode(w, value); }
+protected:
+    BitWriter &w;
+};
+
+class Decoder {
+public:
+    Decoder(BitReader &r) : r(r) {};
+    template <typename T, class Encoding> void operator()(T &value, Encoding) { Encoding::decode(r, value); }
+protected:
+    BitReader &r;
+};
+
+class MaxBits {
+public:
+    MaxBits() : bits(0) {};
+    template <typename T, class Encoding> void operator()(T &, Encoding) { bits += Encoding::MAX_BITS; }
+    size_t bits;
+};
+
+template <class Message> bool BitWriter::put(Message &msg) {
+    Encoder encoder(*this);
+    msg.fields(encoder);
+    return ok();
+}
+
+template <class Message> bool BitReader::get(Message &msg) {
+    Decoder decoder(*this);
+    msg.fields(decoder);
+    return ok();
+}
+
+/**
+ * @brief Encodes a message
+ *
+ * @return uint8_t - length in bytes, 0 if it does not fit in the buffer
+ */
+template <class Message> uint8_t encode(Message &msg, uint8_t *buf, size_t bufLen) {
+    BitWriter w(buf, bufLen);
+    return (w.put(msg)) ? w.length() : 0;
+}
+
+/**
+ * @brief Decodes a message
+ *
+ * @return true if the buffer held all of the fields
+ */
+template <class Message> bool decode(Message &msg, const uint8_t *buf, size_t len) {
+    BitReader r(buf, len);
+    return r.get(msg);
+}
+
+/**
+ * @brief Longest a message can be once encoded - for working out time on air
+ */
+template <class Message> uint8_t maxEncodedLen() {
+    Message msg;
+    MaxBits counter;
+    msg.fields(counter);
+    return (uint8_t)((counter.bits + 7) / 8);
+}
+
+
+// Message schemas
+
+/**
+ * @brief Data report - node to Gateway
+ *
+ * @details May be followed by a Bits<8> count and that many StoredReport records - see LoRA_Functions.h
+ * The histogram holds the counts in each COUNT_BUCKET_MINUTES interval since the last report was acknowledged,
+ * starting at histogramStart - the interval of the day, in those minutes, of the first bucket.
+ */
+struct DataReport {
+    uint16_t magicNumber;                           // Magic number for devices
+    uint16_t nodeID;                                // Checksum of the deviceID for verification - 0 to 360
+    uint16_t hourly;                                // Hourly count
+    uint16_t daily;                                 // Daily count
+    uint8_t sensorType;                             // What sensor type is it
+    int8_t temp;                                    // Enclosure temp
+    uint8_t battChg;                                // State of charge - percent
+    uint8_t battState;                              // Battery state
+    uint8_t resets;                                 // Reset count
+    uint8_t messageCount;                           // Sequential message number
+    uint8_t successCount;                           // How many successful sends
+    int16_t rssi;                                   // From the node's perspective
+    int16_t snr;                                    // From the node's perspective
+    uint16_t histogramStart;                        // Interval of the day the first bucket starts in
+    CountHistogram histogram;                       // Counts in each interval
+    uint32_t chargeUah;                             // Estimated charge used since the last acknowledged report - 0 if not reported
+
+    template <class Visitor> void fields(Visitor &v) {
+        v(magicNumber, Bits<16>());
+        v(nodeID, Bits<9>());
+        v(hourly, Varint());
+        v(daily, Varint());
+        v(sensorType, Bits<4>());
+        v(temp, SignedBits<8>());
+        v(battChg, Bits<7>());
+        v(battState, Bits<3>());
+        v(resets, Bits<8>());
+        v(messageCount, Bits<8>());
+        v(successCount, Bits<8>());
+        v(rssi, SignedBits<9>());
+        v(snr, SignedBits<7>());
+        v(histogramStart, Bits<9>());
+        v(histogram, AdaptiveCounts());
+        v(chargeUah, Varint());
+    }
+};
+
+/**
+ * @brief A data report that could not be delivered when it was due - sent on the end of a later data report
+ */
+struct StoredReport {
+    uint32_t timestamp;                             // When the report should have been sent
+    uint16_t hourly;                                // Hourly count at that time
+    uint16_t daily;                                 // Daily count at that time
+
+    template <class Visitor> void fields(Visitor &v) {
+        v(timestamp, Bits<32>());
+        v(hourly, Varint());
+        v(daily, Varint());
+    }
+};
+
+/**
+ * @brief Fields at the start of every message from the Gateway
+ */
+struct AckHeader {
+    uint16_t magicNumber;                           // Magic number
+    uint32_t time;                                  // Time.now() on the Gateway
+    uint16_t timeMs;                                // Milliseconds past time when the Gateway started sending this frame
+    uint16_t frequencyMinutes;                      // Reporting frequency - minutes on the hour
+    uint8_t alertCode;                              // Lets the Gateway trigger an alert on the node - typically a join request
+
+    template <class Visitor> void fields(Visitor &v) {
+        v(magicNumber, Bits<16>());
+        v(time, Bits<32>());
+        v(timeMs, Bits<10>());
+        v(frequencyMinutes, Varint());
+        v(alertCode, Bits<4>());
+    }
+};
+
+/**
+ * @brief Data acknowledgement - Gateway to node
+ */
+struct DataAck : public AckHeader {
+    uint8_t sensorType;                             // Lets the Gateway reset the sensor if needed
+    uint8_t openHours;                              // Is the park open?
+    uint8_t messageNumber;                          // Parrots the data report's message count
+    uint16_t slotIndex;                             // Transmit slot for this node
+    uint16_t slotCount;                             // Number of slots in the frame
+    uint8_t storedReports;                          // Number of stored reports the Gateway received with the data report
+    uint8_t dataRate;                               // Recommended data rate for our slot - see LoRA_ADR.h
+    uint8_t txPower;                                // Recommended transmit power in dBm
+
+    template <class Visitor> void fields(Visitor &v) {
+        AckHeader::fields(v);
+        v(sensorType, Bits<4>());
+        v(openHours, Bits<1>());
+        v(messageNumber, Bits<8>());
+        v(slotIndex, Varint());
+        v(slotCount, Varint());
+        v(storedReports, Bits<8>());
+        v(dataRate, Bits<3>());
+        v(txPower, Bits<5>());
+    }
+};
+
+/**
+ * @brief Join request - node to Gateway
+ */
+struct JoinRequest {
+    uint16_t magicNumber;                           // Magic number
+    uint16_t nodeID;                                // Checksum of the deviceID for verification
+    char deviceID[25];                              // Particle deviceID - 24 hex digits, unique to the device
+    uint8_t sensorType;                             // Identifies sensor type to the Gateway
+
+    template <class Visitor> void fields(Visitor &v) {
+        v(magicNumber, Bits<16>());
+        v(nodeID, Bits<9>());
+        v(deviceID, Hex<24>());
+        v(sensorType, Bits<4>());
+    }
+};
+
+/**
+ * @brief Join acknowledgement - Gateway to node
+ */
+struct JoinAck : public AckHeader {
+    uint16_t nodeID;                                // Parrots the join request's nodeID - unconfigured nodes all share a node number
+    uint32_t senderId;                              // linkSenderId() of the join request's deviceID - nodeID alone often collides
+    uint8_t newNodeNumber;                          // New node number for the device
+    uint8_t sensorType;                             // Gateway confirms sensor type
+    uint16_t slotIndex;                             // Transmit slot for this node
+    uint16_t slotCount;                             // Number of slots in the frame
+
+    template <class Visitor> void fields(Visitor &v) {
+        AckHeader::fields(v);
+        v(nodeID, Bits<9>());
+        v(senderId, Bits<32>());
+        v(newNodeNumber, Bits<8>());
+        v(sensorType, Bits<4>());
+        v(slotIndex, Varint());
+        v(slotCount, Varint());
+    }
+};
+
+}  // namespace LoRA_Messages
+
+#endif  /* __LORA_MESSAGES_H */
@@ -5,6 +5,21 @@
 
 MB85RC64 fram(Wire, 0);  
 
+// Wire gets a larger buffer than the default 32 bytes so the FRAM moves a saved structure in a few I2C transactions
+const size_t WIRE_BUFFER_SIZE = 128;
+
+hal_i2c_config_t acquireWireBuffer() {
+    hal_i2c_config_t config = {
+        .size = sizeof(hal_i2c_config_t),
+        .version = HAL_I2C_CONFIG_VERSION_1,
+        .rx_buffer = new (std::nothrow) uint8_t[WIRE_BUFFER_SIZE],
+        .rx_buffer_size = WIRE_BUFFER_SIZE,
+        .tx_buffer = new (std::nothrow) uint8_t[WIRE_BUFFER_SIZE],
+        .tx_buffer_size = WIRE_BUFFER_SIZE
+    };
+    return config;
+}
+
 // *******************  SysStatus Storage Object **********************
 //
 // ********************************************************************
@@ -19,7 +34,7 @@ sysStatusData &sysStatusData::instance() {
     return *_instance;
 }
 
-sysStatusData::sysStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, 0, &sysData.sysHeader, sizeof(SysData), SYS_DATA_MAGIC, SYS_DATA_VERSION) {
+sysStatusData::sysStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, FRAM_SYS_STATUS_OFFSET, &sysData.sysHeader, sizeof(SysData), SYS_DATA_MAGIC, SYS_DATA_VERSION) {
 
 };
 
@@ -27,9 +42,11 @@ sysStatusData::~sysStatusData() {
 }
 
 void sysStatusData::setup() {
+    fram.withTransferSize(WIRE_BUFFER_SIZE);
     fram.begin();
 
     sysStatus
+        .withDoubleBuffer(FRAM_SYS_STATUS_B_OFFSET)        // A power cut during a save must not lose the node number or frame counter
     //    .withLogData(true)
         .withSaveDelayMs(100)
         .load();
@@ -37,6 +54,9 @@ void sysStatusData::setup() {
     // Log.info("sizeof(SysData): %u", sizeof(SysData));
 }
 
+static_assert(sizeof(sysStatusData::SysData) <= FRAM_CURRENT_STATUS_OFFSET - FRAM_SYS_STATUS_OFFSET, "sysStatusData overruns its FRAM region");
+static_assert(sizeof(sysStatusData::SysData) <= FRAM_CURRENT_STATUS_B_OFFSET - FRAM_SYS_STATUS_B_OFFSET, "sysStatusData overruns its second FRAM region");
+
 void sysStatusData::loop() {
     sysStatus.flush(false);
 }
@@ -44,285 +64,756 @@ void sysStatusData::loop() {
 bool sysStatusData::validate(size_t dataSize) {
     bool valid = PersistentDataFRAM::validate(dataSize);
     if (valid) {
-        // If test1 < 0 or test1 > 100, then the data is invalid
-
-        if (sysStatus.get_frequencyMinutes() <=0 || sysStatus.get_frequencyMinutes() > 60) {
-            Log.info("data not valid frequency minutes =%d", sysStatus.get_frequencyMinutes());
-            valid = false;
-        }
-        else if (sysStatus.get_nodeNumber() < 1 || sysStatus.get_nodeNumber() > 11) {
-            Log.info("data not valid node number =%d", sysStatus.get_nodeNumber());
-            valid = false;
-        }
+        SYS_DATA_FIELDS(PERSISTENT_CHECK)
     }
     Log.info("sysStatus data is %s",(valid) ? "valid": "not valid");
     return valid;
 }
 
+bool sysStatusData::migrate(uint16_t fromVersion) {
+    switch (fromVersion) {
+        case 2:
+            // Version 3 added slotIndex, slotCount and clockDriftPpm, which start at 0 - no slot until the Gateway assigns one.
+            // Nodes were numbered 1 to 10 with 11 for an unconfigured node, which is now UNCONFIGURED_NODE
+            if (sysData.nodeNumber == 11) sysData.nodeNumber = UNCONFIGURED_NODE;
+            return true;
+
+        default:
+            return false;                               // Version 1 predates this firmware's node numbering - start again
+    }
+}
+
 void sysStatusData::initialize() {
+    uint32_t frameCounterReserved = sysData.frameCounterReserved;  // Never reset - a used counter would be rejected by the Gateway
     PersistentDataFRAM::initialize();
 
     Log.info("data initialized");
 
-    // Initialize the default value to 10 if the structure is reinitialized.
     // Be careful doing this, because when MyData is extended to add new fields,
     // the initialize method is not called! This is only called when first
     // initialized.
     Log.info("Loading system defaults");              // Letting us know that defaults are being loaded
-    sysStatus.set_nodeNumber(11);
-    sysStatus.set_structuresVersion(1);
-    sysStatus.set_magicNumber(27617);
-    // sysStatus.set_firmwareRelease(1);
-    sysStatus.set_resetCount(0);
-    sysStatus.set_frequencyMinutes(60);
-    sysStatus.set_alertCodeNode(1);
-    sysStatus.set_alertTimestampNode(0);
-    sysStatus.set_openHours(true);
+    beginUpdate();
+    SYS_DATA_FIELDS(PERSISTENT_DEFAULT)
+    set_frameCounterReserved(frameCounterReserved);
+    commit();
 
     // If you manually update fields here, be sure to update the hash
     updateHash();
 }
 
-uint8_t sysStatusData::get_nodeNumber() const {
-    return getValue<uint8_t>(offsetof(SysData, nodeNumber));
+// *****************  Current Status Storage Object *******************
+// Offset of 100 bytes - make room for SysStatus
+// ********************************************************************
+
+currentStatusData *currentStatusData::_instance;
+
+// [static]
+currentStatusData &currentStatusData::instance() {
+    if (!_instance) {
+        _instance = new currentStatusData();
+    }
+    return *_instance;
 }
 
-void sysStatusData::set_nodeNumber(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, nodeNumber), value);
+currentStatusData::currentStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, FRAM_CURRENT_STATUS_OFFSET, &currentData.currentHeader, sizeof(CurrentData), CURRENT_DATA_MAGIC, CURRENT_DATA_VERSION) {
+};
+
+currentStatusData::~currentStatusData() {
+}
+
+void currentStatusData::setup() {
+    fram.begin();
+
+    current
+        .withDoubleBuffer(FRAM_CURRENT_STATUS_B_OFFSET)
+    //    .withLogData(true)
+        .withSaveDelayMs(250)
+        .load();
 }
 
-uint8_t sysStatusData::get_structuresVersion() const {
-    return getValue<uint8_t>(offsetof(SysData, structuresVersion));
+void currentStatusData::loop() {
+    current.flush(false);
 }
 
-void sysStatusData::set_structuresVersion(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, structuresVersion), value);
+static_assert(sizeof(currentStatusData::CurrentData) <= FRAM_SAVED_ROUTES_OFFSET - FRAM_CURRENT_STATUS_OFFSET, "currentStatusData overruns its FRAM region");
+
+void currentStatusData::resetEverything() {                             // The device is waking up in a new day or is a new install
+  current.set_dailyCount(0);                                            // Reset the counts in FRAM as well
+  current.set_hourlyCount(0);
+  current.set_lastCountTime(Time.now());
+  sysStatus.set_resetCount(0);                                          // Reset the reset count as well
+  current.set_messageCount(0);
+  current.set_successCount(0);
+  current.resetBuckets(Time.now());
 }
 
-uint16_t sysStatusData::get_magicNumber() const {
-    return getValue<uint16_t>(offsetof(SysData, magicNumber));
+bool currentStatusData::validate(size_t dataSize) {
+    bool valid = PersistentDataFRAM::validate(dataSize);
+    if (valid) {
+        CURRENT_DATA_FIELDS(PERSISTENT_CHECK, PERSISTENT_SKIP)
+    }
+    Log.info("current data is %s",(valid) ? "valid": "not valid");
+    return valid;
 }
 
-void sysStatusData::set_magicNumber(uint16_t value) {
-    setValue<uint16_t>(offsetof(SysData, magicNumber), value);
+void currentStatusData::loadCurrentDefaults() {
+    beginUpdate();
+    CURRENT_DATA_FIELDS(PERSISTENT_DEFAULT, PERSISTENT_SKIP)
+    commit();
 }
 
+void currentStatusData::initialize() {
+    PersistentDataFRAM::initialize();
 
-uint8_t sysStatusData::get_firmwareRelease() const {
-    return getValue<uint8_t>(offsetof(SysData, firmwareRelease));
+    Log.info("Current Data Initialized");
+
+    loadCurrentDefaults();
+    currentStatusData::resetEverything();
+
+    // If you manually update fields here, be sure to update the hash
+    updateHash();
 }
 
-void sysStatusData::set_firmwareRelease(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, firmwareRelease), value);
+
+uint16_t currentStatusData::get_countBucket(uint8_t index) const {
+    if (index >= MAX_COUNT_BUCKETS) return 0;
+    return getValue<uint16_t>(offsetof(CurrentData, countBuckets) + index * sizeof(uint16_t));
 }
 
-uint8_t sysStatusData::get_resetCount() const {
-    return getValue<uint8_t>(offsetof(SysData, resetCount));
+void currentStatusData::addBucketCount(time_t when, uint16_t counts) {
+    const time_t bucketSeconds = COUNT_BUCKET_MINUTES * 60;
+
+    WITH_LOCK(*this) {
+        if (currentData.bucketStart == 0) resetBuckets(when);       // First count since the buckets were added
+
+        time_t index = (when > currentData.bucketStart) ? (when - currentData.bucketStart) / bucketSeconds : 0;
+        if (index >= MAX_COUNT_BUCKETS) index = MAX_COUNT_BUCKETS - 1;
+        size_t offset = offsetof(CurrentData, countBuckets) + index * sizeof(uint16_t);
+        setValue<uint16_t>(offset, getValue<uint16_t>(offset) + counts);
+    }
 }
 
-void sysStatusData::set_resetCount(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, resetCount), value);
+uint8_t currentStatusData::completeBuckets(time_t now) const {
+    time_t start = get_bucketStart();
+    if (start == 0 || now <= start) return 0;
+
+    time_t buckets = (now - start) / (COUNT_BUCKET_MINUTES * 60);
+    return (buckets > MAX_COUNT_BUCKETS) ? MAX_COUNT_BUCKETS : (uint8_t)buckets;
 }
 
-time_t sysStatusData::get_lastConnection() const {
-    return getValue<time_t>(offsetof(SysData, lastConnection));
+void currentStatusData::shiftBuckets(uint8_t count, time_t now) {
+    const time_t bucketSeconds = COUNT_BUCKET_MINUTES * 60;
+    if (count == 0) return;
+    if (count > MAX_COUNT_BUCKETS) count = MAX_COUNT_BUCKETS;
+
+    beginUpdate();                                                  // Hash once for the whole shift
+    for (uint8_t i = 0; i < MAX_COUNT_BUCKETS; i++) {
+        uint16_t value = (i + count < MAX_COUNT_BUCKETS) ? currentData.countBuckets[i + count] : 0;
+        setValue<uint16_t>(offsetof(CurrentData, countBuckets) + i * sizeof(uint16_t), value);
+    }
+    time_t start = currentData.bucketStart + count * bucketSeconds;
+    if (now >= start + MAX_COUNT_BUCKETS * bucketSeconds) start = now - now % bucketSeconds;   // Fell behind - what was left has been reported
+    setValue<time_t>(offsetof(CurrentData, bucketStart), start);
+    commit();
 }
 
-void sysStatusData::set_lastConnection(time_t value) {
-    setValue<time_t>(offsetof(SysData, lastConnection), value);
+void currentStatusData::resetBuckets(time_t now) {
+    beginUpdate();
+    for (uint8_t i = 0; i < MAX_COUNT_BUCKETS; i++) {
+        setValue<uint16_t>(offsetof(CurrentData, countBuckets) + i * sizeof(uint16_t), 0);
+    }
+    setValue<time_t>(offsetof(CurrentData, bucketStart), now - now % (COUNT_BUCKET_MINUTES * 60));
+    commit();
 }
 
-uint16_t sysStatusData::get_frequencyMinutes() const {
-    return getValue<uint16_t>(offsetof(SysData,frequencyMinutes));
+// *****************  Saved Routes Storage Object *******************
+// Offset of 256 bytes - make room for SysStatus and Current Status
+// ********************************************************************
+
+savedRoutesData *savedRoutesData::_instance;
+
+// [static]
+savedRoutesData &savedRoutesData::instance() {
+    if (!_instance) {
+        _instance = new savedRoutesData();
+    }
+    return *_instance;
 }
 
-void sysStatusData::set_frequencyMinutes(uint16_t value) {
-    setValue<uint16_t>(offsetof(SysData, frequencyMinutes), value);
+savedRoutesData::savedRoutesData() : StorageHelperRK::PersistentDataFRAM(::fram, FRAM_SAVED_ROUTES_OFFSET, &savedRoutesStore.routesHeader, sizeof(SavedRoutes), SAVED_ROUTES_MAGIC, SAVED_ROUTES_VERSION) {
+};
+
+savedRoutesData::~savedRoutesData() {
 }
 
-uint8_t sysStatusData::get_alertCodeNode() const {
-    return getValue<uint8_t>(offsetof(SysData, alertCodeNode));
+void savedRoutesData::setup() {
+    fram.begin();
+
+    savedRoutes
+    //    .withLogData(true)
+        .withSaveDelayMs(250)
+        .load();
 }
 
-void sysStatusData::set_alertCodeNode(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, alertCodeNode), value);
+void savedRoutesData::loop() {
+    savedRoutes.flush(false);
 }
 
-time_t sysStatusData::get_alertTimestampNode() const {
-    return getValue<time_t>(offsetof(SysData, alertTimestampNode));
+bool savedRoutesData::validate(size_t dataSize) {
+    bool valid = PersistentDataFRAM::validate(dataSize);
+    if (valid) {
+        if (savedRoutes.get_routeCount() > MAX_SAVED_ROUTES) {
+            Log.info("saved routes not valid routeCount=%d" , savedRoutes.get_routeCount());
+            valid = false;
+        }
+    }
+    Log.info("saved routes are %s",(valid) ? "valid": "not valid");
+    return valid;
 }
 
-void sysStatusData::set_alertTimestampNode(time_t value) {
-    setValue<time_t>(offsetof(SysData, alertTimestampNode), value);
+void savedRoutesData::initialize() {
+    PersistentDataFRAM::initialize();
+
+    Log.info("Saved Routes Initialized");
+
+    savedRoutesStore.savedAt = 0;                                       // An empty snapshot is never restored
+    savedRoutesStore.routeCount = 0;
+
+    // If you manually update fields here, be sure to update the hash
+    updateHash();
 }
 
-uint8_t sysStatusData::get_sensorType() const {
-    return getValue<uint8_t>(offsetof(SysData, sensorType));
+void savedRoutesData::saveRoutes(const RouteRecord *routes, uint8_t count, time_t savedAt) {
+    if (count > MAX_SAVED_ROUTES) count = MAX_SAVED_ROUTES;
+
+    WITH_LOCK(*this) {                                                  // Update the whole snapshot under one hash update rather than field by field
+        memcpy(savedRoutesStore.routes, routes, count * sizeof(RouteRecord));
+        savedRoutesStore.routeCount = count;
+        savedRoutesStore.savedAt = savedAt;
+        updateHash();
+    }
+    flush(true);                                                        // We are about to sleep - write it now
 }
 
-void sysStatusData::set_sensorType(uint8_t value) {
-    setValue<uint8_t>(offsetof(SysData, sensorType), value);
+bool savedRoutesData::get_route(uint8_t index, RouteRecord &route) const {
+    bool valid = false;
+
+    WITH_LOCK(*this) {
+        if (index < savedRoutesStore.routeCount && index < MAX_SAVED_ROUTES) {
+            route = savedRoutesStore.routes[index];
+            valid = true;
+        }
+    }
+    return valid;
 }
 
-bool sysStatusData::get_openHours() const {
-    return getValue<bool>(offsetof(SysData, openHours));
+time_t savedRoutesData::get_savedAt() const {
+    return getValue<time_t>(offsetof(SavedRoutes, savedAt));
 }
 
-void sysStatusData::set_openHours(bool value) {
-    setValue<bool>(offsetof(SysData, openHours), value);
+uint8_t savedRoutesData::get_routeCount() const {
+    return getValue<uint8_t>(offsetof(SavedRoutes, routeCount));
 }
 
-// *****************  Current Status Storage Object *******************
-// Offset of 100 bytes - make room for SysStatus
+// *****************  Report Backlog Storage Object *******************
+// Offset of 1024 bytes - after the Saved Routes
 // ********************************************************************
 
-currentStatusData *currentStatusData::_instance;
+// CRC-8, polynomial 0x31 - guards the records and blocks written to FRAM a piece at a time
+static uint8_t crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0xff;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static_assert(reportBacklogData::BACKLOG_CAPACITY * sizeof(reportBacklogData::ReportRecord) <= 2048, "Report backlog overruns its FRAM region");
+
+reportBacklogData *reportBacklogData::_instance;
 
 // [static]
-currentStatusData &currentStatusData::instance() {
+reportBacklogData &reportBacklogData::instance() {
     if (!_instance) {
-        _instance = new currentStatusData();
+        _instance = new reportBacklogData();
     }
     return *_instance;
 }
 
-currentStatusData::currentStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, 100, &currentData.currentHeader, sizeof(CurrentData), CURRENT_DATA_MAGIC, CURRENT_DATA_VERSION) {
+reportBacklogData::reportBacklogData() {
 };
 
-currentStatusData::~currentStatusData() {
+reportBacklogData::~reportBacklogData() {
 }
 
-void currentStatusData::setup() {
+void reportBacklogData::setup() {
     fram.begin();
 
-    current
-    //    .withLogData(true)
-        .withSaveDelayMs(250)
-        .load();
+    ReportRecord record;
+    bool found = false;
+    uint32_t newestSeq = 0;
+
+    for (uint16_t i = 0; i < BACKLOG_CAPACITY; i++) {                  // Find the newest intact record - that is where we append
+        fram.readData(FRAM_REPORT_BACKLOG_OFFSET + i * sizeof(ReportRecord), (uint8_t *)&record, sizeof(ReportRecord));
+        if ((record.state != RECORD_PENDING && record.state != RECORD_SENT) || record.crc != recordCrc(record)) continue;
+        if (record.seq % BACKLOG_CAPACITY != i) continue;                // Not where this sequence number would be written
+        if (!found || record.seq > newestSeq) newestSeq = record.seq;
+        found = true;
+    }
+
+    nextSeq = (found) ? newestSeq + 1 : 0;
+    oldestPendingSeq = nextSeq;
+
+    // Reports are sent oldest first, so the pending ones are the run of records just before nextSeq
+    uint32_t firstSeq = (nextSeq > BACKLOG_CAPACITY) ? nextSeq - BACKLOG_CAPACITY : 0;
+    while (oldestPendingSeq > firstSeq && readRecord(oldestPendingSeq - 1, record) && record.state == RECORD_PENDING) {
+        oldestPendingSeq--;
+    }
+
+    Log.info("Report backlog has %d pending reports", pendingCount());
 }
 
-void currentStatusData::loop() {
-    current.flush(false);
+bool reportBacklogData::append(uint32_t timestamp, uint16_t hourlyCount, uint16_t dailyCount) {
+    if (pendingCount() >= BACKLOG_CAPACITY) {
+        Log.info("Report backlog full - dropping the report from %s", Time.format(timestamp, "%T").c_str());
+        oldestPendingSeq++;                                            // About to be overwritten
+    }
+
+    ReportRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = nextSeq;
+    record.timestamp = timestamp;
+    record.hourlyCount = hourlyCount;
+    record.dailyCount = dailyCount;
+    record.state = 0;                                                  // Not valid until the state byte is written
+    record.crc = recordCrc(record);
+
+    size_t addr = recordAddress(record.seq);
+    if (!fram.writeData(addr, (const uint8_t *)&record, sizeof(ReportRecord))) return false;
+
+    uint8_t state = RECORD_PENDING;
+    if (!fram.writeData(addr + offsetof(ReportRecord, state), &state, sizeof(state))) return false;
+
+    nextSeq++;
+    Log.info("Report backlog stored report %lu - %d pending", record.seq, pendingCount());
+    return true;
 }
 
-void currentStatusData::resetEverything() {                             // The device is waking up in a new day or is a new install
-  current.set_dailyCount(0);                                            // Reset the counts in FRAM as well
-  current.set_hourlyCount(0);
-  current.set_lastCountTime(Time.now());
-  sysStatus.set_resetCount(0);                                          // Reset the reset count as well
-  current.set_messageCount(0);
-  current.set_successCount(0);
+bool reportBacklogData::peek(uint16_t index, ReportRecord &record) {
+    if (index >= pendingCount()) return false;
+    return readRecord(oldestPendingSeq + index, record) && record.state == RECORD_PENDING;
 }
 
-bool currentStatusData::validate(size_t dataSize) {
-    bool valid = PersistentDataFRAM::validate(dataSize);
-    if (valid) {
-        if (current.get_hourlyCount() < 0 || current.get_hourlyCount()  > 1024) {
-            Log.info("current data not valid hourlyCount=%d" , current.get_hourlyCount());
-            valid = false;
-        }
+void reportBacklogData::consume(uint16_t count) {
+    uint8_t state = RECORD_SENT;
+
+    for (; count > 0 && oldestPendingSeq < nextSeq; count--) {
+        fram.writeData(recordAddress(oldestPendingSeq) + offsetof(ReportRecord, state), &state, sizeof(state));
+        oldestPendingSeq++;
     }
-    Log.info("current data is %s",(valid) ? "valid": "not valid");
+}
+
+uint16_t reportBacklogData::pendingCount() const {
+    return (uint16_t)(nextSeq - oldestPendingSeq);
+}
+
+bool reportBacklogData::readRecord(uint32_t seq, ReportRecord &record) {
+    if (!fram.readData(recordAddress(seq), (uint8_t *)&record, sizeof(ReportRecord))) return false;
+    return (record.seq == seq && record.crc == recordCrc(record));
+}
+
+// [static]
+uint8_t reportBacklogData::recordCrc(const ReportRecord &record) {
+    uint8_t data[12];                                                  // The fields covered, without the struct padding
+    memcpy(&data[0], &record.seq, 4);
+    memcpy(&data[4], &record.timestamp, 4);
+    memcpy(&data[8], &record.hourlyCount, 2);
+    memcpy(&data[10], &record.dailyCount, 2);
+
+    return crc8(data, sizeof(data));
+}
+
+// [static]
+size_t reportBacklogData::recordAddress(uint32_t seq) {
+    return FRAM_REPORT_BACKLOG_OFFSET + (seq % BACKLOG_CAPACITY) * sizeof(ReportRecord);
+}
+
+
+// *****************  Energy Status Storage Object *******************
+// Offset of 3072 bytes - after the Report Backlog
+// ********************************************************************
+
+static_assert(sizeof(energyStatusData::EnergyData) <= 256, "energyStatusData overruns its FRAM region");
+
+energyStatusData *energyStatusData::_instance;
+
+// [static]
+energyStatusData &energyStatusData::instance() {
+    if (!_instance) {
+        _instance = new energyStatusData();
+    }
+    return *_instance;
+}
+
+energyStatusData::energyStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, FRAM_ENERGY_STATUS_OFFSET, &energyData.energyHeader, sizeof(EnergyData), ENERGY_DATA_MAGIC, ENERGY_DATA_VERSION) {
+};
+
+energyStatusData::~energyStatusData() {
+}
+
+void energyStatusData::setup() {
+    fram.begin();
+
+    energyStatus
+    //    .withLogData(true)
+        .withSaveDelayMs(1000)
+        .load();
+}
+
+void energyStatusData::loop() {
+    energyStatus.flush(false);
+}
+
+bool energyStatusData::validate(size_t dataSize) {
+    bool valid = PersistentDataFRAM::validate(dataSize);
+    Log.info("energy status is %s",(valid) ? "valid": "not valid");
     return valid;
 }
 
-void currentStatusData::initialize() {
+void energyStatusData::initialize() {
     PersistentDataFRAM::initialize();
 
-    Log.info("Current Data Initialized");
+    Log.info("Energy Status Initialized");
 
-    currentStatusData::resetEverything();
+    memset(&energyData.counters, 0, sizeof(energyData.counters));
+    energyData.countersSince = Time.isValid() ? Time.now() : 0;
+    energyData.reportedChargeUah = 0;
+    energyData.rolledChargeUah = 0;
 
     // If you manually update fields here, be sure to update the hash
     updateHash();
 }
 
-
-int8_t currentStatusData::get_internalTempC() const {
-    return getValue<int8_t>(offsetof(CurrentData, internalTempC));
+void energyStatusData::addCounters(const EnergyCounters &delta) {
+    WITH_LOCK(*this) {
+        EnergyCounters &counters = energyData.counters;
+        for (uint8_t i = 0; i < ENERGY_STATES; i++) counters.stateMs[i] += delta.stateMs[i];
+        counters.sleepMs += delta.sleepMs;
+        counters.radioTxMs += delta.radioTxMs;
+        counters.radioRxMs += delta.radioRxMs;
+        counters.framTransactions += delta.framTransactions;
+        counters.sensorWakes += delta.sensorWakes;
+        markDirty(offsetof(EnergyData, counters), sizeof(EnergyCounters));
+        hashChanged();
+    }
 }
 
-void currentStatusData::set_internalTempC(int8_t value) {
-    setValue<int8_t>(offsetof(CurrentData, internalTempC), value);
+void energyStatusData::get_counters(EnergyCounters &counters) const {
+    WITH_LOCK(*this) {
+        counters = energyData.counters;
+    }
 }
 
-double currentStatusData::get_stateOfCharge() const {
-    return getValue<double>(offsetof(CurrentData, stateOfCharge));
+void energyStatusData::rollCounters(uint32_t chargeUah) {
+    WITH_LOCK(*this) {
+        memset(&energyData.counters, 0, sizeof(energyData.counters));
+        if (Time.isValid()) energyData.countersSince = Time.now();
+        energyData.rolledChargeUah = chargeUah;
+        markDirty(offsetof(EnergyData, countersSince), sizeof(time_t));
+        markDirty(offsetof(EnergyData, counters), sizeof(EnergyCounters));
+        markDirty(offsetof(EnergyData, rolledChargeUah), sizeof(uint32_t));
+        hashChanged();
+    }
 }
 
-void currentStatusData::set_stateOfCharge(double value) {
-    setValue<double>(offsetof(CurrentData, stateOfCharge), value);
+uint32_t energyStatusData::get_rolledChargeUah() const {
+    return getValue<uint32_t>(offsetof(EnergyData, rolledChargeUah));
 }
 
-uint8_t currentStatusData::get_batteryState() const {
-    return getValue<uint8_t>(offsetof(CurrentData, batteryState));
+time_t energyStatusData::get_countersSince() const {
+    return getValue<time_t>(offsetof(EnergyData, countersSince));
 }
 
-void currentStatusData::set_batteryState(uint8_t value) {
-    setValue<uint8_t>(offsetof(CurrentData, batteryState), value);
+uint32_t energyStatusData::get_reportedChargeUah() const {
+    return getValue<uint32_t>(offsetof(EnergyData, reportedChargeUah));
 }
 
-time_t currentStatusData::get_lastSampleTime() const {
-    return getValue<time_t>(offsetof(CurrentData, lastSampleTime));
+void energyStatusData::set_reportedChargeUah(uint32_t value) {
+    setValue<uint32_t>(offsetof(EnergyData, reportedChargeUah), value);
 }
 
-void currentStatusData::set_lastSampleTime(time_t value) {
-    setValue<time_t>(offsetof(CurrentData, lastSampleTime), value);
-}
 
-int16_t currentStatusData::get_RSSI() const {
-    return getValue<int16_t>(offsetof(CurrentData, RSSI));
+// *****************  Event Log Storage Object *******************
+// Offset of 4096 bytes - the second half of the FRAM
+// ********************************************************************
+
+static_assert(eventLogData::EVENT_BLOCK_COUNT * eventLogData::EVENT_BLOCK_SIZE <= 4096, "Event log overruns its FRAM region");
+
+eventLogData *eventLogData::_instance;
+
+// [static]
+eventLogData &eventLogData::instance() {
+    if (!_instance) {
+        _instance = new eventLogData();
+    }
+    return *_instance;
 }
 
-void currentStatusData::set_RSSI(int16_t value) {
-    setValue<int16_t>(offsetof(CurrentData, RSSI), value);
+eventLogData::eventLogData() {
+};
+
+eventLogData::~eventLogData() {
 }
 
-int16_t currentStatusData::get_SNR() const {
-    return getValue<int16_t>(offsetof(CurrentData, SNR));
+void eventLogData::setup() {
+    fram.begin();
+
+    BlockHeader header;
+    bool found = false;
+    uint32_t newestSeq = 0;
+
+    for (uint16_t i = 0; i < EVENT_BLOCK_COUNT; i++) {                 // Find the newest intact block - that is where we append
+        fram.readData(FRAM_EVENT_LOG_OFFSET + i * EVENT_BLOCK_SIZE, (uint8_t *)&header, sizeof(BlockHeader));
+        if (header.crc != headerCrc(header) || header.seq % EVENT_BLOCK_COUNT != i) continue;
+        if (!found || header.seq > newestSeq) newestSeq = header.seq;
+        found = true;
+    }
+
+    if (!found) {
+        Log.info("Event log is empty");
+        return;
+    }
+
+    nextSeq = newestSeq + 1;
+    oldestSeq = (nextSeq > EVENT_BLOCK_COUNT) ? nextSeq - EVENT_BLOCK_COUNT : 0;
+
+    // Run through the newest block to find where its events end and the time of the last one
+    Cursor cursor;
+    cursor.seq = newestSeq;
+    uint32_t events = 0;
+    uint64_t tick;
+    uint16_t len;
+    if (loadBlock(cursor)) {
+        while (peekEvent(cursor, tick, len)) {
+            cursor.tick = tick;
+            cursor.pos += len;
+            events++;
+        }
+    }
+    appendPos = cursor.pos;
+    lastTick = cursor.tick;
+
+    Log.info("Event log has %lu blocks, the newest with %lu events to %s", nextSeq - oldestSeq, events, Time.format((time_t)(lastTick / 10), "%F %T").c_str());
 }
 
-void currentStatusData::set_SNR(int16_t value) {
-    setValue<int16_t>(offsetof(CurrentData, SNR), value);
+bool eventLogData::append(const uint32_t *eventMillis, uint8_t count) {
+    if (!Time.isValid()) return false;                                 // Nothing to tie the times to
+
+    uint64_t nowTick = (uint64_t)Time.now() * 10;
+    uint32_t nowMillis = millis();
+    uint8_t buf[EVENT_PAYLOAD_SIZE + 1];
+    uint16_t len = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint64_t clockTick = nowTick - (nowMillis - eventMillis[i]) / EVENT_TICK_MS;
+        uint64_t tick = anchorTick + (eventMillis[i] - anchorMillis) / EVENT_TICK_MS;
+        if (!anchored || tick + 20 < clockTick || tick > clockTick + 20) {       // The clock has been set, or millis() has wrapped
+            anchorTick = tick = clockTick;
+            anchorMillis = eventMillis[i];
+            anchored = true;
+        }
+        if (tick < lastTick) tick = lastTick;                          // Keep the log in order if the clock went back
+
+        uint8_t varint[5];
+        uint64_t gap = tick - lastTick;
+        uint8_t n = encodeGap((gap < 0xfffffffe) ? (uint32_t)gap : 0xfffffffe, varint);
+        if (appendPos + len + n > EVENT_PAYLOAD_SIZE) {                // Close this block and start the next with this event
+            if (len > 0 && !fram.writeData(blockAddress(nextSeq - 1) + sizeof(BlockHeader) + appendPos, buf, len)) return false;
+            len = 0;
+            if (!startBlock(tick)) return false;
+            n = encodeGap(0, varint);
+        }
+        memcpy(&buf[len], varint, n);
+        len += n;
+        lastTick = tick;
+    }
+
+    if (len == 0) return true;
+    buf[len] = 0;                                                      // Ends the block here even over a half written varint
+    uint16_t writeLen = (appendPos + len < EVENT_PAYLOAD_SIZE) ? len + 1 : len;
+    if (!fram.writeData(blockAddress(nextSeq - 1) + sizeof(BlockHeader) + appendPos, buf, writeLen)) return false;
+    appendPos += len;
+    return true;
 }
 
-uint8_t currentStatusData::get_messageCount() const {
-    return getValue<uint8_t>(offsetof(CurrentData, messageCount));
+bool eventLogData::seek(Cursor &cursor, uint32_t fromTime) {
+    uint64_t fromTick = (uint64_t)fromTime * 10;
+    BlockHeader header;
+
+    cursor = Cursor();
+    cursor.seq = oldestSeq;
+    for (uint32_t seq = nextSeq; seq-- > oldestSeq; ) {               // The newest block that starts no later than fromTime
+        if (readHeader(seq, header) && (uint64_t)header.startTime * 10 + header.startTenths <= fromTick) {
+            cursor.seq = seq;
+            break;
+        }
+    }
+
+    uint64_t tick;
+    uint16_t len;
+    while (peekEvent(cursor, tick, len)) {
+        if (tick >= fromTick) return true;
+        cursor.tick = tick;
+        cursor.pos += len;
+    }
+    return false;
 }
 
-void currentStatusData::set_messageCount(uint8_t value) {
-    setValue<uint8_t>(offsetof(CurrentData, messageCount), value);
+bool eventLogData::next(Cursor &cursor, Event &event) {
+    uint64_t tick;
+    uint16_t len;
+
+    if (!peekEvent(cursor, tick, len)) return false;
+    cursor.tick = tick;
+    cursor.pos += len;
+    event.time = (uint32_t)(tick / 10);
+    event.tenths = (uint8_t)(tick % 10);
+    return true;
 }
 
-uint8_t currentStatusData::get_successCount() const {
-    return getValue<uint8_t>(offsetof(CurrentData, successCount));
+uint16_t eventLogData::readChunk(Cursor &cursor, LoRA_Messages::BitWriter &writer) {
+    uint16_t events = 0;
+    uint64_t tick, lastTick = 0;                                       // Not cursor.tick - that goes back to a block's start as it is read
+    uint16_t len;
+
+    while (peekEvent(cursor, tick, len)) {
+        size_t pos = writer.position();
+        if (events == 0) {
+            writer.write((uint32_t)(tick / 10), 32);
+            writer.write((uint32_t)(tick % 10), 4);
+        }
+        else {
+            uint64_t gap = tick - lastTick;
+            LoRA_Messages::Varint::encode(writer, (gap < 0xffffffff) ? (uint32_t)gap : 0xffffffff);
+        }
+        if (!writer.ok()) {                                            // Full - leave this event for the next chunk
+            writer.rewind(pos);
+            break;
+        }
+        cursor.tick = lastTick = tick;
+        cursor.pos += len;
+        events++;
+    }
+    return events;
 }
 
-void currentStatusData::set_successCount(uint8_t value) {
-    setValue<uint8_t>(offsetof(CurrentData, successCount), value);
+bool eventLogData::readHeader(uint32_t seq, BlockHeader &header) {
+    if (!fram.readData(blockAddress(seq), (uint8_t *)&header, sizeof(BlockHeader))) return false;
+    return (header.seq == seq && header.crc == headerCrc(header));
 }
 
-time_t currentStatusData::get_lastCountTime() const {
-    return getValue<time_t>(offsetof(CurrentData, lastCountTime));
+bool eventLogData::loadBlock(Cursor &cursor) {
+    BlockHeader header;
+
+    if (!readHeader(cursor.seq, header)) return false;
+    if (!fram.readData(blockAddress(cursor.seq) + sizeof(BlockHeader), cursor.payload, EVENT_PAYLOAD_SIZE)) return false;
+    if (!cursor.loaded) {
+        cursor.pos = 0;
+        cursor.tick = (uint64_t)header.startTime * 10 + header.startTenths;
+        cursor.loaded = true;
+    }
+    return true;
 }
 
-void currentStatusData::set_lastCountTime(time_t value) {
-    setValue<time_t>(offsetof(CurrentData, lastCountTime), value);
+bool eventLogData::peekEvent(Cursor &cursor, uint64_t &tick, uint16_t &len) {
+    for (;;) {
+        if (cursor.seq < oldestSeq) {                                  // Overwritten while we were away - its copy is stale
+            cursor.seq = oldestSeq;
+            cursor.loaded = false;
+        }
+        if (!cursor.loaded) {
+            if (cursor.seq >= nextSeq) return false;
+            if (!loadBlock(cursor)) {                                  // Damaged - skip it
+                cursor.seq++;
+                continue;
+            }
+        }
+
+        uint32_t gap;
+        len = decodeGap(cursor.payload, cursor.pos, gap);
+        if (len == 0 && loadBlock(cursor)) len = decodeGap(cursor.payload, cursor.pos, gap);  // Events appended since it was read
+        if (len > 0) {
+            tick = cursor.tick + gap;
+            return true;
+        }
+
+        if (cursor.seq + 1 >= nextSeq) return false;                   // Read up to the newest event
+        cursor.seq++;
+        cursor.loaded = false;
+    }
 }
 
-uint16_t currentStatusData::get_hourlyCount() const {
-    return getValue<uint16_t>(offsetof(CurrentData, hourlyCount));
+bool eventLogData::startBlock(uint64_t tick) {
+    uint8_t zeros[EVENT_PAYLOAD_SIZE];
+    memset(zeros, 0, sizeof(zeros));
+
+    BlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.seq = nextSeq;
+    header.startTime = (uint32_t)(tick / 10);
+    header.startTenths = (uint8_t)(tick % 10);
+    header.crc = headerCrc(header);
+
+    size_t addr = blockAddress(header.seq);                            // Zeroed first so the header never covers old events
+    if (!fram.writeData(addr + sizeof(BlockHeader), zeros, sizeof(zeros))) return false;
+    if (!fram.writeData(addr, (const uint8_t *)&header, sizeof(BlockHeader))) return false;
+
+    nextSeq++;
+    if (nextSeq - oldestSeq > EVENT_BLOCK_COUNT) oldestSeq = nextSeq - EVENT_BLOCK_COUNT;
+    appendPos = 0;
+    return true;
 }
 
-void currentStatusData::set_hourlyCount(uint16_t value) {
-    setValue<uint16_t>(offsetof(CurrentData, hourlyCount), value);
+// [static]
+uint8_t eventLogData::headerCrc(const BlockHeader &header) {
+    uint8_t data[9];                                                   // The fields covered, without the struct padding
+    memcpy(&data[0], &header.seq, 4);
+    memcpy(&data[4], &header.startTime, 4);
+    data[8] = header.startTenths;
+    return crc8(data, sizeof(data));
 }
 
-uint16_t currentStatusData::get_dailyCount() const {
-    return getValue<uint16_t>(offsetof(CurrentData, dailyCount));
+// [static]
+size_t eventLogData::blockAddress(uint32_t seq) {
+    return FRAM_EVENT_LOG_OFFSET + (seq % EVENT_BLOCK_COUNT) * EVENT_BLOCK_SIZE;
 }
 
-void currentStatusData::set_dailyCount(uint16_t value) {
-    setValue<uint16_t>(offsetof(CurrentData, dailyCount), value);
+// [static]
+uint16_t eventLogData::decodeGap(const uint8_t *payload, uint16_t pos, uint32_t &gap) {
+    uint32_t value = 0;
+
+    for (uint16_t i = 0; i < 5 && pos + i < EVENT_PAYLOAD_SIZE; i++) {
+        if (payload[pos + i] == 0) return 0;                           // Unused space, or a varint cut short
+        value |= (uint32_t)(payload[pos + i] & 0x7f) << (7 * i);
+        if (!(payload[pos + i] & 0x80)) {
+            gap = value - 1;
+            return i + 1;
+        }
+    }
+    return 0;
 }
 
+// [static]
+uint8_t eventLogData::encodeGap(uint32_t gap, uint8_t *varint) {
+    uint32_t value = gap + 1;
+    uint8_t n = 0;
+
+    while (value > 0x7f) {
+        varint[n++] = 0x80 | (value & 0x7f);
+        value >>= 7;
+    }
+    varint[n++] = value;
+    return n;
+}
@@ -4,14 +4,61 @@
 #include "Particle.h"
 #include "MB85RC256V-FRAM-RK.h"
 #include "StorageHelperRK.h"
+#include "LoRA_Messages.h"
 
 //Define external class instances. These are typically declared public in the main .CPP. I wonder if we can only declare it here?
-// extern MB85RC64 fram;
+extern MB85RC64 fram;
 
 //Macros(#define) to swap out during pre-processing (use sparingly). This is typically used outside of this .H and .CPP file within the main .CPP file or other .CPP files that reference this header file. 
 // This way you can do "data.setup()" instead of "MyPersistentData::instance().setup()" as an example
 #define current currentStatusData::instance()
 #define sysStatus sysStatusData::instance()
+#define savedRoutes savedRoutesData::instance()
+#define reportBacklog reportBacklogData::instance()
+#define energyStatus energyStatusData::instance()
+#define eventLog eventLogData::instance()
+
+// FRAM memory map - MB85RC64 is 8K bytes. Each storage object needs its offset here and must fit before the next one
+const size_t FRAM_SYS_STATUS_OFFSET = 0;						// sysStatusData
+const size_t FRAM_CURRENT_STATUS_OFFSET = 100;					// currentStatusData
+const size_t FRAM_SAVED_ROUTES_OFFSET = 256;					// savedRoutesData - up to 768 bytes
+const size_t FRAM_REPORT_BACKLOG_OFFSET = 1024;					// reportBacklogData - up to 2048 bytes
+const size_t FRAM_ENERGY_STATUS_OFFSET = 3072;					// energyStatusData - up to 256 bytes
+const size_t FRAM_SYS_STATUS_B_OFFSET = 3328;					// Second copy of sysStatusData - up to 100 bytes
+const size_t FRAM_CURRENT_STATUS_B_OFFSET = 3456;				// Second copy of currentStatusData - up to 156 bytes
+const size_t FRAM_EVENT_LOG_OFFSET = 4096;						// eventLogData - the last 4096 bytes of the MB85RC64
+
+// Counts are also kept in fixed width buckets so the data report can carry a traffic profile for the reporting period
+const uint8_t COUNT_BUCKET_MINUTES = 5;						// Width of each bucket
+const uint8_t MAX_COUNT_BUCKETS = 12;						// An hour of buckets - the longest reporting period
+
+// Node numbers are assigned by the gateway in the join acknowledgement. 0 is the gateway and 255 is the LoRA broadcast address
+const uint8_t MAX_NODE_NUMBER = 253;							// Highest node number the gateway can assign
+const uint8_t UNCONFIGURED_NODE = 254;							// Node number we use until we have joined - sends a join request
+
+// Persistent fields are declared once, in a list for each storage object below. Each list entry is
+//   FIELD(type, name, default, low, high)
+// and the list is expanded with the macros here into the structure's members, inline get_ and set_ accessors, the
+// defaults set when the data is initialized and the range checks made when it is loaded. ANY_VALUE for low and high
+// leaves a field unchecked. New fields only ever go at the end of a list, as the list is the layout in FRAM.
+struct AnyValue {};
+const AnyValue ANY_VALUE = AnyValue();
+
+template<class T> inline bool inRange(T, AnyValue, AnyValue) { return true; }
+template<class T, class L, class H> inline bool inRange(T value, L low, H high) { return value >= low && value <= high; }
+
+#define PERSISTENT_MEMBER(type, name, def, low, high) \
+	type name;
+#define PERSISTENT_ARRAY_MEMBER(type, name, count) \
+	type name[count];
+#define PERSISTENT_ACCESSORS(type, name, def, low, high) \
+	type get_##name() const { return getField<type, offsetof(FieldData, name)>(); } \
+	void set_##name(type value) { setField<type, offsetof(FieldData, name)>(value); }
+#define PERSISTENT_DEFAULT(type, name, def, low, high) \
+	set_##name(def);
+#define PERSISTENT_CHECK(type, name, def, low, high) \
+	if (!inRange(get_##name(), low, high)) { Log.info("data not valid " #name "=%ld", (long)get_##name()); valid = false; }
+#define PERSISTENT_SKIP(...)
 
 /**
  * This class is a singleton; you do not create one as a global, on the stack, or with new.
@@ -57,6 +104,14 @@ public:
 	 */
 	bool validate(size_t dataSize);
 
+	/**
+	 * @brief Upgrades data saved by older firmware a version at a time, so a node keeps its node number over an update
+	 * 
+	 * @details Bump SYS_DATA_VERSION only when the meaning of a field changes and add a case here for the old version.
+	 * Fields added at the end do not need a new version - they start at 0.
+	 */
+	bool migrate(uint16_t fromVersion);
+
 	/**
 	 * @brief Will reinitialize data if it is found not to be valid
 	 * 
@@ -68,85 +123,39 @@ public:
 	void initialize();
 
 
+	// Once you've added a field you cannot insert fields, remove fields or change the size of a field.
+	// Doing so will cause the data to be corrupted!
+	#define SYS_DATA_FIELDS(FIELD) \
+		FIELD(uint16_t, nodeNumber, UNCONFIGURED_NODE, 1, UNCONFIGURED_NODE)	/* Assigned by the gateway on joining the network */ \
+		FIELD(uint8_t, structuresVersion, 1, ANY_VALUE, ANY_VALUE)				/* Version of the data structures (system and data) */ \
+		FIELD(uint16_t, magicNumber, 27617, ANY_VALUE, ANY_VALUE)				/* A way to identify nodes and gateways so they can trust each other */ \
+		FIELD(uint8_t, firmwareRelease, 0, ANY_VALUE, ANY_VALUE)				/* Version of the device firmware (integer - aligned to particle product firmware) */ \
+		FIELD(uint8_t, resetCount, 0, ANY_VALUE, ANY_VALUE)						/* reset count of device (0-256) */ \
+		FIELD(time_t, lastConnection, 0, ANY_VALUE, ANY_VALUE)					/* Last time we successfully connected to Particle */ \
+		FIELD(uint16_t, frequencyMinutes, 60, 1, 60)							/* When we are reporing at minute increments - what are they - for Gateways */ \
+		FIELD(uint8_t, alertCodeNode, 1, ANY_VALUE, ANY_VALUE)					/* Alert code from node */ \
+		FIELD(time_t, alertTimestampNode, 0, ANY_VALUE, ANY_VALUE)				/* Timestamp of alert */ \
+		FIELD(uint8_t, sensorType, 0, ANY_VALUE, ANY_VALUE)						/* PIR sensor, car counter, others - this value is changed by the Gateway */ \
+		FIELD(bool, openHours, true, ANY_VALUE, ANY_VALUE)						/* Are we collecting data or is it outside open hours? */ \
+		FIELD(uint16_t, slotIndex, 0, ANY_VALUE, ANY_VALUE)						/* Transmit slot assigned by the Gateway - 0 is the first slot in the frame */ \
+		FIELD(uint16_t, slotCount, 0, ANY_VALUE, ANY_VALUE)						/* Number of slots in the Gateway's frame - 0 if no slot has been assigned */ \
+		FIELD(int16_t, clockDriftPpm, 0, ANY_VALUE, ANY_VALUE)					/* Measured drift of our clock against the Gateway's - positive if we run fast */ \
+		FIELD(uint32_t, frameCounterReserved, 0, ANY_VALUE, ANY_VALUE)			/* Radio frame counters below this may have been used - we start from here after a reset */
+
 	class SysData {
 	public:
 		// This structure must always begin with the header (16 bytes)
 		StorageHelperRK::PersistentDataBase::SavedDataHeader sysHeader;
-		// Your fields go here. Once you've added a field you cannot add fields
-		// (except at the end), insert fields, remove fields, change size of a field.
-		// Doing so will cause the data to be corrupted!
-		uint16_t nodeNumber;                              // Assigned by the gateway on joining the network
-		uint8_t structuresVersion;                        // Version of the data structures (system and data)
-		uint16_t magicNumber;							  // A way to identify nodes and gateways so they can trust each other
-		uint8_t firmwareRelease;                          // Version of the device firmware (integer - aligned to particle product firmware)
-		uint8_t resetCount;                               // reset count of device (0-256)
-		time_t lastConnection;                     		  // Last time we successfully connected to Particle
-		uint16_t frequencyMinutes;                        // When we are reporing at minute increments - what are they - for Gateways
-		uint8_t alertCodeNode;                            // Alert code from node
-		time_t alertTimestampNode;                 	      // Timestamp of alert
-		uint8_t sensorType;                               // PIR sensor, car counter, others - this value is changed by the Gateway
-		bool openHours;									  // Are we collecting data or is it outside open hours?
+		SYS_DATA_FIELDS(PERSISTENT_MEMBER)
 	};
+	typedef SysData FieldData;
 
 	SysData sysData;
 
 	// 	******************* Get and Set Functions for each variable in the storage object ***********
-    
-	/**
-	 * @brief For the Get functions, used to retrieve the value of the variable
-	 * 
-	 * @details Specific to the location in the object and the type of the variable
-	 * 
-	 * @param Nothing needed
-	 * 
-	 * @returns The value of the variable in the corret type
-	 * 
-	 */
-
-	/**
-	 * @brief For the Set functions, used to set the value of the variable
-	 * 
-	 * @details Specific to the location in the object and the type of the variable
-	 * 
-	 * @param Value to set the variable - correct type - for Strings they are truncated if too long
-	 * 
-	 * @returns None needed
-	 * 
-	 */
-
-
-	uint8_t get_nodeNumber() const;
-	void set_nodeNumber(uint8_t value);
-
-	uint8_t get_structuresVersion() const ;
-	void set_structuresVersion(uint8_t value);
+	// get_name() and set_name(value) for each field in SYS_DATA_FIELDS
 
-	uint16_t get_magicNumber() const ;
-	void set_magicNumber(uint16_t value);
-
-	uint8_t get_firmwareRelease() const;
-	void set_firmwareRelease(uint8_t value);
-
-	uint8_t get_resetCount() const;
-	void set_resetCount(uint8_t value);
-
-	time_t get_lastConnection() const;
-	void set_lastConnection(time_t value);
-
-	uint16_t get_frequencyMinutes() const;
-	void set_frequencyMinutes(uint16_t value);
-
-	uint8_t get_alertCodeNode() const;
-	void set_alertCodeNode(uint8_t value);
-
-	time_t get_alertTimestampNode() const;
-	void set_alertTimestampNode(time_t value);
-
-	uint8_t get_sensorType() const;
-	void set_sensorType(uint8_t value);
-
-	bool get_openHours() const;
-	void set_openHours(bool value);
+	SYS_DATA_FIELDS(PERSISTENT_ACCESSORS)
 
 	//Members here are internal only and therefore protected
 protected:
@@ -181,7 +190,7 @@ protected:
 
     //Since these variables are only used internally - They can be private. 
 	static const uint32_t SYS_DATA_MAGIC = 0x20a99e75;
-	static const uint16_t SYS_DATA_VERSION = 2;
+	static const uint16_t SYS_DATA_VERSION = 3;				// 3 - TDMA slots and node numbers up to MAX_NODE_NUMBER
 
 };
 
@@ -244,121 +253,650 @@ public:
 	 */
 	void initialize();  
 
+	// Once you've added a field you cannot insert fields, remove fields or change the size of a field.
+	// Doing so will cause the data to be corrupted!
+	#define CURRENT_DATA_FIELDS(FIELD, ARRAY) \
+		FIELD(int8_t, internalTempC, 0, ANY_VALUE, ANY_VALUE)					/* Enclosure temperature in degrees C */ \
+		FIELD(double, stateOfCharge, 0, ANY_VALUE, ANY_VALUE)					/* Battery charge level */ \
+		FIELD(uint8_t, batteryState, 0, ANY_VALUE, ANY_VALUE)					/* Stores the current battery state (charging, discharging, etc) */ \
+		FIELD(time_t, lastSampleTime, 0, ANY_VALUE, ANY_VALUE)					/* Timestamp of last data collection */ \
+		FIELD(int16_t, RSSI, 0, ANY_VALUE, ANY_VALUE)							/* Latest signal strength value (updated adter ack and sent to gateway on next data report) */ \
+		FIELD(int16_t, SNR, 0, ANY_VALUE, ANY_VALUE)							/* Latest Signal to Noise Ratio (updated after ack and send to gatewat on next dara report) */ \
+		FIELD(uint8_t, messageCount, 0, ANY_VALUE, ANY_VALUE)					/* What message are we on */ \
+		FIELD(uint8_t, successCount, 0, ANY_VALUE, ANY_VALUE)					/* How many messages are delivered successfully */ \
+		FIELD(time_t, lastCountTime, 0, ANY_VALUE, ANY_VALUE)					/* When did we last record a count */ \
+		FIELD(uint16_t, hourlyCount, 0, 0, 1024)								/* Current Hourly Count */ \
+		FIELD(uint16_t, dailyCount, 0, ANY_VALUE, ANY_VALUE)					/* Current Daily Count */ \
+		FIELD(time_t, bucketStart, 0, ANY_VALUE, ANY_VALUE)						/* Start of the first count bucket - on a COUNT_BUCKET_MINUTES boundary */ \
+		ARRAY(uint16_t, countBuckets, MAX_COUNT_BUCKETS)						/* Counts in each COUNT_BUCKET_MINUTES from bucketStart - set with addBucketCount() */
+
 	class CurrentData {
 	public:
 		// This structure must always begin with the header (16 bytes)
 		StorageHelperRK::PersistentDataBase::SavedDataHeader currentHeader;
-		// Your fields go here. Once you've added a field you cannot add fields
-		// (except at the end), insert fields, remove fields, change size of a field.
-		// Doing so will cause the data to be corrupted!
-		// You may want to keep a version number in your data.
-		int8_t internalTempC;                             // Enclosure temperature in degrees C
-		double stateOfCharge;                             // Battery charge level
-		uint8_t batteryState;                             // Stores the current battery state (charging, discharging, etc)
-		time_t lastSampleTime;                            // Timestamp of last data collection
-		int16_t RSSI;                                     // Latest signal strength value (updated adter ack and sent to gateway on next data report)
-		int16_t SNR;									  // Latest Signal to Noise Ratio (updated after ack and send to gatewat on next dara report)
-		uint8_t messageCount;                             // What message are we on
-		uint8_t successCount;							  // How many messages are delivered successfully
-		time_t lastCountTime;                             // When did we last record a count
-		uint16_t hourlyCount;                             // Current Hourly Count
-		uint16_t dailyCount;                              // Current Daily Count
-		// OK to add more fields here 
+		CURRENT_DATA_FIELDS(PERSISTENT_MEMBER, PERSISTENT_ARRAY_MEMBER)
 	};
+	typedef CurrentData FieldData;
+
 	CurrentData currentData;
 
 	// 	******************* Get and Set Functions for each variable in the storage object ***********
-    
+	// get_name() and set_name(value) for each field in CURRENT_DATA_FIELDS
+
+	CURRENT_DATA_FIELDS(PERSISTENT_ACCESSORS, PERSISTENT_SKIP)
+
+	uint16_t get_countBucket(uint8_t index) const;
+
 	/**
-	 * @brief For the Get functions, used to retrieve the value of the variable
+	 * @brief Adds counts to the bucket for the time they happened
 	 * 
-	 * @details Specific to the location in the object and the type of the variable
+	 * @details Counts from after the last bucket go in the last bucket, and counts from before bucketStart in the first,
+	 * so nothing is lost if the buckets are not reported for a while - only the timing
 	 * 
-	 * @param Nothing needed
+	 * @param when Time of the counts
+	 * @param counts Number of counts
+	 */
+	void addBucketCount(time_t when, uint16_t counts);
+
+	/**
+	 * @brief Number of whole buckets since bucketStart - what is ready to report
 	 * 
-	 * @returns The value of the variable in the corret type
+	 * @param now Current time
+	 * @return uint8_t - 0 to MAX_COUNT_BUCKETS
+	 */
+	uint8_t completeBuckets(time_t now) const;
+
+	/**
+	 * @brief Drops the oldest buckets once they have been reported and moves bucketStart on
 	 * 
+	 * @param count Number of buckets reported
+	 * @param now Current time - if the buckets are still behind it they restart from now
 	 */
+	void shiftBuckets(uint8_t count, time_t now);
 
 	/**
-	 * @brief For the Set functions, used to set the value of the variable
+	 * @brief Empties the buckets and starts them from the bucket boundary before now
+	 */
+	void resetBuckets(time_t now);
+
+		//Members here are internal only and therefore protected
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     * 
+     * Use MyPersistentData::instance() to instantiate the singleton.
+     */
+    currentStatusData();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~currentStatusData();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    currentStatusData(const currentStatusData&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    currentStatusData& operator=(const currentStatusData&) = delete;
+
+    /**
+     * @brief Singleton instance of this class
+     * 
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static currentStatusData *_instance;
+
+    //Since these variables are only used internally - They can be private. 
+	static const uint32_t CURRENT_DATA_MAGIC = 0x20a99e80;
+	static const uint16_t CURRENT_DATA_VERSION = 3;
+};
+
+
+
+
+// *****************  Saved Routes Storage Object *******************
+// Snapshot of the mesh routing table taken as the radio goes to sleep
+// ********************************************************************
+
+class savedRoutesData : public StorageHelperRK::PersistentDataFRAM {
+public:
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     * 
+     * Use savedRoutesData::instance() to instantiate the singleton.
+     */
+    static savedRoutesData &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup()
+     * 
+     * You typically use savedRoutes.setup();
+     */
+    void setup();
+
+    /**
+     * @brief Perform application loop operations; call this from global application loop()
+     * 
+     * You typically use savedRoutes.loop();
+     */
+    void loop();
+
+	/**
+	 * @brief Validates values and, if valid, checks that data is in the correct range.
+	 * 
+	 */
+	bool validate(size_t dataSize);
+
+	/**
+	 * @brief Will reinitialize data if it is found not to be valid - an empty snapshot
 	 * 
-	 * @details Specific to the location in the object and the type of the variable
+	 */
+	void initialize();
+
+	static const uint8_t MAX_SAVED_ROUTES = 50;				// Matches the default RH_ROUTING_TABLE_SIZE
+
+	// One route as saved - the age is taken when the snapshot is saved
+	struct RouteRecord {
+		uint8_t dest;                                     // Destination node
+		uint8_t nextHop;                                  // Send via this node
+		int16_t rssi;                                     // Link quality when the route was learned
+		uint32_t ageSeconds;                              // How old the route was when it was saved
+	};
+
+	class SavedRoutes {
+	public:
+		// This structure must always begin with the header (16 bytes)
+		StorageHelperRK::PersistentDataBase::SavedDataHeader routesHeader;
+		// Your fields go here. Once you've added a field you cannot add fields
+		// (except at the end), insert fields, remove fields, change size of a field.
+		// Doing so will cause the data to be corrupted!
+		time_t savedAt;                                   // When the snapshot was taken - 0 if never
+		uint8_t routeCount;                               // Number of valid entries in routes
+		RouteRecord routes[MAX_SAVED_ROUTES];             // The routes
+	};
+	SavedRoutes savedRoutesStore;
+
+	/**
+	 * @brief Replaces the snapshot with a new set of routes and writes it to FRAM straight away
+	 * 
+	 * @param routes Array of routes to save
+	 * @param count Number of routes - any beyond MAX_SAVED_ROUTES are dropped
+	 * @param savedAt Time the snapshot was taken
+	 */
+	void saveRoutes(const RouteRecord *routes, uint8_t count, time_t savedAt);
+
+	/**
+	 * @brief Gets one route from the snapshot
+	 * 
+	 * @param index 0 to get_routeCount() - 1
+	 * @param route Filled in with the route
+	 * @return true if index is valid
+	 */
+	bool get_route(uint8_t index, RouteRecord &route) const;
+
+	time_t get_savedAt() const;
+
+	uint8_t get_routeCount() const;
+
+		//Members here are internal only and therefore protected
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     * 
+     * Use savedRoutesData::instance() to instantiate the singleton.
+     */
+    savedRoutesData();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~savedRoutesData();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    savedRoutesData(const savedRoutesData&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    savedRoutesData& operator=(const savedRoutesData&) = delete;
+
+    /**
+     * @brief Singleton instance of this class
+     * 
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static savedRoutesData *_instance;
+
+    //Since these variables are only used internally - They can be private. 
+	static const uint32_t SAVED_ROUTES_MAGIC = 0x20a99e90;
+	static const uint16_t SAVED_ROUTES_VERSION = 1;
+};
+
+
+// *****************  Report Backlog Storage Object *******************
+// Ring of data reports that could not be delivered, drained on the next successful contact
+// ********************************************************************
+
+/**
+ * Unlike the objects above this is not a StorageHelperRK object - each record is written to FRAM on its own
+ * so appending a report does not rewrite the whole ring.
+ * 
+ * Records carry an ever increasing sequence number so the ring is recovered by scanning it in setup() - there is
+ * no head or tail pointer in FRAM to get out of step. A record is written with its state byte cleared and then
+ * marked pending with a single byte write, so a power loss part way through an append leaves nothing that looks valid.
+ * Sending a record marks it sent, again with a single byte write.
+ */
+class reportBacklogData {
+public:
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     * 
+     * Use reportBacklogData::instance() to instantiate the singleton.
+     */
+    static reportBacklogData &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup()
+     * 
+     * @details Scans the ring in FRAM to find the newest record and the oldest one not yet sent
+     * 
+     * You typically use reportBacklog.setup();
+     */
+    void setup();
+
+	static const uint16_t BACKLOG_CAPACITY = 128;			// Over five days of hourly reports - 128 x 16 byte records fill the 2048 bytes
+
+	// One undelivered data report
+	struct ReportRecord {
+		uint32_t seq;                                     // Sequence number - the ring position is seq % BACKLOG_CAPACITY
+		uint32_t timestamp;                               // When the report should have been sent
+		uint16_t hourlyCount;                             // Counts as they were at that time
+		uint16_t dailyCount;
+		uint8_t state;                                    // RECORD_PENDING or RECORD_SENT - anything else is an empty slot
+		uint8_t crc;                                      // CRC-8 of the fields above except state
+	};
+
+	/**
+	 * @brief Stores a data report that could not be delivered - if the ring is full the oldest report is dropped
 	 * 
-	 * @param Value to set the variable - correct type - for Strings they are truncated if too long
+	 * @param timestamp When the report should have been sent
+	 * @param hourlyCount Hourly count at that time
+	 * @param dailyCount Daily count at that time
+	 * @return true if the record was written to FRAM
+	 */
+	bool append(uint32_t timestamp, uint16_t hourlyCount, uint16_t dailyCount);
+
+	/**
+	 * @brief Gets a report that has not been sent yet
 	 * 
-	 * @returns None needed
+	 * @param index 0 is the oldest, up to pendingCount() - 1
+	 * @param record Filled in with the report
+	 * @return true if index is valid and the record read back intact
+	 */
+	bool peek(uint16_t index, ReportRecord &record);
+
+	/**
+	 * @brief Marks the oldest reports as delivered
 	 * 
+	 * @param count Number of reports the Gateway has acknowledged
 	 */
+	void consume(uint16_t count);
 
+	/**
+	 * @brief Number of reports waiting to be sent
+	 */
+	uint16_t pendingCount() const;
 
-	int8_t get_internalTempC() const ;
-	void set_internalTempC(int8_t value);
+		//Members here are internal only and therefore protected
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     * 
+     * Use reportBacklogData::instance() to instantiate the singleton.
+     */
+    reportBacklogData();
 
-	double get_stateOfCharge() const;
-	void set_stateOfCharge(double value);
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~reportBacklogData();
 
-	uint8_t get_batteryState() const;
-	void set_batteryState(uint8_t value);
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    reportBacklogData(const reportBacklogData&) = delete;
 
-	time_t get_lastSampleTime() const;
-	void set_lastSampleTime(time_t value);
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    reportBacklogData& operator=(const reportBacklogData&) = delete;
 
-	int16_t get_RSSI() const;
-	void set_RSSI(int16_t value);
+    /**
+     * @brief Singleton instance of this class
+     * 
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static reportBacklogData *_instance;
 
-	int16_t get_SNR() const;
-	void set_SNR(int16_t value);
+	bool readRecord(uint32_t seq, ReportRecord &record);
 
-	uint8_t get_messageCount() const;
-	void set_messageCount(uint8_t value);
+	static uint8_t recordCrc(const ReportRecord &record);
 
-	uint8_t get_successCount() const;
-	void set_successCount(uint8_t value);
+	static size_t recordAddress(uint32_t seq);
 
-	time_t get_lastCountTime() const;
-	void set_lastCountTime(time_t value);
+	uint32_t nextSeq = 0;                                 // Sequence number of the next record appended
+	uint32_t oldestPendingSeq = 0;                        // Oldest record not yet sent - equals nextSeq when the ring is empty
 
-	uint16_t get_hourlyCount() const;
-	void set_hourlyCount(uint16_t value);
+    //Since these variables are only used internally - They can be private. 
+	static const uint8_t RECORD_PENDING = 0xa5;
+	static const uint8_t RECORD_SENT = 0x5a;
+};
 
-	uint16_t get_dailyCount() const;
-	void set_dailyCount(uint16_t value);
+
+// *****************  Energy Status Storage Object *******************
+// Where the time and charge have gone since the counters were reset - see EnergyMonitor
+// ********************************************************************
+
+class energyStatusData : public StorageHelperRK::PersistentDataFRAM {
+public:
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     * 
+     * Use energyStatusData::instance() to instantiate the singleton.
+     */
+    static energyStatusData &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup()
+     * 
+     * You typically use energyStatus.setup();
+     */
+    void setup();
+
+    /**
+     * @brief Perform application loop operations; call this from global application loop()
+     * 
+     * You typically use energyStatus.loop();
+     */
+    void loop();
+
+	/**
+	 * @brief Validates values and, if valid, checks that data is in the correct range.
+	 * 
+	 */
+	bool validate(size_t dataSize);
+
+	/**
+	 * @brief Will reinitialize data if it is found not to be valid - zeroes the counters
+	 * 
+	 */
+	void initialize();
+
+	static const uint8_t ENERGY_STATES = 10;			// One for each State in the main loop
+
+	// The counters - added to as a block so there is one hash and one save for each update
+	struct EnergyCounters {
+		uint32_t stateMs[ENERGY_STATES];                  // Time in each state
+		uint32_t sleepMs;                                 // Time asleep
+		uint32_t radioTxMs;                               // Time the radio was transmitting
+		uint32_t radioRxMs;                               // Time the radio was receiving
+		uint32_t framTransactions;                        // FRAM I2C transactions
+		uint32_t sensorWakes;                             // Times the sensor woke us from sleep
+	};
+
+	class EnergyData {
+	public:
+		// This structure must always begin with the header (16 bytes)
+		StorageHelperRK::PersistentDataBase::SavedDataHeader energyHeader;
+		// Your fields go here. Once you've added a field you cannot add fields
+		// (except at the end), insert fields, remove fields, change size of a field.
+		// Doing so will cause the data to be corrupted!
+		time_t countersSince;                             // When the counters were last zeroed
+		EnergyCounters counters;                          // Totals since then
+		uint32_t reportedChargeUah;                       // Charge estimate in the last acknowledged data report
+		uint32_t rolledChargeUah;                         // Charge estimated for the counters rolled over before countersSince
+		// OK to add more fields here 
+	};
+	EnergyData energyData;
+
+	/**
+	 * @brief Adds to every counter at once
+	 */
+	void addCounters(const EnergyCounters &delta);
+
+	void get_counters(EnergyCounters &counters) const;
+
+	/**
+	 * @brief Zeroes the counters, keeping the charge they stood for, and starts counting again from now
+	 *
+	 * @param chargeUah The charge used up to now, rolled-over charge included
+	 */
+	void rollCounters(uint32_t chargeUah);
+
+	uint32_t get_rolledChargeUah() const;
+
+	time_t get_countersSince() const;
+
+	uint32_t get_reportedChargeUah() const;
+	void set_reportedChargeUah(uint32_t value);
 
 		//Members here are internal only and therefore protected
 protected:
     /**
      * @brief The constructor is protected because the class is a singleton
      * 
-     * Use MyPersistentData::instance() to instantiate the singleton.
+     * Use energyStatusData::instance() to instantiate the singleton.
      */
-    currentStatusData();
+    energyStatusData();
 
     /**
      * @brief The destructor is protected because the class is a singleton and cannot be deleted
      */
-    virtual ~currentStatusData();
+    virtual ~energyStatusData();
 
     /**
      * This class is a singleton and cannot be copied
      */
-    currentStatusData(const currentStatusData&) = delete;
+    energyStatusData(const energyStatusData&) = delete;
 
     /**
      * This class is a singleton and cannot be copied
      */
-    currentStatusData& operator=(const currentStatusData&) = delete;
+    energyStatusData& operator=(const energyStatusData&) = delete;
 
     /**
      * @brief Singleton instance of this class
      * 
      * The object pointer to this class is stored here. It's NULL at system boot.
      */
-    static currentStatusData *_instance;
+    static energyStatusData *_instance;
 
     //Since these variables are only used internally - They can be private. 
-	static const uint32_t CURRENT_DATA_MAGIC = 0x20a99e80;
-	static const uint16_t CURRENT_DATA_VERSION = 3;
+	static const uint32_t ENERGY_DATA_MAGIC = 0x20a99ea0;
+	static const uint16_t ENERGY_DATA_VERSION = 1;
+};
+
+
+// *****************  Event Log Storage Object *******************
+// The time of every count, for traffic analysis - the counters above only keep the totals
+// ********************************************************************
+
+/**
+ * Like the report backlog this is not a StorageHelperRK object - events are appended to FRAM a few bytes at a time.
+ * 
+ * The log is a ring of fixed size blocks. Each block starts with a header giving its sequence number and the time of
+ * its first event, followed by the gap to each event from the one before as a varint in tenths of a second. A gap under
+ * 12.7 seconds takes one byte and one under 27 minutes two, so a few thousand events fit and when the ring is full the
+ * oldest block is overwritten.
+ * 
+ * Gaps are stored plus one, so no byte of a varint is ever zero and unused space reads as zeros. A block is zeroed
+ * before its header is written and each append writes a zero after its last varint, so a power loss part way through
+ * an append leaves a varint with a zero in it, which ends the block just as unused space does.
+ * 
+ * Gaps are measured with millis() so they are exact. The time they are added to is tied to the clock when the first
+ * event is logged and again whenever the two drift more than two seconds apart.
+ */
+class eventLogData {
+public:
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     * 
+     * Use eventLogData::instance() to instantiate the singleton.
+     */
+    static eventLogData &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup()
+     * 
+     * @details Scans the block headers in FRAM to find the newest block and where its events end
+     * 
+     * You typically use eventLog.setup();
+     */
+    void setup();
+
+	static const uint16_t EVENT_BLOCK_SIZE = 128;			// The log is overwritten a block at a time
+	static const uint16_t EVENT_BLOCK_COUNT = 32;			// 32 x 128 byte blocks fill the 4096 bytes
+	static const uint16_t EVENT_TICK_MS = 100;				// Event times are kept to a tenth of a second
+
+	// The start of each block
+	struct BlockHeader {
+		uint32_t seq;                                     // Sequence number - the ring position is seq % EVENT_BLOCK_COUNT
+		uint32_t startTime;                               // Time of the first event in the block
+		uint8_t startTenths;                              // and the tenths of a second
+		uint8_t crc;                                      // CRC-8 of the fields above
+	};
+
+	static const uint16_t EVENT_PAYLOAD_SIZE = EVENT_BLOCK_SIZE - sizeof(BlockHeader);
+
+	// One logged event
+	struct Event {
+		uint32_t time;
+		uint8_t tenths;
+	};
+
+	/**
+	 * @brief A place in the log - start one with seek() and read on with next() or readChunk()
+	 * 
+	 * @details A cursor holds a copy of the block it is in, so it is not small. It is left where it stopped when the
+	 * newest event has been read and picks up events appended after that. If the block it is in is overwritten it
+	 * moves on to the oldest block left.
+	 */
+	class Cursor {
+	public:
+		Cursor() : seq(0), pos(0), tick(0), loaded(false) {};
+
+	protected:
+		friend class eventLogData;
+
+		uint32_t seq;                                     // Block the cursor is in
+		uint16_t pos;                                     // Offset of the next varint in payload
+		uint64_t tick;                                    // Time of the event before it, in tenths since 1970
+		bool loaded;                                      // payload holds block seq
+		uint8_t payload[EVENT_PAYLOAD_SIZE];
+	};
+
+	/**
+	 * @brief Logs a batch of events in one FRAM write, or two if a new block has to be started
+	 * 
+	 * @param eventMillis millis() when each event happened, oldest first
+	 * @param count Number of events
+	 * @return true if the events were written to FRAM - false if the clock has not been set
+	 */
+	bool append(const uint32_t *eventMillis, uint8_t count);
+
+	/**
+	 * @brief Positions a cursor at the first event at or after a time
+	 * 
+	 * @param cursor The cursor to position
+	 * @param fromTime Time to start from - 0 for the oldest event in the log
+	 * @return true if there is such an event
+	 */
+	bool seek(Cursor &cursor, uint32_t fromTime);
+
+	/**
+	 * @brief Reads the event at a cursor and moves it on to the next - stop when the event is past the end of your range
+	 * 
+	 * @return true if there was an event
+	 */
+	bool next(Cursor &cursor, Event &event);
+
+	/**
+	 * @brief Encodes as many events from a cursor as fit for sending to the Gateway, moving the cursor past them
+	 * 
+	 * @details The chunk is the first event's time as Bits<32> seconds and Bits<4> tenths, then the gap to each
+	 * following event as a Varint in tenths of a second. Keep a copy of the cursor from before the call until the
+	 * Gateway acknowledges the chunk, and go back to it if it does not.
+	 * 
+	 * @param cursor Where to start
+	 * @param writer Where the chunk goes - it may already hold the rest of a message
+	 * @return uint16_t Number of events in the chunk - 0 if there were none or they did not fit
+	 */
+	uint16_t readChunk(Cursor &cursor, LoRA_Messages::BitWriter &writer);
+
+		//Members here are internal only and therefore protected
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     * 
+     * Use eventLogData::instance() to instantiate the singleton.
+     */
+    eventLogData();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~eventLogData();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    eventLogData(const eventLogData&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    eventLogData& operator=(const eventLogData&) = delete;
+
+    /**
+     * @brief Singleton instance of this class
+     * 
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static eventLogData *_instance;
+
+	bool readHeader(uint32_t seq, BlockHeader &header);
+
+	bool loadBlock(Cursor &cursor);
+
+	bool peekEvent(Cursor &cursor, uint64_t &tick, uint16_t &len);
+
+	bool startBlock(uint64_t tick);
+
+	static uint8_t headerCrc(const BlockHeader &header);
+
+	static size_t blockAddress(uint32_t seq);
+
+	static uint16_t decodeGap(const uint8_t *payload, uint16_t pos, uint32_t &gap);
+
+	static uint8_t encodeGap(uint32_t gap, uint8_t *varint);
+
+	uint32_t nextSeq = 0;                                 // Sequence number of the next block started
+	uint32_t oldestSeq = 0;                               // Oldest block not yet overwritten - equals nextSeq when the log is empty
+	uint16_t appendPos = EVENT_PAYLOAD_SIZE;              // Where the next varint goes in block nextSeq - 1
+	uint64_t lastTick = 0;                                // Time of the newest event, in tenths since 1970
+	uint64_t anchorTick = 0;                              // Time at anchorMillis, in tenths since 1970
+	uint32_t anchorMillis = 0;
+	bool anchored = false;                                // Set once anchorTick has been taken from the clock
 };
 
 
@@ -0,0 +1,134 @@
+#include "StateMachine.h"
+
+#ifdef PARTICLE
+#include "Particle.h"
+#define STATE_MACHINE_ATOMIC ATOMIC_BLOCK()                 // Interrupts and the timer thread post too
+#else
+#define STATE_MACHINE_ATOMIC                                // Host builds are single threaded
+#endif
+
+StateMachine::StateMachine(const Transition *table, size_t tableLen, StateId initial, Clock clock) :
+    table(table), tableLen(tableLen), clock(clock), currentState(initial), previous(initial), justEntered(true), head(0), tail(0), dropped(0) {
+    resetStatistics();
+    if (initial < MAX_STATES) entryCount[initial] = 1;
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) delayed[i].active = false;
+}
+
+bool StateMachine::post(EventId event) {
+    bool queued = false;
+
+    STATE_MACHINE_ATOMIC {
+        uint8_t next = (head + 1) & (QUEUE_LEN - 1);
+        if (next == tail) {
+            if (dropped < 0xffff) dropped++;
+        }
+        else {
+            queue[head] = event;
+            head = next;
+            queued = true;
+        }
+    }
+    return queued;
+}
+
+bool StateMachine::postAfter(EventId event, uint32_t ms) {
+    Delayed *slot = NULL;
+
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) {
+        if (delayed[i].active && delayed[i].event == event) {
+            slot = &delayed[i];                             // Replace the one pending
+            break;
+        }
+        if (!delayed[i].active && !slot) slot = &delayed[i];
+    }
+    if (!slot) return false;
+
+    slot->event = event;
+    slot->active = true;
+    slot->postedAt = clock();
+    slot->ms = ms;
+    return true;
+}
+
+void StateMachine::cancel(EventId event) {
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) {
+        if (delayed[i].event == event) delayed[i].active = false;
+    }
+}
+
+bool StateMachine::scheduled(EventId event) const {
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) {
+        if (delayed[i].active && delayed[i].event == event) return true;
+    }
+    return false;
+}
+
+uint32_t StateMachine::msUntilScheduled() const {
+    uint32_t now = clock();
+    uint32_t soonest = NOTHING_SCHEDULED;
+
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) {
+        if (!delayed[i].active) continue;
+        uint32_t elapsed = now - delayed[i].postedAt;       // Wraps safely
+        uint32_t remaining = (elapsed >= delayed[i].ms) ? 0 : delayed[i].ms - elapsed;
+        if (remaining < soonest) soonest = remaining;
+    }
+    return soonest;
+}
+
+bool StateMachine::dispatch() {
+    bool changed = false;
+    uint32_t now = clock();
+
+    for (uint8_t i = 0; i < MAX_DELAYED; i++) {
+        if (delayed[i].active && now - delayed[i].postedAt >= delayed[i].ms) {
+            delayed[i].active = false;
+            post(delayed[i].event);
+        }
+    }
+
+    while (head != tail) {
+        EventId event = queue[tail];
+        tail = (tail + 1) & (QUEUE_LEN - 1);                // Only dispatch() moves the tail
+
+        for (size_t i = 0; i < tableLen; i++) {
+            if ((table[i].from == currentState || table[i].from == ANY_STATE) && table[i].event == event) {
+                transition(table[i].to);
+                changed = true;
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+bool StateMachine::entered() {
+    bool first = justEntered;
+    justEntered = false;
+    return first;
+}
+
+uint32_t StateMachine::dwellMs(StateId state) const {
+    if (state >= MAX_STATES) return 0;
+
+    return (state == currentState) ? dwell[state] + timeInStateMs() : dwell[state];
+}
+
+void StateMachine::resetStatistics() {
+    for (uint8_t i = 0; i < MAX_STATES; i++) {
+        dwell[i] = 0;
+        entryCount[i] = 0;
+    }
+    enteredAt = clock();
+}
+
+void StateMachine::transition(StateId to) {
+    uint32_t now = clock();
+
+    if (currentState < MAX_STATES) dwell[currentState] += now - enteredAt;
+    if (to < MAX_STATES) entryCount[to]++;
+    previous = currentState;
+    currentState = to;
+    enteredAt = now;
+    justEntered = true;                                     // Also for a transition back into the same state
+}
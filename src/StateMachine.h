@@ -0,0 +1,166 @@
+/**
+ * @file StateMachine.h
+ * @brief Table-driven state machine - timers, interrupts and radio completions post events, loop() dispatches them
+ *
+ * @details Nothing outside loop() changes the state. Anything that wants a transition posts an event to a small queue
+ * and dispatch() looks the state and event up in the transition table. Events the table has no entry for in the
+ * current state are dropped, so a timer that fires late cannot pull the device out of a state it has already left.
+ *
+ * Events can also be posted after a delay. These are timed from the same clock and posted by dispatch(), so unlike a
+ * software timer they keep time while the device naps in ULTRA_LOW_POWER sleep - sleep until msUntilScheduled() and
+ * the event is there on the next pass.
+ *
+ * Time spent in each state and the number of times each is entered are kept for power and debugging work.
+ *
+ * Only the C++ standard headers are used and the clock is passed in, so a table and a sequence of events can be
+ * replayed on the host. On the device post() is made safe to call from interrupts and timer callbacks with
+ * ATOMIC_BLOCK.
+ *
+ */
+
+#ifndef __STATE_MACHINE_H
+#define __STATE_MACHINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class StateMachine {
+public:
+    typedef uint8_t StateId;
+    typedef uint8_t EventId;
+    typedef uint32_t (*Clock)();                            // Milliseconds - millis() on the device
+
+    static const StateId ANY_STATE = 0xff;                  // Transition applies in every state
+    static const uint8_t QUEUE_LEN = 16;                    // Power of two
+    static const uint8_t MAX_STATES = 16;
+    static const uint8_t MAX_DELAYED = 4;                   // Delayed events pending at once
+    static const uint32_t NOTHING_SCHEDULED = 0xffffffff;
+
+    struct Transition {
+        StateId from;                                       // State the event is accepted in - or ANY_STATE
+        EventId event;
+        StateId to;
+    };
+
+    /**
+     * @brief Construct a new State Machine
+     *
+     * @param table Transitions - searched in order so a specific entry ahead of an ANY_STATE entry takes precedence
+     * @param tableLen Entries in the table
+     * @param initial Starting state
+     * @param clock Millisecond clock for the dwell times
+     */
+    StateMachine(const Transition *table, size_t tableLen, StateId initial, Clock clock);
+
+    /**
+     * @brief Queues an event - safe from interrupts and timer callbacks
+     *
+     * @return false if the queue was full and the event was dropped
+     */
+    bool post(EventId event);
+
+    /**
+     * @brief Posts an event once a delay has passed - replaces any delay already pending for the same event
+     *
+     * @details Call from loop(), not from interrupts. The event is posted by the first dispatch() after it is due.
+     *
+     * @return false if MAX_DELAYED other events are already pending
+     */
+    bool postAfter(EventId event, uint32_t ms);
+
+    /**
+     * @brief Drops a delayed event that has not been posted yet
+     */
+    void cancel(EventId event);
+
+    /**
+     * @brief Tests whether a delayed event is pending
+     */
+    bool scheduled(EventId event) const;
+
+    /**
+     * @brief Time until the next delayed event is due - how long a state waiting on one can sleep
+     *
+     * @return uint32_t - milliseconds, 0 if one is due now, NOTHING_SCHEDULED if none is pending
+     */
+    uint32_t msUntilScheduled() const;
+
+    /**
+     * @brief Takes the queued events in order and makes the transition the table gives for each, if any
+     *
+     * @details Call once at the top of loop(). Delayed events that are due are queued first. Each event is looked up in the state the events before it left us in.
+     * As the queue is empty when the state runs, an event the state posts is always dispatched before it runs again.
+     *
+     * @return true if the state changed
+     */
+    bool dispatch();
+
+    /**
+     * @brief Tests whether events are waiting - a state should not sleep on them
+     */
+    bool pending() const { return head != tail; }
+
+    StateId state() const { return currentState; }
+
+    StateId previousState() const { return previous; }
+
+    /**
+     * @brief Tests whether this is the first pass in the current state - true once after each transition
+     */
+    bool entered();
+
+    /**
+     * @brief Time in the current state
+     */
+    uint32_t timeInStateMs() const { return clock() - enteredAt; }
+
+    /**
+     * @brief Total time spent in a state, including the current visit
+     */
+    uint32_t dwellMs(StateId state) const;
+
+    /**
+     * @brief Number of times a state has been entered
+     */
+    uint32_t entries(StateId state) const { return (state < MAX_STATES) ? entryCount[state] : 0; }
+
+    /**
+     * @brief Events dropped because the queue was full
+     */
+    uint16_t overflows() const { return dropped; }
+
+    /**
+     * @brief Zeroes the dwell times and entry counts - the current visit is counted from now
+     */
+    void resetStatistics();
+
+protected:
+    struct Delayed {
+        EventId event;
+        bool active;
+        uint32_t postedAt;
+        uint32_t ms;
+    };
+
+    void transition(StateId to);
+
+    const Transition *table;
+    size_t tableLen;
+    Clock clock;
+
+    StateId currentState;
+    StateId previous;
+    bool justEntered;
+    uint32_t enteredAt;
+    uint32_t dwell[MAX_STATES];
+    uint32_t entryCount[MAX_STATES];
+
+    volatile EventId queue[QUEUE_LEN];
+    volatile uint8_t head;                                  // Written by post()
+    volatile uint8_t tail;                                  // Written by dispatch()
+    volatile uint16_t dropped;
+
+    Delayed delayed[MAX_DELAYED];                           // Only touched from loop()
+};
+
+#endif  /* __STATE_MACHINE_H */
@@ -10,27 +10,68 @@ const char* batteryContext[7] = {"Unknown","Not Charging","Charging","Charged","
 
 FuelGauge fuelGauge;                                // Needed to address issue with updates in low battery state 
 
-bool takeMeasurements() { 
-
-    fuelGauge.quickStart();                           // Start the fuel gauge
-    softDelay(1000);                                  // Give the fuel gauge time to start
+static uint32_t fuelGaugeMaxAgeMs = DEFAULT_FUEL_GAUGE_MAX_AGE_MS;
+static uint32_t temperatureMaxAgeMs = DEFAULT_TEMPERATURE_MAX_AGE_MS;
+static bool fuelGaugeSampled = false;               // Nothing is cached until the first reading
+static bool temperatureSampled = false;
+static unsigned long fuelGaugeSampledAt = 0;        // millis() of the cached readings - millis() keeps running in sleep
+static unsigned long temperatureSampledAt = 0;
+static MeasurementStats stats;
+
+enum ChargingConfig { CHARGING_UNKNOWN, CHARGING_ENABLED, CHARGING_DISABLED };
+static ChargingConfig chargingConfig = CHARGING_UNKNOWN;    // What the power configuration was last set to
+
+bool takeMeasurements(bool force) { 
+    unsigned long start = millis();
+    bool fuelGaugeStale = force || !fuelGaugeSampled || millis() - fuelGaugeSampledAt >= fuelGaugeMaxAgeMs;
+    bool temperatureStale = force || !temperatureSampled || millis() - temperatureSampledAt >= temperatureMaxAgeMs;
+
+    if (fuelGaugeStale && !fuelGaugeSampled) {
+      fuelGauge.quickStart();                         // Start the fuel gauge - only needed once after startup
+      softDelay(1000);                                // Give the fuel gauge time to start
+    }
 
-    // Temperature inside the enclosure
-    current.set_internalTempC((int)tmp36TemperatureC(analogRead(TMP36_SENSE_PIN)));
+    if (temperatureStale) {                           // Temperature inside the enclosure
+      current.set_internalTempC((int)tmp36TemperatureC(analogRead(TMP36_SENSE_PIN)));
+      temperatureSampled = true;
+      temperatureSampledAt = millis();
+      stats.temperatureSamples++;
+    }
 
-    batteryState();
+    if (fuelGaugeStale) {
+      batteryState();
+      fuelGaugeSampled = true;
+      fuelGaugeSampledAt = millis();
+      stats.fuelGaugeSamples++;
+    }
 
-    if (isItSafeToCharge()) {
-      Log.info("Battery State: %s, SOC: %2.0f%%",batteryContext[current.get_batteryState()],current.get_stateOfCharge());
+    if (temperatureStale || fuelGaugeStale) {
+      if (isItSafeToCharge()) {
+        Log.info("Battery State: %s, SOC: %2.0f%%",batteryContext[current.get_batteryState()],current.get_stateOfCharge());
+      }
+      else Log.error("Power configuration error");
     }
-    else Log.error("Power configuration error");
 
     if (sysStatus.get_nodeNumber() == 0 ) getSignalStrength();
 
+    stats.calls++;
+    stats.lastDurationMs = millis() - start;
+    stats.totalDurationMs += stats.lastDurationMs;
+    Log.info("Measurements took %lu ms - fuel gauge %s, temperature %s", stats.lastDurationMs, (fuelGaugeStale) ? "read" : "cached", (temperatureStale) ? "read" : "cached");
+
     return 1;
 
 }
 
+void setMeasurementMaxAge(uint32_t fuelGaugeMs, uint32_t temperatureMs) {
+  fuelGaugeMaxAgeMs = fuelGaugeMs;
+  temperatureMaxAgeMs = temperatureMs;
+}
+
+const MeasurementStats &measurementStats() {
+  return stats;
+}
+
 
 float tmp36TemperatureC (int adcValue) { 
     // Analog inputs have values from 0-4095, or
@@ -63,33 +104,31 @@ bool batteryState() {
 bool isItSafeToCharge()                             // Returns a true or false if the battery is in a safe charging range.
 {
   // current.set_internalTempC(40);                  // This is a test value for the temperature
-  bool returnVal = false;
-
-  if (current.get_internalTempC() < 0 || current.get_internalTempC() > 37 )  {  // Reference: (32 to 113 but with safety)
-
-    if (!initializePowerCfg(false)) {               // Disable charging if the temperature is outside of the safe range
-      current.set_batteryState(1);                    // Overwrites the values from the batteryState API to reflect that we are "Not Charging"
-      Log.info("Charging disabled - temp is %iC",current.get_internalTempC() );
-      returnVal = true;
-    }
-    else  {
-      Log.error("Unable to disable charging");
-      current.set_batteryState(0);                    // Unknown battery state
-    }
-
-  }
-  else {
-    if (!initializePowerCfg(true)) {                                      // Enable charging if the temperature is within the safe range
-      current.set_batteryState(System.batteryState());                      // Call before isItSafeToCharge() as it may overwrite the context
-      Log.info("Charging enabled - inside temp range");
-      returnVal = true;
+  int temp = current.get_internalTempC();
+  bool outsideRange = (temp < 0 || temp > 37);      // Reference: (32 to 113 but with safety)
+  bool wellInsideRange = (temp >= CHARGE_TEMP_HYSTERESIS_C && temp <= 37 - CHARGE_TEMP_HYSTERESIS_C);
+
+  ChargingConfig wanted = chargingConfig;
+  if (outsideRange) wanted = CHARGING_DISABLED;
+  else if (wellInsideRange || chargingConfig == CHARGING_UNKNOWN) wanted = CHARGING_ENABLED;     // In the hysteresis band we stay as we are
+
+  if (wanted != chargingConfig) {                   // Only reconfigure when charging needs to change
+    stats.powerConfigChanges++;
+    if (!initializePowerCfg(wanted == CHARGING_ENABLED)) {
+      chargingConfig = wanted;
+      Log.info("Charging %s - temp is %iC", (wanted == CHARGING_ENABLED) ? "enabled" : "disabled", temp);
     }
-    else  {
-      current.set_batteryState(0);                    // Unknown battery state
-      Log.error("Unable to enable charging");
+    else {
+      chargingConfig = CHARGING_UNKNOWN;            // Try again next time
+      current.set_batteryState(0);                  // Unknown battery state
+      Log.error("Unable to %s charging", (wanted == CHARGING_ENABLED) ? "enable" : "disable");
+      return false;
     }
   }
-  return returnVal;
+
+  if (chargingConfig == CHARGING_DISABLED) current.set_batteryState(1);   // Overwrites the values from the batteryState API to reflect that we are "Not Charging"
+  else current.set_batteryState(System.batteryState());
+  return true;
 }
 
 
@@ -112,19 +151,80 @@ void getSignalStrength() {
 }
 
 
-bool recordCount() // This is where we check to see if an interrupt is set when not asleep or act on a tap that woke the device
+// Counts are queued by the sensor interrupt and recorded from the main loop - one producer and one consumer so no lock is needed
+const uint8_t COUNT_QUEUE_LEN = 64;                                                                   // Power of 2 - three seconds of pulses at 20Hz between passes of the loop
+const unsigned long COUNT_LED_MS = 500;                                                               // How long the blue LED shows a count
+static volatile uint32_t countQueue[COUNT_QUEUE_LEN];                                                 // millis() of each count
+static volatile uint8_t countHead = 0;                                                                // Only written by queueCount()
+static volatile uint8_t countTail = 0;                                                                // Only written by recordCounts()
+static volatile uint16_t countOverflow = 0;                                                           // Counts that arrived with the queue full
+static unsigned long countLedOnAt = 0;
+static bool countLedOn = false;
+
+void queueCount() {
+  uint8_t head = countHead;
+  uint8_t next = (head + 1) & (COUNT_QUEUE_LEN - 1);
+
+  if (next == countTail) {                                                                            // Full - keep the count, lose the time
+    countOverflow++;
+    return;
+  }
+  countQueue[head] = millis();
+  countHead = next;                                                                                   // Publish the entry only once it is written
+}
+
+uint16_t recordCounts()                                                                               // This is where we act on the counts queued by the sensor interrupt
 {
-  pinSetFast(BLUE_LED);                                                                               // Turn on the blue LED
+  uint16_t counts = 0;
+  uint32_t lastCountMillis = 0;
 
-  current.set_lastCountTime(Time.now());
-  current.set_hourlyCount(current.get_hourlyCount() +1);                                              // Increment the PersonCount
-  current.set_dailyCount(current.get_dailyCount() +1);                                               // Increment the PersonCount
-  Log.info("Count, hourly: %i. daily: %i",current.get_hourlyCount(),current.get_dailyCount());
-  
-  delay(500);
-  pinResetFast(BLUE_LED);
+  uint16_t overflow;
+  ATOMIC_BLOCK() {
+    overflow = countOverflow;
+    countOverflow = 0;
+  }
+  if (countTail == countHead && !overflow) {
+    if (countLedOn && millis() - countLedOnAt >= COUNT_LED_MS) {
+      pinResetFast(BLUE_LED);
+      countLedOn = false;
+    }
+    return 0;
+  }
 
-  return true;
+  uint8_t head = countHead;                                                                           // Counts queued while we work wait for the next pass - the queue holds
+  uint32_t countMillis[COUNT_QUEUE_LEN];                                                              // at most COUNT_QUEUE_LEN - 1 up to here, so they all fit in countMillis
+  current.beginUpdate();                                                                              // One hash and one save for the whole batch
+  time_t now = Time.now();
+  while (countTail != head) {
+    lastCountMillis = countQueue[countTail];
+    countTail = (countTail + 1) & (COUNT_QUEUE_LEN - 1);
+    current.addBucketCount(now - (millis() - lastCountMillis) / 1000, 1);                             // Each count goes in the bucket for when it happened
+    countMillis[counts++] = lastCountMillis;
+  }
+  eventLog.append(countMillis, counts);
+
+  if (overflow) {
+    Log.info("Count queue overflowed - %d counts recorded without their time", overflow);
+    current.addBucketCount(now, overflow);
+    counts += overflow;
+    lastCountMillis = millis();
+  }
+
+  current.set_lastCountTime(now - (millis() - lastCountMillis) / 1000);
+  current.set_hourlyCount(current.get_hourlyCount() + counts);                                        // Increment the PersonCount
+  current.set_dailyCount(current.get_dailyCount() + counts);                                          // Increment the PersonCount
+  current.commit();
+  Log.info("Count %d, hourly: %i. daily: %i", counts, current.get_hourlyCount(), current.get_dailyCount());
+
+  pinSetFast(BLUE_LED);                                                                               // Turn on the blue LED - turned off on a later pass
+  countLedOnAt = millis();
+  countLedOn = true;
+
+  return counts;
+}
+
+bool countFeedbackActive() {
+  return countLedOn;
 }
 
 /**
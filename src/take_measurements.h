@@ -18,15 +18,50 @@
 extern char internalTempStr[16];                       // External as this can be called as a Particle variable
 extern char signalStr[64];
 
+// Readings are cached - a value is only sampled again once it is older than its maximum age
+const uint32_t DEFAULT_FUEL_GAUGE_MAX_AGE_MS = 10 * 60 * 1000UL;   // State of charge moves slowly
+const uint32_t DEFAULT_TEMPERATURE_MAX_AGE_MS = 5 * 60 * 1000UL;
+
+// Charging is stopped outside 0 to 37C and only restarted once the temperature is this far back inside the range
+const int CHARGE_TEMP_HYSTERESIS_C = 2;
+
+/**
+ * @brief Timings and counts for takeMeasurements() - to see what the cache saves
+ */
+struct MeasurementStats {
+  uint32_t calls;                                      // Calls to takeMeasurements()
+  uint32_t fuelGaugeSamples;                           // Times the fuel gauge was read - the rest were served from the cache
+  uint32_t temperatureSamples;                         // Times the TMP36 was read
+  uint32_t powerConfigChanges;                         // Times charging was reconfigured
+  uint32_t lastDurationMs;                             // Time the last call took
+  uint32_t totalDurationMs;                            // Time all of the calls took
+};
+
 /**
  * @brief This code collects basic data from the default sensors - TMP-36 (inside temp), battery charge level and signal strength
  * 
- * @details Uses an analog input and the appropriate scaling
+ * @details Uses an analog input and the appropriate scaling. Readings newer than their maximum age are not taken again.
+ * The fuel gauge is only quick started, with its one second settling delay, for the first reading after startup.
+ * 
+ * @param force Take every reading even if the cached one is fresh
  * 
  * @returns Returns true if succesful and puts the data into the current object
  * 
  */
-bool takeMeasurements();                               // Function that calls the needed functions in turn
+bool takeMeasurements(bool force = false);             // Function that calls the needed functions in turn
+
+/**
+ * @brief Sets how old a cached reading can be before takeMeasurements() takes it again
+ * 
+ * @param fuelGaugeMs Maximum age of the state of charge and battery state
+ * @param temperatureMs Maximum age of the enclosure temperature
+ */
+void setMeasurementMaxAge(uint32_t fuelGaugeMs, uint32_t temperatureMs);
+
+/**
+ * @brief Timings and counts since startup
+ */
+const MeasurementStats &measurementStats();
 
 /**
  * @brief tmp36TemperatureC
@@ -53,7 +88,8 @@ bool batteryState();                                   // Data on state of charg
 /**
  * @brief Checks to see if the temperature is in the range to support charging
  * 
- * @details Will enable or disable charging based on the current temperature
+ * @details Will enable or disable charging based on the current temperature. The power configuration is only
+ * applied when charging needs to change - with CHARGE_TEMP_HYSTERESIS_C so it does not toggle at a threshold
  * 
  * @link https://batteryuniversity.com/learn/article/charging_at_high_and_low_temperatures @endlink
  * 
@@ -69,16 +105,32 @@ bool isItSafeToCharge();                               // See if it is safe to c
 void getSignalStrength();
 
 /**
- * @brief This function is called once a hardware interrupt is triggered by the device's sensor
+ * @brief Queues a count - call this from the sensor interrupt
+ * 
+ * @details Only stores the millis() time of the event so it is safe in an ISR. If the queue is full the count
+ * is still kept, just without its time. recordCounts() does the rest from the main loop.
+ * 
+ */
+void queueCount();
+
+/**
+ * @brief Records the counts queued since the last call - call this on every pass through the main loop
  * 
- * @details The sensor may change based on the settings in sysSettings but the overall concept of operations
- * is the same regardless.  The sensor will trigger an interrupt, which will set a flag. In the main loop
- * that flag will call this function which will determine if this event should "count" as a visitor.
+ * @details The whole batch goes into the current object in one persistent store update, and the blue LED
+ * is turned on and, on a later call, off again rather than blocking while it blinks.
+ * 
+ * @returns the number of counts recorded
+ * 
+ */
+uint16_t recordCounts();
+
+/**
+ * @brief Is the blue LED still showing a count
  * 
- * @returns true so we can reset the interrupt flag
+ * @returns true until recordCounts() has turned it off - wait for this before sleeping
  * 
  */
-bool recordCount();
+bool countFeedbackActive();
 
 /**
  * @brief soft delay let's us process Particle functions and service the sensor interrupts while pausing
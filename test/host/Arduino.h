@@ -0,0 +1,9 @@
+/**
+ * @file   Arduino.h - host stand-in for Particle's Arduino compatibility header
+ */
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include "Particle.h"
+
+#endif /* __HOST_ARDUINO_H */
@@ -0,0 +1,182 @@
+/**
+ * @file   HostBoard.h - the hardware behind the host stand-in for Device OS
+ * @brief  The clock, pins, I2C and SPI devices the firmware sees when it runs on a PC
+ *
+ * @details Particle.h calls through HostBoard::current() for anything that would touch hardware. StandaloneBoard is
+ * the default - time only moves as the code waits, and a test attaches the chip models it needs and schedules pin
+ * edges. The network simulator in test/sim puts a board on each device that runs in lockstep with the others.
+ */
+#ifndef __HOST_BOARD_H
+#define __HOST_BOARD_H
+
+#include "Particle.h"
+#include <functional>
+#include <map>
+#include <vector>
+
+/**
+ * @brief An I2C peripheral - the bytes of each transaction between the address and the stop
+ */
+class HostI2CDevice {
+public:
+    virtual ~HostI2CDevice() {}
+
+    /**
+     * @brief The master wrote these bytes
+     *
+     * @return false to NACK them
+     */
+    virtual bool write(const uint8_t *data, size_t length) = 0;
+
+    /**
+     * @brief The master is reading length bytes
+     *
+     * @return the number of bytes read
+     */
+    virtual size_t read(uint8_t *data, size_t length) = 0;
+};
+
+/**
+ * @brief An SPI peripheral, selected by pulling its chip select low
+ */
+class HostSPIDevice {
+public:
+    virtual ~HostSPIDevice() {}
+    virtual void select() {}
+    virtual uint8_t transfer(uint8_t data) = 0;
+    virtual void deselect() {}
+};
+
+class HostBoard {
+public:
+    /**
+     * @brief Thrown by StandaloneBoard::reset() so a test can catch a reset and start the firmware again
+     */
+    struct Reset {
+        bool powerDown;
+    };
+
+    virtual ~HostBoard() {}
+
+    /**
+     * @brief The board the runtime uses - a StandaloneBoard unless use() was called
+     */
+    static HostBoard &current();
+    static void use(HostBoard &board);
+
+    /**
+     * @brief Microseconds since the board started on its own clock - what micros() and millis() return
+     */
+    virtual uint64_t micros() = 0;
+
+    /**
+     * @brief Lets time pass on this board's clock
+     *
+     * @param us Microseconds to wait
+     * @param wakePins Bit for each pin whose interrupt ends the wait early
+     * @return the pin that ended the wait, or PIN_INVALID if the time ran out
+     */
+    virtual pin_t wait(uint64_t us, uint32_t wakePins) = 0;
+
+    /**
+     * @brief Interrupts raised since the last call, a bit for each pin - they are cleared
+     */
+    virtual uint32_t takeInterrupts() = 0;
+
+    /**
+     * @brief Called as the processor goes in and out of System.sleep()
+     */
+    virtual void sleeping(bool asleep) { (void)asleep; }
+
+    /**
+     * @brief Called when the firmware drives an output pin - for lines like a radio's reset
+     */
+    virtual void pinWritten(pin_t pin, uint8_t value) { (void)pin; (void)value; }
+
+    virtual HostI2CDevice *i2cDevice(uint8_t address) = 0;
+    virtual HostSPIDevice *spiDevice(pin_t chipSelect) = 0;
+
+    virtual int digitalRead(pin_t pin) { (void)pin; return HIGH; }		// Inputs float high - the user button is not pressed
+    virtual int analogRead(pin_t pin) { (void)pin; return 930; }		// 25C on the TMP36
+    virtual float batteryCharge() { return 80.0; }
+    virtual const char *deviceID() = 0;
+    virtual uint32_t randomNumber() = 0;
+
+    /**
+     * @brief How long the spin loops in RadioHead let pass on each YIELD - an interrupt ends it early
+     */
+    virtual uint32_t yieldUs() { return 1000; }
+
+    /**
+     * @brief System.reset() - does not return
+     */
+    [[noreturn]] virtual void reset() = 0;
+
+    /**
+     * @brief The AB1805 has cut the power - the board comes back after the countdown
+     */
+    [[noreturn]] virtual void powerDown(uint32_t seconds) = 0;
+
+    virtual void log(LogLevel level, const char *category, const char *message) = 0;
+};
+
+/**
+ * @brief A board on its own - time moves on as the code waits, so a program runs as fast as it can
+ */
+class StandaloneBoard : public HostBoard {
+public:
+    StandaloneBoard();
+
+    uint64_t micros() override { return nowUs; }
+    pin_t wait(uint64_t us, uint32_t wakePins) override;
+    uint32_t takeInterrupts() override;
+    HostI2CDevice *i2cDevice(uint8_t address) override;
+    HostSPIDevice *spiDevice(pin_t chipSelect) override;
+    const char *deviceID() override { return id; }
+    uint32_t randomNumber() override;
+    [[noreturn]] void reset() override { throw Reset{false}; }
+    [[noreturn]] void powerDown(uint32_t seconds) override { nowUs += seconds * 1000000ULL; throw Reset{true}; }
+    void log(LogLevel level, const char *category, const char *message) override;
+
+    void attach(uint8_t address, HostI2CDevice &device) { i2c[address] = &device; }
+    void attach(pin_t chipSelect, HostSPIDevice &device) { spi[chipSelect] = &device; }
+    void setDeviceID(const char *deviceID);
+
+    /**
+     * @brief Raises an interrupt on the pin when the clock reaches atUs
+     */
+    void interruptAt(pin_t pin, uint64_t atUs);
+    void interruptNow(pin_t pin) { pending |= 1UL << pin; }
+
+    /**
+     * @brief Moves the clock on without running anything - time spent somewhere the firmware can't see
+     */
+    void advance(uint64_t us) { nowUs += us; }
+
+    bool logging = false;                    // Log output to stderr - set HOST_LOG in the environment to turn it on
+
+private:
+    uint64_t nowUs = 0;
+    uint32_t pending = 0;
+    uint64_t rngState = 0x2545F4914F6CDD1DULL;
+    char id[25] = "e00fce68c6ad7f8a2f9b1c03";
+    std::multimap<uint64_t, pin_t> scheduled;
+    std::map<uint8_t, HostI2CDevice *> i2c;
+    std::map<pin_t, HostSPIDevice *> spi;
+};
+
+StandaloneBoard &standaloneBoard();
+
+/**
+ * @brief Runs the pin interrupt handlers for any interrupts the board has raised
+ *
+ * @details Called as the code waits. Handlers don't nest and don't run between noInterrupts() and interrupts().
+ */
+void hostRunInterrupts();
+
+/**
+ * @brief One pass of the Device OS main loop - what happens between calls to loop()
+ */
+void hostLoopPass(uint32_t us);
+
+#endif /* __HOST_BOARD_H */
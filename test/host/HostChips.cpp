@@ -0,0 +1,240 @@
+/**
+ * @file   HostChips.cpp - models of the chips on the carrier board
+ */
+#include "HostChips.h"
+
+// ************************************************************************
+// *****                       MB85RC64 FRAM                          *****
+// ************************************************************************
+bool FramChip::write(const uint8_t *data, size_t length) {
+    if (length < 2) return length == 0;				// An address probe
+    state.latch = ((data[0] << 8) | data[1]) & (SIZE - 1);
+    state.writes++;
+    for (size_t i = 2; i < length; i++) {
+        if (cutAfterBytes == 0) {
+            cutAfterBytes = -1;
+            HostBoard::current().powerDown(0);		// The bytes before this one are in the FRAM
+        }
+        if (cutAfterBytes > 0) cutAfterBytes--;
+        state.memory[state.latch] = data[i];
+        state.latch = (state.latch + 1) & (SIZE - 1);
+        state.bytesWritten++;
+    }
+    return true;
+}
+
+size_t FramChip::read(uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        data[i] = state.memory[state.latch];
+        state.latch = (state.latch + 1) & (SIZE - 1);
+    }
+    return length;
+}
+
+// ************************************************************************
+// *****                       AB1805 RTC                             *****
+// ************************************************************************
+const uint8_t REG_HUNDREDTH = 0x00;
+const uint8_t REG_WEEKDAY = 0x07;
+const uint8_t REG_CTRL_1 = 0x10;
+const uint8_t REG_CTRL_1_WRTC = 0x01;
+const uint8_t REG_CAL_XT = 0x14;
+const uint8_t REG_SLEEP_CTRL = 0x17;
+const uint8_t REG_SLEEP_CTRL_SLP = 0x80;
+const uint8_t REG_TIMER_CTRL = 0x18;
+const uint8_t REG_TIMER = 0x19;
+const uint8_t REG_ID0 = 0x28;
+const uint8_t REG_ID1 = 0x29;
+const double XT_CAL_PPM_PER_STEP = 1.907;
+
+static uint8_t toBcd(int value) { return (uint8_t)(((value / 10) % 10) << 4 | (value % 10)); }
+static int fromBcd(uint8_t bcd) { return (bcd >> 4) * 10 + (bcd & 0x0f); }
+
+void RtcChip::powerUp(State &state, double ppm) {
+    memset(&state, 0, sizeof(state));
+    state.regs[REG_CTRL_1] = 0x13;					// OUT | RSO | PWR2 | WRTC
+    state.regs[REG_ID0] = 0x18;						// AB18xx
+    state.regs[REG_ID1] = 0x05;						// AB1805
+    state.baseSeconds = 946684800.0;				// 2000-01-01
+    state.ppm = ppm;
+}
+
+double RtcChip::calibrationPpm() {
+    uint8_t value = state.regs[REG_CAL_XT];
+    int steps = value & 0x7f;
+    if (steps & 0x40) steps -= 0x80;
+    if (value & 0x80) steps *= 2;					// CMDX - coarser steps
+    return steps * XT_CAL_PPM_PER_STEP;
+}
+
+double RtcChip::seconds() {
+    uint64_t now = clockUs();
+    return state.baseSeconds + (now - state.baseUs) / 1e6 * (1.0 + (state.ppm + calibrationPpm()) / 1e6);
+}
+
+void RtcChip::rebase() {
+    state.baseSeconds = seconds();
+    state.baseUs = clockUs();
+}
+
+void RtcChip::loadTimeRegisters() {
+    double now = seconds();
+    time_t whole = (time_t)now;
+    struct tm parts;
+    gmtime_r(&whole, &parts);
+    state.regs[REG_HUNDREDTH] = toBcd((int)((now - whole) * 100.0 + 1e-4));	// Within a microsecond - the seconds are a double around 2^31
+    state.regs[0x01] = toBcd(parts.tm_sec);
+    state.regs[0x02] = toBcd(parts.tm_min);
+    state.regs[0x03] = toBcd(parts.tm_hour);
+    state.regs[0x04] = toBcd(parts.tm_mday);
+    state.regs[0x05] = toBcd(parts.tm_mon + 1);
+    state.regs[0x06] = toBcd(parts.tm_year % 100);
+    state.regs[REG_WEEKDAY] = toBcd(parts.tm_wday);
+}
+
+void RtcChip::timeRegistersWritten() {
+    struct tm parts;
+    memset(&parts, 0, sizeof(parts));
+    parts.tm_sec = fromBcd(state.regs[0x01]);
+    parts.tm_min = fromBcd(state.regs[0x02]);
+    parts.tm_hour = fromBcd(state.regs[0x03]);
+    parts.tm_mday = fromBcd(state.regs[0x04]);
+    parts.tm_mon = fromBcd(state.regs[0x05]) - 1;
+    parts.tm_year = fromBcd(state.regs[0x06]) + 100;
+    state.baseSeconds = (double)timegm(&parts) + fromBcd(state.regs[REG_HUNDREDTH]) / 100.0;
+    state.baseUs = clockUs();
+}
+
+bool RtcChip::write(const uint8_t *data, size_t length) {
+    if (length == 0) return true;
+    state.latch = data[0];
+    bool timeWritten = false;
+
+    for (size_t i = 1; i < length; i++) {
+        uint8_t reg = state.latch++;
+        if (reg <= REG_WEEKDAY) {
+            if (!(state.regs[REG_CTRL_1] & REG_CTRL_1_WRTC)) continue;	// The time can only be written with WRTC set
+            if (!timeWritten) loadTimeRegisters();	// A partial write keeps the rest of the time
+            timeWritten = true;
+        }
+        if (reg == REG_CAL_XT) rebase();			// The old rate up to now
+        state.regs[reg] = data[i];
+        if (reg == REG_SLEEP_CTRL && (data[i] & REG_SLEEP_CTRL_SLP)) {
+            uint32_t ticks = state.regs[REG_TIMER];
+            uint32_t seconds = ((state.regs[REG_TIMER_CTRL] & 0x03) == 0x03) ? ticks * 60 : ticks;
+            state.regs[REG_SLEEP_CTRL] = 0;
+            HostBoard::current().powerDown(seconds ? seconds : 1);
+        }
+    }
+    if (timeWritten) timeRegistersWritten();
+    return true;
+}
+
+size_t RtcChip::read(uint8_t *data, size_t length) {
+    if (state.latch <= REG_WEEKDAY) loadTimeRegisters();	// Reading the hundredths latches the time
+    for (size_t i = 0; i < length; i++) data[i] = state.regs[state.latch++];
+    return length;
+}
+
+// ************************************************************************
+// *****                       RFM95 radio                            *****
+// ************************************************************************
+const uint8_t REG_FIFO = 0x00;
+const uint8_t REG_OP_MODE = 0x01;
+const uint8_t REG_OP_MODE_LORA = 0x80;
+const uint8_t REG_FIFO_ADDR_PTR = 0x0d;
+const uint8_t REG_FIFO_RX_CURRENT_ADDR = 0x10;
+const uint8_t REG_IRQ_FLAGS = 0x12;
+const uint8_t REG_RX_NB_BYTES = 0x13;
+const uint8_t REG_PKT_SNR_VALUE = 0x19;
+const uint8_t REG_PKT_RSSI_VALUE = 0x1a;
+const uint8_t REG_HOP_CHANNEL = 0x1c;
+const uint8_t REG_PAYLOAD_LENGTH = 0x22;
+const uint8_t REG_DIO_MAPPING_1 = 0x40;
+const uint8_t REG_VERSION = 0x42;
+const uint8_t IRQ_RX_TIMEOUT = 0x80;
+const uint8_t IRQ_RX_DONE = 0x40;
+const uint8_t IRQ_VALID_HEADER = 0x10;
+const uint8_t IRQ_TX_DONE = 0x08;
+const uint8_t IRQ_CAD_DONE = 0x04;
+const uint8_t HOP_CHANNEL_CRC_ON = 0x40;
+
+RadioChip::RadioChip(pin_t dio0) : dio0(dio0) {
+    memset(regs, 0, sizeof(regs));
+    memset(fifo, 0, sizeof(fifo));
+    regs[REG_OP_MODE] = MODE_STDBY;
+    regs[REG_VERSION] = 0x12;
+}
+
+uint8_t RadioChip::transfer(uint8_t data) {
+    if (first) {
+        first = false;
+        address = data;
+        return 0;
+    }
+    uint8_t reg = address & 0x7f;
+    bool writing = address & 0x80;
+    uint8_t value = 0;
+    if (reg == REG_FIFO) {								// The FIFO goes through its own pointer
+        if (writing) fifo[regs[REG_FIFO_ADDR_PTR]] = data;
+        else value = fifo[regs[REG_FIFO_ADDR_PTR]];
+        regs[REG_FIFO_ADDR_PTR]++;
+        return value;
+    }
+    if (writing) writeRegister(reg, data);
+    else value = regs[reg];
+    address = (address & 0x80) | ((reg + 1) & 0x7f);
+    return value;
+}
+
+void RadioChip::writeRegister(uint8_t reg, uint8_t value) {
+    if (reg == REG_IRQ_FLAGS) {
+        regs[reg] &= ~value;							// Write 1 to clear
+        return;
+    }
+    if (reg == REG_VERSION || reg == REG_FIFO_RX_CURRENT_ADDR || reg == REG_RX_NB_BYTES) return;
+    if (reg != REG_OP_MODE) {
+        regs[reg] = value;
+        if (reg == REG_DIO_MAPPING_1) interrupt(0);		// DIO0 follows its flag through the mapping
+        return;
+    }
+    if (mode() != MODE_SLEEP && (value & 0x07) != MODE_SLEEP) value = (value & 0x7f) | (regs[REG_OP_MODE] & REG_OP_MODE_LORA);	// LoRa only changes in sleep
+    regs[REG_OP_MODE] = value;
+    if (mode() == MODE_TX) {
+        sent.push_back(std::vector<uint8_t>(fifo, fifo + regs[REG_PAYLOAD_LENGTH]));
+        regs[REG_OP_MODE] = (regs[REG_OP_MODE] & ~0x07) | MODE_STDBY;
+        interrupt(IRQ_TX_DONE);
+    }
+    else if (mode() == MODE_CAD) {
+        regs[REG_OP_MODE] = (regs[REG_OP_MODE] & ~0x07) | MODE_STDBY;
+        interrupt(IRQ_CAD_DONE);						// The channel is always clear
+    }
+}
+
+void RadioChip::interrupt(uint8_t flags) {
+    regs[REG_IRQ_FLAGS] |= flags;
+    uint8_t mapping = regs[REG_DIO_MAPPING_1] >> 6;	// DIO0 - RxDone, TxDone or CadDone
+    uint8_t dio0Flag = (mapping == 0) ? IRQ_RX_DONE : (mapping == 1) ? IRQ_TX_DONE : (mapping == 2) ? IRQ_CAD_DONE : 0;
+    if (regs[REG_IRQ_FLAGS] & dio0Flag) standaloneBoard().interruptNow(dio0);
+}
+
+bool RadioChip::receive(const uint8_t *frame, uint8_t length, int8_t snr, int16_t rssi) {
+    if (mode() != MODE_RXCONTINUOUS && mode() != MODE_RXSINGLE) return false;
+    for (uint8_t i = 0; i < length; i++) fifo[(uint8_t)(rxPosition + i)] = frame[i];
+    regs[REG_FIFO_RX_CURRENT_ADDR] = rxPosition;
+    rxPosition += length;
+    regs[REG_RX_NB_BYTES] = length;
+    regs[REG_PKT_SNR_VALUE] = (uint8_t)(snr * 4);
+    regs[REG_PKT_RSSI_VALUE] = (uint8_t)constrain(rssi + 157, 0, 255);	// HF port
+    regs[REG_HOP_CHANNEL] |= HOP_CHANNEL_CRC_ON;
+    if (mode() == MODE_RXSINGLE) regs[REG_OP_MODE] = (regs[REG_OP_MODE] & ~0x07) | MODE_STDBY;
+    interrupt(IRQ_RX_DONE | IRQ_VALID_HEADER);
+    return true;
+}
+
+bool RadioChip::receiveTimeout() {
+    if (mode() != MODE_RXSINGLE) return false;
+    regs[REG_OP_MODE] = (regs[REG_OP_MODE] & ~0x07) | MODE_STDBY;
+    interrupt(IRQ_RX_TIMEOUT);
+    return true;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file   HostChips.h - models of the chips on the carrier board
+ * @brief  The MB85RC64 FRAM, the AB1805 RTC / watchdog and the RFM95 radio, at the register level the libraries in lib/ use
+ *
+ * @details The FRAM and RTC keep their state in a plain struct they are given, so the state can outlive the model - in shared
+ * memory for the network simulator, where it has to survive the device resetting, or in a test that cuts the power.
+ */
+#ifndef __HOST_CHIPS_H
+#define __HOST_CHIPS_H
+
+#include "HostBoard.h"
+
+/**
+ * @brief MB85RC64 - 8K bytes of FRAM at I2C address 0x50
+ *
+ * @details A write is two address bytes, most significant first, then data. A read carries on from the address latch.
+ * Every byte written counts down cutAfterBytes when it is set - at zero the power goes and the board resets mid write.
+ */
+class FramChip : public HostI2CDevice {
+public:
+    static const uint8_t ADDRESS = 0x50;
+    static const size_t SIZE = 8192;
+
+    struct State {
+        uint8_t memory[SIZE];
+        uint16_t latch;
+        uint32_t bytesWritten;
+        uint32_t writes;
+    };
+
+    explicit FramChip(State &state) : state(state) {}
+
+    /**
+     * @brief Starts a chip that has never been written - FRAM ships erased to zeros
+     */
+    static void erase(State &state) { memset(&state, 0, sizeof(state)); }
+
+    bool write(const uint8_t *data, size_t length) override;
+    size_t read(uint8_t *data, size_t length) override;
+
+    int32_t cutAfterBytes = -1;                // Bytes still to be written before the power is cut - -1 for never
+
+private:
+    State &state;
+};
+
+/**
+ * @brief AB1805 real time clock and watchdog at I2C address 0x69
+ *
+ * @details The time registers count on their own crystal, which runs ppm fast on top of whatever the XT calibration
+ * register adds. Setting SLP in the sleep control register cuts the power for the countdown timer's period.
+ */
+class RtcChip : public HostI2CDevice {
+public:
+    static const uint8_t ADDRESS = 0x69;
+
+    struct State {
+        uint8_t regs[256];
+        uint8_t latch;
+        double baseSeconds;                    // Time in the registers at baseUs, with hundredths
+        uint64_t baseUs;                       // On the reference clock
+        double ppm;                            // How fast the crystal runs before calibration
+    };
+
+    /**
+     * @param clockUs The true time, in microseconds - what the crystal is measured against
+     */
+    RtcChip(State &state, std::function<uint64_t()> clockUs) : state(state), clockUs(clockUs) {}
+
+    /**
+     * @brief Cold power-up - WRTC set and the clock at 2000-01-01
+     */
+    static void powerUp(State &state, double ppm);
+
+    bool write(const uint8_t *data, size_t length) override;
+    size_t read(uint8_t *data, size_t length) override;
+
+    /**
+     * @brief Seconds since the epoch the registers hold now
+     */
+    double seconds();
+
+    /**
+     * @brief Parts per million the XT calibration register adds
+     */
+    double calibrationPpm();
+
+private:
+    void rebase();
+    void loadTimeRegisters();
+    void timeRegistersWritten();
+
+    State &state;
+    std::function<uint64_t()> clockUs;
+};
+
+/**
+ * @brief RFM95 (SX1276) on its own - the test hands it the frames it hears and takes the frames it sends
+ *
+ * @details There is no channel here, see test/sim for that. A transmission ends at once and a received frame arrives
+ * when the test calls receive(), each raising DIO0 as RH_RF95 maps it, so the driver's interrupt handler runs the next
+ * time the code waits. The FIFO, IRQ flags and modes behave as RH_RF95 relies on.
+ */
+class RadioChip : public HostSPIDevice {
+public:
+    static const uint8_t MODE_SLEEP = 0;
+    static const uint8_t MODE_STDBY = 1;
+    static const uint8_t MODE_TX = 3;
+    static const uint8_t MODE_RXCONTINUOUS = 5;
+    static const uint8_t MODE_RXSINGLE = 6;
+    static const uint8_t MODE_CAD = 7;
+
+    /**
+     * @param dio0 The processor pin DIO0 is wired to
+     */
+    explicit RadioChip(pin_t dio0);
+
+    void select() override { first = true; }
+    uint8_t transfer(uint8_t data) override;
+
+    /**
+     * @brief A frame arrives - including the four RadioHead headers
+     *
+     * @param snr Signal to noise ratio in dB
+     * @param rssi Packet RSSI in dBm
+     * @return false if the radio was not receiving, so did not hear it
+     */
+    bool receive(const uint8_t *frame, uint8_t length, int8_t snr = 8, int16_t rssi = -60);
+
+    /**
+     * @brief A single receive window runs out with nothing heard - the flag is set but DIO0 is not raised
+     */
+    bool receiveTimeout();
+
+    uint8_t mode() const { return regs[0x01] & 0x07; }
+
+    /**
+     * @brief Symbols a single receive window waits for a preamble - from RegModemConfig2 and RegSymbTimeoutLsb
+     */
+    uint16_t symbolTimeout() const { return ((regs[0x1e] & 0x03) << 8) | regs[0x1f]; }
+
+    uint8_t regs[128];
+    uint8_t fifo[256];
+    std::vector<std::vector<uint8_t>> sent;    // Each frame transmitted, headers first
+
+private:
+    void writeRegister(uint8_t reg, uint8_t value);
+    void interrupt(uint8_t flags);
+
+    pin_t dio0;
+    bool first = true;
+    uint8_t address = 0;
+    uint8_t rxPosition = 0;                    // Where the next received frame goes in the FIFO
+};
+
+#endif /* __HOST_CHIPS_H */
@@ -0,0 +1,67 @@
+/**
+ * @file   LoopbackDriver.cpp - RadioHead drivers joined by a channel in memory
+ */
+#include "LoopbackDriver.h"
+#include <algorithm>
+
+void LoopbackChannel::transmit(LoopbackDriver &sender, const Frame &frame) {
+    sent.push_back(frame);
+    Frame delivered = frame;
+    if (filter && !filter(delivered)) return;
+    for (LoopbackDriver *driver : drivers) {
+        if (driver != &sender) driver->rxQueue.push_back(delivered);
+    }
+}
+
+LoopbackDriver::LoopbackDriver(LoopbackChannel &channel) : channel(channel) {
+    channel.drivers.push_back(this);
+}
+
+LoopbackDriver::~LoopbackDriver() {
+    channel.drivers.erase(std::remove(channel.drivers.begin(), channel.drivers.end(), this), channel.drivers.end());
+}
+
+bool LoopbackDriver::init() {
+    RHGenericDriver::init();
+    _mode = RHModeIdle;
+    return true;
+}
+
+bool LoopbackDriver::available() {
+    // Drop what isn't for us, as a radio driver does on reception
+    while (!rxQueue.empty()) {
+        const LoopbackChannel::Frame &frame = rxQueue.front();
+        if (_promiscuous || frame.to == _thisAddress || frame.to == RH_BROADCAST_ADDRESS) return true;
+        rxQueue.pop_front();
+    }
+    return false;
+}
+
+bool LoopbackDriver::recv(uint8_t *buf, uint8_t *len) {
+    if (!available()) return false;
+    LoopbackChannel::Frame frame = rxQueue.front();
+    rxQueue.pop_front();
+    _rxHeaderTo = frame.to;
+    _rxHeaderFrom = frame.from;
+    _rxHeaderId = frame.id;
+    _rxHeaderFlags = frame.flags;
+    _rxGood++;
+    if (buf && len) {
+        if (*len > frame.data.size()) *len = frame.data.size();
+        memcpy(buf, frame.data.data(), *len);
+    }
+    return true;
+}
+
+bool LoopbackDriver::send(const uint8_t *data, uint8_t len) {
+    if (len > RH_LOOPBACK_MAX_MESSAGE_LEN) return false;
+    LoopbackChannel::Frame frame;
+    frame.to = _txHeaderTo;
+    frame.from = _txHeaderFrom;
+    frame.id = _txHeaderId;
+    frame.flags = _txHeaderFlags;
+    frame.data.assign(data, data + len);
+    _txGood++;
+    channel.transmit(*this, frame);
+    return true;
+}
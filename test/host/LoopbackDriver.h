@@ -0,0 +1,69 @@
+/**
+ * @file   LoopbackDriver.h - RadioHead drivers joined by a channel in memory
+ * @brief  An RHGenericDriver for the unit tests - what one driver sends, every other driver on the channel receives
+ *
+ * @details Frames arrive at once and in order, with their to / from / id / flags headers, and each receiver filters
+ * them by address as a radio driver does. The channel can drop or change frames on the way - to test the layers above
+ * the driver (RHReliableDatagram retries, RHAuthenticatedDriver's tag and replay checks) without a radio model.
+ */
+#ifndef __LOOPBACK_DRIVER_H
+#define __LOOPBACK_DRIVER_H
+
+#include <RHGenericDriver.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#define RH_LOOPBACK_MAX_MESSAGE_LEN 251
+
+class LoopbackDriver;
+
+class LoopbackChannel {
+public:
+    struct Frame {
+        uint8_t to;
+        uint8_t from;
+        uint8_t id;
+        uint8_t flags;
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * @brief Sees every frame before it is delivered - return false to drop it
+     */
+    std::function<bool(Frame &frame)> filter;
+
+    /**
+     * @brief Every frame sent on the channel, in order - as sent, before the filter
+     */
+    std::vector<Frame> sent;
+
+private:
+    friend class LoopbackDriver;
+    void transmit(LoopbackDriver &sender, const Frame &frame);
+    std::vector<LoopbackDriver *> drivers;
+};
+
+class LoopbackDriver : public RHGenericDriver {
+public:
+    explicit LoopbackDriver(LoopbackChannel &channel);
+    ~LoopbackDriver();
+
+    bool init() override;
+    bool available() override;
+    bool recv(uint8_t *buf, uint8_t *len) override;
+    bool send(const uint8_t *data, uint8_t len) override;
+    uint8_t maxMessageLength() override { return RH_LOOPBACK_MAX_MESSAGE_LEN; }
+
+    /**
+     * @brief Frames waiting to be received
+     */
+    size_t queued() const { return rxQueue.size(); }
+
+private:
+    friend class LoopbackChannel;
+    LoopbackChannel &channel;
+    std::deque<LoopbackChannel::Frame> rxQueue;
+};
+
+#endif /* __LOOPBACK_DRIVER_H */
@@ -0,0 +1,470 @@
+/**
+ * @file   Particle.cpp - host stand-in for Device OS
+ * @brief  The Particle API in Particle.h, on top of the HostBoard
+ */
+#include "Particle.h"
+#include "SPI.h"
+#include "HostBoard.h"
+
+hal_i2c_config_t acquireWireBuffer() __attribute__((weak));	// The application can ask for bigger I2C buffers
+
+const Logger Log;
+USBSerial Serial;
+TimeClass Time;
+SystemClass System;
+CloudClass Particle;
+CellularClass Cellular;
+EEPROMClass EEPROM;
+TwoWire Wire;
+SPIClass SPI;
+
+static HostBoard *board = NULL;
+
+static void (*pinHandlers[HOST_PIN_COUNT])() = {};
+static int interruptsDisabled = 0;
+static bool inInterrupt = false;
+static uint8_t outputLevels[HOST_PIN_COUNT] = {};
+static HostSPIDevice *selectedSpi = NULL;
+static uint32_t spinCalls = 0;				// Calls to millis() since the code last waited
+const uint32_t SPIN_CALLS_BEFORE_YIELD = 100000;	// Something is spinning on millis() without a YIELD - let time pass
+
+// ************************************************************************
+// *****                       Boards                                 *****
+// ************************************************************************
+StandaloneBoard::StandaloneBoard() {
+    logging = getenv("HOST_LOG") != NULL;
+}
+
+pin_t StandaloneBoard::wait(uint64_t us, uint32_t wakePins) {
+    uint64_t until = nowUs + us;
+
+    for (;;) {
+        if (pending & wakePins) {
+            for (pin_t pin = 0; pin < HOST_PIN_COUNT; pin++) if (pending & wakePins & (1UL << pin)) return pin;
+        }
+        auto next = scheduled.begin();
+        if (next == scheduled.end() || next->first > until) break;
+        if (next->first > nowUs) nowUs = next->first;
+        pending |= 1UL << next->second;
+        scheduled.erase(next);
+    }
+    nowUs = until;
+    return PIN_INVALID;
+}
+
+uint32_t StandaloneBoard::takeInterrupts() {
+    while (!scheduled.empty() && scheduled.begin()->first <= nowUs) {		// Due while the code was running
+        pending |= 1UL << scheduled.begin()->second;
+        scheduled.erase(scheduled.begin());
+    }
+    uint32_t pins = pending;
+    pending = 0;
+    return pins;
+}
+
+HostI2CDevice *StandaloneBoard::i2cDevice(uint8_t address) {
+    auto it = i2c.find(address);
+    return (it == i2c.end()) ? NULL : it->second;
+}
+
+HostSPIDevice *StandaloneBoard::spiDevice(pin_t chipSelect) {
+    auto it = spi.find(chipSelect);
+    return (it == spi.end()) ? NULL : it->second;
+}
+
+uint32_t StandaloneBoard::randomNumber() {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (uint32_t)((rngState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+void StandaloneBoard::log(LogLevel level, const char *category, const char *message) {
+    if (!logging) return;
+    fprintf(stderr, "%010.3f [%s] %s: %s\n", nowUs / 1e6, category, (level >= LOG_LEVEL_ERROR) ? "ERROR" : (level >= LOG_LEVEL_WARN) ? "WARN" : "INFO", message);
+}
+
+void StandaloneBoard::setDeviceID(const char *deviceID) {
+    strncpy(id, deviceID, sizeof(id) - 1);
+    id[sizeof(id) - 1] = 0;
+}
+
+void StandaloneBoard::interruptAt(pin_t pin, uint64_t atUs) {
+    scheduled.insert(std::make_pair(atUs, pin));
+}
+
+StandaloneBoard &standaloneBoard() {
+    static StandaloneBoard standalone;
+    return standalone;
+}
+
+HostBoard &HostBoard::current() {
+    if (!board) board = &standaloneBoard();
+    return *board;
+}
+
+void HostBoard::use(HostBoard &newBoard) {
+    board = &newBoard;
+}
+
+void hostRunInterrupts() {
+    if (inInterrupt || interruptsDisabled) return;
+    uint32_t pins = HostBoard::current().takeInterrupts();
+    inInterrupt = true;
+    for (pin_t pin = 0; pins && pin < HOST_PIN_COUNT; pin++) {
+        if (!(pins & (1UL << pin))) continue;
+        pins &= ~(1UL << pin);
+        if (pinHandlers[pin]) pinHandlers[pin]();
+    }
+    inInterrupt = false;
+}
+
+static void hostWait(uint64_t us, uint32_t wakePins) {
+    spinCalls = 0;
+    if (inInterrupt) {								// A handler that waits holds up the rest - as it would on the Boron
+        HostBoard::current().wait(us, 0);
+        return;
+    }
+    HostBoard::current().wait(us, wakePins);
+    hostRunInterrupts();
+}
+
+void hostLoopPass(uint32_t us) {
+    hostRunInterrupts();
+    hostWait(us, 0xffffffff);
+}
+
+// ************************************************************************
+// *****                       Timing                                 *****
+// ************************************************************************
+unsigned long micros() {
+    return (unsigned long)(uint32_t)HostBoard::current().micros();
+}
+
+system_tick_t millis() {
+    if (++spinCalls > SPIN_CALLS_BEFORE_YIELD) hostYield();
+    return (system_tick_t)(HostBoard::current().micros() / 1000ULL);
+}
+
+void delay(unsigned long ms) {
+    uint64_t until = HostBoard::current().micros() + ms * 1000ULL;
+    for (uint64_t now = HostBoard::current().micros(); now < until; now = HostBoard::current().micros()) {
+        hostWait(until - now, 0xffffffff);			// Interrupts are serviced as they come in
+    }
+}
+
+void delayMicroseconds(unsigned int us) {
+    (void)us;										// Register settle times - nothing to wait for on the host
+}
+
+void hostYield() {
+    hostRunInterrupts();
+    hostWait(HostBoard::current().yieldUs(), 0xffffffff);
+}
+
+// ************************************************************************
+// *****                       Pins                                   *****
+// ************************************************************************
+void pinMode(pin_t pin, PinMode mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(pin_t pin, uint8_t value) {
+    if (pin >= HOST_PIN_COUNT) return;
+    outputLevels[pin] = value;
+    HostBoard::current().pinWritten(pin, value);
+    HostSPIDevice *device = HostBoard::current().spiDevice(pin);
+    if (!device) return;
+    if (value == LOW) {
+        selectedSpi = device;
+        device->select();
+    }
+    else if (selectedSpi == device) {
+        device->deselect();
+        selectedSpi = NULL;
+    }
+}
+
+int32_t digitalRead(pin_t pin) {
+    return HostBoard::current().digitalRead(pin);
+}
+
+int32_t analogRead(pin_t pin) {
+    return HostBoard::current().analogRead(pin);
+}
+
+bool attachInterrupt(pin_t pin, void (*handler)(), InterruptMode mode, int8_t priority, uint8_t subpriority) {
+    (void)mode;
+    (void)priority;
+    (void)subpriority;
+    if (pin >= HOST_PIN_COUNT) return false;
+    pinHandlers[pin] = handler;
+    return true;
+}
+
+bool detachInterrupt(pin_t pin) {
+    if (pin >= HOST_PIN_COUNT) return false;
+    pinHandlers[pin] = NULL;
+    return true;
+}
+
+void interrupts() {
+    if (interruptsDisabled > 0) interruptsDisabled--;
+}
+
+void noInterrupts() {
+    interruptsDisabled++;
+}
+
+int HAL_disable_irq() {
+    noInterrupts();
+    return 0;
+}
+
+void HAL_enable_irq(int mask) {
+    (void)mask;
+    interrupts();
+}
+
+uint32_t HAL_RNG_GetRandomNumber() {
+    return HostBoard::current().randomNumber();
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    return (selectedSpi) ? selectedSpi->transfer(data) : 0xff;
+}
+
+// ************************************************************************
+// *****                       Math                                   *****
+// ************************************************************************
+static uint32_t randomState = 1;
+
+long random(long max) {
+    if (max <= 0) return 0;
+    randomState = randomState * 1103515245UL + 12345UL;
+    return (long)((randomState >> 1) % (uint32_t)max);
+}
+
+long random(long min, long max) {
+    if (min >= max) return min;
+    return min + random(max - min);
+}
+
+void randomSeed(unsigned int seed) {
+    randomState = seed;
+}
+
+long map(long value, long fromStart, long fromEnd, long toStart, long toEnd) {
+    if (fromEnd == fromStart) return toStart;
+    return (value - fromStart) * (toEnd - toStart) / (fromEnd - fromStart) + toStart;
+}
+
+// ************************************************************************
+// *****                       Logging                                *****
+// ************************************************************************
+static void hostLog(LogLevel level, const char *category, const char *fmt, va_list ap) {
+    char message[512];
+    vsnprintf(message, sizeof(message), fmt, ap);
+    HostBoard::current().log(level, category, message);
+}
+
+#define HOST_LOG_AT(level) { va_list ap; va_start(ap, fmt); hostLog(level, name, fmt, ap); va_end(ap); }
+void Logger::trace(const char *fmt, ...) const HOST_LOG_AT(LOG_LEVEL_TRACE)
+void Logger::info(const char *fmt, ...) const HOST_LOG_AT(LOG_LEVEL_INFO)
+void Logger::warn(const char *fmt, ...) const HOST_LOG_AT(LOG_LEVEL_WARN)
+void Logger::error(const char *fmt, ...) const HOST_LOG_AT(LOG_LEVEL_ERROR)
+void Logger::log(LogLevel level, const char *fmt, ...) const HOST_LOG_AT(level)
+
+void Logger::print(const char *str) const {
+    HostBoard::current().log(LOG_LEVEL_TRACE, name, str);
+}
+
+void Logger::dump(const void *data, size_t size) const {
+    char hex[3 * 64 + 1];
+    size_t len = 0;
+    for (size_t i = 0; i < size && i < 64; i++) len += snprintf(hex + len, sizeof(hex) - len, "%02x ", ((const uint8_t *)data)[i]);
+    hex[len] = 0;
+    HostBoard::current().log(LOG_LEVEL_TRACE, name, hex);
+}
+
+// ************************************************************************
+// *****                       Time                                   *****
+// ************************************************************************
+static bool timeValid = false;
+static time_t timeBase = 0;					// Time.now() at timeBaseUs on the board's clock
+static uint64_t timeBaseUs = 0;
+
+time_t TimeClass::now() {
+    if (!timeValid) return (time_t)(HostBoard::current().micros() / 1000000ULL);	// Seconds since boot, like 1970 on the Boron
+    return timeBase + (time_t)((HostBoard::current().micros() - timeBaseUs) / 1000000ULL);
+}
+
+bool TimeClass::isValid() {
+    return timeValid;
+}
+
+void TimeClass::setTime(time_t t) {
+    timeBase = t;
+    timeBaseUs = HostBoard::current().micros();
+    timeValid = true;
+}
+
+static struct tm timeParts(time_t t) {
+    struct tm parts;
+    gmtime_r(&t, &parts);
+    return parts;
+}
+
+int TimeClass::hour(time_t t) { return timeParts(t).tm_hour; }
+int TimeClass::minute(time_t t) { return timeParts(t).tm_min; }
+int TimeClass::second(time_t t) { return timeParts(t).tm_sec; }
+int TimeClass::day(time_t t) { return timeParts(t).tm_mday; }
+int TimeClass::weekday(time_t t) { return timeParts(t).tm_wday + 1; }
+int TimeClass::month(time_t t) { return timeParts(t).tm_mon + 1; }
+int TimeClass::year(time_t t) { return timeParts(t).tm_year + 1900; }
+
+String TimeClass::format(time_t t, const char *fmt) {
+    char out[64];
+    struct tm parts = timeParts(t);
+    if (!fmt || strcmp(fmt, TIME_FORMAT_DEFAULT) == 0) fmt = "%a %b %e %H:%M:%S %Y";
+    strftime(out, sizeof(out), fmt, &parts);
+    return String(out);
+}
+
+String TimeClass::timeStr(time_t t) {
+    return format(t, TIME_FORMAT_DEFAULT);
+}
+
+// ************************************************************************
+// *****                       System                                 *****
+// ************************************************************************
+String SystemClass::deviceID() {
+    return String(HostBoard::current().deviceID());
+}
+
+void SystemClass::reset() {
+    HostBoard::current().reset();
+    abort();										// Boards don't return from reset()
+}
+
+SystemSleepResult SystemClass::sleep(const SystemSleepConfiguration &config) {
+    HostBoard &host = HostBoard::current();
+    uint64_t until = host.micros() + config.durationMs * 1000ULL;
+    pin_t woke = PIN_INVALID;
+
+    host.sleeping(true);
+    spinCalls = 0;
+    while (woke == PIN_INVALID) {
+        uint64_t now = host.micros();
+        if (config.durationMs && now >= until) break;
+        woke = host.wait((config.durationMs) ? until - now : 0xffffffffffffULL, config.wakePins);
+    }
+    host.sleeping(false);
+    hostRunInterrupts();							// The pin that woke us, and anything else that came in
+    return SystemSleepResult(woke);
+}
+
+bool SystemClass::on(system_event_t events, system_event_handler_t handler) {
+    (void)events;									// Nothing here raises system events
+    (void)handler;
+    return true;
+}
+
+float SystemClass::batteryCharge() {
+    return HostBoard::current().batteryCharge();
+}
+
+void CloudClass::process() {
+    hostYield();
+}
+
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex) {
+    *mutex = new int(0);
+    return 0;
+}
+
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) {
+    delete mutex;
+    return 0;
+}
+
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) {
+    (*mutex)++;
+    return 0;
+}
+
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex) {
+    (*mutex)++;
+    return 0;
+}
+
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) {
+    (*mutex)--;
+    return 0;
+}
+
+static uint8_t eepromData[4096];
+static bool eepromErased = false;
+
+uint8_t EEPROMClass::read(int index) const {
+    if (!eepromErased) return 0xff;
+    return (index >= 0 && index < (int)sizeof(eepromData)) ? eepromData[index] : 0xff;
+}
+
+void EEPROMClass::write(int index, uint8_t value) {
+    if (!eepromErased) {
+        memset(eepromData, 0xff, sizeof(eepromData));
+        eepromErased = true;
+    }
+    if (index >= 0 && index < (int)sizeof(eepromData)) eepromData[index] = value;
+}
+
+// ************************************************************************
+// *****                       I2C                                    *****
+// ************************************************************************
+void TwoWire::begin() {
+    if (configuredSize == 0) {
+        configuredSize = 32;						// Device OS default
+        if (acquireWireBuffer) configuredSize = std::min((size_t)acquireWireBuffer().rx_buffer_size, sizeof(rxBuffer));
+    }
+}
+
+size_t TwoWire::bufferSize() {
+    begin();
+    return configuredSize;
+}
+
+void TwoWire::beginTransmission(int addr) {
+    address = addr;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLength >= bufferSize()) return 0;
+    txBuffer[txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+    size_t written = 0;
+    while (written < quantity && write(data[written])) written++;
+    return written;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop) {
+    (void)sendStop;
+    HostI2CDevice *device = HostBoard::current().i2cDevice(address);
+    if (!device) return 2;							// NACK on the address
+    return device->write(txBuffer, txLength) ? 0 : 3;
+}
+
+size_t TwoWire::requestFrom(int addr, size_t quantity, int sendStop) {
+    (void)sendStop;
+    rxIndex = 0;
+    rxLength = 0;
+    HostI2CDevice *device = HostBoard::current().i2cDevice(addr);
+    if (!device) return 0;
+    rxLength = device->read(rxBuffer, std::min(quantity, bufferSize()));
+    return rxLength;
+}
@@ -0,0 +1,427 @@
+/**
+ * @file   Particle.h - host stand-in for Device OS
+ * @brief  Just enough of the Particle API for the firmware in src/ and the libraries in lib/ to build and run on a PC
+ *
+ * @details Everything that touches hardware goes through the HostBoard (see HostBoard.h) - the clock, waits and sleep,
+ * pin interrupts, the I2C and SPI devices and resets. The default board runs on its own, advancing time as the code
+ * waits, which is what the test programs use. The network simulator in test/sim gives each device a board that runs
+ * in lockstep with the others in virtual time.
+ *
+ * Interrupt handlers run when the code waits - delay(), System.sleep(), Particle.process(), RadioHead's YIELD and
+ * between passes of loop() - rather than at any instruction, so code that is only safe because of where interrupts
+ * happen to land on the Boron can pass here.
+ */
+#ifndef __HOST_PARTICLE_H
+#define __HOST_PARTICLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+// A Boron - RadioHead picks its platform from these
+#ifndef PARTICLE
+#define PARTICLE 1
+#endif
+#define PLATFORM_ID 13
+#define HAL_PLATFORM_NRF52840 1
+
+typedef uint16_t pin_t;
+typedef uint32_t system_tick_t;
+
+// Boron pin numbers
+enum : pin_t { D0 = 0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13, A5, A4, A3, A2, A1, A0 };
+const pin_t SS = A5;
+const pin_t PIN_INVALID = 0xff;
+const pin_t HOST_PIN_COUNT = 20;
+
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+enum InterruptMode { CHANGE, RISING, FALLING };
+#define HIGH 1
+#define LOW 0
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (p)
+
+#define HEX 16
+#define DEC 10
+
+// Build macros that only mean something on the device
+#define SYSTEM_MODE(x)
+#define SYSTEM_THREAD(x)
+#define STARTUP(x)
+#define PRODUCT_VERSION(x)
+#define PRODUCT_ID(x)
+#define retained
+#define retained_system
+
+// Interrupt handlers only run when the code waits, so a block the code stays in is already atomic
+#define ATOMIC_BLOCK() for (bool __todo = true; __todo; __todo = false)
+#define SINGLE_THREADED_BLOCK() for (bool __todo = true; __todo; __todo = false)
+#define WITH_LOCK(lock) for (bool __todo = true; __todo; ) \
+    for (std::lock_guard<std::remove_reference<decltype(lock)>::type> __withLock(lock); __todo; __todo = false)
+
+#define waitFor(condition, timeoutMs) hostWaitFor([&]() -> bool { return (condition)(); }, (timeoutMs))
+#define waitForNot(condition, timeoutMs) hostWaitFor([&]() -> bool { return !(condition)(); }, (timeoutMs))
+
+// RadioHead spins on the radio's mode and on millis() - let time pass and the interrupts in
+#define YIELD hostYield();
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define memcpy_P memcpy
+#define PROGMEM
+using std::min;
+using std::max;
+
+// Timing
+system_tick_t millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void hostYield();
+template <typename Condition> bool hostWaitFor(Condition condition, system_tick_t timeoutMs) {
+    system_tick_t start = millis();
+    while (!condition()) {
+        if (millis() - start >= timeoutMs) return false;
+        delay(1);
+    }
+    return true;
+}
+
+// Pins and interrupts
+void pinMode(pin_t pin, PinMode mode);
+void digitalWrite(pin_t pin, uint8_t value);
+int32_t digitalRead(pin_t pin);
+int32_t analogRead(pin_t pin);
+inline void pinSetFast(pin_t pin) { digitalWrite(pin, HIGH); }
+inline void pinResetFast(pin_t pin) { digitalWrite(pin, LOW); }
+bool attachInterrupt(pin_t pin, void (*handler)(), InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0);
+bool detachInterrupt(pin_t pin);
+void interrupts();
+void noInterrupts();
+int HAL_disable_irq();
+void HAL_enable_irq(int mask);
+uint32_t HAL_RNG_GetRandomNumber();
+
+// Math
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned int seed);
+long map(long value, long fromStart, long fromEnd, long toStart, long toEnd);
+
+/**
+ * @brief Wiring String, on std::string
+ */
+class String {
+public:
+    String() {}
+    String(const char *str) : s(str ? str : "") {}
+    String(const std::string &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(int value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned int value, unsigned char base = 10) { fromLong(value, base); }
+    String(long value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned long value, unsigned char base = 10) { fromLong(value, base); }
+    String(double value, int decimalPlaces = 2) { char tmp[64]; snprintf(tmp, sizeof(tmp), "%.*f", decimalPlaces, value); s = tmp; }
+
+    static String format(const char *fmt, ...) {
+        char tmp[512];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(tmp, sizeof(tmp), fmt, ap);
+        va_end(ap);
+        return String(tmp);
+    }
+
+    const char *c_str() const { return s.c_str(); }
+    operator const char *() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    char charAt(unsigned int index) const { return (index < s.length()) ? s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+        if (!buf || bufsize == 0) return;
+        size_t n = (index < s.length()) ? std::min((size_t)bufsize - 1, s.length() - index) : 0;
+        memcpy(buf, s.c_str() + index, n);
+        buf[n] = 0;
+    }
+    int toInt() const { return atoi(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    String substring(unsigned int from) const { return (from < s.length()) ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const { return (from < s.length() && to > from) ? String(s.substr(from, to - from)) : String(); }
+    int indexOf(char c) const { size_t i = s.find(c); return (i == std::string::npos) ? -1 : (int)i; }
+    bool equals(const char *str) const { return s == str; }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator==(const char *str) const { return s == str; }
+    bool operator!=(const String &other) const { return s != other.s; }
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    String &operator+=(const char *str) { s += str; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    String &concat(const String &other) { return *this += other; }
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+
+private:
+    void fromLong(long value, unsigned char base) {
+        char tmp[72];
+        if (base == 16) snprintf(tmp, sizeof(tmp), "%lx", value);
+        else snprintf(tmp, sizeof(tmp), "%ld", value);
+        s = tmp;
+    }
+    std::string s;
+};
+
+// Logging - the board decides where it goes
+enum LogLevel { LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30, LOG_LEVEL_WARN = 40, LOG_LEVEL_ERROR = 50, LOG_LEVEL_NONE = 70 };
+
+class Logger {
+public:
+    explicit Logger(const char *name = "app") : name(name) {}
+    void trace(const char *fmt, ...) const;
+    void info(const char *fmt, ...) const;
+    void warn(const char *fmt, ...) const;
+    void error(const char *fmt, ...) const;
+    void log(LogLevel level, const char *fmt, ...) const;
+    void print(const char *str) const;
+    void dump(const void *data, size_t size) const;
+
+    const char *name;
+};
+extern const Logger Log;
+
+class SerialLogHandler {
+public:
+    explicit SerialLogHandler(LogLevel level = LOG_LEVEL_INFO) { (void)level; }
+};
+
+class USBSerial {
+public:
+    void begin(long baud = 9600) { (void)baud; }
+    bool isConnected() { return true; }
+    template <typename T> size_t print(const T &) { return 0; }
+    template <typename T> size_t print(const T &, int) { return 0; }
+    template <typename T> size_t println(const T &) { return 0; }
+    template <typename T> size_t println(const T &, int) { return 0; }
+    size_t println() { return 0; }
+    size_t printlnf(const char *, ...) { return 0; }
+    size_t printf(const char *, ...) { return 0; }
+};
+extern USBSerial Serial;
+
+// Time - runs from millis(), so it drifts with the board's clock, and is only valid once it has been set
+#define TIME_FORMAT_DEFAULT "asctime"
+#define TIME_FORMAT_ISO8601_FULL "%Y-%m-%dT%H:%M:%S%z"
+
+class TimeClass {
+public:
+    time_t now();
+    bool isValid();
+    void setTime(time_t t);
+    void zone(float offset) { (void)offset; }
+    int hour() { return hour(now()); }
+    int hour(time_t t);
+    int minute() { return minute(now()); }
+    int minute(time_t t);
+    int second() { return second(now()); }
+    int second(time_t t);
+    int day() { return day(now()); }
+    int day(time_t t);
+    int weekday() { return weekday(now()); }
+    int weekday(time_t t);
+    int month() { return month(now()); }
+    int month(time_t t);
+    int year() { return year(now()); }
+    int year(time_t t);
+    String format(time_t t, const char *fmt = TIME_FORMAT_DEFAULT);
+    String format(const char *fmt = TIME_FORMAT_DEFAULT) { return format(now(), fmt); }
+    String timeStr() { return timeStr(now()); }
+    String timeStr(time_t t);
+};
+extern TimeClass Time;
+
+// System
+enum system_event_values : uint64_t {
+    setup_begin = 1ULL << 1, setup_end = 1ULL << 2, network_status = 1ULL << 4, cloud_status = 1ULL << 5,
+    button_status = 1ULL << 6, firmware_update = 1ULL << 7, reset_pending = 1ULL << 8, reset = 1ULL << 9,
+    button_click = 1ULL << 10, time_changed = 1ULL << 12, low_battery = 1ULL << 13, out_of_memory = 1ULL << 14
+};
+typedef uint64_t system_event_t;
+typedef void (*system_event_handler_t)(system_event_t event, int param);
+#define FEATURE_RESET_INFO 1
+
+enum class SystemSleepMode { NONE, STOP, ULTRA_LOW_POWER, HIBERNATE };
+enum class SystemSleepWakeupReason { UNKNOWN, BY_GPIO, BY_ADC, BY_DAC, BY_RTC, BY_LPCOMP, BY_USART, BY_CAN, BY_NFC, BY_NETWORK };
+
+class SystemSleepConfiguration {
+public:
+    SystemSleepConfiguration &mode(SystemSleepMode m) { sleepMode = m; return *this; }
+    SystemSleepConfiguration &gpio(pin_t pin, InterruptMode mode) { (void)mode; if (pin < HOST_PIN_COUNT) wakePins |= 1UL << pin; return *this; }
+    SystemSleepConfiguration &duration(system_tick_t ms) { durationMs = ms; return *this; }
+
+    SystemSleepMode sleepMode = SystemSleepMode::NONE;
+    uint32_t wakePins = 0;
+    system_tick_t durationMs = 0;
+};
+
+class SystemSleepResult {
+public:
+    SystemSleepResult(pin_t pin = PIN_INVALID) : pin(pin) {}
+    pin_t wakeupPin() const { return pin; }
+    SystemSleepWakeupReason wakeupReason() const { return (pin != PIN_INVALID) ? SystemSleepWakeupReason::BY_GPIO : SystemSleepWakeupReason::BY_RTC; }
+private:
+    pin_t pin;
+};
+
+enum class SystemPowerFeature { NONE, PMIC_DETECTION, USE_VIN_SETTINGS_WITH_USB_HOST, DISABLE, DISABLE_CHARGING };
+class SystemPowerConfiguration {
+public:
+    SystemPowerConfiguration &feature(SystemPowerFeature) { return *this; }
+    SystemPowerConfiguration &powerSourceMaxCurrent(uint16_t) { return *this; }
+    SystemPowerConfiguration &powerSourceMinVoltage(uint16_t) { return *this; }
+    SystemPowerConfiguration &batteryChargeCurrent(uint16_t) { return *this; }
+    SystemPowerConfiguration &batteryChargeVoltage(uint16_t) { return *this; }
+};
+
+class SystemClass {
+public:
+    String deviceID();
+    [[noreturn]] void reset();
+    SystemSleepResult sleep(const SystemSleepConfiguration &config);
+    bool on(system_event_t events, system_event_handler_t handler);
+    void enableFeature(int feature) { (void)feature; }
+    uint32_t freeMemory() { return 80000; }
+    float batteryCharge();
+    int batteryState() { return 4; }              // Discharging
+    int setPowerConfiguration(const SystemPowerConfiguration &) { return 0; }
+    system_tick_t millis() { return ::millis(); }
+};
+extern SystemClass System;
+
+// The cloud is never reachable from the host
+class CloudClass {
+public:
+    void connect() {}
+    void disconnect() {}
+    bool connected() { return false; }
+    bool disconnected() { return true; }
+    void process();
+    bool publish(const char *, const char * = NULL, int = 60, int = 0) { return false; }
+    system_tick_t timeSyncedLast() { return 0; }
+    void syncTime() {}
+};
+extern CloudClass Particle;
+
+class CellularSignal {
+public:
+    int getAccessTechnology() const { return 0; }
+    float getStrength() const { return 0; }
+    float getQuality() const { return 0; }
+};
+class CellularClass {
+public:
+    CellularSignal RSSI() { return CellularSignal(); }
+    void on() {}
+    void off() {}
+    void disconnect() {}
+    bool isOn() { return false; }
+    bool isOff() { return true; }
+};
+extern CellularClass Cellular;
+
+class FuelGauge {
+public:
+    void quickStart() {}
+    float getVCell() { return 3.9; }
+    float getSoC() { return System.batteryCharge(); }
+};
+
+#define RGB_COLOR_BLUE 0x000000ff
+#define RGB_COLOR_ORANGE 0x00ff6000
+#define RGB_COLOR_GREEN 0x0000ff00
+#define RGB_COLOR_RED 0x00ff0000
+enum LEDPattern { LED_PATTERN_INVALID, LED_PATTERN_SOLID, LED_PATTERN_BLINK, LED_PATTERN_FADE };
+enum LEDSpeed { LED_SPEED_SLOW, LED_SPEED_NORMAL, LED_SPEED_FAST };
+enum LEDPriority { LED_PRIORITY_BACKGROUND, LED_PRIORITY_NORMAL, LED_PRIORITY_IMPORTANT, LED_PRIORITY_CRITICAL };
+class LEDStatus {
+public:
+    LEDStatus(uint32_t color = RGB_COLOR_BLUE, LEDPattern pattern = LED_PATTERN_SOLID, LEDSpeed speed = LED_SPEED_NORMAL, LEDPriority priority = LED_PRIORITY_NORMAL) {}
+    void setActive(bool active = true) { (void)active; }
+};
+
+class RecursiveMutex {
+public:
+    void lock() const { depth++; }
+    void unlock() const { depth--; }
+    bool trylock() const { depth++; return true; }
+private:
+    mutable int depth = 0;
+};
+
+// Only one thread runs on the host, so the OS mutexes just count
+typedef int *os_mutex_recursive_t;
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex);
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex);
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex);
+
+class EEPROMClass {
+public:
+    uint8_t read(int index) const;
+    void write(int index, uint8_t value);
+    size_t length() const { return 4096; }
+};
+extern EEPROMClass EEPROM;
+
+// I2C - transfers go to the board's device at that address
+#define HAL_I2C_CONFIG_VERSION_1 1
+typedef struct {
+    uint16_t size;
+    uint16_t version;
+    uint8_t *rx_buffer;
+    uint32_t rx_buffer_size;
+    uint8_t *tx_buffer;
+    uint32_t tx_buffer_size;
+} hal_i2c_config_t;
+
+class TwoWire {
+public:
+    void begin();
+    void end() {}
+    bool isEnabled() { return true; }
+    void setSpeed(uint32_t) {}
+    void lock() { depth++; }
+    void unlock() { depth--; }
+    void beginTransmission(int address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t quantity);
+    uint8_t endTransmission(uint8_t sendStop = true);
+    size_t requestFrom(int address, size_t quantity, int sendStop = true);
+    int available() { return rxLength - rxIndex; }
+    int read() { return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : -1; }
+    int peek() { return (rxIndex < rxLength) ? rxBuffer[rxIndex] : -1; }
+
+private:
+    size_t bufferSize();
+
+    uint8_t address = 0;
+    uint8_t txBuffer[512];
+    size_t txLength = 0;
+    uint8_t rxBuffer[512];
+    int rxLength = 0;
+    int rxIndex = 0;
+    int depth = 0;
+    size_t configuredSize = 0;
+};
+extern TwoWire Wire;
+
+#endif /* __HOST_PARTICLE_H */
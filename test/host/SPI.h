@@ -0,0 +1,50 @@
+/**
+ * @file   SPI.h - host stand-in for the Particle SPI class
+ * @brief  Bytes go to the device whose chip select the code has pulled low - see HostBoard
+ */
+#ifndef __HOST_SPI_H
+#define __HOST_SPI_H
+
+#include "Particle.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+#define SPI_CLOCK_DIV2 0x00
+#define SPI_CLOCK_DIV4 0x08
+#define SPI_CLOCK_DIV8 0x10
+#define SPI_CLOCK_DIV16 0x18
+#define SPI_CLOCK_DIV32 0x20
+#define SPI_CLOCK_DIV64 0x28
+#define SPI_CLOCK_DIV128 0x30
+#define SPI_CLOCK_DIV256 0x38
+#define MHZ 1000000
+
+class SPISettings {
+public:
+    SPISettings() {}
+    SPISettings(unsigned int clock, uint8_t bitOrder, uint8_t dataMode) { (void)clock; (void)bitOrder; (void)dataMode; }
+};
+
+class SPIClass {
+public:
+    void begin() {}
+    void begin(pin_t ss) { (void)ss; }
+    void end() {}
+    void setBitOrder(uint8_t) {}
+    void setDataMode(uint8_t) {}
+    void setClockDivider(uint8_t) {}
+    void setClockSpeed(unsigned int, unsigned int = MHZ) {}
+    void beginTransaction(const SPISettings &) {}
+    void endTransaction() {}
+    void usingInterrupt(uint8_t) {}
+    void attachInterrupt() {}
+    void detachInterrupt() {}
+    uint8_t transfer(uint8_t data);
+};
+extern SPIClass SPI;
+
+#endif /* __HOST_SPI_H */
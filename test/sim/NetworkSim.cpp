@@ -0,0 +1,411 @@
+/**
+ * @file   NetworkSim.cpp - network_sim, a Gateway and a field of nodes in virtual time
+ * @brief  Runs the firmware on every device against one radio channel and reports how the network did
+ *
+ * @details Each device is its own process - sim_gateway or sim_node - so each has the firmware's globals to itself,
+ * and all of them map one SimShared. The coordinator holds the virtual clock. It moves it on to the next thing that
+ * happens - a device's wait running out, the end of a frame or receive window, a sensor pulse, a device powering on -
+ * handles the radio and pin events due then, and runs each device that is due, one at a time, until it waits again.
+ * A device that resets or powers down exits and is started again at its power on time, with its FRAM, RTC and radio
+ * carried over in shared memory.
+ *
+ * The Gateway is in the middle of a square with the nodes scattered over it at random. Every link has log distance
+ * path loss and a fixed shadowing term. Sensor pulses come at random at each node, and each node's processor clock and
+ * RTC crystal are off by a random amount within the limits given.
+ *
+ * The report gives the delivery ratio - the share of reporting periods, from the first whole one after each node was
+ * switched on, that the Gateway has a report for, live or stored - the frames on the air and lost to collisions, the
+ * share of the nodes' time in each state, and the radio and sleep time the firmware counted against the true figures.
+ *
+ *   network_sim --nodes 50 --hours 24 --period 15 --seed 7 [--log logs] [--min-delivery 0.9]
+ */
+#include "SimRadio.h"
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <random>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *stateNames[SIM_STATES] = {"Initialize", "Error", "Idle", "Sleeping", "LoRA Transmit", "LoRA Listening", "LoRA Retry Wait", "Connecting", "Disconnecting", "Reporting"};
+static const double PATH_LOSS_1M_DB = 31.7;				// Free space at 1m and 927MHz
+
+static SimShared *shared = NULL;
+static int sharedFd = -1;
+static char programDir[PATH_MAX];
+static uint64_t firstPowerOnUs[SIM_MAX_DEVICES];
+
+static void usage() {
+    fprintf(stderr,
+        "network_sim - the node firmware and a Gateway on a simulated LoRa channel in virtual time\n"
+        "  --nodes N           Nodes, not counting the Gateway (default 20, up to %d)\n"
+        "  --hours H           Virtual time to run for (default 6)\n"
+        "  --period M          Reporting period the Gateway gives out, in minutes (default 15)\n"
+        "  --seed S            Placement, shadowing, clocks and pulses (default 1)\n"
+        "  --area M            Width of the square the nodes are scattered over, in meters (default 3000)\n"
+        "  --exponent N        Path loss exponent (default 3.3)\n"
+        "  --shadowing DB      Standard deviation of the shadowing on each link (default 6)\n"
+        "  --pulses N          Sensor pulses an hour at each node (default 60)\n"
+        "  --clock-ppm N       Processor clocks are off by up to this (default 50)\n"
+        "  --rtc-ppm N         RTC crystals are off by up to this (default 20)\n"
+        "  --boot-spread S     Nodes are switched on over this many seconds (default 600)\n"
+        "  --step-us N         Time a pass of loop() or a YIELD in RadioHead lets pass (default 10000) - larger is faster, coarser\n"
+        "  --log DIR           Each device logs to DIR/<device>.log - the Gateway is 0\n"
+        "  --per-node          Print a line for each node\n"
+        "  --min-delivery R    Exit with 1 if the delivery ratio is below R - for ctest\n"
+        "  --max-rx-period S   Exit with 1 if nodes with a slot have the receiver on more than S seconds a period\n"
+        "  --unique-nodes      Exit with 1 if two nodes end up holding the same node number\n"
+        "  --all-stored        Exit with 1 if a joined node has a period with its report neither delivered nor in its backlog\n",
+        SIM_MAX_DEVICES - 1);
+}
+
+static void fail(const char *message) {
+    fprintf(stderr, "network_sim: %s\n", message);
+    for (uint16_t i = 0; shared && i < simDeviceCount(*shared); i++) {
+        if (shared->devices[i].pid > 0) kill(shared->devices[i].pid, SIGKILL);
+    }
+    exit(2);
+}
+
+// ************************************************************************
+// *****                       Scenario                               *****
+// ************************************************************************
+static void placeDevices(std::mt19937_64 &rng) {
+    SimConfig &config = shared->config;
+    std::uniform_real_distribution<double> position(-config.areaMeters / 2, config.areaMeters / 2);
+    std::uniform_real_distribution<double> unit(-1.0, 1.0);
+    std::normal_distribution<double> shadowing(0.0, config.shadowingDb);
+    std::uniform_int_distribution<int> nibble(0, 15);
+
+    for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+        SimDevice &device = shared->devices[i];
+        device.kind = (i == 0) ? SIM_GATEWAY : SIM_NODE;
+        device.x = (i == 0) ? 0.0 : position(rng);
+        device.y = (i == 0) ? 0.0 : position(rng);
+        device.clockPpm = (i == 0) ? 0.0 : config.clockPpm * unit(rng);	// The Gateway's time is the true time
+        device.seed = rng();
+        for (int c = 0; c < 24; c++) device.deviceId[c] = "0123456789abcdef"[nibble(rng)];
+        device.state = SIM_OFF;
+        device.powerOnUs = (i == 0) ? 0 : std::uniform_int_distribution<uint64_t>(1, std::max<uint64_t>(config.bootSpreadUs, 1))(rng);
+        firstPowerOnUs[i] = device.powerOnUs;
+        device.pulsesPerUs = (i == 0) ? 0.0 : config.pulsesPerHour / 3.6e9;
+        device.nextPulseUs = (device.pulsesPerUs > 0) ? (uint64_t)std::exponential_distribution<double>(device.pulsesPerUs)(rng) : UINT64_MAX;
+        FramChip::erase(device.fram);
+        RtcChip::powerUp(device.rtc, (i == 0) ? 0.0 : config.rtcPpm * unit(rng));
+        SimRadio::powerUp(*shared, i);
+        if (sem_init(&device.run, 1, 0) != 0) fail("sem_init failed");
+    }
+    for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+        for (uint16_t j = 0; j < i; j++) {
+            double meters = std::max(1.0, hypot(shared->devices[i].x - shared->devices[j].x, shared->devices[i].y - shared->devices[j].y));
+            double loss = PATH_LOSS_1M_DB + 10.0 * config.pathLossExponent * log10(meters) + shadowing(rng);
+            shared->pathLossDb[i][j] = shared->pathLossDb[j][i] = (float)loss;
+        }
+    }
+}
+
+// ************************************************************************
+// *****                       Devices                                *****
+// ************************************************************************
+static void spawn(uint16_t index) {
+    SimDevice &device = shared->devices[index];
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", programDir, (device.kind == SIM_GATEWAY) ? "sim_gateway" : "sim_node");
+
+    device.state = SIM_READY;
+    device.bootUs = shared->nowUs;
+    device.boots++;
+    device.pending = 0;
+    device.asleep = false;
+    pid_t pid = fork();
+    if (pid < 0) fail("fork failed");
+    if (pid == 0) {
+        char fd[16], deviceIndex[16];
+        snprintf(fd, sizeof(fd), "%d", sharedFd);
+        snprintf(deviceIndex, sizeof(deviceIndex), "%u", index);
+        setenv("SIM_SHARED_FD", fd, 1);
+        setenv("SIM_DEVICE", deviceIndex, 1);
+        execl(path, path, (char *)NULL);
+        perror(path);
+        _exit(127);
+    }
+    device.pid = pid;
+}
+
+/**
+ * @brief Lets a device run until it waits, resets or powers down
+ */
+static void run(uint16_t index) {
+    SimDevice &device = shared->devices[index];
+    device.state = SIM_RUNNING;
+    sem_post(&device.run);
+
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        if (sem_timedwait(&shared->coordinator, &deadline) == 0) break;
+        if (errno != ETIMEDOUT && errno != EINTR) fail("sem_timedwait failed");
+        int status;
+        if (waitpid(device.pid, &status, WNOHANG) == device.pid) {		// Gone without handing back - it crashed
+            char message[128];
+            snprintf(message, sizeof(message), "device %u exited with status %d at %.3f s", index, status, shared->nowUs / 1e6);
+            device.pid = 0;
+            fail(message);
+        }
+    }
+    if (device.state == SIM_OFF) {									// Reset or powered down - the process has exited
+        waitpid(device.pid, NULL, 0);
+        device.pid = 0;
+    }
+}
+
+static uint64_t nextEventUs() {
+    uint64_t next = simRadioNextEventUs(*shared);
+    for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+        SimDevice &device = shared->devices[i];
+        if (device.state == SIM_OFF) next = std::min(next, device.powerOnUs);
+        else if (device.state == SIM_BLOCKED) next = std::min(next, device.wakeAtUs);
+        else if (device.state == SIM_READY) next = std::min(next, shared->nowUs);
+        next = std::min(next, device.nextPulseUs);
+    }
+    return std::max(next, shared->nowUs);
+}
+
+static void simulate(std::mt19937_64 &rng) {
+    for (;;) {
+        uint64_t next = nextEventUs();
+        if (next > shared->config.durationUs) break;
+        shared->nowUs = next;
+
+        simRadioEvents(*shared);
+        for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+            SimDevice &device = shared->devices[i];
+            while (device.nextPulseUs <= shared->nowUs) {
+                if (device.state == SIM_BLOCKED || device.state == SIM_RUNNING) {
+                    simRaisePin(*shared, i, device.sensorPin);
+                    device.pulses++;
+                }
+                device.nextPulseUs += std::max<uint64_t>(1, (uint64_t)std::exponential_distribution<double>(device.pulsesPerUs)(rng));
+            }
+            if (device.state == SIM_OFF && device.powerOnUs <= shared->nowUs) spawn(i);
+        }
+        for (bool ran = true; ran;) {									// Until everyone due now is waiting for later
+            ran = false;
+            for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+                SimDevice &device = shared->devices[i];
+                if (device.state == SIM_READY || (device.state == SIM_BLOCKED && device.wakeAtUs <= shared->nowUs)) {
+                    run(i);
+                    ran = true;
+                }
+            }
+        }
+    }
+    shared->nowUs = shared->config.durationUs;
+
+    shared->finishing = true;										// Each device copies out its report and exits
+    for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+        SimDevice &device = shared->devices[i];
+        if (device.pid <= 0) continue;
+        sem_post(&device.run);
+        waitpid(device.pid, NULL, 0);
+        device.pid = 0;
+    }
+}
+
+// ************************************************************************
+// *****                       Report                                 *****
+// ************************************************************************
+static void report(bool perNode, double &deliveryRatio, double &slottedRxS, uint32_t &sharing, uint32_t &unstored) {
+    SimConfig &config = shared->config;
+    uint64_t periodUs = config.frequencyMinutes * 60000000ULL;
+    uint32_t wholePeriods = (uint32_t)std::min<uint64_t>(config.durationUs / periodUs, SIM_MAX_PERIODS);
+    uint32_t due = 0, delivered = 0, joined = 0, joins = 0, resets = 0, powerDowns = 0, sent = 0, received = 0, lost = 0;
+    uint64_t stateMs[SIM_STATES] = {}, allStatesMs = 0, fwTxMs = 0, fwRxMs = 0, fwSleepMs = 0, txUs = 0, rxUs = 0, asleepUs = 0;
+    uint16_t holders[256] = {};										// Nodes that ended up with each node number
+    uint64_t slottedRxUs = 0, unslottedRxUs = 0;						// Receiver on time at nodes the Gateway gave a slot, and the rest
+    double slottedPeriods = 0.0, unslottedPeriods = 0.0;
+    unstored = 0;
+
+    if (perNode) printf("device  node  slot      x      y  loss dB  joins  resets  due  delivered  unstored  sent  lost  tx s  rx s  awake %%\n");
+    for (uint16_t i = 0; i < simDeviceCount(*shared); i++) {
+        SimDevice &device = shared->devices[i];
+        sent += device.radio.framesSent;
+        received += device.radio.framesReceived;
+        lost += device.radio.framesLost;
+        if (device.kind != SIM_NODE) continue;
+
+        uint32_t nodeDue = 0, nodeDelivered = 0;
+        for (uint32_t period = firstPowerOnUs[i] / periodUs + 1; period < wholePeriods; period++) {
+            nodeDue++;
+            if (device.delivered[period / 8] & (1 << (period % 8))) nodeDelivered++;
+        }
+        due += nodeDue;
+        // From its first delivered report on, a node has a report delivered or stored for every period but the last, whose
+        // window may still be open
+        uint32_t firstDelivered = firstPowerOnUs[i] / periodUs + 1;
+        while (firstDelivered < wholePeriods && !(device.delivered[firstDelivered / 8] & (1 << (firstDelivered % 8)))) firstDelivered++;
+        uint32_t nodeUnstored = 0;
+        for (uint32_t period = firstDelivered; device.report.valid && period + 1 < wholePeriods; period++) {
+            if (!(device.delivered[period / 8] & (1 << (period % 8))) && !(device.report.backlogged[period / 8] & (1 << (period % 8)))) nodeUnstored++;
+        }
+        unstored += nodeUnstored;
+        delivered += nodeDelivered;
+        if (device.joinedUs) joined++;
+        joins += device.joins;
+        resets += device.resets;
+        powerDowns += device.powerDowns;
+        txUs += device.radio.txUs;
+        rxUs += device.radio.rxUs;
+        asleepUs += device.asleepUs;
+        if (device.report.valid) {
+            for (uint8_t s = 0; s < SIM_STATES; s++) {
+                stateMs[s] += device.report.stateMs[s];
+                allStatesMs += device.report.stateMs[s];
+            }
+            fwTxMs += device.report.radioTxMs;
+            fwRxMs += device.report.radioRxMs;
+            fwSleepMs += device.report.sleepMs;
+            holders[device.report.nodeNumber]++;
+            double periods = (double)(config.durationUs - firstPowerOnUs[i]) / periodUs;
+            if (device.report.slotCount > 0) {
+                slottedRxUs += device.radio.rxUs;
+                slottedPeriods += periods;
+            }
+            else {
+                unslottedRxUs += device.radio.rxUs;
+                unslottedPeriods += periods;
+            }
+        }
+        if (perNode) {
+            double awake = 100.0 * (1.0 - (double)device.asleepUs / (config.durationUs - firstPowerOnUs[i]));
+            printf("%6u  %4u  %4u  %5.0f  %5.0f  %7.1f  %5u  %6u  %3u  %9u  %8u  %4u  %4u  %4.1f  %4.0f  %7.2f\n", i, device.report.nodeNumber,
+                device.report.slotIndex, device.x, device.y, shared->pathLossDb[0][i], device.joins, device.resets + device.powerDowns,
+                nodeDue, nodeDelivered, nodeUnstored, device.radio.framesSent, device.radio.framesLost, device.radio.txUs / 1e6, device.radio.rxUs / 1e6, awake);
+        }
+    }
+
+    deliveryRatio = (due > 0) ? (double)delivered / due : 0.0;
+    printf("Network simulation - %u nodes for %.1f hours, %u minute periods, seed %u\n", config.nodes, config.durationUs / 3.6e9, config.frequencyMinutes, config.seed);
+    printf("  Joined          %u of %u nodes with %u join acknowledgements\n", joined, config.nodes, joins);
+    printf("  Delivery ratio  %.1f%% - %u of %u reports due\n", 100.0 * deliveryRatio, delivered, due);
+    printf("  Unstored        %u periods since each node's first delivered report with no report delivered or stored\n", unstored);
+    printf("  Frames          %u sent, %u received, %u lost to collisions\n", sent, received, lost);
+    printf("  Restarts        %u resets, %u power downs\n", resets, powerDowns);
+    sharing = 0;
+    for (uint16_t n = 1; n < 254; n++) if (holders[n] > 1) sharing += holders[n];	// 254 is every unconfigured node
+    printf("  Node numbers    %u nodes hold a node number another node also holds\n", sharing);
+    printf("  Time in state  ");
+    for (uint8_t s = 0; s < SIM_STATES; s++) {
+        if (stateMs[s] > 0) printf(" %s %.2f%%", stateNames[s], 100.0 * stateMs[s] / std::max<uint64_t>(allStatesMs, 1));
+    }
+    printf("\n");
+    printf("  Radio transmit  %.1f s counted by the nodes, %.1f s true\n", fwTxMs / 1e3, txUs / 1e6);
+    printf("  Radio receive   %.1f s counted by the nodes, %.1f s true\n", fwRxMs / 1e3, rxUs / 1e6);
+    slottedRxS = (slottedPeriods > 0.0) ? slottedRxUs / 1e6 / slottedPeriods : 0.0;
+    printf("  Receiver on     %.1f s a period at nodes with a slot, %.1f s at nodes without\n", slottedRxS,
+        (unslottedPeriods > 0.0) ? unslottedRxUs / 1e6 / unslottedPeriods : 0.0);
+    printf("  Asleep          %.1f s counted by the nodes up to their last sleep, %.1f s true\n", fwSleepMs / 1e3, asleepUs / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"nodes", required_argument, NULL, 'n'}, {"hours", required_argument, NULL, 'h'}, {"period", required_argument, NULL, 'p'},
+        {"seed", required_argument, NULL, 's'}, {"area", required_argument, NULL, 'a'}, {"exponent", required_argument, NULL, 'e'},
+        {"shadowing", required_argument, NULL, 'w'}, {"pulses", required_argument, NULL, 'u'}, {"clock-ppm", required_argument, NULL, 'c'},
+        {"rtc-ppm", required_argument, NULL, 'r'}, {"boot-spread", required_argument, NULL, 'b'}, {"step-us", required_argument, NULL, 't'},
+        {"log", required_argument, NULL, 'l'}, {"per-node", no_argument, NULL, 'N'}, {"min-delivery", required_argument, NULL, 'm'},
+        {"max-rx-period", required_argument, NULL, 'x'}, {"unique-nodes", no_argument, NULL, 'U'},
+        {"all-stored", no_argument, NULL, 'S'}, {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}};
+    SimConfig config;
+    memset(&config, 0, sizeof(config));
+    config.nodes = 20;
+    config.seed = 1;
+    config.durationUs = 6 * 3600000000ULL;
+    config.epochSeconds = 1767225600ULL;							// 2026-01-01 - on a period boundary
+    config.frequencyMinutes = 15;
+    config.areaMeters = 3000.0;
+    config.pathLossExponent = 3.3;
+    config.shadowingDb = 6.0;
+    config.pulsesPerHour = 60.0;
+    config.clockPpm = 50.0;
+    config.rtcPpm = 20.0;
+    config.bootSpreadUs = 600000000ULL;
+    config.rebootUs = 2000000;
+    config.loopUs = 10000;
+    config.yieldUs = 10000;
+    bool perNode = false;
+    double minDelivery = -1.0;
+    double maxRxPeriodS = -1.0;
+    bool uniqueNodes = false;
+    bool allStored = false;
+
+    for (int opt; (opt = getopt_long(argc, argv, "", options, NULL)) != -1;) {
+        switch (opt) {
+            case 'n': config.nodes = (uint16_t)constrain(atoi(optarg), 1, SIM_MAX_DEVICES - 1); break;
+            case 'h': config.durationUs = (uint64_t)(atof(optarg) * 3.6e9); break;
+            case 'p': config.frequencyMinutes = (uint16_t)constrain(atoi(optarg), 1, 60); break;
+            case 's': config.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'a': config.areaMeters = atof(optarg); break;
+            case 'e': config.pathLossExponent = atof(optarg); break;
+            case 'w': config.shadowingDb = atof(optarg); break;
+            case 'u': config.pulsesPerHour = atof(optarg); break;
+            case 'c': config.clockPpm = atof(optarg); break;
+            case 'r': config.rtcPpm = atof(optarg); break;
+            case 'b': config.bootSpreadUs = (uint64_t)(atof(optarg) * 1e6); break;
+            case 't': config.loopUs = config.yieldUs = (uint32_t)constrain(atoi(optarg), 1, 100000); break;
+            case 'l': config.logging = true; strncpy(config.logDir, optarg, sizeof(config.logDir) - 1); break;
+            case 'N': perNode = true; break;
+            case 'm': minDelivery = atof(optarg); break;
+            case 'x': maxRxPeriodS = atof(optarg); break;
+            case 'U': uniqueNodes = true; break;
+            case 'S': allStored = true; break;
+            default: usage(); return 2;
+        }
+    }
+    if (config.logging) mkdir(config.logDir, 0755);
+
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0) fail("can't find where network_sim is");
+    self[len] = 0;
+    strncpy(programDir, dirname(self), sizeof(programDir) - 1);
+
+    sharedFd = memfd_create("network_sim", 0);						// Inherited by the device processes
+    if (sharedFd < 0 || ftruncate(sharedFd, sizeof(SimShared)) != 0) fail("can't create the shared memory");
+    void *mapped = mmap(NULL, sizeof(SimShared), PROT_READ | PROT_WRITE, MAP_SHARED, sharedFd, 0);
+    if (mapped == MAP_FAILED) fail("can't map the shared memory");
+    shared = (SimShared *)mapped;
+    shared->config = config;
+    if (sem_init(&shared->coordinator, 1, 0) != 0) fail("sem_init failed");
+
+    std::mt19937_64 rng(config.seed);
+    placeDevices(rng);
+    simulate(rng);
+
+    double deliveryRatio, slottedRxS;
+    uint32_t sharing, unstored;
+    report(perNode, deliveryRatio, slottedRxS, sharing, unstored);
+    if (minDelivery >= 0.0 && deliveryRatio < minDelivery) {
+        printf("Delivery ratio below %.1f%%\n", 100.0 * minDelivery);
+        return 1;
+    }
+    if (maxRxPeriodS >= 0.0 && slottedRxS > maxRxPeriodS) {
+        printf("Receiver on more than %.1f s a period\n", maxRxPeriodS);
+        return 1;
+    }
+    if (uniqueNodes && sharing > 0) {
+        printf("Node numbers held by more than one node\n");
+        return 1;
+    }
+    if (allStored && unstored > 0) {
+        printf("Reports neither delivered nor stored\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file   SimBoard.cpp - the board under each simulated device
+ */
+#include "SimBoard.h"
+#include "device_pinout.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+static SimShared *attached = NULL;
+static void (*reportHandler)(SimDevice &device) = NULL;
+
+SimShared &simShared() {
+    return *attached;
+}
+
+void simAttach(SimShared *shared) {
+    attached = shared;
+}
+
+static void semWait(sem_t *sem) {
+    while (sem_wait(sem) != 0 && errno == EINTR) {}
+}
+
+// ************************************************************************
+// *****                       SimBoard                               *****
+// ************************************************************************
+SimBoard::SimBoard(SimShared &shared, uint16_t index)
+    : shared(shared), device(shared.devices[index]), index(index), fram(device.fram),
+      rtc(device.rtc, [&shared]() { return shared.nowUs; }), radio(shared, index) {
+    rngState = (device.seed + 0x9E3779B97F4A7C15ULL * device.boots) | 1;	// A new sequence each boot
+    if (shared.config.logging) {
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%u.log", shared.config.logDir, index);
+        logFile = fopen(path, "a");
+    }
+}
+
+uint64_t SimBoard::micros() {
+    return (uint64_t)((shared.nowUs - device.bootUs) * (1.0 + device.clockPpm / 1e6));
+}
+
+pin_t SimBoard::wait(uint64_t us, uint32_t wakePins) {
+    if (!(device.pending & wakePins) && us > 0) {
+        // Our clock runs ppm fast - the true time it reaches micros() + us
+        uint64_t at = device.bootUs + (uint64_t)ceil((micros() + us) / (1.0 + device.clockPpm / 1e6));
+        device.wakeAtUs = std::max(at, shared.nowUs + 1);
+        device.wakeMask = wakePins;
+        block();
+    }
+    for (pin_t pin = 0; pin < HOST_PIN_COUNT; pin++) {
+        if (device.pending & wakePins & (1UL << pin)) return pin;
+    }
+    return PIN_INVALID;
+}
+
+uint32_t SimBoard::takeInterrupts() {
+    uint32_t pins = device.pending;
+    device.pending = 0;
+    return pins;
+}
+
+void SimBoard::sleeping(bool asleep) {
+    if (asleep == device.asleep) return;
+    if (asleep) device.asleepSinceUs = shared.nowUs;
+    else device.asleepUs += shared.nowUs - device.asleepSinceUs;
+    device.asleep = asleep;
+}
+
+void SimBoard::pinWritten(pin_t pin, uint8_t value) {
+    if (pin == RFM95_RST && value == LOW) SimRadio::powerUp(shared, index);	// Held in reset - back to the defaults
+}
+
+HostI2CDevice *SimBoard::i2cDevice(uint8_t address) {
+    if (address == FramChip::ADDRESS) return &fram;
+    if (address == RtcChip::ADDRESS) return &rtc;
+    return NULL;
+}
+
+HostSPIDevice *SimBoard::spiDevice(pin_t chipSelect) {
+    return (chipSelect == RFM95_CS) ? &radio : NULL;
+}
+
+const char *SimBoard::deviceID() {
+    return device.deviceId;
+}
+
+uint32_t SimBoard::randomNumber() {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (uint32_t)((rngState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+uint32_t SimBoard::yieldUs() {
+    return shared.config.yieldUs;
+}
+
+void SimBoard::reset() {
+    sleeping(false);
+    device.resets++;
+    device.powerOnUs = shared.nowUs + shared.config.rebootUs;
+    device.state = SIM_OFF;
+    if (logFile) fclose(logFile);
+    sem_post(&shared.coordinator);
+    _exit(0);
+}
+
+void SimBoard::powerDown(uint32_t seconds) {
+    sleeping(false);
+    SimRadio::powerUp(shared, index);					// The radio loses its power too
+    device.powerDowns++;
+    device.powerOnUs = shared.nowUs + seconds * 1000000ULL;
+    device.state = SIM_OFF;
+    if (logFile) fclose(logFile);
+    sem_post(&shared.coordinator);
+    _exit(0);
+}
+
+void SimBoard::log(LogLevel level, const char *category, const char *message) {
+    if (!logFile) return;
+    fprintf(logFile, "%010.3f [%s] %s: %s\n", shared.nowUs / 1e6, category, (level >= LOG_LEVEL_ERROR) ? "ERROR" : (level >= LOG_LEVEL_WARN) ? "WARN" : "INFO", message);
+}
+
+void SimBoard::block() {
+    device.state = SIM_BLOCKED;
+    if (logFile) fflush(logFile);
+    sem_post(&shared.coordinator);
+    semWait(&device.run);
+    if (shared.finishing) {
+        sleeping(false);
+        if (reportHandler) reportHandler(device);
+        if (logFile) fclose(logFile);
+        _exit(0);
+    }
+    device.state = SIM_RUNNING;
+}
+
+// ************************************************************************
+// *****                       Device process                         *****
+// ************************************************************************
+int simDeviceMain(void (*report)(SimDevice &device)) {
+    const char *fd = getenv("SIM_SHARED_FD");
+    const char *indexEnv = getenv("SIM_DEVICE");
+    if (!fd || !indexEnv) {
+        fprintf(stderr, "Run by network_sim - SIM_SHARED_FD and SIM_DEVICE are not set\n");
+        return 2;
+    }
+    void *mapped = mmap(NULL, sizeof(SimShared), PROT_READ | PROT_WRITE, MAP_SHARED, atoi(fd), 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return 2;
+    }
+    SimShared &shared = *(SimShared *)mapped;
+    uint16_t index = (uint16_t)atoi(indexEnv);
+    SimDevice &device = shared.devices[index];
+
+    simAttach(&shared);
+    reportHandler = report;
+    device.radioIntPin = RFM95_INT;
+    device.sensorPin = INT_PIN;
+    static SimBoard board(shared, index);
+    HostBoard::use(board);
+
+    semWait(&device.run);								// The coordinator runs us when it has the clock at our power on
+    if (shared.finishing) _exit(0);
+    device.state = SIM_RUNNING;
+
+    setup();
+    for (;;) {
+        loop();
+        hostLoopPass(shared.config.loopUs);
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * @file   SimBoard.h - the board under each simulated device
+ * @brief  A HostBoard that runs in lockstep with the other devices on the virtual clock in SimShared
+ *
+ * @details Time only passes while the firmware waits. A wait hands back to the coordinator, which runs the other
+ * devices and the radio channel until this device's time comes round or one of the pins it waits on is raised. The
+ * processor clock runs SimDevice::clockPpm fast on the true time, so a node's millis() drifts from the Gateway's as it
+ * would in the field. The FRAM, RTC and radio live in shared memory and carry on through resets and power downs.
+ */
+#ifndef __SIM_BOARD_H
+#define __SIM_BOARD_H
+
+#include "SimShared.h"
+#include "SimRadio.h"
+
+class SimBoard : public HostBoard {
+public:
+    SimBoard(SimShared &shared, uint16_t index);
+
+    uint64_t micros() override;
+    pin_t wait(uint64_t us, uint32_t wakePins) override;
+    uint32_t takeInterrupts() override;
+    void sleeping(bool asleep) override;
+    void pinWritten(pin_t pin, uint8_t value) override;
+    HostI2CDevice *i2cDevice(uint8_t address) override;
+    HostSPIDevice *spiDevice(pin_t chipSelect) override;
+    const char *deviceID() override;
+    uint32_t randomNumber() override;
+    uint32_t yieldUs() override;
+    [[noreturn]] void reset() override;
+    [[noreturn]] void powerDown(uint32_t seconds) override;
+    void log(LogLevel level, const char *category, const char *message) override;
+
+    /**
+     * @brief Hands back to the coordinator until this device is run again
+     *
+     * @details When the simulation is finishing this does not return - the report is taken and the process exits
+     */
+    void block();
+
+private:
+    SimShared &shared;
+    SimDevice &device;
+    uint16_t index;
+    FramChip fram;
+    RtcChip rtc;
+    SimRadio radio;
+    uint64_t rngState;
+    FILE *logFile = NULL;
+};
+
+/**
+ * @brief Runs the firmware's setup() and loop() on a SimBoard - the main() of sim_node and sim_gateway
+ *
+ * @details The coordinator starts the process with SIM_SHARED_FD and SIM_DEVICE in the environment
+ *
+ * @param report Fills in the device's report when the simulation finishes - may be NULL
+ */
+int simDeviceMain(void (*report)(SimDevice &device));
+
+#endif /* __SIM_BOARD_H */
@@ -0,0 +1,237 @@
+/**
+ * @file   SimGateway.cpp - sim_gateway, a Gateway for the simulated nodes
+ * @brief  Answers join requests and data reports as the v14 Gateway does, on the same radio stack as the nodes
+ *
+ * @details The Gateway's own firmware is not in this repository, so this is the part of it the nodes depend on, built
+ * on LoRA_Functions and LoRA_Messages so the two ends agree on everything on the air:
+ *  - A join request gets the next free node number - the same one again for a device that already has one - and the
+ *    slot nodeNumber - 1 of a frame with a slot for every node in the scenario
+ *  - A data report gets a data acknowledgement with the Gateway's time, the count of stored reports it carried, and
+ *    the data rate and power LoRA_ADR recommends for a node one hop away. A report from a node number the Gateway did
+ *    not give to that device gets alert 1 so the node joins again
+ *  - In each node's slot the radio is switched to the data rate that node was last told to use. A node that misses
+ *    LoRA_ADR::FALLBACK_FAILURES slots in a row is listened for at the default again, as it will have fallen back
+ *  - Replies go back the way the message came, so there is no route discovery between the time stamp and the send
+ *  - Between frames the processor naps until the next slot or the radio interrupt
+ * Each report received is marked in the node's SimDevice so NetworkSim can work out the delivery ratio.
+ */
+#include "SimBoard.h"
+#include <RHMesh.h>
+#include <RH_RF95.h>
+#include "LoRA_Functions.h"
+#include "LoRA_Messages.h"
+#include "LoRA_ADR.h"
+#include "MyPersistentData.h"
+#include "device_pinout.h"
+
+extern RH_RF95 driver;
+extern RHMesh manager;
+
+// Message flags - as in LoRA_Functions.cpp
+const uint8_t JOIN_REQ = 1;
+const uint8_t JOIN_ACK = 2;
+const uint8_t DATA_RPT = 3;
+const uint8_t DATA_ACK = 4;
+
+static char nodeDevice[MAX_NODE_NUMBER + 1][25];		// deviceID we gave each node number to
+static uint8_t nodesAssigned = 0;
+static LinkStats nodeLink[MAX_NODE_NUMBER + 1];
+static uint8_t nodeDataRate[MAX_NODE_NUMBER + 1];		// What the node was last told to use in its slot
+static int8_t nodeTxPower[MAX_NODE_NUMBER + 1];
+static uint32_t nodeHeardPeriod[MAX_NODE_NUMBER + 1];	// Reporting period we last heard from it in
+static uint8_t radioDataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+static uint8_t message[RH_MESH_MAX_MESSAGE_LEN];
+
+static uint64_t gatewayMs() {
+    return simShared().config.epochSeconds * 1000ULL + millis();	// The Gateway boots at virtual time 0 on a true clock
+}
+
+static uint32_t periodMs() {
+    return sysStatus.get_frequencyMinutes() * 60000UL;
+}
+
+static uint32_t currentPeriod() {
+    return (uint32_t)(gatewayMs() / periodMs());
+}
+
+static void useDataRate(uint8_t dataRate) {
+    if (dataRate == radioDataRate) return;
+    RH_RF95::ModemConfig config = {0x72, (uint8_t)((LoRA_ADR::spreadingFactor(dataRate) << 4) | 0x04), 0x04};
+    driver.setModemRegisters(&config);
+    driver.setLowDatarate();
+    radioDataRate = dataRate;
+}
+
+/**
+ * @brief The node whose slot we are in - 0 outside the frame
+ */
+static uint8_t slotOwner() {
+    uint32_t slot = (gatewayMs() % periodMs()) / LoRA_Functions::instance().slotMs();
+    return (slot < sysStatus.get_slotCount() && slot < nodesAssigned) ? slot + 1 : 0;
+}
+
+/**
+ * @brief Index of a device in the simulation from its deviceID - for the bookkeeping, not the protocol
+ */
+static SimDevice *simDevice(const char *deviceID) {
+    SimShared &shared = simShared();
+    for (uint16_t i = 1; i <= shared.config.nodes; i++) {
+        if (strcmp(shared.devices[i].deviceId, deviceID) == 0) return &shared.devices[i];
+    }
+    return NULL;
+}
+
+static void markDelivered(SimDevice *device, uint64_t seconds) {
+    SimShared &shared = simShared();
+    if (!device || seconds < shared.config.epochSeconds) return;
+    uint32_t period = (seconds - shared.config.epochSeconds) / (shared.config.frequencyMinutes * 60UL);
+    if (period < SIM_MAX_PERIODS) device->delivered[period / 8] |= 1 << (period % 8);
+    device->reportsReceived++;
+}
+
+static void stampHeader(LoRA_Messages::AckHeader &header, uint8_t alertCode) {
+    uint64_t now = gatewayMs();
+    header.magicNumber = sysStatus.get_magicNumber();
+    header.time = (uint32_t)(now / 1000ULL);
+    header.timeMs = now % 1000ULL;
+    header.frequencyMinutes = sysStatus.get_frequencyMinutes();
+    header.alertCode = alertCode;
+}
+
+static void joinRequest(uint8_t len, uint8_t from) {
+    LoRA_Messages::JoinRequest request;
+    if (!LoRA_Messages::decode(request, message, len) || request.magicNumber != sysStatus.get_magicNumber()) return;
+
+    uint8_t nodeNumber = 0;
+    for (uint8_t n = 1; n <= nodesAssigned; n++) if (strcmp(nodeDevice[n], request.deviceID) == 0) nodeNumber = n;
+    if (nodeNumber == 0) {
+        if (nodesAssigned >= MAX_NODE_NUMBER) return;
+        nodeNumber = ++nodesAssigned;
+        strncpy(nodeDevice[nodeNumber], request.deviceID, sizeof(nodeDevice[nodeNumber]) - 1);
+        nodeDataRate[nodeNumber] = LoRA_ADR::DEFAULT_DATA_RATE;
+        nodeTxPower[nodeNumber] = LoRA_ADR::MAX_TX_POWER;
+        nodeLink[nodeNumber].reset();
+    }
+    nodeHeardPeriod[nodeNumber] = currentPeriod();
+
+    LoRA_Messages::JoinAck ack;
+    stampHeader(ack, 0);
+    ack.nodeID = request.nodeID;
+    ack.senderId = LoRA_Functions::instance().linkSenderId(request.deviceID);
+    ack.newNodeNumber = nodeNumber;
+    ack.sensorType = request.sensorType;
+    ack.slotIndex = nodeNumber - 1;
+    ack.slotCount = sysStatus.get_slotCount();
+    len = LoRA_Messages::encode(ack, message, sizeof(message));
+    bool delivered = manager.sendtoWait(message, len, from, JOIN_ACK) == RH_ROUTER_ERROR_NONE;
+    Log.info("Join request from %s - node %d %s", request.deviceID, nodeNumber, (delivered) ? "acknowledged" : "not acknowledged");
+
+    SimDevice *device = simDevice(request.deviceID);
+    if (device && delivered) {
+        device->nodeNumber = nodeNumber;
+        device->joins++;
+        if (device->joinedUs == 0) device->joinedUs = simShared().nowUs;
+    }
+}
+
+static void dataReport(uint8_t len, uint8_t from, uint8_t hops) {
+    LoRA_Messages::DataReport report;
+    LoRA_Messages::BitReader reader(message, len);
+    if (!reader.get(report) || report.magicNumber != sysStatus.get_magicNumber()) return;
+
+    bool known = from >= 1 && from <= nodesAssigned && LoRA_Functions::instance().stringCheckSum(nodeDevice[from]) == report.nodeID;
+    SimDevice *device = (known) ? simDevice(nodeDevice[from]) : NULL;
+    uint8_t storedReports = 0;
+    if (known) {
+        markDelivered(device, gatewayMs() / 1000ULL);
+        uint8_t count = (reader.remaining() >= 8) ? reader.read(8) : 0;
+        for (uint8_t i = 0; i < count; i++) {
+            LoRA_Messages::StoredReport stored;
+            if (!reader.get(stored)) break;
+            markDelivered(device, stored.timestamp);
+            storedReports++;
+        }
+        nodeHeardPeriod[from] = currentPeriod();
+    }
+
+    uint8_t dataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+    int8_t txPower = LoRA_ADR::MAX_TX_POWER;
+    if (known && hops == 0) {										// Only a node one hop away can use another data rate
+        nodeLink[from].record(true, driver.lastRssi(), driver.lastSNR());
+        dataRate = nodeDataRate[from];
+        txPower = nodeTxPower[from];
+        LoRA_ADR::recommend(nodeLink[from], dataRate, txPower);
+    }
+
+    LoRA_Messages::DataAck ack;
+    stampHeader(ack, (known) ? 0 : 1);								// Not a node number we gave this device - join again
+    ack.sensorType = report.sensorType;
+    ack.openHours = 1;
+    ack.messageNumber = report.messageCount;
+    ack.slotIndex = (known) ? from - 1 : 0;
+    ack.slotCount = sysStatus.get_slotCount();
+    ack.storedReports = storedReports;
+    ack.dataRate = dataRate;
+    ack.txPower = txPower;
+    len = LoRA_Messages::encode(ack, message, sizeof(message));
+    bool delivered = manager.sendtoWait(message, len, from, DATA_ACK) == RH_ROUTER_ERROR_NONE;
+    if (known && delivered) {										// The node has it - it uses these in its next slot
+        if (dataRate != nodeDataRate[from]) nodeLink[from].reset();
+        nodeDataRate[from] = dataRate;
+        nodeTxPower[from] = txPower;
+    }
+    Log.info("Data report from node %d with %d stored - %s%s", from, storedReports, (known) ? "" : "unknown node - ", (delivered) ? "acknowledged" : "not acknowledged");
+}
+
+void setup() {
+    SimShared &shared = simShared();
+
+    sysStatus.setup();
+    current.setup();
+    savedRoutes.setup();
+    reportBacklog.setup();
+    energyStatus.setup();
+    eventLog.setup();
+
+    Time.setTime(shared.config.epochSeconds);
+    sysStatus.set_frequencyMinutes(shared.config.frequencyMinutes);
+    sysStatus.set_slotIndex(0);
+    sysStatus.set_slotCount(shared.config.nodes);					// A slot for every node in the scenario
+    if (!LoRA_Functions::instance().setup(true)) Log.error("Radio did not initialize");
+    Log.info("Gateway up - %d slots of %lu mSec in a %lu mSec period", sysStatus.get_slotCount(), LoRA_Functions::instance().slotMs(), periodMs());
+    if (LoRA_Functions::instance().frameMs() > periodMs()) Log.warn("The frame is longer than the reporting period");
+}
+
+void loop() {
+    uint8_t owner = slotOwner();
+    if (owner && nodeDataRate[owner] != LoRA_ADR::DEFAULT_DATA_RATE && currentPeriod() - nodeHeardPeriod[owner] > LoRA_ADR::FALLBACK_FAILURES) {
+        nodeDataRate[owner] = LoRA_ADR::DEFAULT_DATA_RATE;			// It will have fallen back by now
+        nodeTxPower[owner] = LoRA_ADR::MAX_TX_POWER;
+        nodeLink[owner].reset();
+    }
+    useDataRate((owner) ? nodeDataRate[owner] : LoRA_ADR::DEFAULT_DATA_RATE);
+
+    uint8_t len = sizeof(message);
+    uint8_t from, dest, id, flags, hops;
+    if (manager.recvfromAck(message, &len, &from, &dest, &id, &flags, &hops)) {
+        if (!manager.peekRouteTo(from)) manager.addRouteTo(from, manager.headerFrom());	// Reply the way it came - no route discovery before the time stamp
+        if (flags == JOIN_REQ) joinRequest(len, from);
+        else if (flags == DATA_RPT) dataReport(len, from, hops);
+        return;
+    }
+    sysStatus.loop();
+
+    // Nap with the receiver on until the next slot starts or a frame comes in
+    uint32_t slotMs = LoRA_Functions::instance().slotMs();
+    uint32_t intoPeriodMs = gatewayMs() % periodMs();
+    uint32_t napMs = (intoPeriodMs < sysStatus.get_slotCount() * slotMs) ? slotMs - intoPeriodMs % slotMs : periodMs() - intoPeriodMs;
+    SystemSleepConfiguration napConfig;
+    napConfig.mode(SystemSleepMode::ULTRA_LOW_POWER)
+        .gpio(RFM95_INT, RISING)
+        .duration(napMs);
+    System.sleep(napConfig);
+}
+
+int main() {
+    return simDeviceMain(NULL);
+}
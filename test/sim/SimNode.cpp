@@ -0,0 +1,41 @@
+/**
+ * @file   SimNode.cpp - sim_node, the node firmware on a SimBoard
+ * @brief  src/LoRA-Particle-Node.cpp as it is, with a main() that runs it and copies its figures out at the end
+ */
+#include "SimBoard.h"
+#include "MyPersistentData.h"
+#include "EnergyMonitor.h"
+
+/**
+ * @brief The node's own accounting, as of the last time it went to sleep - compared with the true figures in the report
+ */
+static void report(SimDevice &device) {
+    energyStatusData::EnergyCounters counters;
+    energyStatus.get_counters(counters);
+
+    SimNodeReport &out = device.report;
+    for (uint8_t i = 0; i < SIM_STATES && i < energyStatusData::ENERGY_STATES; i++) out.stateMs[i] = counters.stateMs[i];
+    out.sleepMs = counters.sleepMs;
+    out.radioTxMs = counters.radioTxMs;
+    out.radioRxMs = counters.radioRxMs;
+    out.framTransactions = counters.framTransactions;
+    out.sensorWakes = counters.sensorWakes;
+    out.chargeUah = EnergyMonitor::instance().chargeUah();
+    out.nodeNumber = sysStatus.get_nodeNumber();
+    out.slotIndex = sysStatus.get_slotIndex();
+    out.slotCount = sysStatus.get_slotCount();
+
+    const SimConfig &config = simShared().config;
+    memset(out.backlogged, 0, sizeof(out.backlogged));
+    reportBacklogData::ReportRecord record;
+    for (uint16_t i = 0; i < reportBacklog.pendingCount(); i++) {
+        if (!reportBacklog.peek(i, record) || record.timestamp < config.epochSeconds) continue;
+        uint32_t period = (record.timestamp - config.epochSeconds) / (config.frequencyMinutes * 60UL);
+        if (period < SIM_MAX_PERIODS) out.backlogged[period / 8] |= 1 << (period % 8);
+    }
+    out.valid = true;
+}
+
+int main() {
+    return simDeviceMain(report);
+}
@@ -0,0 +1,405 @@
+/**
+ * @file   SimRadio.cpp - the RFM95 radios and the channel between them
+ */
+#include "SimRadio.h"
+#include <RH_RF95.h>
+#include <math.h>
+
+const double NOISE_FIGURE_DB = 6.0;
+const double CAPTURE_DB = 6.0;                        // A frame survives interference this much weaker
+const double SF_ISOLATION_DB = 16.0;                  // Other spreading factors are this much quieter to the demodulator
+const double PREAMBLE_SYMBOLS_TO_LOCK = 5.0;          // Symbols of preamble the receiver needs to synchronize
+const double CAD_SYMBOLS = 2.0;
+
+static const double BANDWIDTH_HZ[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+
+static uint8_t mode(const SimRadioState &radio) { return radio.regs[RH_RF95_REG_01_OP_MODE] & RH_RF95_MODE; }
+
+static bool receiving(const SimRadioState &radio) {
+    return mode(radio) == RH_RF95_MODE_RXCONTINUOUS || mode(radio) == RH_RF95_MODE_RXSINGLE;
+}
+
+static uint8_t spreadingFactor(const uint8_t *regs) { return regs[RH_RF95_REG_1E_MODEM_CONFIG2] >> 4; }
+
+static uint8_t bandwidth(const uint8_t *regs) { return regs[RH_RF95_REG_1D_MODEM_CONFIG1] >> 4; }
+
+static uint32_t frequency(const uint8_t *regs) {
+    return ((uint32_t)regs[RH_RF95_REG_06_FRF_MSB] << 16) | ((uint32_t)regs[RH_RF95_REG_07_FRF_MID] << 8) | regs[RH_RF95_REG_08_FRF_LSB];
+}
+
+static double bandwidthHz(uint8_t bw) { return (bw < 10) ? BANDWIDTH_HZ[bw] : BANDWIDTH_HZ[7]; }
+
+static double symbolUs(const uint8_t *regs) { return 1e6 * (double)(1UL << spreadingFactor(regs)) / bandwidthHz(bandwidth(regs)); }
+
+static double noiseDbm(uint8_t bw) { return -174.0 + 10.0 * log10(bandwidthHz(bw)) + NOISE_FIGURE_DB; }
+
+/**
+ * @brief Lowest SNR each spreading factor demodulates - SX1276 datasheet table 13
+ */
+static double requiredSnrDb(uint8_t sf) {
+    if (sf < 6) sf = 6;
+    if (sf > 12) sf = 12;
+    return -5.0 - 2.5 * (sf - 6);
+}
+
+/**
+ * @brief Power out of PA_BOOST for the PA registers RH_RF95::setTxPower() writes
+ */
+static double powerDbm(const uint8_t *regs) {
+    double power = 2.0 + (regs[RH_RF95_REG_09_PA_CONFIG] & 0x0f);
+    if ((regs[RH_RF95_REG_4D_PA_DAC] & 0x07) == 0x07) power += 3.0;
+    return power;
+}
+
+static SimFrame *frameFor(SimShared &shared, int64_t seq) {
+    if (seq < 0) return NULL;
+    SimFrame *frame = &shared.frames[seq % SIM_MAX_FRAMES];
+    return (frame->seq == (uint32_t)seq) ? frame : NULL;		// NULL once it has been overwritten
+}
+
+static double receivedDbm(SimShared &shared, const SimFrame &frame, uint16_t receiver) {
+    return frame.powerDbm - shared.pathLossDb[frame.sender][receiver];
+}
+
+uint64_t simTimeOnAirUs(const uint8_t *regs, uint8_t payloadLen) {
+    int SF = spreadingFactor(regs);
+    int CR = (regs[RH_RF95_REG_1D_MODEM_CONFIG1] >> 1) & 0x07;
+    int IH = regs[RH_RF95_REG_1D_MODEM_CONFIG1] & 0x01;
+    int CRC = (regs[RH_RF95_REG_1E_MODEM_CONFIG2] & RH_RF95_PAYLOAD_CRC_ON) ? 1 : 0;
+    int DE = (regs[RH_RF95_REG_26_MODEM_CONFIG3] & RH_RF95_LOW_DATA_RATE_OPTIMIZE) ? 1 : 0;
+    int preamble = (regs[RH_RF95_REG_20_PREAMBLE_MSB] << 8) | regs[RH_RF95_REG_21_PREAMBLE_LSB];
+
+    int numerator = 8 * payloadLen - 4 * SF + 28 + 16 * CRC - 20 * IH;
+    int denominator = 4 * (SF - 2 * DE);
+    int payloadSymbols = 8;
+    if (numerator > 0 && denominator > 0) payloadSymbols += ((numerator + denominator - 1) / denominator) * (CR + 4);
+    return (uint64_t)((preamble + 4.25 + payloadSymbols) * symbolUs(regs));
+}
+
+void simRaisePin(SimShared &shared, uint16_t index, uint8_t pin) {
+    SimDevice &device = shared.devices[index];
+    if (pin >= 32 || device.state == SIM_OFF || device.state == SIM_EXITED) return;
+    device.pending |= 1UL << pin;
+    if (device.state == SIM_BLOCKED && (device.wakeMask & (1UL << pin))) device.wakeAtUs = shared.nowUs;
+}
+
+static void raiseIrq(SimShared &shared, uint16_t index, uint8_t flags) {
+    SimRadioState &radio = shared.devices[index].radio;
+    uint8_t dio0 = radio.regs[RH_RF95_REG_40_DIO_MAPPING1] & 0xc0;
+    radio.regs[RH_RF95_REG_12_IRQ_FLAGS] |= flags;
+    if ((dio0 == 0x00 && (flags & RH_RF95_RX_DONE)) || (dio0 == 0x40 && (flags & RH_RF95_TX_DONE)) || (dio0 == 0x80 && (flags & RH_RF95_CAD_DONE))) {
+        simRaisePin(shared, index, shared.devices[index].radioIntPin);
+    }
+}
+
+/**
+ * @brief Locks a receiver on to the strongest frame it can still catch the preamble of
+ */
+static void tryLock(SimShared &shared, uint16_t index) {
+    SimRadioState &radio = shared.devices[index].radio;
+    if (!receiving(radio) || radio.lockedFrame >= 0) return;
+
+    uint64_t now = shared.nowUs;
+    double noise = noiseDbm(bandwidth(radio.regs));
+    double best = -1000.0;
+    for (uint32_t i = 0; i < SIM_MAX_FRAMES && i < shared.frameSeq; i++) {
+        const SimFrame &frame = shared.frames[(shared.frameSeq - 1 - i) % SIM_MAX_FRAMES];
+        if (frame.endUs + 10000000ULL < now) break;		// Newest first - the rest are long gone
+        if (frame.startUs > now || frame.lockByUs < now || frame.aborted || frame.sender == index) continue;
+        if (frame.frf != frequency(radio.regs) || frame.sf != spreadingFactor(radio.regs) || frame.bw != bandwidth(radio.regs)) continue;
+        double signal = receivedDbm(shared, frame, index);
+        if (signal - noise < requiredSnrDb(frame.sf) || signal <= best) continue;
+        best = signal;
+        radio.lockedFrame = frame.seq;
+    }
+    if (radio.lockedFrame >= 0) radio.rxTimeoutUs = 0;	// A single receive carries on to the end of the frame
+}
+
+/**
+ * @brief The radio leaves its mode - counts the time in it and drops what it was doing
+ */
+static void leaveMode(SimShared &shared, uint16_t index) {
+    SimRadioState &radio = shared.devices[index].radio;
+    uint64_t now = shared.nowUs;
+    uint8_t old = mode(radio);
+
+    if (old == RH_RF95_MODE_TX) radio.txUs += now - radio.modeSinceUs;
+    if (old == RH_RF95_MODE_RXCONTINUOUS || old == RH_RF95_MODE_RXSINGLE || old == RH_RF95_MODE_CAD) radio.rxUs += now - radio.modeSinceUs;
+    SimFrame *sending = frameFor(shared, radio.txFrame);
+    if (sending && sending->endUs > now) sending->aborted = true;
+    radio.txFrame = -1;
+    radio.lockedFrame = -1;
+    radio.rxTimeoutUs = 0;
+    radio.cadDoneUs = 0;
+    radio.modeSinceUs = now;
+}
+
+static void startFrame(SimShared &shared, uint16_t index) {
+    SimRadioState &radio = shared.devices[index].radio;
+    uint64_t now = shared.nowUs;
+    uint8_t len = radio.regs[RH_RF95_REG_22_PAYLOAD_LENGTH];
+    uint8_t base = radio.regs[RH_RF95_REG_0E_FIFO_TX_BASE_ADDR];
+
+    uint32_t seq = shared.frameSeq++;
+    SimFrame &frame = shared.frames[seq % SIM_MAX_FRAMES];
+    frame.seq = seq;
+    frame.sender = index;
+    frame.frf = frequency(radio.regs);
+    frame.sf = spreadingFactor(radio.regs);
+    frame.bw = bandwidth(radio.regs);
+    frame.powerDbm = powerDbm(radio.regs);
+    frame.startUs = now;
+    frame.endUs = now + simTimeOnAirUs(radio.regs, len);
+    int preamble = (radio.regs[RH_RF95_REG_20_PREAMBLE_MSB] << 8) | radio.regs[RH_RF95_REG_21_PREAMBLE_LSB];
+    frame.lockByUs = now + (uint64_t)(std::max(0.0, preamble + 4.25 - PREAMBLE_SYMBOLS_TO_LOCK) * symbolUs(radio.regs));
+    frame.aborted = false;
+    frame.len = len;
+    for (uint16_t i = 0; i < len; i++) frame.data[i] = radio.fifo[(uint8_t)(base + i)];
+    radio.txFrame = seq;
+    radio.framesSent++;
+
+    for (uint16_t other = 0; other < simDeviceCount(shared); other++) {
+        if (other != index) tryLock(shared, other);
+    }
+}
+
+/**
+ * @brief A write to RegOpMode - the LoRa bit only changes going into or in sleep, as on the chip
+ */
+static void setOpMode(SimShared &shared, uint16_t index, uint8_t value) {
+    SimRadioState &radio = shared.devices[index].radio;
+    uint8_t old = radio.regs[RH_RF95_REG_01_OP_MODE];
+    uint8_t newMode = value & RH_RF95_MODE;
+
+    if ((old & RH_RF95_MODE) != RH_RF95_MODE_SLEEP && newMode != RH_RF95_MODE_SLEEP) value = (value & ~RH_RF95_LONG_RANGE_MODE) | (old & RH_RF95_LONG_RANGE_MODE);
+    if ((old & RH_RF95_MODE) == newMode && newMode != RH_RF95_MODE_TX) {	// No change - a locked receiver carries on
+        radio.regs[RH_RF95_REG_01_OP_MODE] = value;
+        return;
+    }
+    leaveMode(shared, index);
+    radio.regs[RH_RF95_REG_01_OP_MODE] = value;
+
+    switch (newMode) {
+        case RH_RF95_MODE_TX:
+            startFrame(shared, index);
+            break;
+        case RH_RF95_MODE_RXSINGLE: {
+            uint16_t symbols = ((radio.regs[RH_RF95_REG_1E_MODEM_CONFIG2] & 0x03) << 8) | radio.regs[RH_RF95_REG_1F_SYMB_TIMEOUT_LSB];
+            radio.rxTimeoutUs = shared.nowUs + (uint64_t)(symbols * symbolUs(radio.regs));
+            tryLock(shared, index);
+        } break;
+        case RH_RF95_MODE_RXCONTINUOUS:
+            tryLock(shared, index);
+            break;
+        case RH_RF95_MODE_CAD:
+            radio.cadDoneUs = shared.nowUs + (uint64_t)(CAD_SYMBOLS * symbolUs(radio.regs));
+            break;
+    }
+}
+
+static void writeRegister(SimShared &shared, uint16_t index, uint8_t reg, uint8_t value) {
+    SimRadioState &radio = shared.devices[index].radio;
+
+    switch (reg) {
+        case RH_RF95_REG_00_FIFO:
+            radio.fifo[radio.regs[RH_RF95_REG_0D_FIFO_ADDR_PTR]++] = value;
+            return;
+        case RH_RF95_REG_01_OP_MODE:
+            setOpMode(shared, index, value);
+            return;
+        case RH_RF95_REG_12_IRQ_FLAGS:
+            radio.regs[reg] &= ~value;					// Write a 1 to clear
+            return;
+        case RH_RF95_REG_06_FRF_MSB:
+        case RH_RF95_REG_07_FRF_MID:
+        case RH_RF95_REG_08_FRF_LSB:
+        case RH_RF95_REG_1D_MODEM_CONFIG1:
+        case RH_RF95_REG_26_MODEM_CONFIG3:
+            if (radio.regs[reg] != value) radio.lockedFrame = -1;	// Retuned under a frame - it is lost
+            break;
+        case RH_RF95_REG_1E_MODEM_CONFIG2:
+            if ((radio.regs[reg] ^ value) & 0xf4) radio.lockedFrame = -1;	// The symbol timeout bits can change
+            break;
+        case RH_RF95_REG_42_VERSION:
+        case RH_RF95_REG_13_RX_NB_BYTES:
+        case RH_RF95_REG_19_PKT_SNR_VALUE:
+        case RH_RF95_REG_1A_PKT_RSSI_VALUE:
+            return;										// Read only
+    }
+    radio.regs[reg] = value;
+}
+
+static uint8_t readRegister(SimShared &shared, uint16_t index, uint8_t reg) {
+    SimRadioState &radio = shared.devices[index].radio;
+
+    if (reg == RH_RF95_REG_00_FIFO) return radio.fifo[radio.regs[RH_RF95_REG_0D_FIFO_ADDR_PTR]++];
+    if (reg == RH_RF95_REG_1B_RSSI_VALUE) return (uint8_t)constrain((int)(noiseDbm(bandwidth(radio.regs)) + 157.0), 0, 255);
+    return radio.regs[reg];
+}
+
+void SimRadio::powerUp(SimShared &shared, uint16_t index) {
+    SimRadioState &radio = shared.devices[index].radio;
+    if (mode(radio) != RH_RF95_MODE_SLEEP) leaveMode(shared, index);
+
+    memset(radio.regs, 0, sizeof(radio.regs));
+    radio.regs[RH_RF95_REG_01_OP_MODE] = 0x09;			// FSK, low frequency mode, standby
+    radio.regs[RH_RF95_REG_06_FRF_MSB] = 0x6c;
+    radio.regs[RH_RF95_REG_07_FRF_MID] = 0x80;
+    radio.regs[RH_RF95_REG_09_PA_CONFIG] = 0x4f;
+    radio.regs[RH_RF95_REG_0E_FIFO_TX_BASE_ADDR] = 0x80;
+    radio.regs[RH_RF95_REG_1D_MODEM_CONFIG1] = 0x72;
+    radio.regs[RH_RF95_REG_1E_MODEM_CONFIG2] = 0x70;
+    radio.regs[RH_RF95_REG_1F_SYMB_TIMEOUT_LSB] = 0x64;
+    radio.regs[RH_RF95_REG_21_PREAMBLE_LSB] = 0x08;
+    radio.regs[RH_RF95_REG_22_PAYLOAD_LENGTH] = 0x01;
+    radio.regs[RH_RF95_REG_26_MODEM_CONFIG3] = 0x04;
+    radio.regs[RH_RF95_REG_42_VERSION] = 0x12;
+    radio.regs[RH_RF95_REG_4D_PA_DAC] = 0x84;
+    radio.spiFirst = true;
+    radio.modeSinceUs = shared.nowUs;
+    radio.txFrame = -1;
+    radio.lockedFrame = -1;
+    radio.rxTimeoutUs = 0;
+    radio.cadDoneUs = 0;
+}
+
+void SimRadio::select() {
+    shared.devices[index].radio.spiFirst = true;
+}
+
+uint8_t SimRadio::transfer(uint8_t data) {
+    SimRadioState &radio = shared.devices[index].radio;
+
+    if (radio.spiFirst) {
+        radio.spiFirst = false;
+        radio.spiAddress = data;
+        return 0;
+    }
+    uint8_t reg = radio.spiAddress & 0x7f;
+    uint8_t value = 0;
+    if (radio.spiAddress & 0x80) writeRegister(shared, index, reg, data);
+    else value = readRegister(shared, index, reg);
+    if (reg != RH_RF95_REG_00_FIFO) radio.spiAddress = (radio.spiAddress & 0x80) | ((reg + 1) & 0x7f);	// Bursts move on, except in the FIFO
+    return value;
+}
+
+// ************************************************************************
+// *****                       Channel events                         *****
+// ************************************************************************
+uint64_t simRadioNextEventUs(SimShared &shared) {
+    uint64_t next = UINT64_MAX;
+
+    for (uint16_t index = 0; index < simDeviceCount(shared); index++) {
+        SimRadioState &radio = shared.devices[index].radio;
+        SimFrame *frame = frameFor(shared, radio.txFrame);
+        if (frame) next = std::min(next, frame->endUs);
+        frame = frameFor(shared, radio.lockedFrame);
+        if (frame) next = std::min(next, frame->endUs);
+        if (radio.rxTimeoutUs) next = std::min(next, radio.rxTimeoutUs);
+        if (radio.cadDoneUs) next = std::min(next, radio.cadDoneUs);
+    }
+    return next;
+}
+
+/**
+ * @brief Whether a frame got through to a receiver, and the SNR it would report
+ */
+static bool received(SimShared &shared, const SimFrame &frame, uint16_t receiver, double &signal, double &snr) {
+    double noise = noiseDbm(frame.bw);
+    double interferenceMw = 0.0;
+
+    signal = receivedDbm(shared, frame, receiver);
+    for (uint32_t i = 0; i < SIM_MAX_FRAMES && i < shared.frameSeq; i++) {
+        const SimFrame &other = shared.frames[(shared.frameSeq - 1 - i) % SIM_MAX_FRAMES];
+        if (other.endUs + 10000000ULL < frame.startUs) break;
+        if (other.seq == frame.seq || other.sender == receiver || other.frf != frame.frf) continue;
+        if (other.startUs >= frame.endUs || other.endUs <= frame.startUs) continue;
+        double power = receivedDbm(shared, other, receiver) - ((other.sf == frame.sf) ? 0.0 : SF_ISOLATION_DB);
+        interferenceMw += pow(10.0, power / 10.0);
+    }
+    snr = signal - 10.0 * log10(pow(10.0, noise / 10.0) + interferenceMw);
+    if (frame.aborted || signal - noise < requiredSnrDb(frame.sf)) return false;
+    return interferenceMw == 0.0 || signal - 10.0 * log10(interferenceMw) >= CAPTURE_DB;
+}
+
+/**
+ * @brief Puts a frame in the receiver's FIFO and the packet registers, as the chip does at RxDone
+ */
+static void deliver(SimShared &shared, uint16_t index, const SimFrame &frame) {
+    SimRadioState &radio = shared.devices[index].radio;
+    double signal, snr;
+    bool ok = received(shared, frame, index, signal, snr);
+
+    uint8_t base = radio.regs[RH_RF95_REG_0F_FIFO_RX_BASE_ADDR];
+    for (uint16_t i = 0; i < frame.len; i++) radio.fifo[(uint8_t)(base + i)] = frame.data[i];
+    if (!ok) radio.fifo[base] ^= 0x5a;					// What comes out of a failed CRC is rubbish
+    radio.regs[RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] = base;
+    radio.regs[RH_RF95_REG_13_RX_NB_BYTES] = frame.len;
+    radio.regs[RH_RF95_REG_1C_HOP_CHANNEL] = RH_RF95_RX_PAYLOAD_CRC_IS_ON;
+
+    // RH_RF95 reads back SNR = reg / 4 and RSSI = reg + SNR - 157 below 0dB SNR, reg * 16 / 15 - 157 above
+    int8_t snrReg = (int8_t)constrain((int)lround(snr * 4.0), -128, 127);
+    radio.regs[RH_RF95_REG_19_PKT_SNR_VALUE] = (uint8_t)snrReg;
+    int snrDb = snrReg / 4;
+    double rssiReg = (snrDb < 0) ? signal + 157.0 - snrDb : (signal + 157.0) * 15.0 / 16.0;
+    radio.regs[RH_RF95_REG_1A_PKT_RSSI_VALUE] = (uint8_t)constrain((int)lround(rssiReg), 0, 255);
+
+    if (ok) radio.framesReceived++;
+    else {
+        radio.framesLost++;
+        shared.collisions++;
+    }
+    raiseIrq(shared, index, RH_RF95_RX_DONE | RH_RF95_VALID_HEADER | ((ok) ? 0 : RH_RF95_PAYLOAD_CRC_ERROR));
+}
+
+static void toStandby(SimShared &shared, uint16_t index) {
+    SimRadioState &radio = shared.devices[index].radio;
+    leaveMode(shared, index);
+    radio.regs[RH_RF95_REG_01_OP_MODE] = (radio.regs[RH_RF95_REG_01_OP_MODE] & ~RH_RF95_MODE) | RH_RF95_MODE_STDBY;
+}
+
+void simRadioEvents(SimShared &shared) {
+    uint64_t now = shared.nowUs;
+
+    // Transmitters first, so a frame's end is seen the same way by everyone
+    for (uint16_t index = 0; index < simDeviceCount(shared); index++) {
+        SimRadioState &radio = shared.devices[index].radio;
+        SimFrame *frame = frameFor(shared, radio.txFrame);
+        if (frame && frame->endUs <= now) {
+            toStandby(shared, index);
+            raiseIrq(shared, index, RH_RF95_TX_DONE);
+        }
+    }
+
+    for (uint16_t index = 0; index < simDeviceCount(shared); index++) {
+        SimRadioState &radio = shared.devices[index].radio;
+
+        if (radio.lockedFrame >= 0) {
+            SimFrame *frame = frameFor(shared, radio.lockedFrame);
+            if (!frame) radio.lockedFrame = -1;
+            else if (frame->endUs <= now) {
+                radio.lockedFrame = -1;
+                bool single = mode(radio) == RH_RF95_MODE_RXSINGLE;
+                deliver(shared, index, *frame);
+                if (single) toStandby(shared, index);
+                else tryLock(shared, index);			// Back to looking for a preamble
+            }
+        }
+        if (radio.rxTimeoutUs && radio.rxTimeoutUs <= now && radio.lockedFrame < 0) {
+            toStandby(shared, index);
+            raiseIrq(shared, index, RH_RF95_RX_TIMEOUT);	// On DIO1 - RH_RF95 polls for it
+        }
+        if (radio.cadDoneUs && radio.cadDoneUs <= now) {
+            bool detected = false;
+            for (uint32_t i = 0; i < SIM_MAX_FRAMES && i < shared.frameSeq; i++) {
+                const SimFrame &frame = shared.frames[(shared.frameSeq - 1 - i) % SIM_MAX_FRAMES];
+                if (frame.endUs + 10000000ULL < now) break;
+                if (frame.startUs > now || frame.endUs < now || frame.sender == index) continue;
+                if (frame.frf != frequency(radio.regs) || frame.sf != spreadingFactor(radio.regs)) continue;
+                if (receivedDbm(shared, frame, index) - noiseDbm(frame.bw) >= requiredSnrDb(frame.sf)) detected = true;
+            }
+            toStandby(shared, index);
+            raiseIrq(shared, index, RH_RF95_CAD_DONE | ((detected) ? RH_RF95_CAD_DETECTED : 0));
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * @file   SimRadio.h - the RFM95 radios and the channel between them
+ * @brief  An SX1276 at the register level RH_RF95 uses, on a shared channel with path loss, air time and collisions
+ *
+ * @details Each device's radio is a SimRadio on its SPI bus, working on the SimRadioState in shared memory. Register
+ * writes take effect at once on the virtual clock: going into transmit puts a frame on the air, going into receive
+ * looks for a preamble to lock on to. What happens later - the end of a frame, a receive timeout, the end of channel
+ * activity detection - is left for the coordinator, which calls simRadioEvents() as the clock reaches it.
+ *
+ * The channel
+ *  - Path loss is log distance with a fixed shadowing term on each link, in SimShared::pathLossDb
+ *  - A receiver locks on to a frame with its frequency, spreading factor and bandwidth whose SNR is above what the
+ *    spreading factor can demodulate, if it is listening before the preamble is over. It stays on that frame
+ *  - The frame is received if, over its whole length, it is 6dB above everything else on the frequency - frames at
+ *    other spreading factors count 16dB down. Otherwise the receiver gets a CRC error
+ *  - Any change of mode or modem setting while locked loses the frame
+ */
+#ifndef __SIM_RADIO_H
+#define __SIM_RADIO_H
+
+#include "SimShared.h"
+
+class SimRadio : public HostSPIDevice {
+public:
+    SimRadio(SimShared &shared, uint16_t index) : shared(shared), index(index) {}
+
+    /**
+     * @brief Power on reset - the registers go back to their defaults and anything in progress is lost
+     */
+    static void powerUp(SimShared &shared, uint16_t index);
+
+    void select() override;
+    uint8_t transfer(uint8_t data) override;
+
+private:
+    SimShared &shared;
+    uint16_t index;
+};
+
+/**
+ * @brief Time on air of a frame sent with these registers - the SX1276 datasheet's formula
+ */
+uint64_t simTimeOnAirUs(const uint8_t *regs, uint8_t payloadLen);
+
+/**
+ * @brief When the next thing the radios are waiting for happens - UINT64_MAX if nothing is
+ */
+uint64_t simRadioNextEventUs(SimShared &shared);
+
+/**
+ * @brief Ends the frames, timeouts and CAD due by the clock, raising the DIO0 interrupts they map to
+ */
+void simRadioEvents(SimShared &shared);
+
+/**
+ * @brief Raises an interrupt on a device's pin, waking it if it is waiting on that pin
+ */
+void simRaisePin(SimShared &shared, uint16_t index, uint8_t pin);
+
+#endif /* __SIM_RADIO_H */
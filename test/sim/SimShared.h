@@ -0,0 +1,171 @@
+/**
+ * @file   SimShared.h - what the network simulator's processes share
+ * @brief  The devices, the radio channel and the virtual clock, in one block of shared memory
+ *
+ * @details NetworkSim forks a process for the Gateway and for each node - sim_gateway and sim_node, each the firmware
+ * linked against the host runtime in test/host - and maps this block into all of them. Only one process runs at a time:
+ * a device runs until its firmware waits, then hands back to the coordinator, which moves the clock on to the next
+ * thing that happens and runs whichever devices are due. So nothing here is locked, and everything is plain data.
+ */
+#ifndef __SIM_SHARED_H
+#define __SIM_SHARED_H
+
+#include <semaphore.h>
+#include <stdint.h>
+#include "HostChips.h"
+
+const uint16_t SIM_MAX_DEVICES = 256;                  // The Gateway is device 0
+const uint16_t SIM_MAX_FRAMES = 1024;                  // Frames kept for working out interference - a ring
+const uint8_t SIM_STATES = 10;                         // States in the node's main loop
+const uint16_t SIM_MAX_PERIODS = 4096;                 // Reporting periods tracked for the delivery ratio
+
+/**
+ * @brief The scenario - set by NetworkSim from its command line
+ */
+struct SimConfig {
+    uint16_t nodes;                                     // Not counting the Gateway
+    uint32_t seed;
+    uint64_t durationUs;                                // Virtual time to run for
+    uint64_t epochSeconds;                              // The Gateway's Time.now() at virtual time 0
+    uint16_t frequencyMinutes;                          // Reporting period the Gateway gives out
+    double areaMeters;                                  // Nodes are scattered over a square this wide, the Gateway in the middle
+    double pathLossExponent;                            // Log distance path loss - 2 in free space, 3 or more through trees
+    double shadowingDb;                                 // Standard deviation of the fixed shadowing on each link
+    double pulsesPerHour;                               // Sensor interrupts at each node - Poisson
+    double clockPpm;                                    // The nodes' processor clocks are off by up to this much either way
+    double rtcPpm;                                      // And their RTC crystals
+    uint64_t bootSpreadUs;                              // Nodes are switched on at random over this long
+    uint64_t rebootUs;                                  // From System.reset() to setup()
+    uint32_t loopUs;                                    // Time each pass of the main loop takes
+    uint32_t yieldUs;                                   // Time each YIELD in RadioHead's wait loops lets pass
+    bool logging;                                       // Each device logs to logDir/<index>.log
+    char logDir[256];
+};
+
+/**
+ * @brief A LoRa frame on the air
+ */
+struct SimFrame {
+    uint32_t seq;                                       // Frames sent so far when this one started - its place in the ring
+    uint16_t sender;
+    uint32_t frf;                                       // Frequency registers
+    uint8_t sf;
+    uint8_t bw;                                         // Bandwidth register value
+    double powerDbm;
+    uint64_t startUs;
+    uint64_t lockByUs;                                  // A receiver that starts listening after this has missed the preamble
+    uint64_t endUs;
+    bool aborted;                                       // The sender left transmit before the end
+    uint8_t len;
+    uint8_t data[256];
+};
+
+/**
+ * @brief The SX1276 behind an RFM95 - registers, FIFO and what it is doing
+ */
+struct SimRadioState {
+    uint8_t regs[128];
+    uint8_t fifo[256];
+    uint8_t spiAddress;                                 // Register the SPI transaction is on - bit 7 set for a write
+    bool spiFirst;                                      // The next byte is the address
+    uint64_t modeSinceUs;                               // When the radio went into its mode - for the time in each
+    int64_t txFrame;                                    // seq of the frame being sent, -1 for none
+    int64_t lockedFrame;                                // seq of the frame being received, -1 for none
+    uint64_t rxTimeoutUs;                               // Single receive gives up here with nothing locked - 0 for never
+    uint64_t cadDoneUs;                                 // Channel activity detection finishes - 0 for none
+    uint64_t txUs;                                      // True time transmitting
+    uint64_t rxUs;                                      // And receiving, including CAD
+    uint32_t framesSent;
+    uint32_t framesReceived;                            // Handed to the processor with a good CRC
+    uint32_t framesLost;                                // Locked on but lost to interference
+};
+
+/**
+ * @brief The node's own figures, copied out as it exits - see SimNode.cpp
+ */
+struct SimNodeReport {
+    bool valid;
+    uint32_t stateMs[SIM_STATES];                       // From the state machine, as EnergyMonitor keeps them
+    uint32_t sleepMs;
+    uint32_t radioTxMs;                                 // As RH_RF95 measured them
+    uint32_t radioRxMs;
+    uint32_t framTransactions;
+    uint32_t sensorWakes;
+    uint32_t chargeUah;
+    uint8_t nodeNumber;
+    uint16_t slotIndex;
+    uint16_t slotCount;
+    uint8_t backlogged[SIM_MAX_PERIODS / 8];            // A bit for each period with a report still in the node's backlog
+};
+
+enum SimDeviceState : uint8_t {
+    SIM_OFF,                                            // Not running - powerOnUs says when it starts again
+    SIM_READY,                                          // Forked, waiting to be run for the first time
+    SIM_RUNNING,
+    SIM_BLOCKED,                                        // Waiting until wakeAtUs or a pin in wakeMask
+    SIM_EXITED
+};
+
+enum SimDeviceKind : uint8_t { SIM_GATEWAY, SIM_NODE };
+
+struct SimDevice {
+    sem_t run;                                          // Posted by the coordinator to let the device run
+    int32_t pid;
+    SimDeviceKind kind;
+    SimDeviceState state;
+    uint64_t wakeAtUs;
+    uint32_t wakeMask;
+    uint32_t pending;                                   // Pin interrupts raised and not yet taken
+    uint64_t powerOnUs;
+    uint64_t bootUs;                                    // When the running process started - its micros() count from here
+    bool asleep;
+    uint64_t asleepSinceUs;
+    uint64_t asleepUs;                                  // True time in System.sleep()
+    double x, y;
+    double clockPpm;
+    char deviceId[25];
+    uint64_t seed;
+    uint32_t boots;
+    uint32_t resets;                                    // System.reset()
+    uint32_t powerDowns;                                // Power cut by the AB1805
+    uint8_t radioIntPin;                                // Set by the firmware's process - RFM95_INT
+    uint8_t sensorPin;                                  // INT_PIN
+    double pulsesPerUs;
+    uint64_t nextPulseUs;
+    uint32_t pulses;
+    FramChip::State fram;
+    RtcChip::State rtc;
+    SimRadioState radio;
+    SimNodeReport report;
+    // Kept by the Gateway
+    uint8_t nodeNumber;                                 // What the Gateway gave it - 0 if it has not joined
+    uint64_t joinedUs;                                  // First join acknowledgement
+    uint32_t joins;
+    uint32_t reportsReceived;                           // Data reports the Gateway decoded, live or stored
+    uint8_t delivered[SIM_MAX_PERIODS / 8];             // A bit for each period the Gateway has a report for
+};
+
+struct SimShared {
+    SimConfig config;
+    uint64_t nowUs;                                     // The virtual clock
+    sem_t coordinator;                                  // Posted by a device when it stops running
+    bool finishing;                                     // Devices copy out their reports and exit when next run
+    uint32_t frameSeq;                                  // Frames sent so far
+    SimFrame frames[SIM_MAX_FRAMES];
+    float pathLossDb[SIM_MAX_DEVICES][SIM_MAX_DEVICES];
+    uint32_t collisions;                                // Frames lost at a receiver that had locked on to them
+    SimDevice devices[SIM_MAX_DEVICES];
+};
+
+/**
+ * @brief Devices in the scenario - the Gateway and the nodes
+ */
+inline uint16_t simDeviceCount(const SimShared &shared) { return shared.config.nodes + 1; }
+
+/**
+ * @brief The block this process shares - mapped from the descriptor in SIM_SHARED_FD by a device process
+ */
+SimShared &simShared();
+void simAttach(SimShared *shared);
+
+#endif /* __SIM_SHARED_H */
@@ -0,0 +1,154 @@
+/**
+ * @file   AdrTest.cpp - adaptive data rate in LoRA_ADR
+ * @brief  The rolling link window, where recommend() moves a link and when it sends it back to the default
+ */
+#include "HostTest.h"
+#include "LoRA_ADR.h"
+
+static void testWindow() {
+    LinkStats link;
+    CHECK_EQUAL(0, link.samples());
+    CHECK_EQUAL(0, link.successPercent());
+    CHECK_EQUAL(0, link.averageRssi());
+
+    link.record(true, -90, 5);
+    link.record(false);
+    link.record(true, -100, -3);
+    link.record(false, -20, 30);						// A failure's RSSI and SNR mean nothing
+    CHECK_EQUAL(4, link.samples());
+    CHECK_EQUAL(50, link.successPercent());
+    CHECK_EQUAL(5, link.maxSnr());
+    CHECK_EQUAL(-95, link.averageRssi());
+    CHECK_EQUAL(1, link.consecutiveFailures());
+
+    for (uint8_t i = 0; i < LinkStats::WINDOW; i++) link.record(true, -60, 2);	// The old samples roll out
+    CHECK_EQUAL(LinkStats::WINDOW, link.samples());
+    CHECK_EQUAL(100, link.successPercent());
+    CHECK_EQUAL(2, link.maxSnr());
+    CHECK_EQUAL(-60, link.averageRssi());
+    CHECK_EQUAL(0, link.consecutiveFailures());
+
+    link.record(false);
+    link.record(false);
+    CHECK_EQUAL(2, link.consecutiveFailures());
+    CHECK_EQUAL(75, link.successPercent());
+    link.reset();
+    CHECK_EQUAL(0, link.samples());
+    CHECK_EQUAL(0, link.consecutiveFailures());
+}
+
+static void fill(LinkStats &link, uint8_t samples, int16_t snr) {
+    link.reset();
+    for (uint8_t i = 0; i < samples; i++) link.record(true, -80, snr);
+}
+
+static void testNeedsHistory() {
+    LinkStats link;
+    fill(link, LoRA_ADR::MIN_SAMPLES - 1, 20);
+    uint8_t dataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+    int8_t txPower = LoRA_ADR::MAX_TX_POWER;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::DEFAULT_DATA_RATE, dataRate);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+}
+
+static void testSpendsMarginOnDataRateFirst() {
+    LinkStats link;
+    fill(link, LinkStats::WINDOW, 10);					// 10dB at SF11 - 27.5dB over what it needs, 17.5dB after the margin
+    uint8_t dataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+    int8_t txPower = LoRA_ADR::MAX_TX_POWER;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::MAX_DATA_RATE, dataRate);		// 10dB on 4 data rate steps
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER - 2 * 3, txPower);	// And 6dB on 2 power steps, with 1.5dB over
+
+    fill(link, LinkStats::WINDOW, -4);					// 3.5dB over at SF11 after the margin - 1 step
+    dataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+    txPower = LoRA_ADR::MAX_TX_POWER;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(1, dataRate);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+}
+
+static void testShortOfMarginRaisesPowerThenDataRateComesDown() {
+    LinkStats link;
+    fill(link, LinkStats::WINDOW, -3);					// At SF7 that is 5.5dB short - a power step and a data rate step
+    uint8_t dataRate = LoRA_ADR::MAX_DATA_RATE;
+    int8_t txPower = LoRA_ADR::MAX_TX_POWER - 3;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+    CHECK_EQUAL(LoRA_ADR::MAX_DATA_RATE - 1, dataRate);
+}
+
+/**
+ * @brief A link whose SNR is its power less a fixed path loss, whatever the data rate - the recommendation settles
+ * in a few reports, keeps the installation margin and leaves no whole step unspent
+ */
+static void testSettles() {
+    for (int16_t pathLoss = 0; pathLoss <= 40; pathLoss++) {
+        LinkStats link;
+        uint8_t dataRate = LoRA_ADR::DEFAULT_DATA_RATE;
+        int8_t txPower = LoRA_ADR::MAX_TX_POWER;
+        uint8_t changes = 0;
+        for (uint8_t report = 0; report < 20; report++) {
+            fill(link, LinkStats::WINDOW, txPower - pathLoss);
+            uint8_t oldRate = dataRate;
+            int8_t oldPower = txPower;
+            LoRA_ADR::recommend(link, dataRate, txPower);
+            if (dataRate != oldRate || txPower != oldPower) changes++;
+        }
+        CHECK(changes <= 2);							// Up once and maybe back a step - no oscillation
+
+        int16_t marginTenths = (txPower - pathLoss) * 10 - LoRA_ADR::requiredSnrTenths(dataRate);
+        if (dataRate != LoRA_ADR::DEFAULT_DATA_RATE || txPower != LoRA_ADR::MAX_TX_POWER) {
+            CHECK(marginTenths >= LoRA_ADR::INSTALLATION_MARGIN_TENTHS);
+        }
+        bool spare = marginTenths - LoRA_ADR::INSTALLATION_MARGIN_TENTHS >= 30;		// Room for another step
+        CHECK(!spare || (dataRate == LoRA_ADR::MAX_DATA_RATE && txPower - 3 < LoRA_ADR::MIN_TX_POWER));
+    }
+}
+
+static void testFallsBack() {
+    LinkStats link;
+    fill(link, LinkStats::WINDOW, 10);
+    for (uint8_t i = 0; i < LoRA_ADR::FALLBACK_FAILURES - 1; i++) link.record(false);
+    uint8_t dataRate = 3;
+    int8_t txPower = 8;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK(dataRate != LoRA_ADR::DEFAULT_DATA_RATE);		// Not yet
+    link.record(false);
+    dataRate = 3;
+    txPower = 8;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::DEFAULT_DATA_RATE, dataRate);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+
+    link.reset();										// Losing too many, but never enough in a row
+    for (uint8_t i = 0; i < LinkStats::WINDOW; i++) link.record(i % 2, -80, 10);
+    dataRate = 3;
+    txPower = 8;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::DEFAULT_DATA_RATE, dataRate);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+}
+
+static void testOutOfRange() {
+    LinkStats link;
+    uint8_t dataRate = 9;
+    int8_t txPower = 30;
+    LoRA_ADR::recommend(link, dataRate, txPower);
+    CHECK_EQUAL(LoRA_ADR::DEFAULT_DATA_RATE, dataRate);
+    CHECK_EQUAL(LoRA_ADR::MAX_TX_POWER, txPower);
+    CHECK_EQUAL(11, LoRA_ADR::spreadingFactor(9));
+    CHECK_EQUAL(7, LoRA_ADR::spreadingFactor(LoRA_ADR::MAX_DATA_RATE));
+}
+
+int main() {
+    testWindow();
+    testNeedsHistory();
+    testSpendsMarginOnDataRateFirst();
+    testShortOfMarginRaisesPowerThenDataRateComesDown();
+    testSettles();
+    testFallsBack();
+    testOutOfRange();
+    return hostTestResult("adr_test");
+}
@@ -0,0 +1,234 @@
+/**
+ * @file   AuthenticatedDriverTest.cpp - RHAuthenticatedDriver over a LoopbackDriver
+ * @brief  Round trips, altered, forged and replayed frames, the sender id in the nonce and frame counter reservation
+ */
+#include "HostTest.h"
+#include "LoopbackDriver.h"
+#include <RHAuthenticatedDriver.h>
+#include <Ascon128.h>
+
+static const uint8_t KEY[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+
+/**
+ * @brief A device on the channel - its own radio, cipher and authenticated layer
+ */
+struct Device {
+    LoopbackDriver radio;
+    Ascon128 cipher;
+    RHAuthenticatedDriver link;
+
+    Device(LoopbackChannel &channel, uint8_t address, uint32_t senderId, const uint8_t *key = KEY) : radio(channel), link(radio, cipher) {
+        cipher.setKey(key, 16);
+        link.init();
+        link.setThisAddress(address);
+        link.setHeaderFrom(address);
+        link.setSenderId(senderId);
+    }
+
+    bool send(uint8_t to, const char *text) {
+        link.setHeaderTo(to);
+        return link.send((const uint8_t *)text, strlen(text));
+    }
+
+    /**
+     * @brief The next message, as text - empty if there was none or it was dropped
+     */
+    std::string receive() {
+        uint8_t buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+        uint8_t len = sizeof(buf);
+        if (!link.available() || !link.recv(buf, &len)) return "";
+        return std::string((const char *)buf, len);
+    }
+};
+
+/**
+ * @brief Puts a frame captured from the channel on the air again, as anyone with a radio could
+ */
+static void resend(LoopbackDriver &radio, const LoopbackChannel::Frame &frame) {
+    radio.setHeaderTo(frame.to);
+    radio.setHeaderFrom(frame.from);
+    radio.setHeaderId(frame.id);
+    radio.setHeaderFlags(frame.flags, 0xff);
+    radio.send(frame.data.data(), frame.data.size());
+}
+
+static void testRoundTrip() {
+    LoopbackChannel channel;
+    Device node(channel, 1, 0x11111111);
+    Device gateway(channel, 0, 0x22222222);
+
+    CHECK_EQUAL(RH_LOOPBACK_MAX_MESSAGE_LEN - 11, node.link.maxMessageLength());
+    CHECK(node.send(0, "hello gateway"));
+    CHECK_EQUAL(strlen("hello gateway") + RH_AUTHENTICATED_OVERHEAD, channel.sent.back().data.size());
+    CHECK(memcmp(channel.sent.back().data.data() + 7, "hello", 5) != 0);	// Not in the clear
+    CHECK(gateway.receive() == "hello gateway");
+    CHECK_EQUAL(0x11111111, gateway.link.lastSenderId());
+    CHECK_EQUAL(1, gateway.link.headerFrom());
+
+    CHECK(gateway.send(1, ""));								// An empty message still carries its tag
+    CHECK(node.receive() == "");
+    CHECK_EQUAL(1, node.link.rxGood());
+    CHECK_EQUAL(0, node.link.rxBad());
+
+    std::string longest(node.link.maxMessageLength(), 'x');
+    CHECK(node.send(0, longest.c_str()));
+    CHECK(gateway.receive() == longest);
+    longest += "x";
+    CHECK(!node.send(0, longest.c_str()));
+}
+
+/**
+ * @brief Changes each byte of a frame, and each header, in turn - every one is dropped
+ */
+static void testAlteredFramesDropped() {
+    LoopbackChannel channel;
+    Device node(channel, 1, 0x11111111);
+    Device gateway(channel, 0, 0x22222222);
+    LoopbackDriver attacker(channel);
+    attacker.init();
+
+    node.send(0, "count 42");
+    LoopbackChannel::Frame original = channel.sent.back();
+    gateway.receive();
+    uint16_t dropped = 0;
+    for (size_t i = 0; i < original.data.size() + 3; i++) {
+        LoopbackChannel::Frame altered = original;
+        if (i < original.data.size()) altered.data[i] ^= 0x01;
+        else if (i == original.data.size()) altered.from = 7;	// Another address - it is in the nonce and the tag
+        else if (i == original.data.size() + 1) altered.id++;
+        else altered.flags ^= 0x01;
+        if (i < 3) altered.data[2] = original.data[2] + 1;	// Keep the counter ahead so the tag is what catches it
+        resend(attacker, altered);
+        if (CHECK(gateway.receive() == "")) dropped++;
+    }
+    CHECK_EQUAL(original.data.size() + 3, dropped);
+    CHECK_EQUAL(dropped, gateway.link.rxBad());
+
+    Device outsider(channel, 1, 0x11111111, (const uint8_t *)"not the link key");
+    outsider.link.setFrameCounter(1000);
+    outsider.send(0, "count 43");
+    CHECK(gateway.receive() == "");
+
+    uint8_t shortFrame[RH_AUTHENTICATED_OVERHEAD - 1] = {};
+    attacker.setHeaderTo(0);
+    attacker.send(shortFrame, sizeof(shortFrame));
+    CHECK(gateway.receive() == "");
+
+    node.send(0, "count 44");								// None of that got in the node's way
+    CHECK(gateway.receive() == "count 44");
+}
+
+static void testReplaysDropped() {
+    LoopbackChannel channel;
+    Device node(channel, 1, 0x11111111);
+    Device gateway(channel, 0, 0x22222222);
+    LoopbackDriver attacker(channel);
+    attacker.init();
+
+    node.send(0, "first");
+    LoopbackChannel::Frame first = channel.sent.back();
+    node.send(0, "second");
+    LoopbackChannel::Frame second = channel.sent.back();
+    CHECK(gateway.receive() == "first");
+    CHECK(gateway.receive() == "second");
+
+    resend(attacker, second);
+    CHECK(gateway.receive() == "");
+    resend(attacker, first);								// Older still
+    CHECK(gateway.receive() == "");
+    CHECK_EQUAL(2, gateway.link.rxReplayed());
+
+    node.send(0, "third");
+    CHECK(gateway.receive() == "third");
+
+    gateway.link.clearReplayTable();						// As after the Gateway restarts
+    resend(attacker, first);
+    CHECK(gateway.receive() == "first");
+}
+
+/**
+ * @brief A node number passes to another device, which starts its counter again - its sender id keeps it apart
+ */
+static void testNewOwnerOfAnAddress() {
+    LoopbackChannel channel;
+    Device gateway(channel, 0, 0x22222222);
+    Device oldOwner(channel, 5, 0xaaaaaaaa);
+    oldOwner.link.setFrameCounter(5000);
+    oldOwner.send(0, "old owner");
+    CHECK(gateway.receive() == "old owner");
+
+    Device newOwner(channel, 5, 0xbbbbbbbb);
+    CHECK_EQUAL(1, newOwner.link.frameCounter());
+    newOwner.send(0, "new owner");
+    CHECK(gateway.receive() == "new owner");
+    CHECK_EQUAL(0xbbbbbbbb, gateway.link.lastSenderId());
+
+    oldOwner.send(0, "still here");							// Both at once - each with its own counter
+    CHECK(gateway.receive() == "still here");
+    newOwner.send(0, "me too");
+    CHECK(gateway.receive() == "me too");
+    CHECK_EQUAL(0, gateway.link.rxBad());
+}
+
+/**
+ * @brief Two devices sending the same message from the same address under the same counter - the sender id keeps the
+ * nonces apart, so the key streams differ
+ */
+static void testSenderIdInTheNonce() {
+    LoopbackChannel channel;
+    Device one(channel, 9, 0x01020304);
+    Device two(channel, 9, 0x01020305);
+    one.send(0, "identical message");
+    LoopbackChannel::Frame a = channel.sent.back();
+    two.send(0, "identical message");
+    LoopbackChannel::Frame b = channel.sent.back();
+    CHECK(memcmp(a.data.data(), b.data.data(), 3) == 0);	// Same counter
+    CHECK(memcmp(a.data.data() + 7, b.data.data() + 7, a.data.size() - 7) != 0);
+
+    size_t same = 0;
+    for (size_t i = 7; i < a.data.size() - RH_AUTHENTICATED_TAG_LEN; i++) if (a.data[i] == b.data[i]) same++;
+    CHECK(same < 4);
+}
+
+static uint32_t reserved = 0;
+static uint16_t reservations = 0;
+
+static void counterReserved(uint32_t reservedTo) {
+    reserved = reservedTo;
+    reservations++;
+}
+
+static void testCounterReservation() {
+    LoopbackChannel channel;
+    Device gateway(channel, 0, 0x22222222);
+    {
+        Device node(channel, 1, 0x11111111);
+        node.link.setReserveHandler(counterReserved);
+        for (uint16_t i = 0; i < 100; i++) node.send(0, "x");
+        CHECK_EQUAL(2, reservations);						// Once a block
+        CHECK_EQUAL(1 + 2 * RH_AUTHENTICATED_COUNTER_BLOCK, reserved);
+        while (gateway.link.available()) gateway.receive();
+    }
+
+    Device rebooted(channel, 1, 0x11111111);				// Starts from what was stored - nothing sent before is reused
+    rebooted.link.setReserveHandler(counterReserved);
+    rebooted.link.setFrameCounter(reserved);
+    rebooted.send(0, "after reboot");
+    CHECK(gateway.receive() == "after reboot");
+    CHECK_EQUAL(3, reservations);
+    CHECK_EQUAL(0, gateway.link.rxBad());
+
+    rebooted.link.setFrameCounter(RH_AUTHENTICATED_MAX_COUNTER);
+    CHECK(rebooted.send(0, "last"));
+    CHECK(!rebooted.send(0, "one too many"));				// Never wraps back to a counter already used
+}
+
+int main() {
+    testRoundTrip();
+    testAlteredFramesDropped();
+    testReplaysDropped();
+    testNewOwnerOfAnAddress();
+    testSenderIdInTheNonce();
+    testCounterReservation();
+    return hostTestResult("authenticated_driver_test");
+}
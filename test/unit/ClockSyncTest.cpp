@@ -0,0 +1,285 @@
+/**
+ * @file   ClockSyncTest.cpp - time sync to the millisecond
+ * @brief  ClockSync carrying the Gateway's time and learning our drift, the radio's time stamp and air time, and the
+ * AB1805 set to the hundredth and calibrated
+ */
+#include "HostTest.h"
+#include "ClockSync.h"
+#include <AB1805_RK.h>
+#include <RH_RF95.h>
+#include "device_pinout.h"
+#include <math.h>
+
+// ************************************************************************
+// *****                       ClockSync                              *****
+// ************************************************************************
+
+// A node's clock against true time - off by ppm and started at some arbitrary count
+static uint64_t trueMs = 0;
+static double localPpm = 0.0;
+static uint32_t localStart = 0;
+
+static uint32_t localClock() {
+    return localStart + (uint32_t)(uint64_t)llround(trueMs * (1.0 + localPpm / 1e6));
+}
+
+const uint64_t EPOCH_MS = 1767225600000ULL;					// 2026-01-01
+
+static void testCarriesTimeForward() {
+    trueMs = 0;
+    localPpm = 0.0;
+    localStart = 123456;
+    ClockSync clock(localClock);
+    CHECK(!clock.synced());
+    CHECK_EQUAL(0, clock.now());
+    CHECK_EQUAL(0, clock.sync(EPOCH_MS + 250));				// Nothing to be out against yet
+    CHECK(clock.synced());
+
+    trueMs += 61789;
+    CHECK_EQUAL(EPOCH_MS + 250 + 61789, clock.now());		// To the millisecond, not the second
+    CHECK_EQUAL(61789, clock.sinceSyncMs());
+
+    CHECK_EQUAL(40, clock.sync(EPOCH_MS + 250 + 61789 - 40));	// We were 40 ms ahead
+    CHECK_EQUAL(EPOCH_MS + 250 + 61789 - 40, clock.now());
+
+    clock.reset();
+    CHECK(!clock.synced());
+    CHECK_EQUAL(0, clock.now());
+}
+
+/**
+ * @brief Our clock wraps between syncs - the time carries on across it
+ */
+static void testMillisWrap() {
+    trueMs = 0;
+    localPpm = 0.0;
+    localStart = 0xffffffff - 5000;
+    ClockSync clock(localClock);
+    clock.sync(EPOCH_MS);
+    trueMs += 900000;
+    CHECK(localClock() < 5000 + 900000);
+    CHECK_EQUAL(EPOCH_MS + 900000, clock.now());
+}
+
+/**
+ * @brief Syncs every 15 minutes, each up to 5 ms out, against a clock off by ppm - the drift is learnt and the time
+ * between syncs stays close
+ */
+static void checkDriftLearnt(double ppm) {
+    trueMs = 0;
+    localPpm = ppm;
+    localStart = 1000;
+    ClockSync clock(localClock);
+    uint32_t seed = 7;
+    int32_t worstLateMs = 0;
+    for (int sync = 0; sync < 96; sync++) {					// A day
+        seed = seed * 1103515245 + 12345;
+        int32_t errorMs = (int32_t)((seed >> 16) % 11) - 5;
+        clock.sync(EPOCH_MS + trueMs + errorMs);
+        trueMs += 900000;
+        int32_t outMs = (int32_t)((int64_t)clock.now() - (int64_t)(EPOCH_MS + trueMs));
+        if (sync >= 48) worstLateMs = std::max(worstLateMs, abs(outMs));	// Just before the next sync - as far out as it gets
+    }
+    printf("Clock %+.0f ppm: drift learnt %+d ppm, at most %d ms out at the end of the second half day's periods\n", ppm, (int)clock.driftPpm(), (int)worstLateMs);
+    CHECK(abs(clock.driftPpm() - (int32_t)ppm) <= 3);
+    CHECK(worstLateMs < 10 + 3 * 900);						// Sync error plus 3 ppm over a period
+}
+
+static void testDrift() {
+    checkDriftLearnt(0);
+    checkDriftLearnt(47);
+    checkDriftLearnt(-85);
+    checkDriftLearnt(1500);
+}
+
+/**
+ * @brief A time far out is a step - the Gateway or our clock was reset - and not taken as drift
+ */
+static void testStepIsNotDrift() {
+    trueMs = 0;
+    localPpm = 30.0;
+    localStart = 0;
+    ClockSync clock(localClock);
+    for (int sync = 0; sync < 20; sync++) {
+        clock.sync(EPOCH_MS + trueMs);
+        trueMs += 900000;
+    }
+    int32_t learnt = clock.driftPpm();
+    CHECK(abs(learnt - 30) <= 2);
+
+    int32_t offsetMs = clock.sync(EPOCH_MS + trueMs + 3000);
+    CHECK(abs(offsetMs + 3000) <= 5);						// 3 s behind
+    CHECK_EQUAL(learnt, clock.driftPpm());
+    CHECK_EQUAL(EPOCH_MS + trueMs + 3000, clock.now());		// Followed at once
+    for (int sync = 0; sync < 6; sync++) {
+        trueMs += 900000;
+        clock.sync(EPOCH_MS + trueMs + 3000);
+    }
+    CHECK(abs(clock.driftPpm() - 30) <= 2);
+
+    trueMs += 900000;
+    clock.sync(EPOCH_MS + trueMs + 3000 + 500, false);		// Less accurate than usual - sets the time only
+    CHECK(abs(clock.driftPpm() - 30) <= 2);
+    CHECK_EQUAL(EPOCH_MS + trueMs + 3500, clock.now());
+}
+
+static void testSavedDrift() {
+    trueMs = 0;
+    localPpm = -60.0;
+    localStart = 0;
+    ClockSync clock(localClock);
+    clock.setDriftPpm(-60);									// From sysStatus - right from the first sync
+    CHECK_EQUAL(-60, clock.driftPpm());
+    clock.sync(EPOCH_MS);
+    trueMs += 3600000;
+    CHECK(llabs((int64_t)clock.now() - (int64_t)(EPOCH_MS + trueMs)) <= 1);
+
+    clock.setDriftPpm(5000);
+    CHECK_EQUAL(ClockSync::MAX_DRIFT_PPM, clock.driftPpm());
+    clock.setDriftPpm(-5000);
+    CHECK_EQUAL(-ClockSync::MAX_DRIFT_PPM, clock.driftPpm());
+}
+
+// ************************************************************************
+// *****                  Radio time stamp and air time               *****
+// ************************************************************************
+
+static RadioChip radioChip(RFM95_INT);
+static RH_RF95 radio(RFM95_CS, RFM95_INT);
+
+/**
+ * @brief Time on air from the SX1276 datasheet, worked in floating point
+ */
+static double datasheetAirMs(int sf, int payloadLen, bool lowDataRate) {
+    double symbolMs = (double)(1 << sf) / 125.0;
+    int de = lowDataRate ? 1 : 0;
+    double payloadSymbols = 8 + std::max(ceil((8.0 * payloadLen - 4 * sf + 28 + 16) / (4.0 * (sf - 2 * de))) * 5, 0.0);
+    return (8 + 4.25) * symbolMs + payloadSymbols * symbolMs;
+}
+
+static void testTimeOnAir() {
+    standaloneBoard().attach(RFM95_CS, radioChip);
+    CHECK(radio.init());
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf2048);			// As the node sets it up
+    radio.setLowDatarate();
+    CHECK_EQUAL(824, radio.timeOnAir(20));					// SF11, 24 bytes with the headers - 823.3 ms
+    for (uint8_t len = 0; len < 200; len += 13) {
+        double expected = datasheetAirMs(11, len + RH_RF95_HEADER_LEN, true);
+        CHECK(radio.timeOnAir(len) >= expected && radio.timeOnAir(len) <= expected + 1);
+    }
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf128);
+    radio.setLowDatarate();
+    for (uint8_t len = 0; len < 200; len += 13) {
+        double expected = datasheetAirMs(7, len + RH_RF95_HEADER_LEN, false);
+        CHECK(radio.timeOnAir(len) >= expected && radio.timeOnAir(len) <= expected + 1);
+    }
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf2048);
+    radio.setLowDatarate();
+}
+
+/**
+ * @brief The Gateway stamps its time as it starts sending - the node works it out from when the frame ended and its air
+ * time, however long it takes to get round to reading it
+ */
+static void testStampCompensation() {
+    radio.setThisAddress(5);
+    for (uint32_t readDelayMs : {0, 7, 350, 2000}) {
+        radio.available();
+        uint8_t frame[4 + 20] = {5, 0, 1, 0};
+        uint32_t airMs = radio.timeOnAir(20);
+        uint32_t startMs = millis();						// The Gateway starts sending - its stamp
+        delay(airMs);
+        CHECK(radioChip.receive(frame, sizeof(frame)));
+        delay(1);											// RxDone
+        delay(readDelayMs);									// Busy with something else before recv()
+        uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+        uint8_t len = sizeof(buf);
+        CHECK(radio.recv(buf, &len));
+        uint32_t gatewayMs = startMs + radio.lastRxTimeOnAir() + (millis() - radio.lastRxDoneMs());	// As LoRA_Functions does
+        CHECK(gatewayMs - millis() <= 2);					// Now, to the interrupt latency and the rounding of the air time
+        CHECK(millis() - gatewayMs <= 2);
+    }
+}
+
+// ************************************************************************
+// *****                  AB1805 to the hundredth                     *****
+// ************************************************************************
+
+static RtcChip::State rtcState;
+static RtcChip rtcChip(rtcState, []() { return standaloneBoard().micros(); });
+static AB1805 rtc(Wire);
+
+static void testRtcHundredths() {
+    RtcChip::powerUp(rtcState, 0.0);
+    standaloneBoard().attach(RtcChip::ADDRESS, rtcChip);
+    time_t seconds;
+    uint16_t ms;
+    CHECK(!rtc.getRtcAsTimeMs(seconds, ms));				// Never set
+
+    const time_t SET = 1767225600;
+    CHECK(rtc.setRtcFromTimeMs(SET, 370));
+    CHECK(rtc.getRtcAsTimeMs(seconds, ms));
+    CHECK_EQUAL(SET, seconds);
+    CHECK_EQUAL(370, ms);
+    delay(1234);
+    CHECK(rtc.getRtcAsTimeMs(seconds, ms));
+    CHECK_EQUAL(SET + 1, seconds);
+    CHECK_EQUAL(600, ms);
+    CHECK(fabs(rtcChip.seconds() - (SET + 1.604)) < 0.001);
+
+    CHECK(rtc.setRtcFromTimeMs(SET, 999));					// Set to the hundredth
+    CHECK(rtc.getRtcAsTimeMs(seconds, ms));
+    CHECK_EQUAL(990, ms);
+}
+
+static void testRtcCalibration() {
+    for (int steps : {0, 1, -1, 21, -64, 63, 64, 126}) {
+        CHECK(rtc.setXtCalibration(steps));
+        CHECK_EQUAL(steps, rtc.getXtCalibration());
+        CHECK(fabs(rtcChip.calibrationPpm() - steps * (int32_t)AB1805::XT_CAL_PPB_PER_STEP / 1000.0) < 0.01);
+    }
+    CHECK(rtc.setXtCalibration(127));						// From 64 up in pairs of steps
+    CHECK_EQUAL(126, rtc.getXtCalibration());
+    CHECK(!rtc.setXtCalibration(128));
+    CHECK(!rtc.setXtCalibration(-65));
+    CHECK_EQUAL(126, rtc.getXtCalibration());
+}
+
+/**
+ * @brief A crystal 40 ppm fast, measured over an hour and calibrated out - as syncRtc() does, half at a time
+ */
+static void testRtcDisciplined() {
+    RtcChip::powerUp(rtcState, 40.0);
+    rtc.setXtCalibration(0);
+    const time_t SET = 1767225600;
+    double residualPpm = 40.0;
+    for (int hour = 0; hour < 8; hour++) {
+        uint64_t trueAtSetMs = (uint64_t)SET * 1000 + hour * 3600000ULL;
+        rtc.setRtcFromTimeMs((time_t)(trueAtSetMs / 1000), trueAtSetMs % 1000);
+        delay(3600000);
+        time_t seconds;
+        uint16_t ms;
+        rtc.getRtcAsTimeMs(seconds, ms);
+        int64_t offsetMs = (int64_t)seconds * 1000 + ms - (int64_t)(trueAtSetMs + 3600000);
+        int32_t ppb = (int32_t)(offsetMs * 1000000000LL / 3600000);
+        residualPpm = ppb / 1000.0;
+        rtc.setXtCalibration(rtc.getXtCalibration() - ppb / (2 * (int32_t)AB1805::XT_CAL_PPB_PER_STEP));
+    }
+    printf("RTC crystal +40 ppm: %+.1f ppm after calibration, %d steps\n", residualPpm, rtc.getXtCalibration());
+    CHECK(fabs(residualPpm) < 3.9);							// Halving stops short of a correction under 2 steps
+    CHECK(abs(rtc.getXtCalibration() + 20) <= 1);			// 40 ppm / 1.907 ppm a step
+}
+
+int main() {
+    testCarriesTimeForward();
+    testMillisWrap();
+    testDrift();
+    testStepIsNotDrift();
+    testSavedDrift();
+    testTimeOnAir();
+    testStampCompensation();
+    testRtcHundredths();
+    testRtcCalibration();
+    testRtcDisciplined();
+    return hostTestResult("clock_sync_test");
+}
@@ -0,0 +1,114 @@
+/**
+ * @file   CountQueueTest.cpp - sensor counts queued by the interrupt and recorded from the main loop
+ * @brief  Bursts lose no counts, even past the queue, and each batch is one update of the current data
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+#include "take_measurements.h"
+#include "device_pinout.h"
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+
+static void startCounting() {
+    FramChip::erase(framState);
+    current.setup();
+    eventLog.setup();
+    current.resetBuckets(Time.now());
+    attachInterrupt(INT_PIN, queueCount, RISING);
+}
+
+/**
+ * @brief Sensor pulses every periodUs from now - they are queued as the code waits
+ */
+static void pulses(uint16_t count, uint32_t periodUs) {
+    uint64_t now = micros();
+    for (uint16_t i = 1; i <= count; i++) standaloneBoard().interruptAt(INT_PIN, now + i * (uint64_t)periodUs);
+}
+
+static uint32_t bucketTotal() {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < MAX_COUNT_BUCKETS; i++) total += current.get_countBucket(i);
+    return total;
+}
+
+/**
+ * @brief 20Hz for ten seconds, with the main loop tied up for two seconds a pass
+ */
+static void testSlowLoop() {
+    uint16_t hourly = current.get_hourlyCount();
+    pulses(200, 50000);
+    uint32_t recorded = 0;
+    for (uint8_t pass = 0; pass < 6; pass++) {
+        delay(2000);
+        uint16_t counts = recordCounts();
+        CHECK(counts <= 41);
+        recorded += counts;
+    }
+    CHECK_EQUAL(200, recorded);
+    CHECK_EQUAL(hourly + 200, current.get_hourlyCount());
+    CHECK_EQUAL(current.get_hourlyCount(), bucketTotal());
+}
+
+/**
+ * @brief More pulses than the queue holds before the loop comes round - the ones past it are counted without their time
+ */
+static void testBurstPastTheQueue() {
+    uint16_t hourly = current.get_hourlyCount();
+    uint16_t daily = current.get_dailyCount();
+    pulses(150, 500);
+    delay(100);
+    CHECK_EQUAL(150, recordCounts());
+    CHECK_EQUAL(0, recordCounts());
+    CHECK_EQUAL(hourly + 150, current.get_hourlyCount());
+    CHECK_EQUAL(daily + 150, current.get_dailyCount());
+    CHECK_EQUAL(current.get_hourlyCount(), bucketTotal());
+    CHECK_EQUAL(Time.now(), current.get_lastCountTime());
+}
+
+/**
+ * @brief FRAM writes for a batch of counts - with the current data saved on every change, as a set outside a batch would be
+ */
+static uint32_t batchWrites(uint16_t count) {
+    pulses(count, 1000);
+    delay(count + 1);
+    uint32_t before = framState.writes;
+    CHECK_EQUAL(count, recordCounts());
+    return framState.writes - before;
+}
+
+static void testOneUpdateABatch() {
+    current.withSaveDelayMs(0);
+    uint32_t one = batchWrites(1);
+    uint32_t many = batchWrites(40);
+    printf("FRAM writes to record a batch: %lu for 1 count, %lu for 40\n", (unsigned long)one, (unsigned long)many);
+    CHECK(many <= one + 1);								// The event log may open another block - nothing else grows
+    current.withSaveDelayMs(250);					// As currentStatusData::setup() leaves it
+}
+
+static void testLedDoesNotBlock() {
+    pulses(1, 1000);
+    delay(2);
+    uint64_t start = micros();
+    CHECK_EQUAL(1, recordCounts());
+    CHECK(micros() - start < 10000);
+    CHECK(countFeedbackActive());
+    delay(400);
+    recordCounts();
+    CHECK(countFeedbackActive());
+    delay(100);
+    recordCounts();
+    CHECK(!countFeedbackActive());
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+    Time.setTime(1767225600UL);
+    startCounting();
+
+    testSlowLoop();
+    testBurstPastTheQueue();
+    testOneUpdateABatch();
+    testLedDoesNotBlock();
+    return hostTestResult("count_queue_test");
+}
@@ -0,0 +1,216 @@
+/**
+ * @file   DoubleBufferTest.cpp - A/B copies of a PersistentDataFRAM
+ * @brief  The power is cut after every byte of a save in turn - the newest whole copy always comes back
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+#include <vector>
+
+extern MB85RC64 fram;
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+
+/**
+ * @brief Fields of several sizes, so a save can be one span or several that do not merge
+ */
+struct Record {
+    StorageHelperRK::PersistentDataBase::SavedDataHeader header;
+    uint32_t a;
+    char big[40];
+    uint16_t b;
+    uint32_t c[6];
+};
+
+const size_t PAYLOAD = sizeof(Record) - sizeof(StorageHelperRK::PersistentDataBase::SavedDataHeader);
+
+class TestStore : public StorageHelperRK::PersistentDataFRAM {
+public:
+    explicit TestStore(bool doubleBuffer) : PersistentDataFRAM(::fram, 100, &record.header, sizeof(Record), 0x20202020, 1) {
+        if (doubleBuffer) withDoubleBuffer(3000);
+    }
+
+    void setA(uint32_t value) { setValue<uint32_t>(offsetof(Record, a), value); }
+    void setB(uint16_t value) { setValue<uint16_t>(offsetof(Record, b), value); }
+    void setC(int i, uint32_t value) { setValue<uint32_t>(offsetof(Record, c) + 4 * i, value); }
+    void setBig(uint8_t value) {
+        char text[40];
+        memset(text, 'a' + value % 26, sizeof(text) - 1);
+        text[sizeof(text) - 1] = 0;
+        setValueString(offsetof(Record, big), sizeof(text), text);
+    }
+
+    /**
+     * @brief The changes for save number step - one field, several fields, a long field or spans that do not merge
+     */
+    void change(int step) {
+        switch (step % 4) {
+        case 0: setA(step); break;
+        case 1: setA(step); setB(step); setC(5, step); break;
+        case 2: setBig(step); break;
+        case 3: for (int i = 0; i < 6; i++) setC(i, step * 7 + i); setA(step); break;
+        }
+    }
+
+    bool samePayload(const Record &other) const { return memcmp(&record.a, &other.a, PAYLOAD) == 0; }
+
+    void initialize() override {
+        initializations++;
+        PersistentDataFRAM::initialize();
+    }
+
+    Record record;
+    int initializations = 0;
+};
+
+struct CutResults {
+    long cuts = 0;
+    long newest = 0;										// Came back with the save the power was cut in
+    long before = 0;										// With the save before it
+    long lost = 0;											// Neither - reinitialized or a mix
+};
+
+/**
+ * @brief Saves 1 to steps - 1 in full, then cuts the power after each byte of save number steps in turn
+ */
+static CutResults cutEveryByte(bool doubleBuffer, int steps) {
+    std::vector<Record> expected;							// What each save should leave
+    {
+        FramChip::erase(framState);
+        TestStore store(doubleBuffer);
+        store.load();
+        store.save();
+        expected.push_back(store.record);
+        for (int k = 1; k <= steps; k++) {
+            store.change(k);
+            store.save();
+            expected.push_back(store.record);
+        }
+    }
+
+    CutResults results;
+    for (int k = 1; k <= steps; k++) {
+        for (int32_t cut = 0; ; cut++) {
+            FramChip::erase(framState);
+            bool powerLost = false;
+            {
+                TestStore store(doubleBuffer);
+                store.load();
+                store.save();
+                for (int j = 1; j < k; j++) {
+                    store.change(j);
+                    store.save();
+                }
+                store.change(k);
+                framChip.cutAfterBytes = cut;
+                try {
+                    store.save();
+                }
+                catch (HostBoard::Reset &reset) {
+                    powerLost = true;
+                }
+                framChip.cutAfterBytes = -1;
+            }
+
+            TestStore recovered(doubleBuffer);
+            recovered.load();
+            results.cuts++;
+            if (recovered.initializations == 0 && recovered.samePayload(expected[k])) results.newest++;
+            else if (recovered.initializations == 0 && powerLost && recovered.samePayload(expected[k - 1])) results.before++;
+            else results.lost++;
+
+            if (doubleBuffer && recovered.initializations == 0) {	// And it carries on saving from there
+                recovered.change(k + 1);
+                recovered.save();
+                TestStore next(doubleBuffer);
+                next.load();
+                CHECK(next.initializations == 0 && next.samePayload(recovered.record));
+            }
+            if (!powerLost) break;
+        }
+    }
+    return results;
+}
+
+static void testDoubleBufferSurvivesEveryCut() {
+    CutResults results = cutEveryByte(true, 12);
+    printf("A/B copies: %ld power cuts - %ld came back with the save, %ld with the one before, %ld lost\n", results.cuts, results.newest, results.before, results.lost);
+    CHECK(results.cuts > 100);
+    CHECK_EQUAL(0, results.lost);
+    CHECK(results.before > 0);
+}
+
+static void testSingleCopyLosesData() {
+    CutResults results = cutEveryByte(false, 12);
+    printf("One copy: %ld power cuts - %ld lost\n", results.cuts, results.lost);
+    CHECK(results.lost > 0);								// What the second copy is for
+}
+
+/**
+ * @brief Data saved before the second copy was turned on is picked up from the first
+ */
+static void testUpgradeFromOneCopy() {
+    FramChip::erase(framState);
+    {
+        TestStore single(false);
+        single.load();
+        single.setA(77);
+        single.save();
+    }
+    TestStore store(true);
+    store.load();
+    CHECK_EQUAL(0, store.initializations);
+    CHECK_EQUAL(77, store.record.a);
+    store.setA(78);
+    store.save();
+    TestStore again(true);
+    again.load();
+    CHECK_EQUAL(78, again.record.a);
+}
+
+/**
+ * @brief sysStatus, with the node number and frame counter reservation - a cut anywhere in its save keeps one or the other
+ */
+static void testSysStatus() {
+    delay(1000);											// A change at millis() 0 looks like no change to flush()
+    FramChip::erase(framState);
+    sysStatus.setup();
+    sysStatus.set_nodeNumber(12);
+    sysStatus.set_frameCounterReserved(640);
+    sysStatus.flush(true);
+
+    int oldKept = 0, newKept = 0;
+    for (int32_t cut = 0; ; cut++) {
+        sysStatus.setup();
+        sysStatus.set_nodeNumber(12);
+        sysStatus.set_frameCounterReserved(640);
+        sysStatus.flush(true);
+        sysStatus.set_nodeNumber(13);
+        sysStatus.set_frameCounterReserved(704);
+        bool powerLost = false;
+        framChip.cutAfterBytes = cut;
+        try {
+            sysStatus.flush(true);
+        }
+        catch (HostBoard::Reset &reset) {
+            powerLost = true;
+        }
+        framChip.cutAfterBytes = -1;
+
+        sysStatus.setup();
+        if (sysStatus.get_nodeNumber() == 12 && sysStatus.get_frameCounterReserved() == 640) oldKept++;
+        else if (CHECK(sysStatus.get_nodeNumber() == 13 && sysStatus.get_frameCounterReserved() == 704)) newKept++;
+        if (!powerLost) break;
+    }
+    CHECK(oldKept > 0 && newKept > 0);
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+
+    testDoubleBufferSurvivesEveryCut();
+    testSingleCopyLosesData();
+    testUpgradeFromOneCopy();
+    testSysStatus();
+    return hostTestResult("double_buffer_test");
+}
@@ -0,0 +1,199 @@
+/**
+ * @file   EncryptedDriverTest.cpp - RHEncryptedDriver and the multi-block modes in BlockCipher
+ * @brief  ECB and CTR round trips over a LoopbackDriver, CTR without padding and its nonce carried through a reboot
+ */
+#include "HostTest.h"
+#include "LoopbackDriver.h"
+#include <RHEncryptedDriver.h>
+#include <Speck.h>
+#include <SpeckTiny.h>
+#include <set>
+
+static const uint8_t KEY[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+
+static void fillMessage(uint8_t *message, uint8_t len, uint8_t seed) {
+    for (uint8_t i = 0; i < len; i++) message[i] = (uint8_t)(seed + i * 7);
+}
+
+/**
+ * @brief The multi-block calls against one block at a time
+ */
+static void testBlockModes() {
+    Speck speck;
+    speck.setKey(KEY, sizeof(KEY));
+    uint8_t plain[64], once[64], each[64], back[64];
+    fillMessage(plain, sizeof(plain), 1);
+
+    speck.encryptBlocks(once, plain, 4);
+    for (uint8_t b = 0; b < 4; b++) speck.encryptBlock(each + b * 16, plain + b * 16);
+    CHECK(memcmp(once, each, sizeof(once)) == 0);
+    speck.decryptBlocks(back, once, 4);
+    CHECK(memcmp(back, plain, sizeof(plain)) == 0);
+
+    uint8_t iv[16] = {}, iv2[16] = {};
+    speck.encryptCBC(once, plain, 4, iv);
+    CHECK(memcmp(once, once + 16, 16) != 0);
+    speck.decryptCBC(back, once, 4, iv2);
+    CHECK(memcmp(back, plain, sizeof(plain)) == 0);
+
+    uint8_t counter[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfe};	// Carries into the byte above
+    uint8_t block[16];
+    memcpy(block, counter, 16);
+    for (uint8_t b = 0; b < 4; b++) {
+        speck.encryptBlock(each + b * 16, block);
+        for (int8_t i = 15; i >= 0 && ++block[i] == 0; i--) {}
+    }
+    for (uint8_t i = 0; i < 61; i++) each[i] ^= plain[i];
+    speck.cryptCTR(once, plain, 61, counter);				// Not a whole number of blocks
+    CHECK(memcmp(once, each, 61) == 0);
+    CHECK(memcmp(counter, block, 16) == 0);					// Left ready for the next block
+}
+
+static void testEcbRoundTrip() {
+    LoopbackChannel channel;
+    LoopbackDriver nodeRadio(channel), gatewayRadio(channel);
+    Speck nodeCipher, gatewayCipher;
+    nodeCipher.setKey(KEY, sizeof(KEY));
+    gatewayCipher.setKey(KEY, sizeof(KEY));
+    RHEncryptedDriver node(nodeRadio, nodeCipher), gateway(gatewayRadio, gatewayCipher);
+    node.init();
+    gateway.init();
+
+    for (uint8_t len = 1; len <= 40; len++) {
+        uint8_t message[64], buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+        fillMessage(message, len, len);
+        CHECK(node.send(message, len));
+        CHECK_EQUAL((len / 16 + 1) * 16, channel.sent.back().data.size());	// Length byte and padding to whole blocks
+        uint8_t got = sizeof(buf);
+        CHECK(gateway.recv(buf, &got));
+        CHECK_EQUAL(len, got);
+        CHECK(memcmp(buf, message, len) == 0);
+    }
+}
+
+/**
+ * @brief Two ends in CTR mode with the given cipher
+ */
+struct CtrLink {
+    LoopbackChannel channel;
+    LoopbackDriver nodeRadio{channel}, gatewayRadio{channel};
+    BlockCipher &nodeCipher, &gatewayCipher;
+    RHEncryptedDriver node{nodeRadio, nodeCipher}, gateway{gatewayRadio, gatewayCipher};
+
+    CtrLink(BlockCipher &nodeCipher, BlockCipher &gatewayCipher) : nodeCipher(nodeCipher), gatewayCipher(gatewayCipher) {
+        nodeCipher.setKey(KEY, sizeof(KEY));
+        gatewayCipher.setKey(KEY, sizeof(KEY));
+        node.init();
+        gateway.init();
+        node.setCipherMode(RHEncryptedDriver::CipherModeCTR);
+        gateway.setCipherMode(RHEncryptedDriver::CipherModeCTR);
+        node.setHeaderFrom(7);
+    }
+};
+
+static void testCtrRoundTrip() {
+    SpeckTiny nodeCipher;									// Only needs encryptBlock()
+    Speck gatewayCipher;
+    CtrLink link(nodeCipher, gatewayCipher);
+    CHECK_EQUAL(RH_LOOPBACK_MAX_MESSAGE_LEN - RH_ENCRYPTED_NONCE_LEN, link.node.maxMessageLength());
+
+    for (uint8_t len = 0; len <= link.node.maxMessageLength(); len += 17) {
+        uint8_t message[RH_LOOPBACK_MAX_MESSAGE_LEN], buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+        fillMessage(message, len, 3);
+        CHECK(link.node.send(message, len));
+        CHECK_EQUAL(len + RH_ENCRYPTED_NONCE_LEN, link.channel.sent.back().data.size());	// No padding
+        uint8_t got = sizeof(buf);
+        CHECK(link.gateway.recv(buf, &got));
+        CHECK_EQUAL(len, got);
+        CHECK(memcmp(buf, message, len) == 0);
+    }
+
+    uint8_t report[19];										// A data report - 23 bytes on the air rather than 32
+    fillMessage(report, sizeof(report), 9);
+    link.node.send(report, sizeof(report));
+    CHECK_EQUAL(23, link.channel.sent.back().data.size());
+    uint8_t buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+    uint8_t got = sizeof(buf);
+    link.gateway.recv(buf, &got);
+
+    link.node.send(report, sizeof(report));					// The same message again goes under another nonce
+    const std::vector<uint8_t> &first = link.channel.sent[link.channel.sent.size() - 2].data;
+    const std::vector<uint8_t> &second = link.channel.sent.back().data;
+    CHECK(memcmp(first.data() + RH_ENCRYPTED_NONCE_LEN, second.data() + RH_ENCRYPTED_NONCE_LEN, sizeof(report)) != 0);
+    got = sizeof(buf);
+    link.gateway.recv(buf, &got);
+
+    uint8_t shortFrame[RH_ENCRYPTED_NONCE_LEN - 1] = {};
+    link.nodeRadio.send(shortFrame, sizeof(shortFrame));
+    got = sizeof(buf);
+    CHECK(!link.gateway.recv(buf, &got));
+}
+
+/**
+ * @brief Two senders at the same nonce - the from address keeps their key streams apart
+ */
+static void testFromAddressInTheCounter() {
+    Speck a, b;
+    CtrLink link(a, b);
+    uint8_t zeros[32] = {};
+    link.node.setNonce(1000);
+    link.node.setHeaderFrom(7);
+    link.node.send(zeros, sizeof(zeros));
+    std::vector<uint8_t> from7 = link.channel.sent.back().data;
+    link.node.setNonce(1000);
+    link.node.setHeaderFrom(8);
+    link.node.send(zeros, sizeof(zeros));
+    CHECK(memcmp(from7.data(), link.channel.sent.back().data.data(), RH_ENCRYPTED_NONCE_LEN) == 0);
+    CHECK(memcmp(from7.data() + RH_ENCRYPTED_NONCE_LEN, link.channel.sent.back().data.data() + RH_ENCRYPTED_NONCE_LEN, sizeof(zeros)) != 0);
+}
+
+static uint32_t reserved = 0;
+static uint16_t reservations = 0;
+
+static void nonceReserved(uint32_t reservedTo) {
+    reserved = reservedTo;
+    reservations++;
+}
+
+static uint32_t sentNonce(const LoopbackChannel &channel) {
+    const uint8_t *d = channel.sent.back().data.data();
+    return ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+}
+
+/**
+ * @brief Nonces are reserved a block at a time and the stored value carries them on through a reboot - none is used
+ * twice, however many reboots there are or wherever in a block they come
+ */
+static void testNoncePersistence() {
+    std::set<uint32_t> used;
+    uint32_t stored = 0;									// Nothing stored yet - the first boot picks at random
+    bool reused = false;
+    for (uint8_t boot = 0; boot < 6; boot++) {
+        Speck a, b;
+        CtrLink link(a, b);
+        link.node.setReserveHandler(nonceReserved);
+        if (stored) link.node.setNonce(stored);
+        CHECK_EQUAL(stored, link.node.nonce());
+        reservations = 0;
+        uint8_t sends = 10 + boot * 37;						// Reboots early and late in a block
+        for (uint8_t i = 0; i < sends; i++) {
+            uint8_t message[4] = {boot, i};
+            link.node.send(message, sizeof(message));
+            uint32_t nonce = sentNonce(link.channel);
+            if (!used.insert(nonce).second) reused = true;
+            CHECK(nonce < reserved);						// Stored before it went on the air
+        }
+        CHECK_EQUAL((sends + RH_ENCRYPTED_NONCE_BLOCK - 1) / RH_ENCRYPTED_NONCE_BLOCK, reservations);
+        stored = reserved;
+    }
+    CHECK(!reused);
+}
+
+int main() {
+    testBlockModes();
+    testEcbRoundTrip();
+    testCtrRoundTrip();
+    testFromAddressInTheCounter();
+    testNoncePersistence();
+    return hostTestResult("encrypted_driver_test");
+}
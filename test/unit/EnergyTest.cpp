@@ -0,0 +1,109 @@
+/**
+ * @file   EnergyTest.cpp - the EnergyMonitor charge estimate over months of wake cycles
+ * @brief  The millisecond counters are rolled over before they wrap - the charge keeps adding up, and so does the charge
+ * since the last acknowledged report
+ */
+#include "HostTest.h"
+#include "EnergyMonitor.h"
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+
+enum State { AWAKE, ASLEEP };
+enum Event { SLEEP, WAKE };
+
+static const StateMachine::Transition table[] = {
+    {AWAKE, SLEEP, ASLEEP},
+    {ASLEEP, WAKE, AWAKE},
+};
+
+static uint32_t clockMs() { return millis(); }
+static StateMachine machine(table, 2, AWAKE, clockMs);
+
+const uint32_t AWAKE_MS = 60000;
+const uint32_t ASLEEP_MS = 14 * 60000;
+const uint32_t PERIODS_A_DAY = 96;
+// Charge for one period at the default currents - micro amp ms over the ms in an hour
+const uint32_t PERIOD_UAH = ((uint64_t)ASLEEP_MS * EnergyMonitor::DEFAULT_SLEEP_UA + (uint64_t)AWAKE_MS * EnergyMonitor::DEFAULT_AWAKE_UA) / 3600000ULL;
+
+/**
+ * @brief A wake cycle as the main loop has it - awake, then asleep, with update() on the way into sleep
+ */
+static void period() {
+    delay(AWAKE_MS);
+    machine.post(SLEEP);
+    machine.dispatch();
+    EnergyMonitor::instance().update(machine);
+    delay(ASLEEP_MS);
+    EnergyMonitor::instance().slept(ASLEEP_MS);
+    machine.post(WAKE);
+    machine.dispatch();
+}
+
+static bool countersValid() {
+    energyStatusData::EnergyCounters counters;
+    energyStatus.get_counters(counters);
+    return CHECK(counters.sleepMs < EnergyMonitor::ROLLOVER_MS) && CHECK(counters.sleepMs <= counters.stateMs[ASLEEP]);
+}
+
+static void testChargeThroughRollovers() {
+    EnergyMonitor &monitor = EnergyMonitor::instance();
+    time_t start = Time.now();
+    CHECK_EQUAL(start, energyStatus.get_countersSince());
+
+    uint32_t periods = 0;
+    for (; periods < 20 * PERIODS_A_DAY; periods++) period();
+    CHECK_EQUAL(start, energyStatus.get_countersSince());	// Not rolled over yet
+    CHECK_EQUAL(0, energyStatus.get_rolledChargeUah());
+    uint32_t acknowledged = monitor.chargeUah();
+    monitor.reportAcknowledged(acknowledged);
+    CHECK_EQUAL(0, monitor.chargeSinceReportUah());
+
+    time_t rolledAt = 0;
+    uint32_t mismatches = 0;
+    for (; periods < 100 * PERIODS_A_DAY; periods++) {		// Three rollovers, and millis() wraps twice
+        uint32_t before = monitor.chargeUah();
+        period();
+        if (!rolledAt && energyStatus.get_countersSince() != start) rolledAt = Time.now();
+        uint32_t step = monitor.chargeUah() - before;
+        if (step + 1 < PERIOD_UAH || step > PERIOD_UAH + 1) mismatches++;	// Each period's estimate is cut to whole uAh
+        if (!countersValid()) break;
+    }
+    CHECK_EQUAL(0, mismatches);
+    CHECK(rolledAt != 0);
+    CHECK(rolledAt - start >= EnergyMonitor::ROLLOVER_MS / 1000);
+    CHECK(energyStatus.get_rolledChargeUah() > 0);
+    CHECK(Time.now() - energyStatus.get_countersSince() < EnergyMonitor::ROLLOVER_MS / 1000);
+
+    uint32_t charge = monitor.chargeUah();
+    uint32_t expected = periods * PERIOD_UAH - ASLEEP_MS * EnergyMonitor::DEFAULT_SLEEP_UA / 3600000UL;	// The last sleep is not in yet
+    CHECK(charge <= expected && charge + 3 >= expected);		// Under a uAh lost at each rollover
+    CHECK_EQUAL(charge - acknowledged, monitor.chargeSinceReportUah());
+}
+
+/**
+ * @brief The rolled over charge and the new countersSince are saved with the counters
+ */
+static void testRolloverSaved() {
+    uint32_t charge = EnergyMonitor::instance().chargeUah();
+    time_t since = energyStatus.get_countersSince();
+    energyStatus.flush(true);
+    energyStatus.load();
+    CHECK_EQUAL(charge, EnergyMonitor::instance().chargeUah());
+    CHECK_EQUAL(since, energyStatus.get_countersSince());
+}
+
+int main() {
+    FramChip::erase(framState);
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+    Time.setTime(1767225600);								// 2026-01-01
+    delay(1000);											// A change at millis() 0 looks like no change to flush()
+
+    energyStatus.setup();
+    EnergyMonitor::instance().setup();
+    machine.resetStatistics();
+
+    testChargeThroughRollovers();
+    testRolloverSaved();
+    return hostTestResult("energy_test");
+}
@@ -0,0 +1,383 @@
+/**
+ * @file   EventLogTest.cpp - the event log in the second half of the FRAM
+ * @brief  Appends read back exactly, range queries, chunks for the Gateway, the ring wrapping, reboots and power cuts
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+#include <random>
+#include <vector>
+
+extern MB85RC64 fram;
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+static std::mt19937 rng(23);
+
+/**
+ * @brief A log of its own for each test, or each boot - the firmware's is a singleton
+ */
+class TestLog : public eventLogData {
+public:
+    TestLog() {}
+    ~TestLog() {}
+};
+
+/**
+ * @brief What the log should hold - the time of each event in tenths, from millis() as the log measures it
+ */
+struct Model {
+    std::vector<uint32_t> eventMillis;
+    uint64_t firstTick = 0;									// Read back from the log - tied to the clock, which only has seconds
+
+    uint64_t tick(size_t i) const { return firstTick + (eventMillis[i] - eventMillis[0]) / eventLogData::EVENT_TICK_MS; }
+};
+
+/**
+ * @brief A gap between events - mostly a few seconds, sometimes the same tenth, now and then minutes or hours
+ */
+static uint32_t randomGapMs() {
+    uint32_t kind = rng() % 100;
+    if (kind < 5) return rng() % 50;
+    if (kind < 95) return 300 + rng() % 10000;
+    if (kind < 99) return 60000 + rng() % 1800000;
+    return 3600000 + rng() % 7200000;
+}
+
+/**
+ * @brief Events as the sensor queue sees them, then logged in one append as the firmware does
+ */
+static bool appendBatch(eventLogData &log, Model &model, uint8_t count) {
+    uint32_t batch[32];
+    for (uint8_t i = 0; i < count; i++) {
+        delay(randomGapMs());
+        batch[i] = millis();
+        model.eventMillis.push_back(batch[i]);
+    }
+    delay(50);
+    return log.append(batch, count);
+}
+
+static uint64_t eventTick(const eventLogData::Event &event) {
+    return (uint64_t)event.time * 10 + event.tenths;
+}
+
+static std::vector<uint64_t> readAll(eventLogData &log, uint32_t fromTime) {
+    std::vector<uint64_t> ticks;
+    eventLogData::Cursor cursor;
+    eventLogData::Event event;
+    if (!log.seek(cursor, fromTime)) return ticks;
+    while (log.next(cursor, event)) ticks.push_back(eventTick(event));
+    return ticks;
+}
+
+/**
+ * @brief The log holds the model's events from first on, in order and to the tenth
+ */
+static bool holds(const std::vector<uint64_t> &ticks, const Model &model, size_t first) {
+    if (!CHECK_EQUAL(model.eventMillis.size() - first, ticks.size())) return false;
+    for (size_t i = 0; i < ticks.size(); i++) {
+        if (!CHECK_EQUAL(model.tick(first + i), ticks[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Starts a model from the first event in the log
+ */
+static void tieToLog(eventLogData &log, Model &model) {
+    eventLogData::Cursor cursor;
+    eventLogData::Event event;
+    if (CHECK(log.seek(cursor, 0) && log.next(cursor, event))) model.firstTick = eventTick(event);
+}
+
+static void testNeedsTheClock() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    uint32_t now = millis();
+    CHECK(!Time.isValid());
+    CHECK(!log.append(&now, 1));							// Nothing to tie the time to
+    eventLogData::Cursor cursor;
+    CHECK(!log.seek(cursor, 0));
+}
+
+static void testAppendAndRead() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    Model model;
+    for (int batch = 0; batch < 40; batch++) CHECK(appendBatch(log, model, 1 + rng() % 8));
+    tieToLog(log, model);
+    CHECK(model.firstTick / 10 + 2 >= (uint64_t)Time.now() - (millis() - model.eventMillis[0]) / 1000);	// Tied to the clock
+    holds(readAll(log, 0), model, 0);
+}
+
+/**
+ * @brief seek() from every event's second, and between them - the first event at or after the time
+ */
+static void testRangeQueries() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    Model model;
+    for (int batch = 0; batch < 100; batch++) appendBatch(log, model, 1 + rng() % 5);
+    tieToLog(log, model);
+
+    for (size_t i = 0; i < model.eventMillis.size(); i += 7) {
+        uint32_t from = (uint32_t)(model.tick(i) / 10) + (i % 2);
+        size_t first = 0;
+        while (first < model.eventMillis.size() && model.tick(first) < (uint64_t)from * 10) first++;
+        std::vector<uint64_t> ticks = readAll(log, from);
+        if (!holds(ticks, model, first)) break;
+    }
+
+    uint32_t to = (uint32_t)(model.tick(model.eventMillis.size() / 2) / 10);	// A range with an end - stop at the first past it
+    eventLogData::Cursor cursor;
+    eventLogData::Event event;
+    size_t inRange = 0;
+    log.seek(cursor, (uint32_t)(model.firstTick / 10));
+    while (log.next(cursor, event) && event.time < to) inRange++;
+    size_t expected = 0;
+    while (model.tick(expected) < (uint64_t)to * 10) expected++;
+    CHECK_EQUAL(expected, inRange);
+
+    CHECK(!log.seek(cursor, Time.now() + 3600));			// Nothing after the newest event
+}
+
+/**
+ * @brief A cursor at the end picks up events appended later
+ */
+static void testCursorFollowsAppends() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    Model model;
+    appendBatch(log, model, 3);
+    tieToLog(log, model);
+
+    eventLogData::Cursor cursor;
+    eventLogData::Event event;
+    std::vector<uint64_t> ticks;
+    log.seek(cursor, 0);
+    for (int batch = 0; batch < 200; batch++) {				// Across several blocks
+        while (log.next(cursor, event)) ticks.push_back(eventTick(event));
+        appendBatch(log, model, 1 + rng() % 3);
+    }
+    while (log.next(cursor, event)) ticks.push_back(eventTick(event));
+    holds(ticks, model, 0);
+}
+
+/**
+ * @brief Decodes a chunk as the Gateway does
+ */
+static void decodeChunk(const uint8_t *buf, size_t len, uint16_t events, std::vector<uint64_t> &ticks) {
+    LoRA_Messages::BitReader reader(buf, len);
+    uint64_t tick = (uint64_t)reader.read(32) * 10;
+    tick += reader.read(4);
+    ticks.push_back(tick);
+    for (uint16_t i = 1; i < events; i++) {
+        uint32_t gap;
+        LoRA_Messages::Varint::decode(reader, gap);
+        tick += gap;
+        ticks.push_back(tick);
+    }
+    CHECK(reader.ok());
+}
+
+/**
+ * @brief Every event goes up once, in chunks that fit a message, and a chunk the Gateway did not acknowledge is sent again
+ */
+static void testChunks() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    Model model;
+    for (int batch = 0; batch < 150; batch++) appendBatch(log, model, 1 + rng() % 6);
+    tieToLog(log, model);
+
+    std::vector<uint64_t> ticks;
+    eventLogData::Cursor cursor;
+    log.seek(cursor, 0);
+    int chunks = 0;
+    for (;;) {
+        uint8_t buf[24];
+        eventLogData::Cursor before = cursor;
+        LoRA_Messages::BitWriter writer(buf, sizeof(buf));
+        uint16_t events = log.readChunk(cursor, writer);
+        if (events == 0) break;
+        CHECK(writer.ok());
+        if (chunks++ % 5 == 0) {							// Not acknowledged - go back and send it again
+            cursor = before;
+            uint8_t again[24];
+            LoRA_Messages::BitWriter retry(again, sizeof(again));
+            CHECK_EQUAL(events, log.readChunk(cursor, retry));
+            CHECK(memcmp(buf, again, (writer.position() + 7) / 8) == 0);
+        }
+        decodeChunk(buf, sizeof(buf), events, ticks);
+    }
+    CHECK(chunks > 10);
+    holds(ticks, model, 0);
+
+    uint8_t tiny[4];										// Not even the first event's time fits
+    LoRA_Messages::BitWriter writer(tiny, sizeof(tiny));
+    log.seek(cursor, 0);
+    CHECK_EQUAL(0, log.readChunk(cursor, writer));
+}
+
+/**
+ * @brief Fills the ring more than twice over - the oldest blocks go, what is left reads back, and a cursor left in a
+ * block that was overwritten moves on to the oldest block left
+ */
+static void testWrap() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    Model model;
+    appendBatch(log, model, 1);
+    tieToLog(log, model);
+
+    eventLogData::Cursor stale;
+    eventLogData::Event event;
+    log.seek(stale, 0);
+    while (model.eventMillis.size() < 8000) appendBatch(log, model, 1 + rng() % 10);
+
+    std::vector<uint64_t> ticks = readAll(log, 0);
+    CHECK(ticks.size() > 3000);
+    CHECK(ticks.size() < model.eventMillis.size());
+    holds(ticks, model, model.eventMillis.size() - ticks.size());
+
+    CHECK(log.next(stale, event));
+    CHECK_EQUAL(ticks[0], eventTick(event));
+}
+
+/**
+ * @brief setup() after a reboot finds the newest block and where its events end, and appending carries on from there.
+ * Each boot ties its times to the clock again, so they are exact within a boot and in order across them.
+ */
+static void testReboot() {
+    FramChip::erase(framState);
+    std::vector<Model> boots(8);
+    for (Model &model : boots) {
+        TestLog log;
+        log.setup();
+        for (int batch = 0; batch < 60; batch++) appendBatch(log, model, 1 + rng() % 4);
+        delay(5000);
+    }
+    TestLog log;
+    log.setup();
+    std::vector<uint64_t> ticks = readAll(log, 0);
+    size_t first = 0;
+    for (Model &model : boots) {
+        if (!CHECK(first + model.eventMillis.size() <= ticks.size())) break;
+        model.firstTick = ticks[first];
+        if (first > 0) CHECK(ticks[first] >= ticks[first - 1]);
+        std::vector<uint64_t> boot(ticks.begin() + first, ticks.begin() + first + model.eventMillis.size());
+        if (!holds(boot, model, 0)) break;
+        first += model.eventMillis.size();
+    }
+    CHECK_EQUAL(ticks.size(), first);
+}
+
+/**
+ * @brief The power cut after each byte of an append that starts a new block - the log keeps every event before it and
+ * reads no event that was not logged
+ */
+static void testPowerCuts() {
+    uint32_t cuts = 0, partial = 0;
+    for (int32_t cut = 0; ; cut++) {
+        FramChip::erase(framState);
+        rng.seed(2300);
+        Model model;
+        size_t before = 0;
+        bool powerLost = false;
+        {
+            TestLog log;
+            log.setup();
+            while (model.eventMillis.size() < 110) appendBatch(log, model, 5);
+            tieToLog(log, model);
+            before = model.eventMillis.size();
+            framChip.cutAfterBytes = cut;
+            try {
+                appendBatch(log, model, 20);					// Past the end of the first block
+            }
+            catch (HostBoard::Reset &reset) {
+                powerLost = true;
+            }
+            framChip.cutAfterBytes = -1;
+        }
+        TestLog log;
+        log.setup();
+        std::vector<uint64_t> ticks = readAll(log, 0);
+        bool ok = ticks.size() >= before && ticks.size() <= model.eventMillis.size();
+        for (size_t i = 0; ok && i < ticks.size(); i++) ok = ticks[i] == model.tick(i);
+        if (!CHECK(ok)) break;
+        if (ticks.size() > before && ticks.size() < model.eventMillis.size()) partial++;
+        if (!powerLost) {
+            CHECK_EQUAL(model.eventMillis.size(), ticks.size());
+            break;
+        }
+        cuts++;
+
+        uint32_t after = millis();							// And appends carry on after the reboot
+        CHECK(log.append(&after, 1));
+        CHECK_EQUAL(ticks.size() + 1, readAll(log, 0).size());
+    }
+    printf("Power cut at %lu places in an append - every event before it kept, %lu kept part of the batch\n", (unsigned long)cuts, (unsigned long)partial);
+    CHECK(cuts > 100);
+}
+
+/**
+ * @brief Events a few seconds apart take a byte each - the benchmark of what an append costs and how many events fit
+ */
+static void testDensityAndCost() {
+    FramChip::erase(framState);
+    TestLog log;
+    log.setup();
+    uint32_t appends = 0, transactions = 0, maxTransactions = 0, written = 0;
+    uint32_t now;
+    for (int i = 0; i < 6000; i++) {
+        delay(300 + rng() % 10000);
+        now = millis();
+        uint32_t before = fram.transactionCount();
+        uint32_t bytesBefore = framState.bytesWritten;
+        CHECK(log.append(&now, 1));
+        uint32_t used = fram.transactionCount() - before;
+        transactions += used;
+        maxTransactions = std::max(maxTransactions, used);
+        written += framState.bytesWritten - bytesBefore;
+        appends++;
+    }
+    size_t held = readAll(log, 0).size();
+    printf("Events a few seconds apart: %u held in %u bytes - %.2f bytes each\n", (unsigned)held, eventLogData::EVENT_BLOCK_COUNT * eventLogData::EVENT_BLOCK_SIZE, (double)(eventLogData::EVENT_BLOCK_COUNT * eventLogData::EVENT_BLOCK_SIZE) / held);
+    printf("Appending one event: %.2f FRAM transactions and %.1f bytes written on average, %u at most\n", (double)transactions / appends, (double)written / appends, maxTransactions);
+    CHECK(held >= (eventLogData::EVENT_BLOCK_COUNT - 1) * eventLogData::EVENT_PAYLOAD_SIZE);	// One byte each, less the block being overwritten
+    CHECK(maxTransactions <= 4);							// The rest of the old block, the new block's zeros and header, the event
+    CHECK((double)transactions / appends < 1.1);
+
+    uint32_t batch[32];										// A batch of counts goes in one write
+    for (uint8_t i = 0; i < 32; i++) {
+        delay(200);
+        batch[i] = millis();
+    }
+    uint32_t before = fram.transactionCount();
+    log.append(batch, 32);
+    CHECK(fram.transactionCount() - before <= 4);
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+    fram.withTransferSize(128);								// As sysStatus.setup() leaves it
+    fram.begin();
+
+    testNeedsTheClock();
+    Time.setTime(1760000000);
+    testAppendAndRead();
+    testRangeQueries();
+    testCursorFollowsAppends();
+    testChunks();
+    testWrap();
+    testReboot();
+    testPowerCuts();
+    testDensityAndCost();
+    return hostTestResult("event_log_test");
+}
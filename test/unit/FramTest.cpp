@@ -0,0 +1,128 @@
+/**
+ * @file   FramTest.cpp - the MB85RC FRAM driver on the FramChip model
+ * @brief  I2C transactions per read and write at each transfer size, scatter / gather writes and overlapping moves
+ */
+#include "HostTest.h"
+#include "MB85RC256V-FRAM-RK.h"
+#include "MyPersistentData.h"
+#include <random>
+#include <vector>
+
+extern MB85RC64 fram;										// The firmware's, with the larger Wire buffer it asks for
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+static std::mt19937 rng(19);
+
+static std::vector<uint8_t> randomBytes(size_t len) {
+    std::vector<uint8_t> bytes(len);
+    for (uint8_t &b : bytes) b = (uint8_t)rng();
+    return bytes;
+}
+
+static bool framHolds(size_t framAddr, const uint8_t *expected, size_t len) {
+    return memcmp(framState.memory + framAddr, expected, len) == 0;
+}
+
+/**
+ * @brief Transactions one read or write of len bytes takes - each is a whole I2C transaction, address bytes and all
+ */
+static void checkTransactions(MB85RC &device, size_t len) {
+    size_t transfer = device.getTransferSize();
+    std::vector<uint8_t> data = randomBytes(len);
+
+    uint32_t before = device.transactionCount();
+    uint32_t chipWrites = framState.writes;
+    CHECK(device.writeData(100, data.data(), len));
+    CHECK_EQUAL((len + transfer - 3) / (transfer - 2), device.transactionCount() - before);
+    CHECK_EQUAL(device.transactionCount() - before, framState.writes - chipWrites);
+    CHECK(framHolds(100, data.data(), len));
+
+    std::vector<uint8_t> back(len);
+    before = device.transactionCount();
+    chipWrites = framState.writes;
+    CHECK(device.readData(100, back.data(), len));
+    CHECK_EQUAL((len + transfer - 1) / transfer, device.transactionCount() - before);
+    CHECK_EQUAL(1, framState.writes - chipWrites);			// The address is only sent once - the reads carry on from it
+    CHECK(back == data);
+}
+
+static void testTransactionCounts() {
+    fram.withTransferSize(128);
+    fram.begin();
+    CHECK_EQUAL(128, fram.getTransferSize());
+    for (size_t len : {1, 30, 126, 127, 128, 129, 300, 1000}) checkTransactions(fram, len);
+
+    MB85RC64 small(Wire, 0);								// The Device OS default Wire buffer
+    small.withTransferSize(MB85RC::DEFAULT_TRANSFER_SIZE);
+    for (size_t len : {1, 30, 31, 32, 33, 300}) checkTransactions(small, len);
+
+    uint32_t before = fram.transactionCount();
+    std::vector<uint8_t> saved = randomBytes(sizeof(sysStatusData::SysData));
+    fram.writeData(0, saved.data(), saved.size());
+    uint32_t large = fram.transactionCount() - before;
+    before = small.transactionCount();
+    small.writeData(0, saved.data(), saved.size());
+    printf("Saving %u bytes: %lu transactions at 128 bytes, %lu at 32\n", (unsigned)saved.size(), (unsigned long)large, (unsigned long)(small.transactionCount() - before));
+}
+
+static void testWriteSpans() {
+    std::vector<uint8_t> a = randomBytes(10), b = randomBytes(200), c = randomBytes(3);
+    MB85RC::Span spans[] = {{4000, a.data(), a.size()}, {20, b.data(), b.size()}, {4010, c.data(), c.size()}};
+    uint32_t before = fram.transactionCount();
+    CHECK(fram.writeSpans(spans, 3));
+    CHECK_EQUAL(1 + 2 + 1, fram.transactionCount() - before);
+    CHECK(framHolds(4000, a.data(), a.size()));
+    CHECK(framHolds(20, b.data(), b.size()));
+    CHECK(framHolds(4010, c.data(), c.size()));
+    CHECK(fram.writeSpans(spans, 0));
+}
+
+/**
+ * @brief Moves of every size around MOVE_BUFFER_SIZE, up and down, overlapping and not - against memmove
+ */
+static void testMoveData() {
+    std::vector<uint8_t> model(framState.memory, framState.memory + FramChip::SIZE);
+    for (int i = 0; i < 400; i++) {
+        size_t len = rng() % (3 * MB85RC::MOVE_BUFFER_SIZE) + 1;
+        size_t from = rng() % (FramChip::SIZE - len);
+        size_t to = (i % 2) ? from + rng() % 300 : from - std::min(from, (size_t)(rng() % 300));	// Mostly overlapping
+        if (to + len > FramChip::SIZE) to = FramChip::SIZE - len;
+        if (i % 10 == 0) {
+            std::vector<uint8_t> data = randomBytes(len);
+            fram.writeData(from, data.data(), len);
+            memcpy(&model[from], data.data(), len);
+        }
+        CHECK(fram.moveData(from, to, len));
+        memmove(&model[to], &model[from], len);
+        if (!CHECK(memcmp(framState.memory, model.data(), FramChip::SIZE) == 0)) break;
+    }
+    CHECK(fram.moveData(50, 50, 100));						// Nowhere to go
+    CHECK(memcmp(framState.memory, model.data(), FramChip::SIZE) == 0);
+}
+
+static void testErase() {
+    memset(framState.memory, 0xa5, FramChip::SIZE);
+    CHECK(fram.erase());
+    uint8_t zeros[FramChip::SIZE] = {};
+    CHECK(framHolds(0, zeros, FramChip::SIZE));
+}
+
+static void testMissingChip() {
+    MB85RC64 absent(Wire, 3);								// Nothing at 0x53
+    uint8_t data[4] = {1, 2, 3, 4};
+    CHECK(!absent.writeData(0, data, sizeof(data)));
+    CHECK(!absent.readData(0, data, sizeof(data)));
+}
+
+int main() {
+    FramChip::erase(framState);
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+
+    testTransactionCounts();
+    testWriteSpans();
+    testMoveData();
+    testErase();
+    testMissingChip();
+    return hostTestResult("fram_test");
+}
@@ -0,0 +1,55 @@
+/**
+ * @file   HostTest.h - checks for the test programs in test/unit
+ * @brief  CHECK and CHECK_EQUAL count what fails and say where - main() runs the tests and returns hostTestResult()
+ *
+ * @details Each program is one part of the firmware on a StandaloneBoard, built with the host runtime in test/host and
+ * run by ctest. A test is a plain function; a failed check prints its file and line and the test carries on.
+ */
+#ifndef __HOST_TEST_H
+#define __HOST_TEST_H
+
+#include "HostBoard.h"
+#include "HostChips.h"
+#include <stdio.h>
+
+struct HostTestCounts {
+    uint32_t checks;
+    uint32_t failures;
+};
+
+inline HostTestCounts &hostTestCounts() {
+    static HostTestCounts counts = {0, 0};
+    return counts;
+}
+
+inline bool hostCheck(bool passed, const char *expression, const char *file, int line) {
+    hostTestCounts().checks++;
+    if (!passed) {
+        hostTestCounts().failures++;
+        printf("%s:%d: CHECK(%s) failed\n", file, line, expression);
+    }
+    return passed;
+}
+
+inline bool hostCheckEqual(long long expected, long long actual, const char *expression, const char *file, int line) {
+    hostTestCounts().checks++;
+    if (expected != actual) {
+        hostTestCounts().failures++;
+        printf("%s:%d: CHECK_EQUAL(%s) - expected %lld, got %lld\n", file, line, expression, expected, actual);
+    }
+    return expected == actual;
+}
+
+#define CHECK(condition) hostCheck((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) hostCheckEqual((long long)(expected), (long long)(actual), #expected ", " #actual, __FILE__, __LINE__)
+
+/**
+ * @brief Prints the tally - 0 for ctest if every check passed
+ */
+inline int hostTestResult(const char *name) {
+    HostTestCounts &counts = hostTestCounts();
+    printf("%s: %u checks, %u failed\n", name, counts.checks, counts.failures);
+    return (counts.failures == 0 && counts.checks > 0) ? 0 : 1;
+}
+
+#endif /* __HOST_TEST_H */
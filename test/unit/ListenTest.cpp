@@ -0,0 +1,165 @@
+/**
+ * @file   ListenTest.cpp - single receive windows in RH_RF95, for listening in low power
+ * @brief  Windows set by the symbol timeout, closing on a timeout or a frame, receiving on demand and the receiver's on time
+ */
+#include "HostTest.h"
+#include <RH_RF95.h>
+#include "device_pinout.h"
+
+static RadioChip chip(RFM95_INT);
+static RH_RF95 radio(RFM95_CS, RFM95_INT);
+
+const uint8_t THIS_ADDRESS = 5;
+
+static void startRadio() {
+    standaloneBoard().attach(RFM95_CS, chip);
+    CHECK(radio.init());
+    radio.setFrequency(915.0);
+    radio.setThisAddress(THIS_ADDRESS);
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf2048);		// As the node listens
+}
+
+static bool arrive(uint8_t payload) {
+    uint8_t frame[] = {THIS_ADDRESS, 0, payload, 0, payload};
+    return chip.receive(frame, sizeof(frame));
+}
+
+static void drain() {
+    while (radio.recv(NULL, NULL)) {}
+}
+
+static void testSymbolTime() {
+    CHECK_EQUAL(16384, radio.symbolTimeUs());				// SF11 at 125 kHz
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf128);
+    CHECK_EQUAL(1024, radio.symbolTimeUs());
+    radio.setModemConfig(RH_RF95::Bw125Cr45Sf2048);
+}
+
+static void testWindowTimesOut() {
+    radio.setReceiveOnDemand(true);
+    radio.setModeRxSingle(300);
+    CHECK_EQUAL(RadioChip::MODE_RXSINGLE, chip.mode());
+    CHECK_EQUAL(300, chip.symbolTimeout());
+    CHECK(radio.receiveWindowOpen());
+
+    delay(300 * 16);										// Nothing heard - the radio gives up by itself
+    CHECK(chip.receiveTimeout());
+    delay(1);
+    CHECK(!radio.receiveWindowOpen());						// The timeout is not on DIO0 - it is only seen here
+    CHECK_EQUAL(RHGenericDriver::RHModeIdle, radio.mode());
+    CHECK_EQUAL(RadioChip::MODE_STDBY, chip.mode());
+    CHECK(!radio.available());
+    CHECK_EQUAL(RadioChip::MODE_STDBY, chip.mode());		// Receiving on demand - available() leaves the receiver off
+
+    radio.setModeRxSingle(1);								// Held to what the register takes
+    CHECK_EQUAL(4, chip.symbolTimeout());
+    radio.setModeRxSingle(5000);
+    CHECK_EQUAL(RH_RF95_MAX_SYMB_TIMEOUT, chip.symbolTimeout());
+    radio.setModeIdle();
+    CHECK(!radio.receiveWindowOpen());
+}
+
+static void testFrameInWindow() {
+    radio.setReceiveOnDemand(true);
+    radio.setModeRxSingle(100);
+    CHECK(arrive(7));
+    delay(1);												// DIO0 wakes the processor
+    CHECK_EQUAL(1, radio.rxQueued());
+    CHECK(!radio.receiveWindowOpen());
+    CHECK_EQUAL(RHGenericDriver::RHModeIdle, radio.mode());
+    CHECK(radio.available());
+    uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    CHECK(radio.recv(buf, &len));
+    CHECK_EQUAL(7, buf[0]);
+    CHECK(!arrive(8));										// The window is closed - nothing more is heard
+}
+
+/**
+ * @brief A frame whose RxDone the processor has not handled yet - receiveWindowOpen() takes it, and only once
+ */
+static void testRxDoneSleptThrough() {
+    radio.setReceiveOnDemand(true);
+    radio.setModeRxSingle(100);
+    CHECK(arrive(9));
+    CHECK(!radio.receiveWindowOpen());
+    CHECK_EQUAL(1, radio.rxQueued());
+    delay(1);												// The interrupt handler finds nothing left to do
+    CHECK_EQUAL(1, radio.rxQueued());
+    drain();
+}
+
+/**
+ * @brief Sending ends receiving on demand, so the acknowledgement is heard
+ */
+static void testSendEndsReceiveOnDemand() {
+    radio.setReceiveOnDemand(true);
+    radio.sleep();
+    uint8_t data[] = {1, 2, 3};
+    CHECK(radio.send(data, sizeof(data)));
+    CHECK(radio.waitPacketSent(100));
+    CHECK(!radio.available());
+    CHECK_EQUAL(RadioChip::MODE_RXCONTINUOUS, chip.mode());
+    radio.sleep();
+}
+
+/**
+ * @brief The receiver's on time over a listening window - on throughout, against single windows from a send to the
+ * end of its slot, which close as the reply comes in
+ */
+static void testReceiverOnTime() {
+    const uint32_t LISTEN_MS = 300000, SLOT_MS = 5000, REPLY_MS = 1800;
+
+    radio.setReceiveOnDemand(false);
+    uint32_t start = radio.rxTimeMs();
+    radio.available();
+    delay(LISTEN_MS);
+    radio.sleep();
+    uint32_t continuousMs = radio.rxTimeMs() - start;
+
+    start = radio.rxTimeMs();
+    uint32_t listenStart = millis();
+    uint8_t data[] = {1, 2, 3};
+    radio.send(data, sizeof(data));
+    radio.waitPacketSent(100);
+    uint32_t sentMs = millis();
+    radio.setReceiveOnDemand(true);
+    uint16_t windows = 0;
+    bool replied = false;
+    while (!replied && millis() - sentMs < SLOT_MS) {		// As listenLowPower() opens them
+        uint32_t symbols = ((SLOT_MS - (millis() - sentMs)) * 1000UL) / radio.symbolTimeUs() + 1;
+        radio.setModeRxSingle(symbols);
+        windows++;
+        uint32_t windowEnd = millis() + (symbols * radio.symbolTimeUs() + 999) / 1000;
+        while ((int32_t)(windowEnd - millis()) > 0) {
+            if (millis() - sentMs >= REPLY_MS && arrive(42)) {
+                replied = true;
+                break;
+            }
+            delay(10);
+        }
+        delay(1);
+        if (radio.receiveWindowOpen() && !replied) chip.receiveTimeout();
+    }
+    radio.sleep();
+    delay(LISTEN_MS - (millis() - listenStart));			// Asleep for the rest of the window
+    uint32_t windowedMs = radio.rxTimeMs() - start;
+    drain();
+
+    printf("Receiver on in a %lu s listening window: %lu ms throughout, %lu ms in %u single windows\n", (unsigned long)(LISTEN_MS / 1000), (unsigned long)continuousMs, (unsigned long)windowedMs, windows);
+    CHECK(replied);
+    CHECK_EQUAL(1, windows);
+    CHECK(continuousMs >= LISTEN_MS - 10);
+    CHECK(windowedMs >= REPLY_MS - 50 && windowedMs <= REPLY_MS + 50);	// Only until the reply came
+}
+
+int main() {
+    startRadio();
+    testSymbolTime();
+    testWindowTimesOut();
+    testFrameInWindow();
+    testRxDoneSleptThrough();
+    testSendEndsReceiveOnDemand();
+    testReceiverOnTime();
+    return hostTestResult("listen_test");
+}
@@ -0,0 +1,253 @@
+/**
+ * @file   MessagesTest.cpp - the message schemas and bit-packed codec in LoRA_Messages.h
+ * @brief  Round trips of every message, the encodings at their limits, and decoding short or truncated frames
+ */
+#include "HostTest.h"
+#include "LoRA_Messages.h"
+#include <random>
+
+using namespace LoRA_Messages;
+
+static std::mt19937 rng(1);
+
+static uint32_t randomIn(uint32_t low, uint32_t high) {
+    return std::uniform_int_distribution<uint32_t>(low, high)(rng);
+}
+
+static DataReport randomReport() {
+    DataReport report;
+    memset(&report, 0, sizeof(report));
+    report.magicNumber = randomIn(0, 0xffff);
+    report.nodeID = randomIn(0, 360);
+    report.hourly = randomIn(0, 0xffff);
+    report.daily = randomIn(0, 0xffff);
+    report.sensorType = randomIn(0, 15);
+    report.temp = (int8_t)randomIn(0, 255);
+    report.battChg = randomIn(0, 100);
+    report.battState = randomIn(0, 7);
+    report.resets = randomIn(0, 255);
+    report.messageCount = randomIn(0, 255);
+    report.successCount = randomIn(0, 255);
+    report.rssi = -(int16_t)randomIn(0, 140);
+    report.snr = (int16_t)randomIn(0, 40) - 20;
+    report.histogramStart = randomIn(0, 287);
+    report.histogram.count = randomIn(0, MAX_HISTOGRAM_BUCKETS);
+    uint16_t top = (randomIn(0, 1)) ? 15 : 0xffff;
+    for (uint8_t i = 0; i < report.histogram.count; i++) report.histogram.buckets[i] = randomIn(0, top);
+    report.chargeUah = randomIn(0, 0xffffffff);
+    return report;
+}
+
+static void checkSame(const DataReport &a, const DataReport &b) {
+    CHECK_EQUAL(a.magicNumber, b.magicNumber);
+    CHECK_EQUAL(a.nodeID, b.nodeID);
+    CHECK_EQUAL(a.hourly, b.hourly);
+    CHECK_EQUAL(a.daily, b.daily);
+    CHECK_EQUAL(a.sensorType, b.sensorType);
+    CHECK_EQUAL(a.temp, b.temp);
+    CHECK_EQUAL(a.battChg, b.battChg);
+    CHECK_EQUAL(a.battState, b.battState);
+    CHECK_EQUAL(a.resets, b.resets);
+    CHECK_EQUAL(a.messageCount, b.messageCount);
+    CHECK_EQUAL(a.successCount, b.successCount);
+    CHECK_EQUAL(a.rssi, b.rssi);
+    CHECK_EQUAL(a.snr, b.snr);
+    CHECK_EQUAL(a.histogramStart, b.histogramStart);
+    CHECK_EQUAL(a.histogram.count, b.histogram.count);
+    for (uint8_t i = 0; i < a.histogram.count; i++) CHECK_EQUAL(a.histogram.buckets[i], b.histogram.buckets[i]);
+    CHECK_EQUAL(a.chargeUah, b.chargeUah);
+}
+
+/**
+ * @brief Every shorter prefix of an encoded message is rejected
+ */
+template <class Message> static void checkTruncationRejected(Message &msg) {
+    uint8_t buf[128];
+    uint8_t len = encode(msg, buf, sizeof(buf));
+    CHECK(len > 0);
+    for (uint8_t cut = 0; cut < len; cut++) {
+        Message decoded;
+        if (!CHECK(!decode(decoded, buf, cut))) break;
+    }
+}
+
+static void testDataReportRoundTrips() {
+    for (int i = 0; i < 2000; i++) {
+        DataReport report = randomReport();
+        uint8_t buf[64];
+        uint8_t len = encode(report, buf, sizeof(buf));
+        CHECK(len > 0 && len <= maxEncodedLen<DataReport>());
+        DataReport decoded;
+        memset(&decoded, 0, sizeof(decoded));
+        CHECK(decode(decoded, buf, len));
+        checkSame(report, decoded);
+        if (i % 100 == 0) checkTruncationRejected(report);
+    }
+}
+
+static void testTypicalReportIsSmall() {
+    DataReport report = {27617, 200, 12, 340, 1, 21, 87, 2, 3, 45, 44, -97, 7, 0, {0, {}}, 0};
+    uint8_t buf[64];
+    uint8_t len = encode(report, buf, sizeof(buf));
+    printf("Typical data report: %u bytes, at most %u\n", len, maxEncodedLen<DataReport>());
+    CHECK(len < 19);									// The hand-packed report it replaced
+}
+
+static void testAcksRoundTrip() {
+    for (int i = 0; i < 1000; i++) {
+        DataAck ack;
+        ack.magicNumber = randomIn(0, 0xffff);
+        ack.time = randomIn(0, 0xffffffff);
+        ack.timeMs = randomIn(0, 999);
+        ack.frequencyMinutes = randomIn(1, 60);
+        ack.alertCode = randomIn(0, 15);
+        ack.sensorType = randomIn(0, 15);
+        ack.openHours = randomIn(0, 1);
+        ack.messageNumber = randomIn(0, 255);
+        ack.slotIndex = randomIn(0, 252);
+        ack.slotCount = randomIn(1, 253);
+        ack.storedReports = randomIn(0, 255);
+        ack.dataRate = randomIn(0, 7);
+        ack.txPower = randomIn(0, 23);
+        uint8_t buf[64];
+        uint8_t len = encode(ack, buf, sizeof(buf));
+        DataAck decoded;
+        CHECK(len > 0 && len <= maxEncodedLen<DataAck>() && decode(decoded, buf, len));
+        CHECK_EQUAL(ack.time, decoded.time);
+        CHECK_EQUAL(ack.timeMs, decoded.timeMs);
+        CHECK_EQUAL(ack.frequencyMinutes, decoded.frequencyMinutes);
+        CHECK_EQUAL(ack.alertCode, decoded.alertCode);
+        CHECK_EQUAL(ack.openHours, decoded.openHours);
+        CHECK_EQUAL(ack.messageNumber, decoded.messageNumber);
+        CHECK_EQUAL(ack.slotIndex, decoded.slotIndex);
+        CHECK_EQUAL(ack.slotCount, decoded.slotCount);
+        CHECK_EQUAL(ack.storedReports, decoded.storedReports);
+        CHECK_EQUAL(ack.dataRate, decoded.dataRate);
+        CHECK_EQUAL(ack.txPower, decoded.txPower);
+        if (i == 0) checkTruncationRejected(ack);
+
+        JoinAck join;
+        join.magicNumber = ack.magicNumber;
+        join.time = ack.time;
+        join.timeMs = ack.timeMs;
+        join.frequencyMinutes = ack.frequencyMinutes;
+        join.alertCode = ack.alertCode;
+        join.nodeID = randomIn(0, 360);
+        join.senderId = randomIn(0, 0xffffffff);
+        join.newNodeNumber = randomIn(1, 253);
+        join.sensorType = ack.sensorType;
+        join.slotIndex = ack.slotIndex;
+        join.slotCount = ack.slotCount;
+        len = encode(join, buf, sizeof(buf));
+        JoinAck joined;
+        CHECK(len > 0 && decode(joined, buf, len));
+        CHECK_EQUAL(join.time, joined.time);
+        CHECK_EQUAL(join.nodeID, joined.nodeID);
+        CHECK_EQUAL(join.senderId, joined.senderId);
+        CHECK_EQUAL(join.newNodeNumber, joined.newNodeNumber);
+        CHECK_EQUAL(join.slotIndex, joined.slotIndex);
+        CHECK_EQUAL(join.slotCount, joined.slotCount);
+        if (i == 0) checkTruncationRejected(join);
+    }
+}
+
+static void testJoinRequest() {
+    JoinRequest request;
+    request.magicNumber = 27617;
+    request.nodeID = 200;
+    strcpy(request.deviceID, "E00FCE68B1A2C3D4E5F60718");
+    request.sensorType = 3;
+    uint8_t buf[64];
+    uint8_t len = encode(request, buf, sizeof(buf));
+    CHECK_EQUAL(maxEncodedLen<JoinRequest>(), len);	// Every field is fixed width
+    JoinRequest decoded;
+    CHECK(decode(decoded, buf, len));
+    CHECK(strcmp(decoded.deviceID, "e00fce68b1a2c3d4e5f60718") == 0);	// Hex digits come back in lower case
+    CHECK_EQUAL(200, decoded.nodeID);
+    CHECK_EQUAL(3, decoded.sensorType);
+    checkTruncationRejected(request);
+}
+
+/**
+ * @brief Encodes one value on its own and reads it back
+ */
+template <class Encoding, typename T> static T roundTrip(T value, size_t *bits = NULL) {
+    uint8_t buf[8] = {};
+    BitWriter w(buf, sizeof(buf));
+    Encoding::encode(w, value);
+    if (bits) *bits = w.position();
+    BitReader r(buf, sizeof(buf));
+    T decoded;
+    Encoding::decode(r, decoded);
+    return decoded;
+}
+
+static void testEncodingLimits() {
+    CHECK_EQUAL(511, roundTrip<Bits<9>>((uint16_t)600));	// Saturates
+    CHECK_EQUAL(0, roundTrip<Bits<9>>((int16_t)-5));
+    CHECK_EQUAL(0xffffffffUL, roundTrip<Bits<32>>((uint32_t)0xffffffffUL));
+    CHECK_EQUAL(63, roundTrip<SignedBits<7>>((int16_t)100));
+    CHECK_EQUAL(-64, roundTrip<SignedBits<7>>((int16_t)-100));
+    CHECK_EQUAL(-1, roundTrip<SignedBits<7>>((int16_t)-1));
+
+    const uint32_t values[] = {0, 127, 128, 16383, 16384, 2097151, 2097152, 0xffffffffUL};
+    const size_t lengths[] = {8, 8, 16, 16, 24, 24, 32, 40};
+    for (uint8_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        size_t bits;
+        CHECK_EQUAL(values[i], roundTrip<Varint>(values[i], &bits));
+        CHECK_EQUAL(lengths[i], bits);
+    }
+}
+
+static void testHistogramModes() {
+    CountHistogram empty = {0, {}};
+    size_t bits;
+    CHECK_EQUAL(0, roundTrip<AdaptiveCounts>(empty, &bits).count);
+    CHECK_EQUAL(4, bits);
+
+    CountHistogram steady = {12, {200, 201, 199, 200, 202, 203, 201, 200, 199, 198, 200, 201}};
+    uint8_t buf[64] = {};
+    BitWriter w(buf, sizeof(buf));
+    AdaptiveCounts::encode(w, steady);
+    CHECK_EQUAL(1, buf[0] >> 3 & 1);					// Delta mode - 12 in the count, then the mode bit
+    BitReader r(buf, sizeof(buf));
+    CountHistogram decoded;
+    AdaptiveCounts::decode(r, decoded);
+    CHECK_EQUAL(12, decoded.count);
+    for (uint8_t i = 0; i < 12; i++) CHECK_EQUAL(steady.buckets[i], decoded.buckets[i]);
+    CHECK(w.position() < 4 + 1 + 5 + 12 * 8);			// Narrower than the raw counts would be
+
+    CountHistogram bursty = {4, {0, 900, 0, 3}};
+    memset(buf, 0, sizeof(buf));
+    BitWriter w2(buf, sizeof(buf));
+    AdaptiveCounts::encode(w2, bursty);
+    CHECK_EQUAL(0, buf[0] >> 3 & 1);					// Raw mode
+    CHECK_EQUAL(4 + 1 + 5 + 4 * 10, w2.position());
+    BitReader r2(buf, sizeof(buf));
+    AdaptiveCounts::decode(r2, decoded);
+    for (uint8_t i = 0; i < 4; i++) CHECK_EQUAL(bursty.buckets[i], decoded.buckets[i]);
+}
+
+static void testOverflowLeavesBufferAlone() {
+    DataReport report = randomReport();
+    uint8_t buf[24];
+    memset(buf, 0xee, sizeof(buf));
+    CHECK_EQUAL(0, encode(report, buf, 8));				// Too small - and nothing past the end is touched
+    for (uint8_t i = 8; i < sizeof(buf); i++) CHECK_EQUAL(0xee, buf[i]);
+
+    BitWriter w(buf, 8);
+    CHECK(!w.put(report));
+    w.rewind(0);
+    CHECK(w.ok());
+}
+
+int main() {
+    testDataReportRoundTrips();
+    testTypicalReportIsSmall();
+    testAcksRoundTrip();
+    testJoinRequest();
+    testEncodingLimits();
+    testHistogramModes();
+    testOverflowLeavesBufferAlone();
+    return hostTestResult("messages_test");
+}
@@ -0,0 +1,247 @@
+/**
+ * @file   MigrationTest.cpp - sysStatus and current loading data saved by older firmware
+ * @brief  Each historical layout is saved as the old firmware saved it, then loaded by this firmware
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+
+extern MB85RC64 fram;
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+
+const uint32_t SYS_MAGIC = 0x20a99e75;
+const uint32_t CURRENT_MAGIC = 0x20a99e80;
+
+typedef StorageHelperRK::PersistentDataBase::SavedDataHeader Header;
+
+// The sysStatus fields of version 2 - before TDMA slots, with nodes numbered 1 to 10 and 11 for unconfigured
+#define SYS_V2_FIELDS \
+    Header header; \
+    uint16_t nodeNumber; \
+    uint8_t structuresVersion; \
+    uint16_t magicNumber; \
+    uint8_t firmwareRelease; \
+    uint8_t resetCount; \
+    time_t lastConnection; \
+    uint16_t frequencyMinutes; \
+    uint8_t alertCodeNode; \
+    time_t alertTimestampNode; \
+    uint8_t sensorType; \
+    bool openHours;
+
+struct SysV2 {
+    SYS_V2_FIELDS
+};
+
+struct SysV3NoCounter {										// Version 3 before frameCounterReserved was added
+    SYS_V2_FIELDS
+    uint16_t slotIndex;
+    uint16_t slotCount;
+    int16_t clockDriftPpm;
+};
+
+struct CurrentV3NoBuckets {									// Version 3 before the count buckets were added
+    Header header;
+    int8_t internalTempC;
+    double stateOfCharge;
+    uint8_t batteryState;
+    time_t lastSampleTime;
+    int16_t RSSI;
+    int16_t SNR;
+    uint8_t messageCount;
+    uint8_t successCount;
+    time_t lastCountTime;
+    uint16_t hourlyCount;
+    uint16_t dailyCount;
+};
+
+/**
+ * @brief A store as older firmware had it - its own layout and version, one copy, at the same place in FRAM
+ */
+template<class Layout>
+class OldStore : public StorageHelperRK::PersistentDataFRAM {
+public:
+    OldStore(size_t offset, uint32_t magic, uint16_t version) : PersistentDataFRAM(::fram, offset, &data.header, sizeof(Layout), magic, version) {}
+
+    /**
+     * @brief Saves data as the old firmware would have - the library fills in the header
+     */
+    void store(const Layout &values) {
+        load();
+        Header header = data.header;
+        data = values;
+        data.header = header;
+        updateHash();
+        save();
+    }
+
+    Layout data = {};
+};
+
+static SysV2 sysV2(uint16_t nodeNumber) {
+    SysV2 values = {};
+    values.nodeNumber = nodeNumber;
+    values.structuresVersion = 1;
+    values.magicNumber = 27617;
+    values.firmwareRelease = 9;
+    values.resetCount = 5;
+    values.lastConnection = 1700000000;
+    values.frequencyMinutes = 15;
+    values.alertCodeNode = 3;
+    values.alertTimestampNode = 1700000100;
+    values.sensorType = 1;
+    values.openHours = false;
+    return values;
+}
+
+static bool keptV2Fields(const SysV2 &old) {
+    return CHECK_EQUAL(old.structuresVersion, sysStatus.get_structuresVersion())
+        && CHECK_EQUAL(old.magicNumber, sysStatus.get_magicNumber())
+        && CHECK_EQUAL(old.firmwareRelease, sysStatus.get_firmwareRelease())
+        && CHECK_EQUAL(old.resetCount, sysStatus.get_resetCount())
+        && CHECK_EQUAL(old.lastConnection, sysStatus.get_lastConnection())
+        && CHECK_EQUAL(old.frequencyMinutes, sysStatus.get_frequencyMinutes())
+        && CHECK_EQUAL(old.alertCodeNode, sysStatus.get_alertCodeNode())
+        && CHECK_EQUAL(old.alertTimestampNode, sysStatus.get_alertTimestampNode())
+        && CHECK_EQUAL(old.sensorType, sysStatus.get_sensorType())
+        && CHECK_EQUAL(old.openHours, sysStatus.get_openHours());
+}
+
+/**
+ * @brief The header of the newer of the A/B copies in FRAM - what the next boot will read
+ */
+static Header storedHeader(size_t offsetA, size_t offsetB) {
+    Header a, b;
+    memcpy(&a, framState.memory + offsetA, sizeof(a));
+    memcpy(&b, framState.memory + offsetB, sizeof(b));
+    return ((int32_t)(b.reserved1 - a.reserved1) > 0) ? b : a;
+}
+
+/**
+ * @brief The upgrade is stored on the first pass of the loop after setup, so the next boot loads the current version
+ * as it is - the same values, no migration
+ */
+static void checkUpgradeStored() {
+    delay(200);
+    sysStatus.loop();
+    Header stored = storedHeader(FRAM_SYS_STATUS_OFFSET, FRAM_SYS_STATUS_B_OFFSET);
+    CHECK_EQUAL(3, stored.version);
+    CHECK_EQUAL(sizeof(sysStatusData::SysData), stored.size);
+    sysStatusData::SysData upgraded = sysStatus.sysData;
+    sysStatus.setup();
+    CHECK(memcmp(&upgraded, &sysStatus.sysData, sizeof(upgraded)) == 0);
+}
+
+static void testSysV2() {
+    FramChip::erase(framState);
+    SysV2 old = sysV2(7);
+    OldStore<SysV2>(FRAM_SYS_STATUS_OFFSET, SYS_MAGIC, 2).store(old);
+
+    sysStatus.setup();
+    CHECK_EQUAL(7, sysStatus.get_nodeNumber());				// Keeps its node number - no join request
+    keptV2Fields(old);
+    CHECK_EQUAL(0, sysStatus.get_slotIndex());
+    CHECK_EQUAL(0, sysStatus.get_slotCount());					// No slot until the Gateway assigns one
+    CHECK_EQUAL(0, sysStatus.get_clockDriftPpm());
+    CHECK_EQUAL(0, sysStatus.get_frameCounterReserved());
+    checkUpgradeStored();
+}
+
+static void testSysV2Unconfigured() {
+    FramChip::erase(framState);
+    OldStore<SysV2>(FRAM_SYS_STATUS_OFFSET, SYS_MAGIC, 2).store(sysV2(11));
+
+    sysStatus.setup();
+    CHECK_EQUAL(UNCONFIGURED_NODE, sysStatus.get_nodeNumber());
+    CHECK_EQUAL(5, sysStatus.get_resetCount());				// Migrated, not reinitialized
+    checkUpgradeStored();
+}
+
+static void testSysV3WithoutCounter() {
+    FramChip::erase(framState);
+    SysV3NoCounter old = {};
+    SysV2 v2 = sysV2(9);
+    memcpy(&old, &v2, sizeof(v2));
+    old.slotIndex = 4;
+    old.slotCount = 12;
+    old.clockDriftPpm = -17;
+    OldStore<SysV3NoCounter>(FRAM_SYS_STATUS_OFFSET, SYS_MAGIC, 3).store(old);
+
+    sysStatus.setup();
+    CHECK_EQUAL(9, sysStatus.get_nodeNumber());
+    keptV2Fields(v2);
+    CHECK_EQUAL(4, sysStatus.get_slotIndex());
+    CHECK_EQUAL(12, sysStatus.get_slotCount());
+    CHECK_EQUAL(-17, sysStatus.get_clockDriftPpm());
+    CHECK_EQUAL(0, sysStatus.get_frameCounterReserved());		// Added at the end - starts at 0
+    checkUpgradeStored();
+}
+
+/**
+ * @brief Versions there is no migration for - older than this tree knows, or newer than the firmware
+ */
+static void testSysReinitialized() {
+    for (uint16_t version : {1, 4}) {
+        FramChip::erase(framState);
+        OldStore<SysV2>(FRAM_SYS_STATUS_OFFSET, SYS_MAGIC, version).store(sysV2(7));
+        sysStatus.setup();
+        CHECK_EQUAL(UNCONFIGURED_NODE, sysStatus.get_nodeNumber());
+        CHECK_EQUAL(0, sysStatus.get_resetCount());
+        CHECK_EQUAL(60, sysStatus.get_frequencyMinutes());
+        delay(200);
+        sysStatus.loop();
+        CHECK_EQUAL(3, storedHeader(FRAM_SYS_STATUS_OFFSET, FRAM_SYS_STATUS_B_OFFSET).version);
+    }
+}
+
+static void testCurrentV3WithoutBuckets() {
+    FramChip::erase(framState);
+    CurrentV3NoBuckets old = {};
+    old.internalTempC = -4;
+    old.stateOfCharge = 81.5;
+    old.batteryState = 2;
+    old.lastSampleTime = 1700000200;
+    old.RSSI = -97;
+    old.SNR = 8;
+    old.messageCount = 40;
+    old.successCount = 38;
+    old.lastCountTime = 1700000300;
+    old.hourlyCount = 17;
+    old.dailyCount = 250;									// Today's counts are not lost
+    OldStore<CurrentV3NoBuckets>(FRAM_CURRENT_STATUS_OFFSET, CURRENT_MAGIC, 3).store(old);
+
+    current.setup();
+    CHECK_EQUAL(-4, current.get_internalTempC());
+    CHECK(current.get_stateOfCharge() == 81.5);
+    CHECK_EQUAL(2, current.get_batteryState());
+    CHECK_EQUAL(1700000200, current.get_lastSampleTime());
+    CHECK_EQUAL(-97, current.get_RSSI());
+    CHECK_EQUAL(8, current.get_SNR());
+    CHECK_EQUAL(40, current.get_messageCount());
+    CHECK_EQUAL(38, current.get_successCount());
+    CHECK_EQUAL(1700000300, current.get_lastCountTime());
+    CHECK_EQUAL(17, current.get_hourlyCount());
+    CHECK_EQUAL(250, current.get_dailyCount());
+    CHECK_EQUAL(0, current.get_bucketStart());
+    for (uint8_t i = 0; i < MAX_COUNT_BUCKETS; i++) CHECK_EQUAL(0, current.get_countBucket(i));
+
+    delay(300);
+    current.loop();
+    CHECK_EQUAL(sizeof(currentStatusData::CurrentData), storedHeader(FRAM_CURRENT_STATUS_OFFSET, FRAM_CURRENT_STATUS_B_OFFSET).size);
+    currentStatusData::CurrentData grown = current.currentData;
+    current.setup();
+    CHECK(memcmp(&grown, &current.currentData, sizeof(grown)) == 0);
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+    delay(1000);											// As long as a boot takes - a change at millis() 0 looks like no change to flush()
+
+    testSysV2();
+    testSysV2Unconfigured();
+    testSysV3WithoutCounter();
+    testSysReinitialized();
+    testCurrentV3WithoutBuckets();
+    return hostTestResult("migration_test");
+}
@@ -0,0 +1,316 @@
+/**
+ * @file   ReliableDatagramTest.cpp - the asynchronous send in RHReliableDatagram over a LoopbackDriver
+ * @brief  sendtoAsync() and pollSend() - the ACK matched to the message, retries, duplicates re-acknowledged while
+ * waiting, cancelling, one send at a time and the callback called once
+ */
+#include "HostTest.h"
+#include "LoopbackDriver.h"
+#include <RHReliableDatagram.h>
+
+const uint8_t NODE_ADDRESS = 1;
+const uint8_t GATEWAY_ADDRESS = 0;
+const uint8_t PEER_ADDRESS = 2;
+
+/**
+ * @brief A device on the channel - its own radio and reliable datagram layer
+ */
+struct Device {
+    LoopbackDriver radio;
+    RHReliableDatagram manager;
+
+    Device(LoopbackChannel &channel, uint8_t address) : radio(channel), manager(radio, address) {
+        manager.init();
+        manager.setTimeout(100);
+        manager.setRetries(2);
+    }
+};
+
+/**
+ * @brief What the completion callback saw
+ */
+struct Completion {
+    uint8_t calls;
+    uint8_t handle;
+    bool acked;
+};
+
+static void onComplete(uint8_t handle, bool acked, void *context) {
+    Completion *completion = (Completion *)context;
+    completion->calls++;
+    completion->handle = handle;
+    completion->acked = acked;
+}
+
+/**
+ * @brief Puts a frame on the air with the headers given, as another device's radio would
+ */
+static void transmit(LoopbackDriver &radio, uint8_t to, uint8_t from, uint8_t id, uint8_t flags) {
+    uint8_t data = '!';
+    radio.setHeaderTo(to);
+    radio.setHeaderFrom(from);
+    radio.setHeaderId(id);
+    radio.setHeaderFlags(flags, 0xff);
+    radio.send(&data, sizeof(data));
+}
+
+/**
+ * @brief Calls pollSend() every 10 ms until the send completes
+ * @return The time it took in ms
+ */
+static uint32_t pollUntilDone(RHReliableDatagram &manager) {
+    uint32_t start = millis();
+    while (manager.pollSend() && millis() - start < 10000) delay(10);
+    return millis() - start;
+}
+
+static void testAcked() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    Device gateway(channel, GATEWAY_ADDRESS);
+    Completion completion = {};
+
+    uint8_t data[] = {1, 2, 3};
+    uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS, onComplete, &completion);
+    CHECK(handle != 0);
+    data[0] = 9;											// Copied - the caller's buffer can be reused at once
+    CHECK_EQUAL(1, channel.sent.size());
+    CHECK_EQUAL(1, channel.sent.back().data[0]);
+    CHECK_EQUAL(handle, channel.sent.back().id);
+    CHECK(node.manager.sendInProgress());
+    CHECK(node.manager.pollSend());							// Waiting for the ACK
+    CHECK_EQUAL(0, node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS));	// One at a time
+    CHECK_EQUAL(1, channel.sent.size());
+
+    uint8_t buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    CHECK(gateway.manager.recvfromAck(buf, &len));			// Sends the ACK
+    CHECK_EQUAL(0, completion.calls);						// Not until pollSend() sees it
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, completion.calls);
+    CHECK_EQUAL(handle, completion.handle);
+    CHECK(completion.acked);
+    CHECK(node.manager.lastSendAcked());
+    CHECK(!node.manager.sendInProgress());
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, completion.calls);						// Once only
+    CHECK_EQUAL(0, node.manager.retransmissions());
+}
+
+/**
+ * @brief Only an ACK from the address sent to, to us, with the message's sequence number, completes the send
+ */
+static void testAckMatched() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    LoopbackDriver peer(channel);
+    peer.init();
+    Completion completion = {};
+
+    uint8_t data[] = {4};
+    uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS, onComplete, &completion);
+    CHECK(node.manager.pollSend());
+    transmit(peer, NODE_ADDRESS, GATEWAY_ADDRESS, (uint8_t)(handle - 1), RH_FLAGS_ACK);	// An earlier message's ACK
+    CHECK(node.manager.pollSend());
+    transmit(peer, NODE_ADDRESS, PEER_ADDRESS, handle, RH_FLAGS_ACK);	// From someone else
+    CHECK(node.manager.pollSend());
+    transmit(peer, RH_BROADCAST_ADDRESS, GATEWAY_ADDRESS, handle, RH_FLAGS_ACK);	// Not to us
+    CHECK(node.manager.pollSend());
+    transmit(peer, NODE_ADDRESS, GATEWAY_ADDRESS, handle, RH_FLAGS_NONE);	// Not an ACK
+    CHECK(node.manager.pollSend());
+    CHECK_EQUAL(0, completion.calls);
+
+    transmit(peer, NODE_ADDRESS, GATEWAY_ADDRESS, handle, RH_FLAGS_ACK);
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, completion.calls);
+    CHECK(completion.acked);
+}
+
+/**
+ * @brief With no ACK the message is sent 1 + retries times, each after a timeout of 1 to 2 times setTimeout()
+ */
+static void testRetriesExhausted() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    Completion completion = {};
+
+    uint8_t data[] = {5, 6};
+    uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS, onComplete, &completion);
+    uint32_t tookMs = pollUntilDone(node.manager);
+    CHECK_EQUAL(3, channel.sent.size());
+    for (size_t i = 0; i < channel.sent.size(); i++) {
+        CHECK_EQUAL(handle, channel.sent[i].id);
+        CHECK_EQUAL(i == 0 ? 0 : RH_FLAGS_RETRY, channel.sent[i].flags & RH_FLAGS_RETRY);
+    }
+    CHECK(tookMs >= 3 * 100 && tookMs <= 3 * 200 + 30);
+    CHECK_EQUAL(1, completion.calls);
+    CHECK_EQUAL(handle, completion.handle);
+    CHECK(!completion.acked);
+    CHECK(!node.manager.lastSendAcked());
+    CHECK_EQUAL(2, node.manager.retransmissions());
+
+    node.manager.setRetries(0);								// Sent once
+    channel.sent.clear();
+    node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS);
+    pollUntilDone(node.manager);
+    CHECK_EQUAL(1, channel.sent.size());
+    CHECK_EQUAL(0, channel.sent[0].flags & RH_FLAGS_RETRY);	// A new message starts without the flag
+}
+
+/**
+ * @brief A request we have already received and acknowledged comes again while we wait - its ACK was lost, so we
+ * acknowledge it again and keep waiting for ours
+ */
+static void testDuplicateReacked() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    LoopbackDriver peer(channel);
+    peer.init();
+
+    transmit(peer, NODE_ADDRESS, PEER_ADDRESS, 42, RH_FLAGS_NONE);
+    uint8_t buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    CHECK(node.manager.recvfromAck(buf, &len));
+    CHECK_EQUAL(RH_FLAGS_ACK, channel.sent.back().flags & RH_FLAGS_ACK);
+
+    uint8_t data[] = {7};
+    uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS);
+    CHECK_EQUAL(handle, channel.sent.back().id);
+    CHECK(node.manager.pollSend());
+    size_t sentBefore = channel.sent.size();
+    transmit(peer, NODE_ADDRESS, PEER_ADDRESS, 42, RH_FLAGS_RETRY);
+    CHECK(node.manager.pollSend());
+    CHECK_EQUAL(sentBefore + 2, channel.sent.size());		// The peer's frame and our ACK to it
+    const LoopbackChannel::Frame &ack = channel.sent.back();
+    CHECK_EQUAL(PEER_ADDRESS, ack.to);
+    CHECK_EQUAL(42, ack.id);
+    CHECK_EQUAL(RH_FLAGS_ACK, ack.flags & RH_FLAGS_ACK);
+
+    transmit(peer, NODE_ADDRESS, PEER_ADDRESS, 43, RH_FLAGS_NONE);	// A new request is not acknowledged here
+    sentBefore = channel.sent.size();
+    CHECK(node.manager.pollSend());
+    CHECK_EQUAL(sentBefore, channel.sent.size());
+    CHECK(node.manager.sendInProgress());					// Still waiting for ours
+    node.manager.cancelSend();
+}
+
+static void testCancel() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    Device gateway(channel, GATEWAY_ADDRESS);
+    Completion completion = {};
+
+    uint8_t data[] = {8};
+    uint8_t first = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS, onComplete, &completion);
+    CHECK(node.manager.pollSend());
+    node.manager.cancelSend();
+    CHECK(!node.manager.sendInProgress());
+    CHECK(!node.manager.pollSend());
+    delay(1000);
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, channel.sent.size());					// No retries after cancelling
+    CHECK_EQUAL(0, completion.calls);						// And no callback
+
+    uint8_t second = node.manager.sendtoAsync(data, sizeof(data), GATEWAY_ADDRESS, onComplete, &completion);
+    CHECK(second != 0);
+    CHECK(second != first);
+    transmit(gateway.radio, NODE_ADDRESS, GATEWAY_ADDRESS, first, RH_FLAGS_ACK);	// The cancelled message's ACK, late
+    CHECK(node.manager.pollSend());
+    CHECK_EQUAL(0, completion.calls);
+    transmit(gateway.radio, NODE_ADDRESS, GATEWAY_ADDRESS, second, RH_FLAGS_ACK);
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, completion.calls);
+    CHECK_EQUAL(second, completion.handle);
+}
+
+/**
+ * @brief Broadcasts are not acknowledged - they complete as soon as they are sent
+ */
+static void testBroadcast() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    Completion completion = {};
+
+    uint8_t data[] = {9};
+    uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), RH_BROADCAST_ADDRESS, onComplete, &completion);
+    CHECK(!node.manager.pollSend());
+    CHECK_EQUAL(1, completion.calls);
+    CHECK_EQUAL(handle, completion.handle);
+    CHECK(completion.acked);
+    CHECK_EQUAL(1, channel.sent.size());
+}
+
+/**
+ * @brief The callback can start the next send - the engine is idle by then
+ */
+struct Chain {
+    RHReliableDatagram *manager;
+    uint8_t started;
+    uint8_t completed;
+};
+
+static void sendNext(uint8_t handle, bool acked, void *context) {
+    Chain *chain = (Chain *)context;
+    chain->completed++;
+    if (chain->started < 3) {
+        uint8_t data[] = {chain->started};
+        if (chain->manager->sendtoAsync(data, sizeof(data), RH_BROADCAST_ADDRESS, sendNext, chain)) chain->started++;
+    }
+}
+
+static void testCallbackStartsNext() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    Chain chain = {&node.manager, 1, 0};
+
+    uint8_t data[] = {0};
+    CHECK(node.manager.sendtoAsync(data, sizeof(data), RH_BROADCAST_ADDRESS, sendNext, &chain));
+    pollUntilDone(node.manager);
+    pollUntilDone(node.manager);
+    pollUntilDone(node.manager);
+    CHECK_EQUAL(3, chain.started);
+    CHECK_EQUAL(3, chain.completed);
+    CHECK_EQUAL(3, channel.sent.size());
+}
+
+/**
+ * @brief The handle is the sequence number, and 0 is never one - it means the send did not start
+ */
+static void testHandleNeverZero() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    uint8_t data[] = {0};
+    bool sawZero = false;
+    for (int i = 0; i < 600; i++) {
+        uint8_t handle = node.manager.sendtoAsync(data, sizeof(data), RH_BROADCAST_ADDRESS);
+        if (handle == 0) sawZero = true;
+        node.manager.pollSend();
+    }
+    CHECK(!sawZero);
+    CHECK_EQUAL(600, channel.sent.size());
+}
+
+/**
+ * @brief sendtoWait() is the asynchronous send run to completion
+ */
+static void testSendtoWait() {
+    LoopbackChannel channel;
+    Device node(channel, NODE_ADDRESS);
+    uint8_t data[] = {1};
+    uint32_t start = millis();
+    CHECK(!node.manager.sendtoWait(data, sizeof(data), GATEWAY_ADDRESS));
+    CHECK(millis() - start >= 3 * 100);
+    CHECK_EQUAL(3, channel.sent.size());
+}
+
+int main() {
+    testAcked();
+    testAckMatched();
+    testRetriesExhausted();
+    testDuplicateReacked();
+    testCancel();
+    testBroadcast();
+    testCallbackStartsNext();
+    testHandleNeverZero();
+    testSendtoWait();
+    return hostTestResult("reliable_datagram_test");
+}
@@ -0,0 +1,174 @@
+/**
+ * @file   ReportBacklogTest.cpp - the ring of undelivered data reports in FRAM
+ * @brief  Wraparound, a power cut at every byte of an append, and how many stored reports a data report drains
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+#include <RHMesh.h>
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+
+typedef reportBacklogData::ReportRecord ReportRecord;
+const uint16_t CAPACITY = reportBacklogData::BACKLOG_CAPACITY;
+
+/**
+ * @brief A blank FRAM and a fresh boot
+ */
+static void eraseFram() {
+    FramChip::erase(framState);
+    reportBacklog.setup();
+}
+
+static void append(uint32_t n) {
+    CHECK(reportBacklog.append(1767225600UL + n * 3600UL, (uint16_t)n, (uint16_t)(n * 2)));
+}
+
+/**
+ * @brief The pending reports are first to first + count - 1, oldest first
+ */
+static void checkPending(uint32_t first, uint16_t count) {
+    CHECK_EQUAL(count, reportBacklog.pendingCount());
+    for (uint16_t i = 0; i < count; i++) {
+        ReportRecord record;
+        if (!CHECK(reportBacklog.peek(i, record))) return;
+        CHECK_EQUAL(first + i, record.hourlyCount);
+        CHECK_EQUAL(1767225600UL + (first + i) * 3600UL, record.timestamp);
+    }
+    ReportRecord record;
+    CHECK(!reportBacklog.peek(count, record));
+}
+
+static void testAppendConsumeAndReboot() {
+    eraseFram();
+    CHECK_EQUAL(0, reportBacklog.pendingCount());
+    for (uint32_t n = 0; n < 10; n++) append(n);
+    checkPending(0, 10);
+
+    reportBacklog.consume(4);
+    checkPending(4, 6);
+    reportBacklog.setup();								// Sent reports stay sent through a reboot
+    checkPending(4, 6);
+
+    reportBacklog.consume(100);							// More than there are
+    checkPending(10, 0);
+    reportBacklog.setup();
+    checkPending(10, 0);
+    append(10);											// And sequence numbers carry on
+    reportBacklog.setup();
+    checkPending(10, 1);
+}
+
+static void testWraparound() {
+    eraseFram();
+    for (uint32_t n = 0; n < CAPACITY + 40; n++) append(n);
+    checkPending(40, CAPACITY);							// Full - the oldest were dropped
+    reportBacklog.setup();
+    checkPending(40, CAPACITY);
+
+    reportBacklog.consume(100);
+    for (uint32_t n = CAPACITY + 40; n < CAPACITY + 50; n++) append(n);
+    checkPending(140, CAPACITY + 50 - 140);
+    reportBacklog.setup();
+    checkPending(140, CAPACITY + 50 - 140);
+
+    for (uint32_t n = CAPACITY + 50; n < 5 * CAPACITY; n++) append(n);	// Round several times
+    reportBacklog.setup();
+    checkPending(4 * CAPACITY, CAPACITY);
+}
+
+/**
+ * @brief Cuts the power after each byte of an append in turn - the pending reports always come back as an intact run
+ * ending with the report before or, once the append has finished, with the new one. Overwriting the oldest pending
+ * report may lose it, as the append was going to drop it anyway
+ */
+static void testPowerCutDuringAppend(uint32_t alreadyAppended, uint16_t alreadySent) {
+    for (int32_t cut = 0; ; cut++) {
+        eraseFram();
+        for (uint32_t n = 0; n < alreadyAppended; n++) append(n);
+        reportBacklog.consume(alreadySent);
+        uint16_t pending = reportBacklog.pendingCount();
+
+        bool powerLost = false;
+        framChip.cutAfterBytes = cut;
+        try {
+            append(alreadyAppended);
+        }
+        catch (HostBoard::Reset &reset) {
+            powerLost = true;
+        }
+        framChip.cutAfterBytes = -1;
+        reportBacklog.setup();
+
+        uint16_t after = reportBacklog.pendingCount();
+        ReportRecord newest;
+        if (!CHECK(after > 0 && reportBacklog.peek(after - 1, newest))) return;
+        checkPending(newest.hourlyCount + 1 - after, after);
+        if (!powerLost) {								// The cut came after the last byte
+            CHECK_EQUAL(alreadyAppended, newest.hourlyCount);
+            CHECK_EQUAL(min(pending + 1, (int)CAPACITY), after);
+            break;
+        }
+        CHECK_EQUAL(alreadyAppended - 1, newest.hourlyCount);	// Not there until the state byte - the last one written
+        CHECK(after == pending || (pending == CAPACITY && after == CAPACITY - 1));
+    }
+}
+
+/**
+ * @brief Packs stored reports after a full data report as composeDataReportNode() does - over half a day of hourly
+ * reports go in each frame
+ */
+static void testDrainThroughput() {
+    eraseFram();
+    for (uint32_t n = 0; n < CAPACITY; n++) append(n);
+
+    uint16_t frames = 0;
+    uint16_t perFrame = 0;
+    while (reportBacklog.pendingCount() > 0) {
+        uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];
+        LoRA_Messages::BitWriter writer(buf, sizeof(buf));
+        LoRA_Messages::DataReport report;
+        memset(&report, 0, sizeof(report));
+        report.magicNumber = 0xffff;
+        report.hourly = report.daily = 0xffff;
+        report.histogram.count = MAX_COUNT_BUCKETS;
+        for (uint8_t i = 0; i < MAX_COUNT_BUCKETS; i++) report.histogram.buckets[i] = 300;
+        CHECK(writer.put(report));
+        writer.write(0, 8);
+
+        uint16_t carried = 0;
+        ReportRecord record;
+        while (reportBacklog.peek(carried, record)) {
+            LoRA_Messages::StoredReport stored;
+            stored.timestamp = record.timestamp;
+            stored.hourly = record.hourlyCount;
+            stored.daily = record.dailyCount;
+            size_t mark = writer.position();
+            if (!writer.put(stored)) {
+                writer.rewind(mark);
+                break;
+            }
+            carried++;
+        }
+        if (!CHECK(carried > 0)) break;
+        if (frames == 0) perFrame = carried;
+        reportBacklog.consume(carried);
+        frames++;
+    }
+    printf("Drain: %u stored reports in %u data reports of up to %u bytes - %u in the first\n", CAPACITY, frames, (unsigned)RH_MESH_MAX_MESSAGE_LEN, perFrame);
+    CHECK(perFrame >= 10);
+    CHECK(frames <= (CAPACITY + perFrame - 1) / perFrame + 1);
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+    Time.setTime(1767225600UL);
+
+    testAppendConsumeAndReboot();
+    testWraparound();
+    testPowerCutDuringAppend(5, 2);						// Into an empty slot
+    testPowerCutDuringAppend(CAPACITY + 3, 0);			// Over the oldest pending report
+    testPowerCutDuringAppend(CAPACITY + 3, CAPACITY - 3);	// Over a sent report
+    testDrainThroughput();
+    return hostTestResult("report_backlog_test");
+}
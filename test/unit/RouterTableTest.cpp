@@ -0,0 +1,211 @@
+/**
+ * @file   RouterTableTest.cpp - the routing table in RHRouter
+ * @brief  The least recently used route retired when the table is full, and the route count kept as routes are added,
+ * updated, made Invalid and deleted
+ */
+#include "HostTest.h"
+#include "LoopbackDriver.h"
+#include <RHRouter.h>
+#include <list>
+#include <map>
+
+/**
+ * @brief A router with its protected deleteRoute() in reach
+ */
+class TestRouter : public RHRouter {
+public:
+    explicit TestRouter(RHGenericDriver &driver) : RHRouter(driver, 0) {}
+    using RHRouter::deleteRoute;
+};
+
+static LoopbackChannel channel;
+static LoopbackDriver radio(channel);
+static TestRouter router(radio);
+
+/**
+ * @brief The routes the table holds, counted one by one - routeCount() has to agree
+ */
+static uint16_t countedRoutes() {
+    uint16_t count = 0;
+    for (uint16_t dest = 0; dest < 256; dest++) {
+        if (router.peekRouteTo(dest)) count++;
+    }
+    return count;
+}
+
+static bool countConsistent() {
+    return CHECK_EQUAL(countedRoutes(), router.routeCount()) && CHECK(router.routeCount() <= RH_ROUTING_TABLE_SIZE);
+}
+
+static void fill() {
+    router.clearRoutingTable();
+    for (uint16_t dest = 1; dest <= RH_ROUTING_TABLE_SIZE; dest++) router.addRouteTo(dest, 200);
+}
+
+static void testFull() {
+    fill();
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE, router.routeCount());
+    countConsistent();
+
+    router.addRouteTo(RH_ROUTING_TABLE_SIZE + 1, 200);		// Room is made by retiring the first added
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE, router.routeCount());
+    CHECK(router.peekRouteTo(1) == NULL);
+    CHECK(router.peekRouteTo(2) != NULL);
+    CHECK(router.peekRouteTo(RH_ROUTING_TABLE_SIZE + 1) != NULL);
+    countConsistent();
+
+    router.addRouteTo(RH_ROUTING_TABLE_SIZE + 1, 201);		// An update is not a new route
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE, router.routeCount());
+    CHECK(router.peekRouteTo(2) != NULL);
+    CHECK_EQUAL(201, router.peekRouteTo(RH_ROUTING_TABLE_SIZE + 1)->next_hop);
+    countConsistent();
+}
+
+/**
+ * @brief A lookup or an update makes a route recent - peeking does not
+ */
+static void testLeastRecentlyUsedRetired() {
+    fill();
+    CHECK(router.getRouteTo(1) != NULL);					// Used - 2 is now the oldest
+    CHECK(router.peekRouteTo(2) != NULL);					// Peeking leaves it the oldest
+    router.addRouteTo(3, 201);								// Updated - so is not retired next either
+    router.addRouteTo(RH_ROUTING_TABLE_SIZE + 1, 200);
+    CHECK(router.peekRouteTo(1) != NULL);
+    CHECK(router.peekRouteTo(2) == NULL);
+    CHECK(router.peekRouteTo(3) != NULL);
+
+    router.addRouteTo(RH_ROUTING_TABLE_SIZE + 2, 200);		// Then the oldest untouched
+    CHECK(router.peekRouteTo(4) == NULL);
+    CHECK(router.peekRouteTo(3) != NULL);
+    countConsistent();
+
+    router.retireOldestRoute();								// Called directly too
+    CHECK(router.peekRouteTo(5) == NULL);
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE - 1, router.routeCount());
+    router.addRouteTo(5, 200);								// There is room now - nothing retired
+    CHECK(router.peekRouteTo(6) != NULL);
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE, router.routeCount());
+    countConsistent();
+}
+
+/**
+ * @brief A route made Invalid by addRouteTo() stops being counted, and counts again when it is Valid
+ */
+static void testStateChanges() {
+    router.clearRoutingTable();
+    router.addRouteTo(10, 20);
+    router.addRouteTo(11, 20);
+    CHECK_EQUAL(2, router.routeCount());
+
+    router.addRouteTo(10, 20, RHRouter::Invalid);
+    CHECK_EQUAL(1, router.routeCount());
+    CHECK(router.peekRouteTo(10) == NULL);
+    CHECK(router.getRouteTo(10) == NULL);
+    router.addRouteTo(10, 20, RHRouter::Invalid);			// Invalid to Invalid - no change
+    router.addRouteTo(12, 20, RHRouter::Invalid);			// Nor for one never known
+    CHECK_EQUAL(1, router.routeCount());
+
+    router.addRouteTo(10, 21, RHRouter::Discovering);		// Any state but Invalid is a route
+    CHECK_EQUAL(2, router.routeCount());
+    router.addRouteTo(10, 21, RHRouter::Valid);
+    CHECK_EQUAL(2, router.routeCount());
+    countConsistent();
+
+    fill();													// Made Invalid at full - the next add needs no retirement
+    router.addRouteTo(7, 200, RHRouter::Invalid);
+    router.addRouteTo(RH_ROUTING_TABLE_SIZE + 1, 200);
+    CHECK(router.peekRouteTo(1) != NULL);
+    CHECK_EQUAL(RH_ROUTING_TABLE_SIZE, router.routeCount());
+    countConsistent();
+}
+
+static void testDelete() {
+    router.clearRoutingTable();
+    router.addRouteTo(30, 40);
+    CHECK(router.deleteRouteTo(30));
+    CHECK_EQUAL(0, router.routeCount());
+    CHECK(!router.deleteRouteTo(30));						// Already gone
+    CHECK(!router.deleteRouteTo(31));						// Never there
+    CHECK_EQUAL(0, router.routeCount());
+
+    router.addRouteTo(30, 40);
+    router.deleteRoute(31);									// An empty slot - the count is not touched
+    router.deleteRoute(31);
+    CHECK_EQUAL(1, router.routeCount());
+    router.deleteRoute(30);
+    router.deleteRoute(30);
+    CHECK_EQUAL(0, router.routeCount());
+    countConsistent();
+
+    fill();
+    router.clearRoutingTable();
+    CHECK_EQUAL(0, router.routeCount());
+    countConsistent();
+}
+
+/**
+ * @brief Random adds, updates, lookups, Invalid routes and deletes, against a plain LRU list of what should be there
+ */
+static void testAgainstModel() {
+    router.clearRoutingTable();
+    std::list<uint8_t> lru;									// Least recently used first
+    std::map<uint8_t, uint8_t> nextHops;
+    uint32_t seed = 11;
+    uint32_t mismatches = 0;
+    for (int op = 0; op < 20000; op++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t dest = (uint8_t)((seed >> 16) % 120);
+        uint8_t hop = (uint8_t)(seed >> 24);
+        bool known = nextHops.count(dest) != 0;
+        switch ((seed >> 8) % 5) {
+        case 0:
+        case 1:
+            router.addRouteTo(dest, hop);
+            if (known) {
+                lru.remove(dest);
+            }
+            else if (lru.size() >= RH_ROUTING_TABLE_SIZE) {
+                nextHops.erase(lru.front());
+                lru.pop_front();
+            }
+            lru.push_back(dest);
+            nextHops[dest] = hop;
+            break;
+        case 2:
+            if ((router.getRouteTo(dest) != NULL) != known) mismatches++;
+            if (known) {
+                lru.remove(dest);
+                lru.push_back(dest);
+            }
+            break;
+        case 3:
+            router.addRouteTo(dest, hop, RHRouter::Invalid);
+            lru.remove(dest);
+            nextHops.erase(dest);
+            break;
+        case 4:
+            if (router.deleteRouteTo(dest) != known) mismatches++;
+            lru.remove(dest);
+            nextHops.erase(dest);
+            break;
+        }
+        if (router.routeCount() != lru.size()) mismatches++;
+    }
+    CHECK_EQUAL(0, mismatches);
+    for (uint16_t dest = 0; dest < 256; dest++) {
+        const RHRouter::RoutingTableEntry *route = router.peekRouteTo(dest);
+        if (!CHECK((route != NULL) == (nextHops.count(dest) != 0))) break;
+        if (route && !CHECK_EQUAL(nextHops[dest], route->next_hop)) break;
+    }
+    countConsistent();
+}
+
+int main() {
+    radio.init();
+    testFull();
+    testLeastRecentlyUsedRetired();
+    testStateChanges();
+    testDelete();
+    testAgainstModel();
+    return hostTestResult("router_table_test");
+}
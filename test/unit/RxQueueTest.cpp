@@ -0,0 +1,154 @@
+/**
+ * @file   RxQueueTest.cpp - the receive queue in RH_RF95
+ * @brief  Frames that arrive before recv() is called are kept, in order, each with its own RSSI and SNR
+ */
+#include "HostTest.h"
+#include <RH_RF95.h>
+#include "device_pinout.h"
+
+static RadioChip chip(RFM95_INT);
+static RH_RF95 radio(RFM95_CS, RFM95_INT);
+
+const uint8_t THIS_ADDRESS = 5;
+
+static void startRadio() {
+    standaloneBoard().attach(RFM95_CS, chip);
+    CHECK(radio.init());
+    radio.setFrequency(915.0);
+    radio.setThisAddress(THIS_ADDRESS);
+}
+
+/**
+ * @brief Puts a frame on the air to the radio and lets its interrupt handler run
+ */
+static void arrive(uint8_t to, uint8_t from, uint8_t payload, int8_t snr, int16_t rssi) {
+    uint8_t frame[] = {to, from, payload, 0, payload, (uint8_t)(payload + 1)};
+    CHECK(chip.receive(frame, sizeof(frame), snr, rssi));
+    delay(1);
+}
+
+/**
+ * @brief What RH_RF95 makes of a packet RSSI from the HF port with a positive SNR
+ */
+static int16_t reportedRssi(int16_t rssi) {
+    return (int16_t)((rssi + 157) * 16 / 15 - 157);
+}
+
+static void drain() {
+    while (radio.recv(NULL, NULL)) {}
+    radio.resetRxDropped();
+}
+
+static void testFramesWaitInOrder() {
+    CHECK(!radio.available());						// Starts the receiver
+    CHECK_EQUAL(RadioChip::MODE_RXCONTINUOUS, chip.mode());
+    arrive(THIS_ADDRESS, 1, 10, 9, -40);
+    arrive(THIS_ADDRESS, 2, 20, 3, -80);
+    arrive(THIS_ADDRESS, 3, 30, 6, -100);
+    CHECK_EQUAL(3, radio.rxQueued());
+    CHECK_EQUAL(RadioChip::MODE_RXCONTINUOUS, chip.mode());	// Still listening with frames waiting
+
+    const int8_t snrs[] = {9, 3, 6};
+    const int16_t rssis[] = {-40, -80, -100};
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+        uint8_t len = sizeof(buf);
+        CHECK(radio.recv(buf, &len));
+        CHECK_EQUAL(2, len);
+        CHECK_EQUAL(10 * (i + 1), buf[0]);
+        CHECK_EQUAL(i + 1, radio.headerFrom());
+        CHECK_EQUAL(snrs[i], radio.lastSNR());
+        CHECK_EQUAL(reportedRssi(rssis[i]), radio.lastRssi());
+    }
+    CHECK(!radio.recv(NULL, NULL));
+    CHECK_EQUAL(0, radio.rxDropped());
+}
+
+static void testFullQueueCountsDrops() {
+    radio.available();
+    for (uint8_t i = 0; i < RH_RF95_RX_QUEUE_LEN + 2; i++) arrive(THIS_ADDRESS, 1, i, 8, -60);
+    CHECK_EQUAL(RH_RF95_RX_QUEUE_LEN, radio.rxQueued());
+    CHECK_EQUAL(2, radio.rxDropped());
+
+    uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    CHECK(radio.recv(buf, &len));
+    CHECK_EQUAL(0, buf[0]);							// The oldest are kept, the latest dropped
+    arrive(THIS_ADDRESS, 1, 99, 8, -60);			// And a freed slot takes the next
+    CHECK_EQUAL(RH_RF95_RX_QUEUE_LEN, radio.rxQueued());
+    for (uint8_t i = 1; i < RH_RF95_RX_QUEUE_LEN; i++) {
+        len = sizeof(buf);
+        CHECK(radio.recv(buf, &len));
+        CHECK_EQUAL(i, buf[0]);
+    }
+    len = sizeof(buf);
+    CHECK(radio.recv(buf, &len));
+    CHECK_EQUAL(99, buf[0]);
+    drain();
+}
+
+/**
+ * @brief With the queue full, frames for other nodes on a busy channel are not counted as dropped
+ */
+static void testFullQueueCountsOnlyOurDrops() {
+    radio.available();
+    for (uint8_t i = 0; i < RH_RF95_RX_QUEUE_LEN; i++) arrive(THIS_ADDRESS, 1, i, 8, -60);
+    for (uint8_t i = 0; i < 5; i++) arrive(THIS_ADDRESS + 1, 1, i, 8, -60);
+    CHECK_EQUAL(0, radio.rxDropped());
+    arrive(RH_BROADCAST_ADDRESS, 1, 7, 8, -60);
+    arrive(THIS_ADDRESS, 1, 8, 8, -60);
+    CHECK_EQUAL(2, radio.rxDropped());
+    CHECK_EQUAL(RH_RF95_RX_QUEUE_LEN, radio.rxQueued());
+    drain();
+}
+
+static void testOnlyOurFramesQueue() {
+    radio.available();
+    arrive(THIS_ADDRESS + 1, 1, 1, 8, -60);
+    CHECK_EQUAL(0, radio.rxQueued());
+    arrive(RH_BROADCAST_ADDRESS, 1, 2, 8, -60);
+    CHECK_EQUAL(1, radio.rxQueued());
+    radio.setPromiscuous(true);
+    arrive(THIS_ADDRESS + 1, 1, 3, 8, -60);
+    CHECK_EQUAL(2, radio.rxQueued());
+    radio.setPromiscuous(false);
+    CHECK_EQUAL(0, radio.rxDropped());
+    drain();
+}
+
+static void testShortRecvBuffer() {
+    radio.available();
+    arrive(THIS_ADDRESS, 1, 40, 8, -60);
+    uint8_t buf[1];
+    uint8_t len = sizeof(buf);
+    CHECK(radio.recv(buf, &len));					// Cut to fit - and the slot is still released
+    CHECK_EQUAL(1, len);
+    CHECK_EQUAL(40, buf[0]);
+    CHECK_EQUAL(0, radio.rxQueued());
+}
+
+static void testSendLeavesQueueAlone() {
+    radio.available();
+    arrive(THIS_ADDRESS, 1, 50, 8, -60);
+    uint8_t data[] = {1, 2, 3};
+    CHECK(radio.send(data, sizeof(data)));
+    CHECK(radio.waitPacketSent(100));
+    CHECK_EQUAL(1, chip.sent.size());
+    CHECK_EQUAL(3 + RH_RF95_HEADER_LEN, chip.sent.back().size());
+    CHECK_EQUAL(1, radio.rxQueued());				// Sending does not throw away what was heard
+    uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    CHECK(radio.recv(buf, &len));
+    CHECK_EQUAL(50, buf[0]);
+}
+
+int main() {
+    startRadio();
+    testFramesWaitInOrder();
+    testFullQueueCountsDrops();
+    testFullQueueCountsOnlyOurDrops();
+    testOnlyOurFramesQueue();
+    testShortRecvBuffer();
+    testSendLeavesQueueAlone();
+    return hostTestResult("rx_queue_test");
+}
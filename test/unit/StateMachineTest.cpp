@@ -0,0 +1,154 @@
+/**
+ * @file   StateMachineTest.cpp - the table-driven state machine the node's main loop runs on
+ * @brief  Transitions from the table, the bounded event queue, delayed events and the dwell statistics
+ */
+#include "HostTest.h"
+#include "StateMachine.h"
+
+enum State { START, IDLE, BUSY, SLEEP };
+enum Event { GO, WORK, DONE, TIMEOUT, PANIC };
+
+static const StateMachine::Transition table[] = {
+    {START, GO, IDLE},
+    {IDLE, WORK, BUSY},
+    {BUSY, DONE, IDLE},
+    {IDLE, TIMEOUT, SLEEP},
+    {SLEEP, PANIC, BUSY},									// Ahead of the ANY_STATE entry, so it wins in SLEEP
+    {StateMachine::ANY_STATE, PANIC, START},
+};
+const size_t TABLE_LEN = sizeof(table) / sizeof(table[0]);
+
+static uint32_t nowMs = 0;
+static uint32_t clockMs() { return nowMs; }
+
+static void testTransitions() {
+    StateMachine machine(table, TABLE_LEN, START, clockMs);
+    CHECK(machine.entered());								// The initial state counts as entered
+    CHECK(!machine.entered());
+    CHECK(!machine.dispatch());
+
+    machine.post(WORK);										// Not in START - dropped
+    machine.post(GO);
+    machine.post(WORK);										// Looked up in IDLE, where GO left us
+    CHECK(machine.pending());
+    CHECK(machine.dispatch());
+    CHECK(!machine.pending());
+    CHECK_EQUAL(BUSY, machine.state());
+    CHECK_EQUAL(IDLE, machine.previousState());
+    CHECK(machine.entered());
+
+    machine.post(TIMEOUT);									// A late timer for a state we have left
+    CHECK(!machine.dispatch());
+    CHECK_EQUAL(BUSY, machine.state());
+
+    machine.post(PANIC);
+    machine.dispatch();
+    CHECK_EQUAL(START, machine.state());
+    machine.post(GO);
+    machine.post(TIMEOUT);
+    machine.post(PANIC);
+    machine.dispatch();
+    CHECK_EQUAL(BUSY, machine.state());						// The specific entry, not ANY_STATE
+}
+
+static void testReenteringAState() {
+    static const StateMachine::Transition loop[] = {{IDLE, WORK, IDLE}};
+    StateMachine machine(loop, 1, IDLE, clockMs);
+    machine.entered();
+    machine.post(WORK);
+    CHECK(machine.dispatch());
+    CHECK(machine.entered());								// Back into the same state is still an entry
+    CHECK_EQUAL(2, machine.entries(IDLE));
+}
+
+static void testQueueIsBounded() {
+    StateMachine machine(table, TABLE_LEN, START, clockMs);
+    for (uint8_t i = 0; i < StateMachine::QUEUE_LEN - 1; i++) CHECK(machine.post(i % 2 ? WORK : DONE));
+    CHECK(!machine.post(GO));
+    CHECK(!machine.post(GO));
+    CHECK_EQUAL(2, machine.overflows());
+    machine.dispatch();
+    CHECK(!machine.pending());
+    CHECK(machine.post(GO));								// Room again
+    machine.dispatch();
+    CHECK_EQUAL(IDLE, machine.state());
+}
+
+static void testDwellAndEntries() {
+    nowMs = 1000;
+    StateMachine machine(table, TABLE_LEN, START, clockMs);
+    nowMs += 50;
+    machine.post(GO);
+    machine.dispatch();
+    for (uint8_t i = 0; i < 3; i++) {
+        nowMs += 100;
+        machine.post(WORK);
+        machine.dispatch();
+        nowMs += 20;
+        machine.post(DONE);
+        machine.dispatch();
+    }
+    nowMs += 7;
+    CHECK_EQUAL(50, machine.dwellMs(START));
+    CHECK_EQUAL(307, machine.dwellMs(IDLE));				// Including the visit still going
+    CHECK_EQUAL(60, machine.dwellMs(BUSY));
+    CHECK_EQUAL(7, machine.timeInStateMs());
+    CHECK_EQUAL(1, machine.entries(START));
+    CHECK_EQUAL(4, machine.entries(IDLE));
+    CHECK_EQUAL(3, machine.entries(BUSY));
+    CHECK_EQUAL(0, machine.entries(SLEEP));
+    CHECK_EQUAL(0, machine.dwellMs(StateMachine::MAX_STATES));
+
+    machine.resetStatistics();
+    nowMs += 5;
+    CHECK_EQUAL(5, machine.dwellMs(IDLE));
+    CHECK_EQUAL(0, machine.dwellMs(BUSY));
+    CHECK_EQUAL(0, machine.entries(IDLE));
+}
+
+static void testDelayedEvents() {
+    nowMs = 0xffffffff - 500;								// Runs across the clock wrapping
+    StateMachine machine(table, TABLE_LEN, IDLE, clockMs);
+    CHECK_EQUAL(StateMachine::NOTHING_SCHEDULED, machine.msUntilScheduled());
+    CHECK(machine.postAfter(TIMEOUT, 1000));
+    CHECK(machine.scheduled(TIMEOUT));
+    nowMs += 400;
+    CHECK(machine.postAfter(WORK, 2000));
+    CHECK_EQUAL(600, machine.msUntilScheduled());
+    CHECK(!machine.dispatch());
+    CHECK(!machine.pending());
+
+    CHECK(machine.postAfter(TIMEOUT, 800));					// Replaces the one pending - due 800 from now
+    nowMs += 600;
+    CHECK(!machine.dispatch());
+    CHECK_EQUAL(200, machine.msUntilScheduled());
+    nowMs += 250;
+    CHECK(machine.dispatch());								// Late is fine - posted on the first pass after it is due
+    CHECK_EQUAL(SLEEP, machine.state());
+    CHECK(!machine.scheduled(TIMEOUT));
+    CHECK_EQUAL(1, machine.entries(SLEEP));					// And only once, for all it was posted twice
+
+    machine.cancel(WORK);
+    CHECK(!machine.scheduled(WORK));
+    CHECK_EQUAL(StateMachine::NOTHING_SCHEDULED, machine.msUntilScheduled());
+
+    for (uint8_t i = 0; i < StateMachine::MAX_DELAYED; i++) CHECK(machine.postAfter(10 + i, 100));
+    CHECK(!machine.postAfter(GO, 100));						// Every slot taken
+    CHECK(machine.postAfter(10, 50));						// But one pending can still be moved
+    machine.cancel(11);
+    CHECK(machine.postAfter(GO, 100));
+    nowMs += 100;
+    CHECK_EQUAL(0, machine.msUntilScheduled());
+    machine.dispatch();										// None of them mean anything in SLEEP
+    CHECK_EQUAL(SLEEP, machine.state());
+    CHECK_EQUAL(StateMachine::NOTHING_SCHEDULED, machine.msUntilScheduled());
+}
+
+int main() {
+    testTransitions();
+    testReenteringAState();
+    testQueueIsBounded();
+    testDwellAndEntries();
+    testDelayedEvents();
+    return hostTestResult("state_machine_test");
+}
@@ -0,0 +1,277 @@
+/**
+ * @file   StorageSpanTest.cpp - partial saves of a PersistentDataFRAM
+ * @brief  Changed spans merged and capped at four, the hash put off to the outermost commit(), only the spans written,
+ * and the structure reloaded from those saves byte for byte
+ */
+#include "HostTest.h"
+#include "MyPersistentData.h"
+#include <random>
+
+extern MB85RC64 fram;
+
+static FramChip::State framState;
+static FramChip framChip(framState);
+static std::mt19937 rng(23);
+
+const int FRAM_OFFSET = 100;
+
+/**
+ * @brief Fields far enough apart that changing them gives spans that do not merge
+ */
+struct Record {
+    StorageHelperRK::PersistentDataBase::SavedDataHeader header;
+    uint32_t a;
+    uint8_t gap1[20];
+    uint32_t b;
+    uint8_t gap2[20];
+    uint32_t c;
+    uint8_t gap3[20];
+    uint32_t d;
+    uint8_t gap4[20];
+    uint32_t e;
+};
+
+class TestStore : public StorageHelperRK::PersistentDataFRAM {
+public:
+    TestStore() : PersistentDataFRAM(::fram, FRAM_OFFSET, &record.header, sizeof(Record), 0x31313131, 1) {}
+
+    void set(size_t offset, uint32_t value) { setValue<uint32_t>(offset, value); }
+
+    /**
+     * @brief True if one span runs from start to end
+     */
+    bool hasSpan(size_t start, size_t end) const {
+        for (size_t i = 0; i < dirtySpanCount; i++) {
+            if (dirtySpans[i].start == start && dirtySpans[i].end == end) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief True if the spans take in every byte from start to end
+     */
+    bool covered(size_t start, size_t end) const {
+        for (size_t offset = start; offset < end; offset++) {
+            bool in = false;
+            for (size_t i = 0; i < dirtySpanCount; i++) in = in || (dirtySpans[i].start <= offset && offset < dirtySpans[i].end);
+            if (!in) return false;
+        }
+        return true;
+    }
+
+    void initialize() override {
+        initializations++;
+        PersistentDataFRAM::initialize();
+    }
+
+    using PersistentDataFRAM::markDirty;
+    using PersistentDataFRAM::clearDirty;
+    using PersistentDataFRAM::writeDirty;
+    using PersistentDataFRAM::dirtySpanCount;
+    using PersistentDataFRAM::hashPending;
+    using PersistentDataFRAM::MAX_DIRTY_SPANS;
+
+    Record record;
+    int initializations = 0;
+};
+
+static bool framHolds(size_t framAddr, const void *expected, size_t len) {
+    return memcmp(framState.memory + framAddr, expected, len) == 0;
+}
+
+/**
+ * @brief A fresh chip, and a store with its first, whole, save done
+ */
+static void freshStore(TestStore &store) {
+    FramChip::erase(framState);
+    store.load();
+    store.save();
+}
+
+static void testMerging() {
+    TestStore store;
+    store.clearDirty();
+    store.markDirty(20, 4);
+    CHECK_EQUAL(1, store.dirtySpanCount);
+    store.markDirty(26, 2);									// Within DIRTY_MERGE_GAP - one write
+    CHECK_EQUAL(1, store.dirtySpanCount);
+    CHECK(store.hasSpan(20, 28));
+    store.markDirty(40, 4);									// Too far
+    CHECK_EQUAL(2, store.dirtySpanCount);
+    store.markDirty(32, 4);									// Bridges the two
+    CHECK_EQUAL(1, store.dirtySpanCount);
+    CHECK(store.hasSpan(20, 44));
+    store.markDirty(22, 2);									// Already in it
+    store.markDirty(10, 30);								// Takes it all in
+    CHECK_EQUAL(1, store.dirtySpanCount);
+    CHECK(store.hasSpan(10, 44));
+}
+
+/**
+ * @brief A fifth span is merged into the one closest to it - nothing marked is dropped
+ */
+static void testOverflow() {
+    TestStore store;
+    store.clearDirty();
+    store.markDirty(0, 2);
+    store.markDirty(20, 2);
+    store.markDirty(40, 2);
+    store.markDirty(70, 2);
+    CHECK_EQUAL(TestStore::MAX_DIRTY_SPANS, store.dirtySpanCount);
+    store.markDirty(50, 2);									// 8 from 40..42, 18 from 70..72
+    CHECK_EQUAL(TestStore::MAX_DIRTY_SPANS, store.dirtySpanCount);
+    CHECK(store.hasSpan(0, 2));
+    CHECK(store.hasSpan(20, 22));
+    CHECK(store.hasSpan(40, 52));
+    CHECK(store.hasSpan(70, 72));
+    store.markDirty(12, 2);									// Closer to 20..22 than to 0..2
+    CHECK(store.hasSpan(0, 2));
+    CHECK(store.hasSpan(12, 22));
+    store.markDirty(100, 2);								// Past the last
+    CHECK(store.hasSpan(70, 102));
+    CHECK_EQUAL(TestStore::MAX_DIRTY_SPANS, store.dirtySpanCount);
+    for (size_t offset : {0, 12, 20, 40, 50, 70, 100}) CHECK(store.covered(offset, offset + 2));
+}
+
+/**
+ * @brief Set calls between beginUpdate() and the outermost commit() leave the hash alone - then it covers them all
+ */
+static void testDeferredHash() {
+    TestStore store;
+    freshStore(store);
+    uint32_t hash = store.record.header.hash;
+
+    store.beginUpdate();
+    store.set(offsetof(Record, a), 5);
+    CHECK_EQUAL(hash, store.record.header.hash);
+    CHECK(store.hashPending);
+    store.beginUpdate();
+    store.set(offsetof(Record, b), 6);
+    store.commit();											// Not the outermost
+    CHECK_EQUAL(hash, store.record.header.hash);
+    CHECK(store.hashPending);
+    store.commit();
+    CHECK(!store.hashPending);
+    CHECK(store.record.header.hash != hash);
+    CHECK_EQUAL(store.getHash(), store.record.header.hash);
+    CHECK(store.covered(offsetof(Record, header.hash), offsetof(Record, header.hash) + 4));
+    CHECK(store.covered(offsetof(Record, a), offsetof(Record, a) + 4));
+    CHECK(store.covered(offsetof(Record, b), offsetof(Record, b) + 4));
+
+    store.commit();											// No beginUpdate() to match - no harm done
+    store.set(offsetof(Record, c), 7);						// And the next set is hashed straight away
+    CHECK(!store.hashPending);
+    CHECK_EQUAL(store.getHash(), store.record.header.hash);
+
+    store.save();
+    store.beginUpdate();
+    store.set(offsetof(Record, c), 7);						// No change - nothing to hash or save
+    store.commit();
+    CHECK(!store.hashPending);
+    CHECK_EQUAL(0, store.dirtySpanCount);
+}
+
+/**
+ * @brief A save writes the spans and nothing else - a byte changed without a set call stays as it was in FRAM
+ */
+static void testPartialSave() {
+    TestStore store;
+    freshStore(store);
+    CHECK(framHolds(FRAM_OFFSET, &store.record, sizeof(Record)));
+
+    store.record.gap2[5] = 0x5a;							// Not marked
+    store.set(offsetof(Record, c), 9);
+    CHECK_EQUAL(2, store.dirtySpanCount);					// The field and the hash
+    uint32_t writes = framState.writes;
+    store.save();
+    CHECK_EQUAL(2, framState.writes - writes);
+    CHECK_EQUAL(0, store.dirtySpanCount);
+    CHECK(framHolds(FRAM_OFFSET + offsetof(Record, c), &store.record.c, 4));
+    CHECK(framHolds(FRAM_OFFSET + offsetof(Record, header.hash), &store.record.header.hash, 4));
+    CHECK_EQUAL(0, framState.memory[FRAM_OFFSET + offsetof(Record, gap2) + 5]);
+
+    store.updateHash();										// Changed directly - the whole structure goes
+    CHECK(store.hasSpan(0, sizeof(Record)));
+    store.save();
+    CHECK(framHolds(FRAM_OFFSET, &store.record, sizeof(Record)));
+
+    store.clearDirty();										// No spans - writeDirty() writes it all
+    memset(framState.memory + 4000, 0, sizeof(Record));
+    CHECK(store.writeDirty(4000));
+    CHECK(framHolds(4000, &store.record, sizeof(Record)));
+
+    memset(framState.memory + 4000, 0, sizeof(Record));
+    store.markDirty(offsetof(Record, c), 4);				// Or just the spans, at that offset
+    CHECK(store.writeDirty(4000));
+    CHECK(framHolds(4000 + offsetof(Record, c), &store.record.c, 4));
+    CHECK_EQUAL(0, framState.memory[4000 + offsetof(Record, c) - 1]);
+    CHECK_EQUAL(0, framState.memory[4000 + offsetof(Record, c) + 4]);
+    store.clearDirty();
+}
+
+/**
+ * @brief Five fields and the hash are more spans than are kept - merged, the save still writes every change
+ */
+static void testFourSpanSave() {
+    TestStore store;
+    freshStore(store);
+    store.beginUpdate();
+    store.set(offsetof(Record, a), 1);
+    store.set(offsetof(Record, b), 2);
+    store.set(offsetof(Record, c), 3);
+    store.set(offsetof(Record, d), 4);
+    store.set(offsetof(Record, e), 5);
+    store.commit();
+    CHECK_EQUAL(TestStore::MAX_DIRTY_SPANS, store.dirtySpanCount);
+    uint32_t writes = framState.writes;
+    store.save();
+    CHECK(framState.writes - writes <= TestStore::MAX_DIRTY_SPANS);
+    CHECK(framHolds(FRAM_OFFSET, &store.record, sizeof(Record)));
+
+    TestStore reloaded;
+    reloaded.load();
+    CHECK_EQUAL(0, reloaded.initializations);
+    CHECK_EQUAL(5, reloaded.record.e);
+}
+
+/**
+ * @brief Random batches of changes, each saved in spans - FRAM, and a store loaded from it, match byte for byte
+ */
+static void testReloadAfterSpanSaves() {
+    TestStore store;
+    freshStore(store);
+    const size_t fields[] = {offsetof(Record, a), offsetof(Record, b), offsetof(Record, c), offsetof(Record, d), offsetof(Record, e)};
+    uint32_t mismatches = 0, spanSaves = 0;
+
+    for (int save = 0; save < 300; save++) {
+        bool batch = rng() % 2;
+        if (batch) store.beginUpdate();
+        for (uint32_t n = rng() % 6 + 1; n > 0; n--) {
+            if (rng() % 4) store.set(fields[rng() % 5], rng());
+            else store.setValue<uint8_t>(offsetof(Record, gap1) + rng() % (offsetof(Record, e) - offsetof(Record, gap1)), (uint8_t)rng());
+        }
+        if (batch) store.commit();
+        if (store.dirtySpanCount > 0 && !store.hasSpan(0, sizeof(Record))) spanSaves++;
+        store.save();
+
+        TestStore reloaded;
+        reloaded.load();
+        if (!framHolds(FRAM_OFFSET, &store.record, sizeof(Record))) mismatches++;
+        else if (reloaded.initializations != 0 || memcmp(&reloaded.record, &store.record, sizeof(Record)) != 0) mismatches++;
+        else if (reloaded.getHash() != reloaded.record.header.hash) mismatches++;
+    }
+    CHECK_EQUAL(0, mismatches);
+    CHECK(spanSaves > 250);									// Saves that wrote spans, not the whole structure
+}
+
+int main() {
+    standaloneBoard().attach(FramChip::ADDRESS, framChip);
+
+    testMerging();
+    testOverflow();
+    testDeferredHash();
+    testPartialSave();
+    testFourSpanSave();
+    testReloadAfterSpanSaves();
+    return hostTestResult("storage_span_test");
+}